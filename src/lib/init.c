@@ -45,6 +45,7 @@ struct {
 } tag_type_map[] = {
     /* System tags */
     {NULL, "system", "library", NULL, system_tag_create},
+    {"system", NULL, NULL, NULL, system_tag_create},
     /* Allen-Bradley PLCs */
     {"ab-eip", NULL, NULL, NULL, ab_tag_create},
     {"ab_eip", NULL, NULL, NULL, ab_tag_create}
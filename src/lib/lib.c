@@ -32,17 +32,21 @@
 
 #define LIBPLCTAGDLL_EXPORTS 1
 
+#include <ctype.h>
 #include <limits.h>
 #include <float.h>
+#include <stdlib.h>
 #include <lib/libplctag.h>
 #include <lib/tag.h>
 #include <lib/init.h>
+#include <lib/lvt.h>
 #include <platform.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/hash.h>
 #include <util/hashtable.h>
 #include <util/rc.h>
+#include <util/trace.h>
 #include <util/vector.h>
 #include <ab/ab.h>
 
@@ -53,6 +57,9 @@
 
 #define MAX_TAG_MAP_ATTEMPTS (50)
 
+#define SHARED_TAG_MIN (10)
+#define SHARED_TAG_INC (10)
+
 /* these are only internal to the file */
 
 static volatile int32_t next_tag_id = 10; /* MAGIC */
@@ -62,6 +69,25 @@ static mutex_p tag_lookup_mutex = NULL;
 static volatile int library_terminating = 0;
 static thread_p tag_tickler_thread = NULL;
 
+/*
+ * tags created with share_tag=1, by normalized definition.  Protected
+ * by tag_lookup_mutex.
+ */
+struct tag_share_t {
+    char *def;
+    plc_tag_p tag;
+    int handle_count;
+
+    /* the last read started through any handle.  Protected by the tag's API mutex. */
+    int read_in_flight;
+    int64_t read_done_time;
+    int read_done_status;
+};
+
+typedef struct tag_share_t *tag_share_p;
+
+static vector_p shared_tags = NULL;
+
 //static mutex_p global_library_mutex = NULL;
 
 
@@ -69,6 +95,17 @@ static thread_p tag_tickler_thread = NULL;
 /* helper functions. */
 static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
+static int add_tag_lookup_unsafe(plc_tag_p tag);
+static char *shared_tag_def(const char *attrib_str);
+static int attach_shared_tag(const char *def);
+static int add_shared_tag_lookup(plc_tag_p tag, char *def);
+static int shared_read_status(plc_tag_p tag);
+static int read_cache_refresh_start(plc_tag_p tag);
+static int read_cache_refresh_status(plc_tag_p tag);
+static void read_cache_swap(plc_tag_p tag);
+static void tag_tickle(plc_tag_p tag);
+static void op_times_start(plc_tag_p tag, int64_t started_us);
+static void op_times_status(plc_tag_p tag, int rc);
 static int tag_id_inc(int id);
 static THREAD_FUNC(tag_tickler_func);
 //static int to_tag_index(int id);
@@ -81,6 +118,7 @@ static THREAD_FUNC(tag_tickler_func);
 int lib_init(void)
 {
     int rc = PLCTAG_STATUS_OK;
+    const char *trace_file_name = NULL;
 
     pdebug(DEBUG_INFO,"Setting up global library data.");
 
@@ -90,18 +128,41 @@ int lib_init(void)
         return PLCTAG_ERR_NO_MEM;
     }
 
+    pdebug(DEBUG_INFO,"Creating shared tag list.");
+    if((shared_tags = vector_create(SHARED_TAG_MIN, SHARED_TAG_INC)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create shared tag list!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
     pdebug(DEBUG_INFO,"Creating tag hashtable mutex.");
     rc = mutex_create((mutex_p *)&tag_lookup_mutex);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to create tag hashtable mutex!");
     }
 
+    pdebug(DEBUG_INFO,"Setting up last value tables.");
+    rc = lvt_init();
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to set up last value tables!");
+        return rc;
+    }
+
     pdebug(DEBUG_INFO,"Creating tag tickler thread.");
     rc = thread_create(&tag_tickler_thread, tag_tickler_func, 32*1024, NULL);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to create tag tickler thread!");
     }
 
+    /* tracing can be turned on without changing the program. */
+    trace_file_name = getenv("PLCTAG_TRACE");
+    if(trace_file_name && str_length(trace_file_name) > 0) {
+        pdebug(DEBUG_INFO,"Starting tracing to %s.", trace_file_name);
+
+        if(trace_start(trace_file_name) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start tracing to %s!", trace_file_name);
+        }
+    }
+
     pdebug(DEBUG_INFO,"Done.");
 
     return rc;
@@ -125,6 +186,34 @@ void lib_teardown(void)
     pdebug(DEBUG_INFO, "Destroying tag hashtable.");
     hashtable_destroy(tags);
 
+    pdebug(DEBUG_INFO, "Destroying shared tag list.");
+    if(shared_tags) {
+        for(int i=0; i < vector_length(shared_tags); i++) {
+            tag_share_p share = vector_get(shared_tags, i);
+
+            if(share) {
+                mem_free(share->def);
+                mem_free(share);
+            }
+        }
+
+        vector_destroy(shared_tags);
+        shared_tags = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Closing last value tables.");
+    lvt_teardown();
+
+    pdebug(DEBUG_INFO, "Stopping tracing.");
+    trace_teardown();
+
+    /* the messages after this go to stderr. */
+    debug_unregister_logger();
+
+#ifdef PLCTAG_LOCK_STATS
+    lock_stats_report();
+#endif
+
 //    pdebug(DEBUG_INFO,"Destroying global library mutex.");
 //    if(global_library_mutex) {
 //        mutex_destroy((mutex_p*)&global_library_mutex);
@@ -173,7 +262,16 @@ THREAD_FUNC(tag_tickler_func)
 
             if(tag && tag->vtable->tickler) {
                 if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
-                    tag->vtable->tickler(tag);
+                    tag_tickle(tag);
+
+                    /* publish reads that finished in the background. */
+                    if(tag->lvt) {
+                        lvt_read_status(tag, tag->vtable->status(tag));
+                    }
+
+                    if(tag->op_times.in_flight) {
+                        op_times_status(tag, tag->vtable->status(tag));
+                    }
 
                     mutex_unlock(tag->api_mutex);
                 }
@@ -192,6 +290,8 @@ THREAD_FUNC(tag_tickler_func)
 
     debug_set_tag_id(0);
 
+    trace_thread_done();
+
     pdebug(DEBUG_INFO,"Terminating.");
 
     THREAD_RETURN(0);
@@ -217,6 +317,8 @@ THREAD_FUNC(tag_tickler_func)
 LIB_EXPORT const char *plc_tag_decode_error(int rc)
 {
     switch(rc) {
+    case PLCTAG_STATUS_STALE:
+        return "PLCTAG_STATUS_STALE";
     case PLCTAG_STATUS_PENDING:
         return "PLCTAG_STATUS_PENDING";
     case PLCTAG_STATUS_OK:
@@ -326,6 +428,7 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     int rc = PLCTAG_STATUS_OK;
     int read_cache_ms = 0;
     tag_create_function tag_constructor;
+    char *shared_def = NULL;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -348,6 +451,62 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     /* set debug level */
     set_debug_level(attr_get_int(attribs, "debug", DEBUG_NONE));
 
+    /* start tracing if it is not already running, every tag may ask. */
+    if(!trace_enabled && attr_get_str(attribs, "trace", NULL)) {
+        trace_start(attr_get_str(attribs, "trace", NULL));
+    }
+
+    /*
+     * shared tags with the same definition all use the same underlying
+     * tag.  If there is one already, just hand out another ID for it.
+     */
+    if(attr_get_int(attribs, "share_tag", 0)) {
+        shared_def = shared_tag_def(attrib_str);
+        if(!shared_def) {
+            pdebug(DEBUG_WARN, "Unable to normalize tag definition for sharing!");
+            attr_destroy(attribs);
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        id = attach_shared_tag(shared_def);
+        if(id != 0) {
+            mem_free(shared_def);
+            attr_destroy(attribs);
+
+            if(id < 0) {
+                pdebug(DEBUG_WARN, "Unable to map shared tag, rc=%s", plc_tag_decode_error(id));
+                return id;
+            }
+
+            /* the tag might still be setting up. */
+            if(timeout) {
+                int64_t timeout_time = timeout + time_ms();
+
+                rc = plc_tag_status(id);
+
+                while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+                    sleep_ms(1); /* MAGIC */
+                    rc = plc_tag_status(id);
+                }
+
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN,"Timeout waiting for shared tag to be ready!");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error %s while waiting for shared tag!", plc_tag_decode_error(rc));
+                    plc_tag_destroy(id);
+                    return rc;
+                }
+            }
+
+            pdebug(DEBUG_INFO, "Returning new ID %d for shared tag.", id);
+
+            return id;
+        }
+    }
+
     /*
      * create the tag, this is protocol specific.
      *
@@ -358,6 +517,7 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
 
     if(!tag_constructor) {
         pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
+        mem_free(shared_def);
         attr_destroy(attribs);
         return PLCTAG_ERR_BAD_PARAM;
     }
@@ -370,6 +530,7 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
      */
     if(!tag) {
         pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
+        mem_free(shared_def);
         attr_destroy(attribs);
         return PLCTAG_ERR_CREATE;
     }
@@ -377,6 +538,7 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     rc = mutex_create(&(tag->ext_mutex));
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
+        mem_free(shared_def);
         rc_dec(tag);
         return PLCTAG_ERR_CREATE;
     }
@@ -384,6 +546,7 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     rc = mutex_create(&(tag->api_mutex));
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
+        mem_free(shared_def);
         rc_dec(tag);
         return PLCTAG_ERR_CREATE;
     }
@@ -398,6 +561,19 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     tag->read_cache_expire = (int64_t)0;
     tag->read_cache_ms = (int64_t)read_cache_ms;
 
+    /* return expired cached data at once and refresh it in the background? */
+    tag->read_cache_stale = (read_cache_ms > 0 && attr_get_int(attribs, "read_cache_stale", 0));
+
+    /* copy the data of completed reads to a last value table? */
+    rc = lvt_publisher_create(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up publishing for tag!");
+        mem_free(shared_def);
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return rc;
+    }
+
     /*
      * Release memory for attributes
      *
@@ -453,6 +629,8 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
         /* check to see if there was an error during tag creation. */
         if(rc != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
+            mem_free(shared_def);
+            lvt_publisher_destroy(tag);
             rc_dec(tag);
             return rc;
         }
@@ -460,12 +638,17 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
         pdebug(DEBUG_INFO,"tag set up elapsed time %ldms",(time_ms()-start_time));
     }
 
-    /* map the tag to a tag ID */
-    id = add_tag_lookup(tag);
+    /* map the tag to a tag ID, shared tags also go in the shared list. */
+    if(shared_def) {
+        id = add_shared_tag_lookup(tag, shared_def);
+    } else {
+        id = add_tag_lookup(tag);
+    }
 
     /* if the mapping failed, then punt */
     if(id < 0) {
         pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
+        lvt_publisher_destroy(tag);
         rc_dec(tag);
         return id;
     }
@@ -583,6 +766,7 @@ int plc_tag_abort(int32_t id)
     critical_block(tag->api_mutex) {
         /* who knows what state the tag data is in.  */
         tag->read_cache_expire = (uint64_t)0;
+        tag->read_cache_refreshing = 0;
 
         if(!tag->vtable || !tag->vtable->abort) {
             pdebug(DEBUG_WARN,"Tag does not have a abort function!");
@@ -591,6 +775,10 @@ int plc_tag_abort(int32_t id)
 
         /* this may be synchronous. */
         rc = tag->vtable->abort(tag);
+
+        if(tag->share) {
+            tag->share->read_in_flight = 0;
+        }
     }
 
     rc_dec(tag);
@@ -614,6 +802,8 @@ int plc_tag_abort(int32_t id)
 LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
 {
     plc_tag_p tag = NULL;
+    tag_share_p share = NULL;
+    int other_handles = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -624,6 +814,22 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
 
     critical_block(tag_lookup_mutex) {
         tag = hashtable_remove(tags, tag_id);
+
+        /* shared tags stay alive until the last handle goes. */
+        if(tag && tag->share) {
+            tag->share->handle_count--;
+
+            if(tag->share->handle_count > 0) {
+                other_handles = 1;
+            } else {
+                for(int i=0; i < vector_length(shared_tags); i++) {
+                    if(vector_get(shared_tags, i) == tag->share) {
+                        vector_remove(shared_tags, i);
+                        break;
+                    }
+                }
+            }
+        }
     }
 
     if(!tag) {
@@ -631,6 +837,18 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    if(other_handles) {
+        pdebug(DEBUG_DETAIL, "Shared tag still has other handles, not aborting.");
+
+        rc_dec(tag);
+
+        pdebug(DEBUG_INFO, "Done.");
+
+        debug_set_tag_id(0);
+
+        return PLCTAG_STATUS_OK;
+    }
+
     /* abort anything in flight */
     pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
 
@@ -641,6 +859,24 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
 
         /* Force a clean up. */
         tag->vtable->abort(tag);
+
+        tag->read_cache_refreshing = 0;
+
+        if(tag->read_cache_data) {
+            mem_free(tag->read_cache_data);
+            tag->read_cache_data = NULL;
+            tag->read_cache_size = 0;
+        }
+
+        lvt_publisher_destroy(tag);
+
+        share = tag->share;
+        tag->share = NULL;
+    }
+
+    if(share) {
+        mem_free(share->def);
+        mem_free(share);
     }
 
     /* release the reference outside the mutex. */
@@ -672,6 +908,9 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
+    int64_t call_time = time_ms();
+    int64_t op_start_us = 0;
+    int attached = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -681,6 +920,22 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
     }
 
     critical_block(tag->api_mutex) {
+        /* a background refresh may have just finished. */
+        if(tag->read_cache_refreshing) {
+            rc = read_cache_refresh_status(tag);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pdebug(DEBUG_INFO, "Refresh in progress, returning stale data.");
+                rc = PLCTAG_STATUS_STALE;
+                break;
+            }
+
+            /* report a failed refresh once, the next read tries again. */
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
+        }
+
         /* check read cache, if not expired, return existing data. */
         if(tag->read_cache_expire > time_ms()) {
             pdebug(DEBUG_INFO, "Returning cached data.");
@@ -688,16 +943,82 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
             break;
         }
 
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->read(tag);
+        /*
+         * the cache has expired but we have had good data.  Start a
+         * refresh and give the caller what we have now.
+         */
+        if(tag->read_cache_stale && tag->read_cache_expire > 0) {
+            op_start_us = time_mono_us();
+            rc = read_cache_refresh_start(tag);
+
+            if(rc == PLCTAG_STATUS_PENDING || rc == PLCTAG_STATUS_OK) {
+                lvt_read_started(tag);
+                op_times_start(tag, op_start_us);
+                trace_event(TRACE_TAG_READ_START, tag->tag_id, rc, 0, 0);
+                op_times_status(tag, rc);
+
+                tag->read_cache_refreshing = 1;
+            }
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pdebug(DEBUG_INFO, "Cache expired, starting refresh and returning stale data.");
+
+                if(tag->share) {
+                    tag->share->read_in_flight = 1;
+                }
+
+                rc = PLCTAG_STATUS_STALE;
+            } else if(rc == PLCTAG_STATUS_OK) {
+                /* some reads finish at once, swap the new data in now. */
+                rc = read_cache_refresh_status(tag);
+                lvt_read_status(tag, rc);
+            }
 
-        /* if error, return now */
-        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
             break;
         }
 
-        /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
-        tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+        /*
+         * if another handle of a shared tag has a read going, use
+         * that instead of starting another.  If that read finished
+         * while we were waiting for the mutex, its data is new enough.
+         */
+        if(tag->share) {
+            rc = shared_read_status(tag);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pdebug(DEBUG_INFO, "Attaching to shared read already in flight.");
+                attached = 1;
+            } else if(tag->share->read_done_time > call_time) {
+                pdebug(DEBUG_INFO, "Returning result of shared read that just finished.");
+                rc = tag->share->read_done_status;
+                break;
+            }
+        }
+
+        if(!attached) {
+            /* the protocol implementation does not do the timeout. */
+            op_start_us = time_mono_us();
+            rc = tag->vtable->read(tag);
+
+            /* if error, return now */
+            if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+                break;
+            }
+
+            lvt_read_started(tag);
+            op_times_start(tag, op_start_us);
+            trace_event(TRACE_TAG_READ_START, tag->tag_id, rc, 0, 0);
+
+            /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
+            tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+
+            if(tag->share) {
+                tag->share->read_in_flight = 1;
+
+                /* some reads finish immediately. */
+                shared_read_status(tag);
+            }
+        }
 
         /*
          * if there is a timeout, then loop until we get
@@ -710,7 +1031,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
             while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
                 /* give some time to the tickler function. */
                 if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
+                    tag_tickle(tag);
                 }
 
                 rc = tag->vtable->status(tag);
@@ -726,16 +1047,26 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
                 sleep_ms(1); /* MAGIC */
             }
 
+            /* let the other handles see that the read is done. */
+            if(tag->share) {
+                shared_read_status(tag);
+            }
+
             /*
              * if we dropped out of the while loop but the status is
              * still pending, then we timed out.
              *
              * Abort the operation and set the status to show the timeout.
+             * Do not abort a shared read another handle started.
              */
             if(rc != PLCTAG_STATUS_OK) {
                 /* abort the request. */
-                if(tag->vtable->abort) {
+                if(tag->vtable->abort && !attached) {
                     tag->vtable->abort(tag);
+
+                    if(tag->share) {
+                        tag->share->read_in_flight = 0;
+                    }
                 }
 
                 /* translate error if we are still pending. */
@@ -747,6 +1078,9 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
 
             pdebug(DEBUG_INFO,"elapsed time %ldms",(time_ms()-start_time));
         }
+
+        lvt_read_status(tag, rc);
+        op_times_status(tag, rc);
     } /* end of api mutex block */
 
     rc_dec(tag);
@@ -786,10 +1120,21 @@ int plc_tag_status(int32_t id)
 
     critical_block(tag->api_mutex) {
         if(tag && tag->vtable->tickler) {
-            tag->vtable->tickler(tag);
+            tag_tickle(tag);
         }
 
         rc = tag->vtable->status(tag);
+
+        lvt_read_status(tag, rc);
+        op_times_status(tag, rc);
+
+        if(tag->share) {
+            shared_read_status(tag);
+        }
+
+        if(tag->read_cache_refreshing) {
+            read_cache_refresh_status(tag);
+        }
     }
 
     rc_dec(tag);
@@ -818,6 +1163,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
+    int64_t op_start_us = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -828,14 +1174,23 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 
     critical_block(tag->api_mutex) {
         /* the protocol implementation does not do the timeout. */
+        op_start_us = time_mono_us();
         rc = tag->vtable->write(tag);
 
+        /* nothing can attach to a read once a write is started. */
+        if(tag->share && rc != PLCTAG_ERR_BUSY) {
+            tag->share->read_in_flight = 0;
+        }
+
         /* if error, return now */
         if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN,"Response from write command is not OK!");
             break;
         }
 
+        op_times_start(tag, op_start_us);
+        trace_event(TRACE_TAG_WRITE_START, tag->tag_id, rc, 0, 0);
+
         /*
          * if there is a timeout, then loop until we get
          * an error or we timeout.
@@ -847,7 +1202,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
             while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
                 /* give some time to the tickler function. */
                 if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
+                    tag_tickle(tag);
                 }
 
                 rc = tag->vtable->status(tag);
@@ -884,6 +1239,8 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 
             pdebug(DEBUG_INFO,"elapsed time %lldms",(time_ms()-start_time));
         }
+
+        op_times_status(tag, rc);
     } /* end of api mutex block */
 
     rc_dec(tag);
@@ -1772,104 +2129,807 @@ LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
 
 
 
-/*****************************************************************************************************
- *****************************  Support routines for extra indirection *******************************
- ****************************************************************************************************/
 
+/*
+ * plc_tag_get_member_info()
+ *
+ * Look up a structure member by path.  The work is done by the protocol
+ * as only it knows how to find the structure definition.
+ */
 
-plc_tag_p lookup_tag(int32_t tag_id)
+LIB_EXPORT int plc_tag_get_member_info(int32_t id, const char *member_path, int *offset, int *kind, int *bit_num)
 {
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_get(tags, (int64_t)tag_id);
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-        if(tag) {
-            debug_set_tag_id(tag->tag_id);
-        } else {
-            /* FIXME - remove this. */
-            pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
-        }
+    if(!member_path || !offset || !kind || !bit_num) {
+        pdebug(DEBUG_WARN, "Null pointer argument!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-        if(tag && tag->tag_id == tag_id) {
-            pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
-            tag = rc_inc(tag);
-        } else {
-            debug_set_tag_id(0);
-            tag = NULL;
+    tag = lookup_tag(id);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(!tag->vtable || !tag->vtable->member_info) {
+            pdebug(DEBUG_WARN, "Tag type does not support structure members.");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
         }
+
+        rc = tag->vtable->member_info(tag, member_path, offset, kind, bit_num);
     }
 
-    return tag;
+    rc_dec(tag);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
 }
 
 
 
-int tag_id_inc(int id)
+/*
+ * plc_tag_write_bits()
+ *
+ * Set and clear bits in the PLC without a full write.  Only the protocol
+ * knows whether it can do that.
+ */
+
+LIB_EXPORT int plc_tag_write_bits(int32_t id, uint64_t set_mask, uint64_t clear_mask, int timeout)
 {
-    if(id <= 0) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        /* try to correct. */
-        id = (TAG_ID_MASK/2);
-    }
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    int64_t op_start_us = 0;
 
-    id = (id + 1) & TAG_ID_MASK;
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    if(id == 0) {
-        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
-    return id;
-}
+    critical_block(tag->api_mutex) {
+        if(!tag->vtable || !tag->vtable->write_bits) {
+            pdebug(DEBUG_WARN, "Tag type does not support bit writes.");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
 
+        /* the protocol implementation does not do the timeout. */
+        op_start_us = time_mono_us();
+        rc = tag->vtable->write_bits(tag, set_mask, clear_mask);
 
+        /* nothing can attach to a read once a write is started. */
+        if(tag->share && rc != PLCTAG_ERR_BUSY) {
+            tag->share->read_in_flight = 0;
+        }
 
-int add_tag_lookup(plc_tag_p tag)
-{
-    int rc = PLCTAG_ERR_NOT_FOUND;
-    int new_id = 0;
+        /* if error, return now */
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Response from bit write command is not OK!");
+            break;
+        }
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+        op_times_start(tag, op_start_us);
+        trace_event(TRACE_TAG_WRITE_START, tag->tag_id, rc, 0, 0);
 
-    critical_block(tag_lookup_mutex) {
-        int attempts = 0;
+        if(timeout) {
+            int64_t start_time = time_ms();
+            int64_t timeout_time = timeout + start_time;
 
-        /* only get this when we hold the mutex. */
-        new_id = next_tag_id;
+            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+                /* give some time to the tickler function. */
+                if(tag->vtable->tickler) {
+                    tag_tickle(tag);
+                }
 
-        do {
-            new_id = tag_id_inc(new_id);
+                rc = tag->vtable->status(tag);
 
-            if(new_id <=0) {
-                pdebug(DEBUG_WARN,"ID %d is illegal!", new_id);
-                attempts = MAX_TAG_MAP_ATTEMPTS;
-                break;
+                if(rc != PLCTAG_STATUS_PENDING) {
+                    break;
+                }
+
+                sleep_ms(1); /* MAGIC */
             }
 
-            pdebug(DEBUG_SPEW,"Trying new ID %d.", new_id);
+            if(rc != PLCTAG_STATUS_OK) {
+                /* abort the request. */
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
 
-            if(!hashtable_get(tags,(int64_t)new_id)) {
-                pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
-                break;
+                /* translate error if we are still pending. */
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Bit write operation timed out.");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
             }
 
-            attempts++;
-        } while(attempts < MAX_TAG_MAP_ATTEMPTS);
-
-        if(attempts < MAX_TAG_MAP_ATTEMPTS) {
-            rc = hashtable_put(tags, (int64_t)new_id, tag);
-        } else {
-            rc = PLCTAG_ERR_NO_RESOURCES;
+            pdebug(DEBUG_INFO,"elapsed time %lldms",(time_ms()-start_time));
         }
 
-        next_tag_id = new_id;
-    }
+        op_times_status(tag, rc);
+    } /* end of api mutex block */
 
-    if(rc != PLCTAG_STATUS_OK) {
-        new_id = rc;
-    }
+    rc_dec(tag);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_INFO, "Done");
 
-    return new_id;
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_get_op_time()
+ *
+ * Get when a stage of the last read or write happened.
+ */
+
+LIB_EXPORT int64_t plc_tag_get_op_time(int32_t id, int stage)
+{
+    int64_t result = 0;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(stage == PLCTAG_OP_TIME_NOW) {
+        return time_mono_us();
+    }
+
+    tag = lookup_tag(id);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        switch(stage) {
+        case PLCTAG_OP_TIME_STARTED:
+            result = tag->op_times.started_us;
+            break;
+
+        case PLCTAG_OP_TIME_QUEUED:
+            result = tag->op_times.queued_us;
+            break;
+
+        case PLCTAG_OP_TIME_PACKED:
+            result = tag->op_times.packed_us;
+            break;
+
+        case PLCTAG_OP_TIME_SENT:
+            result = tag->op_times.sent_us;
+            break;
+
+        case PLCTAG_OP_TIME_RECEIVED:
+            result = tag->op_times.received_us;
+            break;
+
+        case PLCTAG_OP_TIME_UNPACKED:
+            result = tag->op_times.unpacked_us;
+            break;
+
+        case PLCTAG_OP_TIME_COMPLETED:
+            result = tag->op_times.completed_us;
+            break;
+
+        case PLCTAG_OP_TIME_ACQUIRED:
+            result = tag->op_times.acquired_us;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unknown operation stage %d!", stage);
+            result = PLCTAG_ERR_BAD_PARAM;
+            break;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
+}
+
+
+
+/*
+ * Binary event tracing.  See util/trace.c for the details.
+ */
+
+LIB_EXPORT int plc_tag_trace_start(const char *file_name)
+{
+    return trace_start(file_name);
+}
+
+
+LIB_EXPORT int plc_tag_trace_stop(void)
+{
+    return trace_stop();
+}
+
+
+
+/*
+ * Log callback.  See util/debug.c for the details.
+ */
+
+LIB_EXPORT int plc_tag_register_logger(plc_tag_log_callback_func log_callback_func)
+{
+    return debug_register_logger(log_callback_func);
+}
+
+
+LIB_EXPORT int plc_tag_unregister_logger(void)
+{
+    return debug_unregister_logger();
+}
+
+
+
+/*
+ * Last value table consumer API.  See lvt.c for the details.
+ *
+ * A consumer may never create a tag, so the library may not be set up
+ * yet.  plc_tag_lvt_read() needs a handle from plc_tag_lvt_open() and is
+ * left alone to keep it cheap.
+ */
+
+LIB_EXPORT int32_t plc_tag_lvt_open(const char *table)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    return lvt_open(table);
+}
+
+
+
+LIB_EXPORT int plc_tag_lvt_find(int32_t table, const char *key)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    return lvt_find(table, key);
+}
+
+
+
+LIB_EXPORT int plc_tag_lvt_read(int32_t table, int slot, uint8_t *buf, int buf_size, int64_t *update_time)
+{
+    return lvt_read(table, slot, buf, buf_size, update_time);
+}
+
+
+
+LIB_EXPORT int plc_tag_lvt_close(int32_t table)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    return lvt_close(table);
+}
+
+
+
+/*****************************************************************************************************
+ *****************************  Support routines for extra indirection *******************************
+ ****************************************************************************************************/
+
+
+plc_tag_p lookup_tag(int32_t tag_id)
+{
+    plc_tag_p tag = NULL;
+
+    critical_block(tag_lookup_mutex) {
+        tag = hashtable_get(tags, (int64_t)tag_id);
+
+        if(tag) {
+            debug_set_tag_id(tag->tag_id);
+        } else {
+            /* FIXME - remove this. */
+            pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
+        }
+
+        /* shared tags have more than one ID. */
+        if(tag && (tag->tag_id == tag_id || tag->share)) {
+            pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
+            tag = rc_inc(tag);
+        } else {
+            debug_set_tag_id(0);
+            tag = NULL;
+        }
+    }
+
+    return tag;
+}
+
+
+
+int tag_id_inc(int id)
+{
+    if(id <= 0) {
+        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
+        /* try to correct. */
+        id = (TAG_ID_MASK/2);
+    }
+
+    id = (id + 1) & TAG_ID_MASK;
+
+    if(id == 0) {
+        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
+    }
+
+    return id;
+}
+
+
+
+int add_tag_lookup(plc_tag_p tag)
+{
+    int new_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(tag_lookup_mutex) {
+        new_id = add_tag_lookup_unsafe(tag);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return new_id;
+}
+
+
+
+/*
+ * add_tag_lookup_unsafe
+ *
+ * You must hold the tag lookup mutex before calling this!
+ */
+
+int add_tag_lookup_unsafe(plc_tag_p tag)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    int new_id = 0;
+    int attempts = 0;
+
+    /* only get this when we hold the mutex. */
+    new_id = next_tag_id;
+
+    do {
+        new_id = tag_id_inc(new_id);
+
+        if(new_id <=0) {
+            pdebug(DEBUG_WARN,"ID %d is illegal!", new_id);
+            attempts = MAX_TAG_MAP_ATTEMPTS;
+            break;
+        }
+
+        pdebug(DEBUG_SPEW,"Trying new ID %d.", new_id);
+
+        if(!hashtable_get(tags,(int64_t)new_id)) {
+            pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
+            break;
+        }
+
+        attempts++;
+    } while(attempts < MAX_TAG_MAP_ATTEMPTS);
+
+    if(attempts < MAX_TAG_MAP_ATTEMPTS) {
+        rc = hashtable_put(tags, (int64_t)new_id, tag);
+    } else {
+        rc = PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    next_tag_id = new_id;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        new_id = rc;
+    }
+
+    return new_id;
+}
+
+
+
+static int compare_attr_parts(const void *a, const void *b)
+{
+    return str_cmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+static int attr_part_is(const char *part, const char *name)
+{
+    while(*name && tolower((unsigned char)*part) == tolower((unsigned char)*name)) {
+        part++;
+        name++;
+    }
+
+    return (*name == 0 && *part == '=');
+}
+
+
+/*
+ * shared_tag_def
+ *
+ * Turn an attribute string into a form where two strings that define
+ * the same tag compare equal.  The name=value parts are sorted and the
+ * ones that do not change what tag is created are dropped.
+ */
+
+char *shared_tag_def(const char *attrib_str)
+{
+    char **parts = NULL;
+    int num_parts = 0;
+    int total_size = 0;
+    char *def = NULL;
+    int def_len = 0;
+
+    parts = str_split(attrib_str, "&");
+    if(!parts) {
+        return NULL;
+    }
+
+    for(int i=0; parts[i]; i++) {
+        const char *part = parts[i];
+
+        /* these do not make the tag different. */
+        if(attr_part_is(part, "share_tag") || attr_part_is(part, "debug") || attr_part_is(part, "trace")) {
+            continue;
+        }
+
+        parts[num_parts] = parts[i];
+        num_parts++;
+        total_size += str_length(part) + 1;
+    }
+
+    qsort(parts, (size_t)num_parts, sizeof(char *), compare_attr_parts);
+
+    def = mem_alloc(total_size + 1);
+    if(!def) {
+        mem_free(parts);
+        return NULL;
+    }
+
+    for(int i=0; i < num_parts; i++) {
+        if(i > 0) {
+            def[def_len] = '&';
+            def_len++;
+        }
+
+        str_copy(def + def_len, total_size + 1 - def_len, parts[i]);
+        def_len += str_length(parts[i]);
+    }
+
+    mem_free(parts);
+
+    return def;
+}
+
+
+
+/*
+ * attach_shared_tag
+ *
+ * If there is already a tag with this definition, give it a new
+ * ID and return that.  Return zero if there is no such tag.
+ */
+
+int attach_shared_tag(const char *def)
+{
+    int id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(tag_lookup_mutex) {
+        for(int i=0; i < vector_length(shared_tags); i++) {
+            tag_share_p share = vector_get(shared_tags, i);
+            plc_tag_p tag = NULL;
+
+            if(str_cmp(share->def, def) != 0) {
+                continue;
+            }
+
+            /* each ID holds a reference. */
+            tag = rc_inc(share->tag);
+            if(!tag) {
+                /* on its way out. */
+                break;
+            }
+
+            id = add_tag_lookup_unsafe(tag);
+            if(id < 0) {
+                rc_dec(tag);
+                break;
+            }
+
+            share->handle_count++;
+
+            pdebug(DEBUG_DETAIL, "Shared tag %d now has %d handles.", tag->tag_id, share->handle_count);
+
+            break;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return id;
+}
+
+
+
+/*
+ * add_shared_tag_lookup
+ *
+ * Map a newly created shared tag and put it in the shared list so that
+ * later tags with the same definition use it.   This takes ownership
+ * of the definition string.
+ */
+
+int add_shared_tag_lookup(plc_tag_p tag, char *def)
+{
+    tag_share_p share = NULL;
+    int id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    share = mem_alloc((int)sizeof(struct tag_share_t));
+    if(!share) {
+        mem_free(def);
+        return add_tag_lookup(tag);
+    }
+
+    share->def = def;
+    share->tag = tag;
+    share->handle_count = 1;
+
+    critical_block(tag_lookup_mutex) {
+        int found = 0;
+
+        id = add_tag_lookup_unsafe(tag);
+        if(id < 0) {
+            break;
+        }
+
+        /*
+         * someone might have created the same tag at the same time.
+         * If so, this one is just not shared.
+         */
+        for(int i=0; i < vector_length(shared_tags); i++) {
+            tag_share_p other = vector_get(shared_tags, i);
+
+            if(str_cmp(other->def, def) == 0) {
+                pdebug(DEBUG_DETAIL, "Lost race to create shared tag, this one will not be shared.");
+                found = 1;
+                break;
+            }
+        }
+
+        if(!found) {
+            tag->share = share;
+            vector_put(shared_tags, vector_length(shared_tags), share);
+        }
+    }
+
+    if(!tag->share) {
+        mem_free(share->def);
+        mem_free(share);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return id;
+}
+
+
+
+/*
+ * shared_read_status
+ *
+ * Check whether the last read started on a shared tag is done and
+ * record its result for the other handles.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+int shared_read_status(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->share->read_in_flight) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    rc = tag->vtable->status(tag);
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        tag->share->read_in_flight = 0;
+        tag->share->read_done_time = time_ms();
+        tag->share->read_done_status = rc;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * read_cache_refresh_start
+ *
+ * Start a background refresh of a stale cached read.  The refresh reads
+ * into its own buffer so that callers keep getting the whole of the old
+ * data while the response comes in, possibly in several fragments.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+int read_cache_refresh_start(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag->read_cache_size != tag->size) {
+        uint8_t *new_data = (uint8_t *)mem_realloc(tag->read_cache_data, tag->size);
+
+        if(!new_data) {
+            pdebug(DEBUG_WARN, "Unable to allocate refresh buffer!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tag->read_cache_data = new_data;
+        tag->read_cache_size = tag->size;
+    }
+
+    /* anything the response does not cover keeps its old value. */
+    mem_copy(tag->read_cache_data, tag->data, tag->size);
+
+    read_cache_swap(tag);
+    rc = tag->vtable->read(tag);
+    read_cache_swap(tag);
+
+    return rc;
+}
+
+
+
+/*
+ * read_cache_refresh_status
+ *
+ * Check on a background refresh of a stale cached read.   When it
+ * finishes successfully the new data replaces the old and the cache
+ * is fresh again.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+int read_cache_refresh_status(plc_tag_p tag)
+{
+    int rc = tag->vtable->status(tag);
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        tag->read_cache_refreshing = 0;
+
+        if(rc == PLCTAG_STATUS_OK) {
+            read_cache_swap(tag);
+            tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+        } else {
+            pdebug(DEBUG_WARN, "Background refresh of cached data failed with %s.", plc_tag_decode_error(rc));
+        }
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * read_cache_swap
+ *
+ * Exchange the tag data with the refresh buffer.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+void read_cache_swap(plc_tag_p tag)
+{
+    uint8_t *data = tag->data;
+    int size = tag->size;
+
+    tag->data = tag->read_cache_data;
+    tag->size = tag->read_cache_size;
+
+    tag->read_cache_data = data;
+    tag->read_cache_size = size;
+}
+
+
+
+/*
+ * tag_tickle
+ *
+ * Call the protocol tickler.  While a background refresh is running the
+ * protocol sees the refresh buffer as the tag data, and a refresh that
+ * just finished is swapped in before anyone looks at the data again.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+void tag_tickle(plc_tag_p tag)
+{
+    if(!tag->read_cache_refreshing) {
+        tag->vtable->tickler(tag);
+        return;
+    }
+
+    read_cache_swap(tag);
+    tag->vtable->tickler(tag);
+    read_cache_swap(tag);
+
+    /* failures are left for plc_tag_read() to report. */
+    if(tag->vtable->status(tag) == PLCTAG_STATUS_OK) {
+        read_cache_refresh_status(tag);
+    }
+}
+
+
+
+/*
+ * op_times_start
+ *
+ * A read or write was started.  Forget the times of the last one.
+ * The start time is taken before the request is queued.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+void op_times_start(plc_tag_p tag, int64_t started_us)
+{
+    mem_set(&tag->op_times, 0, (int)sizeof(tag->op_times));
+
+    tag->op_times.started_us = started_us;
+    tag->op_times.in_flight = 1;
+}
+
+
+
+/*
+ * op_times_status
+ *
+ * Note when the operation in flight is done, whether it worked or not.
+ *
+ * You must hold the tag's API mutex before calling this!
+ */
+
+void op_times_status(plc_tag_p tag, int rc)
+{
+    if(tag->op_times.in_flight && rc != PLCTAG_STATUS_PENDING) {
+        tag->op_times.completed_us = time_mono_us();
+        tag->op_times.in_flight = 0;
+
+        /* the stage events must come right before the done event. */
+        if(tag->op_times.queued_us) {
+            trace_event(TRACE_TAG_OP_STAGES, tag->tag_id, tag->op_times.started_us, tag->op_times.queued_us, tag->op_times.packed_us);
+            trace_event(TRACE_TAG_OP_WIRE, tag->tag_id, tag->op_times.sent_us, tag->op_times.received_us, tag->op_times.unpacked_us);
+        }
+
+        trace_event(TRACE_TAG_OP_DONE, tag->tag_id, rc, tag->op_times.completed_us - tag->op_times.started_us, tag->op_times.completed_us);
+    }
 }
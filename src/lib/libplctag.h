@@ -68,6 +68,7 @@ extern "C" {
 
 
     /* library internal status. */
+    #define PLCTAG_STATUS_STALE         (2)
     #define PLCTAG_STATUS_PENDING       (1)
     #define PLCTAG_STATUS_OK            (0)
 
@@ -112,6 +113,60 @@ extern "C" {
     #define PLCTAG_ERR_BUSY             (-39)
 
 
+    /* accessor kinds for structure members, see plc_tag_get_member_info(). */
+    #define PLCTAG_MEMBER_UNKNOWN       (0)
+    #define PLCTAG_MEMBER_BIT           (1)
+    #define PLCTAG_MEMBER_INT8          (2)
+    #define PLCTAG_MEMBER_UINT8         (3)
+    #define PLCTAG_MEMBER_INT16         (4)
+    #define PLCTAG_MEMBER_UINT16        (5)
+    #define PLCTAG_MEMBER_INT32         (6)
+    #define PLCTAG_MEMBER_UINT32        (7)
+    #define PLCTAG_MEMBER_INT64         (8)
+    #define PLCTAG_MEMBER_UINT64        (9)
+    #define PLCTAG_MEMBER_FLOAT32       (10)
+    #define PLCTAG_MEMBER_FLOAT64       (11)
+    #define PLCTAG_MEMBER_STRUCT        (12)
+
+
+    /*
+     * Session statistics.
+     *
+     * Create a tag with "protocol=system&name=@stats" (or the older
+     * "make=system&family=library&name=@stats") and read it to get a
+     * snapshot of every open AB session.  The tag data is one record of
+     * PLCTAG_STATS_RECORD_SIZE bytes per session, so the number of sessions
+     * is plc_tag_get_size() / PLCTAG_STATS_RECORD_SIZE.  Field offsets are
+     * from the start of a record.  Counters are 64-bit, read them with
+     * plc_tag_get_uint64().  The others are 32-bit, read them with
+     * plc_tag_get_uint32().  The gateway is a zero terminated string,
+     * possibly truncated.
+     *
+     * Requests per packet is the packing ratio.  The round trip times are
+     * in microseconds from sending a packet to having the whole reply.  The
+     * percentiles are the upper edge of a histogram bucket so they are within
+     * 25% or so.  The maximum payload is the size the Forward Open got, or
+     * the unconnected size if there is no connection.
+     */
+    #define PLCTAG_STATS_RECORD_SIZE        (128)
+    #define PLCTAG_STATS_REQUESTS_SENT      (0)
+    #define PLCTAG_STATS_PACKETS_SENT       (8)
+    #define PLCTAG_STATS_PACKETS_RECEIVED   (16)
+    #define PLCTAG_STATS_BYTES_SENT         (24)
+    #define PLCTAG_STATS_BYTES_RECEIVED     (32)
+    #define PLCTAG_STATS_RECONNECTS         (40)
+    #define PLCTAG_STATS_TIMEOUTS           (48)
+    #define PLCTAG_STATS_RTT_P50_US         (56)
+    #define PLCTAG_STATS_RTT_P99_US         (64)
+    #define PLCTAG_STATS_RTT_MAX_US         (72)
+    #define PLCTAG_STATS_QUEUE_DEPTH        (80)
+    #define PLCTAG_STATS_MAX_QUEUE_DEPTH    (84)
+    #define PLCTAG_STATS_MAX_PAYLOAD        (88)
+    #define PLCTAG_STATS_CONNECTED          (92)
+    #define PLCTAG_STATS_GATEWAY            (96)
+    #define PLCTAG_STATS_GATEWAY_SIZE       (32)
+
+
 
 
     /*
@@ -152,6 +207,14 @@ extern "C" {
      * the operation was a success.  If the value is less than zero then the
      * tag was not created and the failure error is one of the PLCTAG_ERR_xyz
      * errors.
+     *
+     * On POSIX systems AB tags can go through a local plctag_proxy process
+     * that shares one PLC connection among many processes.  Add
+     * proxy=unix:/path/to/socket or proxy=127.0.0.1:port to the attributes.
+     * The tag then sends unconnected messages to the proxy, which forwards
+     * them over its own connection.  DH+ and consumed (consume=1) tags cannot
+     * use a proxy.  Listing tags and reading UDT templates need a connection
+     * and do not work through it.
      */
 
     LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout);
@@ -227,6 +290,19 @@ extern "C" {
      * If the timeout value is zero, then plc_tag_read will normally return
      * PLCTAG_STATUS_PENDING.
      *
+     * If the tag was created with read_cache_ms and read_cache_stale=1, a read
+     * after the cache expires returns PLCTAG_STATUS_STALE right away, leaving
+     * the old data in place, and refreshes the data in the background.  The
+     * timeout only applies to the first read.  The @stats system tag does not
+     * support read_cache_stale.
+     *
+     * Logix tags created with consume=1 (and optionally rpi=<ms> and
+     * udp_port=<port>, zero for any free port) are produced tags read over a
+     * Class 1 UDP connection.  The PLC sends the data every RPI, so a read
+     * returns the latest data at once without going to the PLC.  All the
+     * consumed tags to one PLC with the same udp_port share one socket.  These
+     * tags cannot be written.
+     *
      * This is a function provided by the underlying protocol implementation.
      */
     LIB_EXPORT int plc_tag_read(int32_t tag, int timeout);
@@ -307,6 +383,214 @@ extern "C" {
     LIB_EXPORT int plc_tag_set_float32(int32_t tag, int offset, float val);
 
 
+
+
+    /*
+     * plc_tag_get_member_info
+     *
+     * Look up a member of a structured (UDT) tag by path, for instance "Motor.Speed"
+     * or "Alarms[3]".  The byte offset of the member within the tag data is returned
+     * in offset and the accessor to use (one of the PLCTAG_MEMBER_xyz values) in kind.
+     * For BOOL members the bit number within the byte at offset is returned in bit_num,
+     * otherwise bit_num is set to zero.
+     *
+     * The tag must know its UDT template.  This is the case for Logix tags created
+     * with the udt_id=<template ID> attribute or with the name @udt/<template ID>.
+     * The template is fetched from the PLC once, by the first read of any tag of that
+     * type, and then shared by all tags of that type on the same connection.  Before
+     * that PLCTAG_ERR_NO_DATA is returned.
+     *
+     * Do the lookup once and keep the offset.  Decoding each sample is then just
+     * the normal plc_tag_get_xyz() calls with no string handling.
+     */
+    LIB_EXPORT int plc_tag_get_member_info(int32_t tag, const char *member_path, int *offset, int *kind, int *bit_num);
+
+
+    /*
+     * plc_tag_write_bits
+     *
+     * Change individual bits of the first element of a tag in the PLC without
+     * touching the others.  Bits set in set_mask are set, bits set in clear_mask
+     * are cleared.  If a bit is in both masks, it is cleared.  Only the low
+     * bits that fit in one element are used, so a DINT tag uses the low 32 bits.
+     *
+     * This uses the Logix Read Modify Write service.  The PLC applies the masks
+     * in one step, so no read is needed first and there is no race with the PLC
+     * logic changing other bits in the same word.  The request is small and is
+     * packed with other requests when packing is allowed.
+     *
+     * Only Logix tags of integer types support this, others return
+     * PLCTAG_ERR_UNSUPPORTED.  The timeout works the same way as in
+     * plc_tag_write().  On success the local copy of the tag data is updated
+     * to match.
+     */
+    LIB_EXPORT int plc_tag_write_bits(int32_t tag, uint64_t set_mask, uint64_t clear_mask, int timeout);
+
+
+
+
+    /*
+     * plc_tag_get_op_time
+     *
+     * Get when a stage of the last read or write of the tag happened.  The
+     * stages are:
+     *
+     *   PLCTAG_OP_TIME_STARTED    plc_tag_read() or plc_tag_write() started it.
+     *   PLCTAG_OP_TIME_QUEUED     the first request was queued for the PLC.
+     *   PLCTAG_OP_TIME_PACKED     the last request was put in a packet.
+     *   PLCTAG_OP_TIME_SENT       that packet was sent.
+     *   PLCTAG_OP_TIME_RECEIVED   the reply to it came in.
+     *   PLCTAG_OP_TIME_UNPACKED   the reply was handed to the request.
+     *   PLCTAG_OP_TIME_COMPLETED  the library saw the operation finish.
+     *
+     * These are microseconds on a monotonic clock with an arbitrary start,
+     * so only differences mean anything.  PLCTAG_OP_TIME_NOW returns the
+     * current time on that clock, the tag is not used.
+     *
+     * PLCTAG_OP_TIME_ACQUIRED is the system time in microseconds when the
+     * reply came in.  Use it to time stamp data.  It counts from the Unix
+     * epoch, 1970-01-01 00:00:00 UTC, on all platforms.
+     *
+     * A stage that has not happened yet, or that the protocol does not
+     * report, is zero.  Large reads and writes take several requests.
+     * Completion is seen by the background thread, plc_tag_status() or the
+     * wait in plc_tag_read()/plc_tag_write(), whichever is first.
+     */
+    #define PLCTAG_OP_TIME_STARTED      (0)
+    #define PLCTAG_OP_TIME_QUEUED       (1)
+    #define PLCTAG_OP_TIME_PACKED       (2)
+    #define PLCTAG_OP_TIME_SENT         (3)
+    #define PLCTAG_OP_TIME_RECEIVED     (4)
+    #define PLCTAG_OP_TIME_COMPLETED    (5)
+    #define PLCTAG_OP_TIME_ACQUIRED     (6)
+    #define PLCTAG_OP_TIME_NOW          (7)
+    #define PLCTAG_OP_TIME_UNPACKED     (8)
+
+    LIB_EXPORT int64_t plc_tag_get_op_time(int32_t tag, int stage);
+
+
+
+    /*
+     * Binary event tracing.
+     *
+     * The debug output is formatted and printed by the thread that makes it,
+     * and that changes the timing enough to hide the problem being chased.
+     * Tracing records fixed size events (tag reads and writes, requests
+     * queued, packets sent and received) into a per-thread ring without
+     * locking or formatting.  A background thread writes them out.
+     *
+     * plc_tag_trace_start(NULL) prints the events to stderr.  Given a file
+     * name, the raw records are written to the file instead.  Decode it with
+     * the plctag_trace tool.  If the background thread falls behind, events
+     * are dropped and the number dropped is recorded.
+     *
+     * If the file name ends in .json, Chrome trace event JSON is written
+     * instead.  Load it in chrome://tracing or ui.perfetto.dev.  Each tag
+     * has a track with a span for every finished read or write, split into
+     * the stages from plc_tag_get_op_time(): the API call, waiting in the
+     * session queue, packing, on the wire, unpacking and waiting for the
+     * library to pick up the result.  Other events show on the track of the
+     * thread that recorded them.
+     *
+     * Tracing can also be started without code changes by setting the
+     * PLCTAG_TRACE environment variable to a file name, or with the trace
+     * attribute when creating a tag.  Either is ignored if tracing is
+     * already running.
+     *
+     * plc_tag_trace_stop() writes out the remaining events and closes the
+     * file.  Both return a status code.  Tracing is stopped when the
+     * library shuts down.
+     */
+
+    LIB_EXPORT int plc_tag_trace_start(const char *file_name);
+    LIB_EXPORT int plc_tag_trace_stop(void);
+
+
+
+    /*
+     * Log callback.
+     *
+     * By default the debug output goes to stderr.  An application with its
+     * own logging can register a callback to get each message instead, split
+     * into the debug level, the library function and line, the tag ID (zero
+     * if none) and the message text without a trailing newline.
+     *
+     * Messages are queued and the callback is called from a library thread,
+     * never from the thread that logged the message.  The callback can be
+     * slow without holding up PLC communication.  If the queue fills, new
+     * messages are dropped and a PLCTAG_DEBUG_WARN message with the number
+     * dropped is sent once there is room.  Long messages are cut to 255
+     * characters.
+     *
+     * The debug level still decides what is logged.  Set it with the debug
+     * attribute when creating a tag or by writing the debug system tag.
+     *
+     * plc_tag_register_logger() replaces any callback already registered.
+     * plc_tag_unregister_logger() delivers the messages already queued and
+     * goes back to stderr.  Both return a status code.
+     */
+
+    #define PLCTAG_DEBUG_NONE      (0)
+    #define PLCTAG_DEBUG_ERROR     (1)
+    #define PLCTAG_DEBUG_WARN      (2)
+    #define PLCTAG_DEBUG_INFO      (3)
+    #define PLCTAG_DEBUG_DETAIL    (4)
+    #define PLCTAG_DEBUG_SPEW      (5)
+
+    typedef void (*plc_tag_log_callback_func)(int level, const char *function, int line, int32_t tag_id, const char *message);
+
+    LIB_EXPORT int plc_tag_register_logger(plc_tag_log_callback_func log_callback_func);
+    LIB_EXPORT int plc_tag_unregister_logger(void);
+
+
+
+
+    /*
+     * Last value tables.
+     *
+     * A tag created with publish=<table> copies its data into a named shared
+     * memory table each time a read of the tag completes.  The slot is found
+     * by publish_key, which defaults to the tag name.  The process that
+     * creates the table sets its size with publish_slots (default 256) and
+     * publish_slot_size (default 512 bytes).  Table names may only contain
+     * letters, digits, '_' and '-'.
+     *
+     * Other processes on the same host can read the latest data without
+     * creating tags or talking to the PLC:
+     *
+     *     table = plc_tag_lvt_open("line1");
+     *     slot = plc_tag_lvt_find(table, "Motor[3]");
+     *     size = plc_tag_lvt_read(table, slot, buf, sizeof(buf), &when);
+     *
+     * plc_tag_lvt_open() returns a handle greater than zero or an error.
+     * plc_tag_lvt_find() returns the slot number of the key, or
+     * PLCTAG_ERR_NOT_FOUND if nothing has published it yet.  Slot numbers do
+     * not change, so look them up once.
+     *
+     * plc_tag_lvt_read() copies the latest data into buf and returns the
+     * number of bytes, or PLCTAG_ERR_NO_DATA if there has not been a read yet.
+     * If update_time is not NULL it gets the time_ms() of that read.  It takes
+     * no locks and makes no system calls.  It retries if the publisher is
+     * writing the slot at the same time.
+     *
+     * On POSIX systems a table outlives its processes, until it is removed
+     * from /dev/shm or the host reboots.  On Windows it goes away when the
+     * last process using it closes it.
+     *
+     * A publisher that dies part way through a write does not block the
+     * table, the next publisher takes over.  On POSIX systems a table that
+     * is damaged, or has smaller slots or fewer of them than a new publisher
+     * asks for, is replaced as long as no live process publishes to it.
+     * Consumers of the old table then get PLCTAG_ERR_BAD_CONNECTION from
+     * plc_tag_lvt_find() and plc_tag_lvt_read() and must close and open it
+     * again.
+     */
+    LIB_EXPORT int32_t plc_tag_lvt_open(const char *table);
+    LIB_EXPORT int plc_tag_lvt_find(int32_t table, const char *key);
+    LIB_EXPORT int plc_tag_lvt_read(int32_t table, int slot, uint8_t *buf, int buf_size, int64_t *update_time);
+    LIB_EXPORT int plc_tag_lvt_close(int32_t table);
+
+
 #ifdef __cplusplus
 }
 #endif
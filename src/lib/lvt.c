@@ -0,0 +1,981 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <lib/lvt.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/vector.h>
+
+
+/*
+ * Region layout:
+ *
+ *    header
+ *    slot_count slots, each slot_stride bytes:
+ *        slot header
+ *        slot_data_size bytes of tag data
+ *
+ * Only fixed size fields are used so that 32 and 64-bit processes agree.
+ * Slots are claimed under the header lock and never given back.  A slot's
+ * key is written before used_count covers it, so readers need no lock.
+ *
+ * The locks in the region hold the process ID of their owner, so a lock
+ * left by a process that died holding it can be taken over.  The header
+ * also lists the processes publishing to the table.  A region that no
+ * live process publishes to can be replaced when it is broken or too
+ * small: its name is removed, it is marked dead and a new one is made.
+ * Consumers of the dead region get PLCTAG_ERR_BAD_CONNECTION and must
+ * open the table again.
+ */
+
+#define LVT_MAGIC               ((uint32_t)0x4C565432) /* "LVT2" */
+#define LVT_DEAD                ((uint32_t)0x44454144) /* "DEAD" */
+#define LVT_KEY_SIZE            (64)
+#define LVT_DEFAULT_SLOTS       (256)
+#define LVT_DEFAULT_SLOT_SIZE   (512)
+#define LVT_MAX_NAME            (64)
+#define LVT_MAX_TABLES          (16)
+#define LVT_READ_RETRIES        (10000)
+#define LVT_INIT_WAIT_MS        (100)
+#define LVT_MAX_PUBLISHERS      (8)
+#define LVT_LOCK_SPINS          (1000)
+#define LVT_CREATE_TRIES        (3)
+
+typedef struct {
+    volatile uint32_t magic;    /* written last by the creator */
+    uint32_t slot_count;
+    uint32_t slot_data_size;
+    uint32_t slot_stride;
+    volatile int32_t lock;      /* owner's process ID, protects used_count, slot claims and publishers */
+    volatile uint32_t used_count;
+    int32_t publishers[LVT_MAX_PUBLISHERS];    /* process IDs, zero if free */
+} lvt_header;
+
+typedef struct {
+    volatile uint32_t seq;      /* odd while a write is in progress, zero if never written */
+    volatile int32_t write_lock;    /* owner's process ID, more than one process may publish the same key */
+    uint32_t data_size;
+    uint32_t reserved;
+    int64_t update_time;        /* time_ms() of the read */
+    char key[LVT_KEY_SIZE];
+} lvt_slot;
+
+struct lvt_table_t {
+    char *name;
+    shm_region_p region;
+    lvt_header *header;
+};
+
+typedef struct lvt_table_t *lvt_table_p;
+
+/*
+ * An open consumer table.  readers counts lvt_find() and lvt_read() calls
+ * using the table, lvt_close() sets it to -1 while it takes the table away.
+ */
+typedef struct {
+    lvt_table_p table;
+    volatile int readers;
+} lvt_consumer;
+
+/* what a publishing tag keeps. */
+struct tag_lvt_t {
+    lvt_table_p table;
+    int slot;
+    int read_pending;
+};
+
+
+static lvt_table_p table_create(const char *name, int slot_count, int slot_data_size, int *rc);
+static int table_join(lvt_table_p table, int slot_count, int slot_data_size);
+static lvt_table_p table_open(const char *name, int *rc);
+static void table_destroy(lvt_table_p table);
+static void table_leave(lvt_table_p table);
+static int table_wait_init(lvt_table_p table);
+static int table_check(lvt_table_p table);
+static int table_has_publisher_unsafe(lvt_table_p table);
+static int shm_lock(volatile int32_t *lock);
+static void shm_unlock(volatile int32_t *lock);
+static lvt_table_p consumer_get(int32_t handle);
+static void consumer_put(int32_t handle);
+static int check_name(const char *name);
+static int claim_slot(lvt_table_p table, const char *key);
+static lvt_slot *get_slot(lvt_table_p table, int slot);
+static int publish(plc_tag_p tag);
+
+
+static mutex_p lvt_mutex = NULL;
+
+/* tables this process publishes to, kept until shutdown. */
+static vector_p publish_tables = NULL;
+
+/* tables opened with plc_tag_lvt_open(), the handle is the index plus one. */
+static lvt_consumer consumer_tables[LVT_MAX_TABLES];
+
+
+
+int lvt_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = mutex_create(&lvt_mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create last value table mutex!");
+        return rc;
+    }
+
+    publish_tables = vector_create(4, 4);
+    if(!publish_tables) {
+        pdebug(DEBUG_ERROR, "Unable to create last value table list!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+void lvt_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(publish_tables) {
+        for(int i=0; i < vector_length(publish_tables); i++) {
+            table_leave(vector_get(publish_tables, i));
+            table_destroy(vector_get(publish_tables, i));
+        }
+
+        vector_destroy(publish_tables);
+        publish_tables = NULL;
+    }
+
+    for(int i=0; i < LVT_MAX_TABLES; i++) {
+        if(consumer_tables[i].table) {
+            table_destroy(consumer_tables[i].table);
+            consumer_tables[i].table = NULL;
+        }
+    }
+
+    if(lvt_mutex) {
+        mutex_destroy(&lvt_mutex);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/*************************************************************************
+ ****************************** Publishing *******************************
+ ************************************************************************/
+
+
+int lvt_publisher_create(plc_tag_p tag, attr attribs)
+{
+    const char *name = attr_get_str(attribs, "publish", NULL);
+    const char *key = attr_get_str(attribs, "publish_key", attr_get_str(attribs, "name", NULL));
+    int slot_count = attr_get_int(attribs, "publish_slots", LVT_DEFAULT_SLOTS);
+    int slot_data_size = attr_get_int(attribs, "publish_slot_size", LVT_DEFAULT_SLOT_SIZE);
+    lvt_table_p table = NULL;
+    int slot = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!name) {
+        /* not publishing. */
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(check_name(name) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Table name must be letters, digits, '_' or '-' and less than %d characters!", LVT_MAX_NAME);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!key || str_length(key) == 0 || str_length(key) >= LVT_KEY_SIZE) {
+        pdebug(DEBUG_WARN, "Publish key must be between 1 and %d characters!", LVT_KEY_SIZE - 1);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(slot_count <= 0 || slot_data_size <= 0 || slot_count > (INT32_MAX / 2) / (slot_data_size + (int)sizeof(lvt_slot) + 8)) {
+        pdebug(DEBUG_WARN, "Bad table size of %d slots of %d bytes!", slot_count, slot_data_size);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(lvt_mutex) {
+        for(int i=0; i < vector_length(publish_tables); i++) {
+            lvt_table_p tmp = vector_get(publish_tables, i);
+
+            if(tmp && str_cmp(tmp->name, name) == 0) {
+                table = tmp;
+                break;
+            }
+        }
+
+        if(!table) {
+            table = table_create(name, slot_count, slot_data_size, &rc);
+
+            if(table) {
+                vector_put(publish_tables, vector_length(publish_tables), table);
+            }
+        }
+    }
+
+    if(!table) {
+        pdebug(DEBUG_WARN, "Unable to set up last value table %s!", name);
+        return rc;
+    }
+
+    if(tag->size > (int)table->header->slot_data_size) {
+        pdebug(DEBUG_WARN, "Tag data, %d bytes, does not fit in a %d byte slot!", tag->size, (int)table->header->slot_data_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    slot = claim_slot(table, key);
+    if(slot < 0) {
+        pdebug(DEBUG_WARN, "No free slot in table %s for %s!", name, key);
+        return slot;
+    }
+
+    tag->lvt = mem_alloc((int)sizeof(struct tag_lvt_t));
+    if(!tag->lvt) {
+        pdebug(DEBUG_ERROR, "Unable to allocate publisher state!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->lvt->table = table;
+    tag->lvt->slot = slot;
+
+    pdebug(DEBUG_INFO, "Publishing %s to slot %d of table %s.", key, slot, name);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void lvt_publisher_destroy(plc_tag_p tag)
+{
+    /* the slot stays, with the last data, for the next publisher of the key. */
+    if(tag->lvt) {
+        mem_free(tag->lvt);
+        tag->lvt = NULL;
+    }
+}
+
+
+
+void lvt_read_started(plc_tag_p tag)
+{
+    if(tag->lvt) {
+        tag->lvt->read_pending = 1;
+    }
+}
+
+
+
+/* called with the tag status whenever it may have changed. */
+void lvt_read_status(plc_tag_p tag, int rc)
+{
+    if(!tag->lvt || !tag->lvt->read_pending) {
+        return;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->lvt->read_pending = 0;
+
+        if(publish(tag) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Tag data, %d bytes, no longer fits in a %d byte slot, not published!", tag->size, (int)tag->lvt->table->header->slot_data_size);
+        }
+    } else if(rc < PLCTAG_STATUS_OK) {
+        tag->lvt->read_pending = 0;
+    }
+}
+
+
+
+/* some tags grow after they are created, so the size is checked every time. */
+int publish(plc_tag_p tag)
+{
+    lvt_slot *slot = get_slot(tag->lvt->table, tag->lvt->slot);
+    int taken_over = 0;
+
+    if(tag->size < 0 || tag->size > (int)tag->lvt->table->header->slot_data_size) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    taken_over = shm_lock(&slot->write_lock);
+
+    /* a writer that died part way through left seq odd, readers already keep away. */
+    if(!taken_over || !(slot->seq & 0x01)) {
+        slot->seq++;
+        mem_barrier();
+    }
+
+    mem_copy((uint8_t *)(slot + 1), tag->data, tag->size);
+    slot->data_size = (uint32_t)tag->size;
+    slot->update_time = time_ms();
+
+    mem_barrier();
+    slot->seq++;
+
+    shm_unlock(&slot->write_lock);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*************************************************************************
+ ****************************** Consuming ********************************
+ ************************************************************************/
+
+
+int32_t lvt_open(const char *name)
+{
+    lvt_table_p table = NULL;
+    int32_t handle = PLCTAG_ERR_NO_RESOURCES;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!name || check_name(name) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Bad table name!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    table = table_open(name, &rc);
+    if(!table) {
+        pdebug(DEBUG_WARN, "Unable to open last value table %s!", name);
+        return rc;
+    }
+
+    critical_block(lvt_mutex) {
+        for(int i=0; i < LVT_MAX_TABLES; i++) {
+            if(!consumer_tables[i].table) {
+                consumer_tables[i].table = table;
+                handle = i + 1;
+                break;
+            }
+        }
+    }
+
+    if(handle < 0) {
+        pdebug(DEBUG_WARN, "Too many open last value tables!");
+        table_destroy(table);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return handle;
+}
+
+
+
+int lvt_close(int32_t handle)
+{
+    lvt_table_p table = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(handle <= 0 || handle > LVT_MAX_TABLES) {
+        pdebug(DEBUG_WARN, "Bad table handle %d!", handle);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(lvt_mutex) {
+        lvt_consumer *consumer = &consumer_tables[handle - 1];
+
+        /* wait for lvt_find() and lvt_read() calls still using the table. */
+        while(!atomic_cas_int(&consumer->readers, 0, -1)) {
+            sleep_ms(1);
+        }
+
+        table = consumer->table;
+        consumer->table = NULL;
+
+        mem_barrier();
+        consumer->readers = 0;
+    }
+
+    if(!table) {
+        pdebug(DEBUG_WARN, "Table handle %d is not open!", handle);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    table_destroy(table);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* returns the slot index of the key. */
+int lvt_find(int32_t handle, const char *key)
+{
+    lvt_table_p table = NULL;
+    uint32_t used = 0;
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!key || !(table = consumer_get(handle))) {
+        pdebug(DEBUG_WARN, "Bad table handle or key!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(table->header->magic != LVT_MAGIC) {
+        pdebug(DEBUG_WARN, "Table %s was replaced, open it again!", table->name);
+        consumer_put(handle);
+        return PLCTAG_ERR_BAD_CONNECTION;
+    }
+
+    used = table->header->used_count;
+    mem_barrier();
+
+    for(uint32_t i=0; i < used && i < table->header->slot_count; i++) {
+        if(str_cmp(get_slot(table, (int)i)->key, key) == 0) {
+            rc = (int)i;
+            break;
+        }
+    }
+
+    consumer_put(handle);
+
+    return rc;
+}
+
+
+
+/*
+ * Copy out the latest data of a slot.  Returns the number of bytes or an
+ * error.  This is the hot path for consumers: no locks and no system
+ * calls, only the count of readers that keeps lvt_close() away.
+ */
+
+int lvt_read(int32_t handle, int slot_index, uint8_t *buf, int buf_size, int64_t *update_time)
+{
+    lvt_table_p table = NULL;
+    lvt_slot *slot = NULL;
+    int rc = PLCTAG_ERR_BUSY;
+
+    if(!buf || !(table = consumer_get(handle))) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(table->header->magic != LVT_MAGIC) {
+        consumer_put(handle);
+        return PLCTAG_ERR_BAD_CONNECTION;
+    }
+
+    if(slot_index < 0 || (uint32_t)slot_index >= table->header->slot_count) {
+        consumer_put(handle);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    slot = get_slot(table, slot_index);
+
+    for(int i=0; i < LVT_READ_RETRIES; i++) {
+        uint32_t seq = slot->seq;
+        uint32_t size = 0;
+        int64_t update = 0;
+
+        mem_barrier();
+
+        if(seq == 0) {
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        /* a write is in progress. */
+        if(seq & 0x01) {
+            continue;
+        }
+
+        size = slot->data_size;
+        if(size > table->header->slot_data_size) {
+            continue;
+        }
+
+        if((int)size > buf_size) {
+            rc = PLCTAG_ERR_TOO_SMALL;
+            break;
+        }
+
+        mem_copy(buf, (uint8_t *)(slot + 1), (int)size);
+        update = slot->update_time;
+
+        mem_barrier();
+
+        if(slot->seq == seq) {
+            if(update_time) {
+                *update_time = update;
+            }
+
+            rc = (int)size;
+            break;
+        }
+    }
+
+    consumer_put(handle);
+
+    return rc;
+}
+
+
+
+
+/*************************************************************************
+ ******************************* Helpers *********************************
+ ************************************************************************/
+
+
+/*
+ * Create the table or join the one that is there.  A table that nobody
+ * publishes to any more is replaced if it is broken or smaller than we
+ * asked for.
+ */
+
+lvt_table_p table_create(const char *name, int slot_count, int slot_data_size, int *rc)
+{
+    lvt_table_p table = NULL;
+    int stride = ((int)sizeof(lvt_slot) + slot_data_size + 7) & ~7;
+    int size = (int)sizeof(lvt_header) + (slot_count * stride);
+    int created = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for(int attempt=0; attempt < LVT_CREATE_TRIES; attempt++) {
+        table = mem_alloc((int)sizeof(struct lvt_table_t));
+        if(!table) {
+            *rc = PLCTAG_ERR_NO_MEM;
+            return NULL;
+        }
+
+        table->name = str_dup(name);
+
+        *rc = shm_region_create(&table->region, name, size, &created);
+        if(*rc != PLCTAG_STATUS_OK || !table->name) {
+            pdebug(DEBUG_WARN, "Unable to create shared memory for table %s!", name);
+            table_destroy(table);
+            return NULL;
+        }
+
+        table->header = shm_region_data(table->region);
+
+        if(created) {
+            lvt_header *header = table->header;
+
+            /* new regions are zero filled.  Anyone joining waits for the lock. */
+            shm_lock(&header->lock);
+
+            header->slot_count = (uint32_t)slot_count;
+            header->slot_data_size = (uint32_t)slot_data_size;
+            header->slot_stride = (uint32_t)stride;
+            header->used_count = 0;
+            header->publishers[0] = (int32_t)process_get_id();
+
+            mem_barrier();
+
+            header->magic = LVT_MAGIC;
+
+            shm_unlock(&header->lock);
+
+            *rc = table_check(table);
+        } else {
+            *rc = table_join(table, slot_count, slot_data_size);
+        }
+
+        if(*rc == PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Done.");
+            return table;
+        }
+
+        table_destroy(table);
+
+        /* the region was replaced, try again with the new one. */
+        if(*rc != PLCTAG_STATUS_PENDING) {
+            return NULL;
+        }
+    }
+
+    pdebug(DEBUG_WARN, "Table %s keeps being replaced!", name);
+
+    *rc = PLCTAG_ERR_BUSY;
+
+    return NULL;
+}
+
+
+
+/*
+ * Add this process to the publishers of a table someone else created.
+ * Returns PLCTAG_STATUS_PENDING if the region was replaced and the
+ * caller should try again.
+ */
+
+int table_join(lvt_table_p table, int slot_count, int slot_data_size)
+{
+    lvt_header *header = table->header;
+    int32_t self = (int32_t)process_get_id();
+    int index = -1;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(shm_region_size(table->region) < (int)sizeof(lvt_header)) {
+        /* there is not even a lock to take, nobody can be using it. */
+        pdebug(DEBUG_WARN, "Region %s is too small for a table, replacing it.", table->name);
+        return (shm_region_unlink(table->name) == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : PLCTAG_ERR_BAD_DATA);
+    }
+
+    /* the creator may still be setting it up, or may have died doing so. */
+    table_wait_init(table);
+
+    shm_lock(&header->lock);
+
+    do {
+        if(header->magic == LVT_DEAD) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        rc = (header->magic == LVT_MAGIC ? table_check(table) : PLCTAG_ERR_BAD_DATA);
+
+        if(rc == PLCTAG_STATUS_OK && header->slot_data_size >= (uint32_t)slot_data_size && header->slot_count >= (uint32_t)slot_count) {
+            break;
+        }
+
+        if(table_has_publisher_unsafe(table)) {
+            /* somebody is using it as it is. */
+            break;
+        }
+
+        /* take the name away first so nobody can open the old region after it is marked. */
+        if(shm_region_unlink(table->name) == PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Replacing table %s, it is %s and nobody publishes to it.", table->name, (rc == PLCTAG_STATUS_OK ? "too small" : "broken"));
+
+            header->magic = LVT_DEAD;
+            rc = PLCTAG_STATUS_PENDING;
+        }
+    } while(0);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        /* take our old entry, or the first free one or one of a dead process. */
+        for(int i=0; i < LVT_MAX_PUBLISHERS; i++) {
+            if(header->publishers[i] == self) {
+                index = i;
+                break;
+            }
+
+            if(index < 0 && (header->publishers[i] == 0 || !process_is_alive(header->publishers[i]))) {
+                index = i;
+            }
+        }
+
+        if(index >= 0) {
+            header->publishers[index] = self;
+        } else {
+            pdebug(DEBUG_WARN, "Table %s already has %d publishing processes!", table->name, LVT_MAX_PUBLISHERS);
+            rc = PLCTAG_ERR_NO_RESOURCES;
+        }
+    }
+
+    shm_unlock(&header->lock);
+
+    return rc;
+}
+
+
+
+lvt_table_p table_open(const char *name, int *rc)
+{
+    lvt_table_p table = NULL;
+
+    table = mem_alloc((int)sizeof(struct lvt_table_t));
+    if(!table) {
+        *rc = PLCTAG_ERR_NO_MEM;
+        return NULL;
+    }
+
+    table->name = str_dup(name);
+
+    *rc = shm_region_open(&table->region, name);
+    if(*rc != PLCTAG_STATUS_OK || !table->name) {
+        table_destroy(table);
+        return NULL;
+    }
+
+    table->header = shm_region_data(table->region);
+
+    if(shm_region_size(table->region) < (int)sizeof(lvt_header)) {
+        pdebug(DEBUG_WARN, "Region %s is too small for a table!", table->name);
+        *rc = PLCTAG_ERR_BAD_DATA;
+    } else if(table_wait_init(table) != PLCTAG_STATUS_OK || table->header->magic != LVT_MAGIC) {
+        pdebug(DEBUG_WARN, "Region %s is not a last value table!", table->name);
+        *rc = PLCTAG_ERR_BAD_DATA;
+    } else {
+        *rc = table_check(table);
+    }
+
+    if(*rc != PLCTAG_STATUS_OK) {
+        table_destroy(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+
+
+void table_destroy(lvt_table_p table)
+{
+    if(!table) {
+        return;
+    }
+
+    if(table->region) {
+        shm_region_close(&table->region);
+    }
+
+    if(table->name) {
+        mem_free(table->name);
+    }
+
+    mem_free(table);
+}
+
+
+
+/* take this process out of the publishers of the table. */
+void table_leave(lvt_table_p table)
+{
+    lvt_header *header = table->header;
+    int32_t self = (int32_t)process_get_id();
+
+    shm_lock(&header->lock);
+
+    for(int i=0; i < LVT_MAX_PUBLISHERS; i++) {
+        if(header->publishers[i] == self) {
+            header->publishers[i] = 0;
+        }
+    }
+
+    shm_unlock(&header->lock);
+}
+
+
+
+/* wait for the creator to finish setting up the header. */
+int table_wait_init(lvt_table_p table)
+{
+    lvt_header *header = table->header;
+    int64_t timeout = time_ms() + LVT_INIT_WAIT_MS;
+
+    while(header->magic != LVT_MAGIC && header->magic != LVT_DEAD && time_ms() < timeout) {
+        sleep_ms(1);
+    }
+
+    mem_barrier();
+
+    return (header->magic == 0 ? PLCTAG_ERR_TIMEOUT : PLCTAG_STATUS_OK);
+}
+
+
+
+/* make sure the layout in the header fits the region. */
+int table_check(lvt_table_p table)
+{
+    lvt_header *header = table->header;
+    int64_t needed = (int64_t)sizeof(lvt_header) + ((int64_t)header->slot_count * header->slot_stride);
+
+    if(header->slot_stride < sizeof(lvt_slot) + header->slot_data_size || needed > shm_region_size(table->region)) {
+        pdebug(DEBUG_WARN, "Table %s header does not match the region!", table->name);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* call with the header lock held. */
+int table_has_publisher_unsafe(lvt_table_p table)
+{
+    for(int i=0; i < LVT_MAX_PUBLISHERS; i++) {
+        if(process_is_alive(table->header->publishers[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Take a lock in shared memory.  Returns 1 if the lock was taken from a
+ * process that died holding it, in which case whatever it protects may
+ * be half done.
+ */
+
+int shm_lock(volatile int32_t *lock)
+{
+    int32_t self = (int32_t)process_get_id();
+    int32_t owner = 0;
+
+    while(1) {
+        for(int i=0; i < LVT_LOCK_SPINS; i++) {
+            if(atomic_cas_int(lock, 0, self)) {
+                return 0;
+            }
+        }
+
+        owner = *lock;
+
+        if(owner != 0 && owner != self && !process_is_alive(owner) && atomic_cas_int(lock, owner, self)) {
+            pdebug(DEBUG_WARN, "Took over a lock left by dead process %d.", (int)owner);
+            return 1;
+        }
+
+        sleep_ms(1);
+    }
+}
+
+
+
+void shm_unlock(volatile int32_t *lock)
+{
+    mem_barrier();
+    *lock = 0;
+}
+
+
+
+/* returns the table of a consumer handle and keeps lvt_close() away until consumer_put(). */
+lvt_table_p consumer_get(int32_t handle)
+{
+    lvt_consumer *consumer = NULL;
+    int readers = 0;
+
+    if(handle <= 0 || handle > LVT_MAX_TABLES) {
+        return NULL;
+    }
+
+    consumer = &consumer_tables[handle - 1];
+
+    do {
+        readers = consumer->readers;
+
+        /* being closed. */
+        if(readers < 0) {
+            return NULL;
+        }
+    } while(!atomic_cas_int(&consumer->readers, readers, readers + 1));
+
+    if(!consumer->table) {
+        consumer_put(handle);
+        return NULL;
+    }
+
+    return consumer->table;
+}
+
+
+
+void consumer_put(int32_t handle)
+{
+    lvt_consumer *consumer = &consumer_tables[handle - 1];
+    int readers = 0;
+
+    do {
+        readers = consumer->readers;
+    } while(!atomic_cas_int(&consumer->readers, readers, readers - 1));
+}
+
+
+
+int check_name(const char *name)
+{
+    int len = str_length(name);
+
+    if(len == 0 || len >= LVT_MAX_NAME) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    for(int i=0; i < len; i++) {
+        if(!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') {
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* find the key's slot, or claim a new one. */
+int claim_slot(lvt_table_p table, const char *key)
+{
+    lvt_header *header = table->header;
+    int rc = PLCTAG_ERR_NO_RESOURCES;
+
+    /* a claim cut short is harmless, used_count only covers finished slots. */
+    shm_lock(&header->lock);
+
+    for(uint32_t i=0; i < header->used_count; i++) {
+        if(str_cmp(get_slot(table, (int)i)->key, key) == 0) {
+            rc = (int)i;
+            break;
+        }
+    }
+
+    if(rc < 0 && header->used_count < header->slot_count) {
+        lvt_slot *slot = get_slot(table, (int)header->used_count);
+
+        mem_set(slot, 0, (int)sizeof(*slot));
+        str_copy(slot->key, LVT_KEY_SIZE, key);
+
+        /* readers must see the key before the count. */
+        mem_barrier();
+
+        rc = (int)header->used_count;
+        header->used_count++;
+    }
+
+    shm_unlock(&header->lock);
+
+    return rc;
+}
+
+
+
+lvt_slot *get_slot(lvt_table_p table, int slot)
+{
+    return (lvt_slot *)((uint8_t *)table->header + sizeof(lvt_header) + ((size_t)slot * table->header->slot_stride));
+}
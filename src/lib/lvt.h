@@ -0,0 +1,52 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __LIB_LVT_H__
+#define __LIB_LVT_H__ 1
+
+#include <lib/tag.h>
+#include <util/attr.h>
+
+/*
+ * Last value tables.
+ *
+ * A tag created with publish=<table> copies the data from each completed
+ * read into a named shared memory region.  Other processes on the same
+ * host open the table read-only and get the latest values without system
+ * calls or PLC traffic.  Each slot has a sequence lock: the publisher
+ * never waits for readers, and a reader that overlaps a write tries again.
+ */
+
+extern int lvt_init(void);
+extern void lvt_teardown(void);
+
+/* publisher side, called by the generic tag code. */
+extern int lvt_publisher_create(plc_tag_p tag, attr attribs);
+extern void lvt_publisher_destroy(plc_tag_p tag);
+extern void lvt_read_started(plc_tag_p tag);
+extern void lvt_read_status(plc_tag_p tag, int rc);
+
+/* consumer side, behind the plc_tag_lvt_xyz() API functions. */
+extern int32_t lvt_open(const char *name);
+extern int lvt_close(int32_t table);
+extern int lvt_find(int32_t table, const char *key);
+extern int lvt_read(int32_t table, int slot, uint8_t *buf, int buf_size, int64_t *update_time);
+
+#endif
@@ -53,6 +53,8 @@ typedef struct plc_tag_t *plc_tag_p;
 //typedef int (*tag_write_func)(plc_tag_p tag);
 
 typedef int (*tag_vtable_func)(plc_tag_p tag);
+typedef int (*tag_member_info_func)(plc_tag_p tag, const char *member_path, int *offset, int *kind, int *bit_num);
+typedef int (*tag_write_bits_func)(plc_tag_p tag, uint64_t set_mask, uint64_t clear_mask);
 
 /* we'll need to set these per protocol type. */
 struct tag_vtable_t {
@@ -61,11 +63,50 @@ struct tag_vtable_t {
     tag_vtable_func status;
     tag_vtable_func tickler;
     tag_vtable_func write;
+
+    /* optional, NULL if the protocol does not support structured tags. */
+    tag_member_info_func member_info;
+
+    /* optional, NULL if the protocol cannot change bits without a full write. */
+    tag_write_bits_func write_bits;
 };
 
 typedef struct tag_vtable_t *tag_vtable_p;
 
 
+/*
+ * Bookkeeping for tags created with share_tag=1.  Several tag
+ * handles with the same definition point at one tag and this.
+ * Only the generic library code touches it.
+ */
+
+struct tag_share_t;
+
+/* publisher state for tags created with publish=<table>, see lvt.h. */
+struct tag_lvt_t;
+
+
+/*
+ * When each stage of the last read or write happened, in time_mono_us()
+ * units.  The generic code sets started and completed.   The protocol
+ * fills in the rest if it can, otherwise they stay zero.
+ */
+
+struct tag_op_times_t {
+    int in_flight;
+    int64_t started_us;
+    int64_t queued_us;
+    int64_t packed_us;
+    int64_t sent_us;
+    int64_t received_us;
+    int64_t unpacked_us;
+    int64_t completed_us;
+
+    /* time_us() when the reply came in, for time stamping data. */
+    int64_t acquired_us;
+};
+
+
 /*
  * The base definition of the tag structure.  This is used
  * by the protocol-specific implementations.
@@ -81,6 +122,13 @@ typedef struct tag_vtable_t *tag_vtable_p;
                         int tag_id; \
                         int64_t read_cache_expire; \
                         int64_t read_cache_ms; \
+                        int read_cache_stale; \
+                        int read_cache_refreshing; \
+                        int read_cache_size; \
+                        uint8_t *read_cache_data; \
+                        struct tag_share_t *share; \
+                        struct tag_lvt_t *lvt; \
+                        struct tag_op_times_t op_times; \
                         int size; \
                         uint8_t *data
 
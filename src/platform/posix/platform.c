@@ -27,6 +27,11 @@
  **************************************************************************/
 
 
+/* syscall() for the lock futex is hidden by a plain _POSIX_C_SOURCE. */
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+    #define _DEFAULT_SOURCE
+#endif
+
 #include <platform.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -41,11 +46,21 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <signal.h>
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
@@ -566,6 +581,19 @@ struct thread_t {
     int initialized;
 };
 
+/* functions to call when a thread exits, kept in a thread specific list. */
+struct thread_exit_t {
+    struct thread_exit_t *next;
+    thread_exit_func_t func;
+};
+
+static pthread_once_t thread_exit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_exit_key;
+static int thread_exit_key_rc = -1;
+
+static void thread_exit_key_create(void);
+static void thread_exit_run(void *list);
+
 /*
  * thread_create()
  *
@@ -703,6 +731,66 @@ extern int thread_destroy(thread_p *t)
 
 
 
+/*
+ * thread_at_exit
+ *
+ * Call func when the calling thread exits.  This works for threads the
+ * library did not create too.
+ */
+extern int thread_at_exit(thread_exit_func_t func)
+{
+    struct thread_exit_t *entry = NULL;
+
+    pthread_once(&thread_exit_once, thread_exit_key_create);
+
+    if(thread_exit_key_rc != 0) {
+        pdebug(DEBUG_WARN, "Unable to create thread exit key!");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    entry = mem_alloc((int)sizeof(*entry));
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate thread exit entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    entry->func = func;
+    entry->next = pthread_getspecific(thread_exit_key);
+
+    if(pthread_setspecific(thread_exit_key, entry)) {
+        pdebug(DEBUG_WARN, "Unable to set thread exit entry!");
+        mem_free(entry);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void thread_exit_key_create(void)
+{
+    thread_exit_key_rc = pthread_key_create(&thread_exit_key, thread_exit_run);
+}
+
+
+
+void thread_exit_run(void *list)
+{
+    struct thread_exit_t *entry = list;
+
+    while(entry) {
+        struct thread_exit_t *next = entry->next;
+
+        entry->func();
+        mem_free(entry);
+
+        entry = next;
+    }
+}
+
+
+
 
 
 
@@ -713,29 +801,101 @@ extern int thread_destroy(thread_p *t)
 /*
  * lock_acquire
  *
- * Tries to write a non-zero value into the lock atomically.
+ * The lock is an int with three states: 0 is free, 1 is held and 2 is
+ * held with threads parked on it.  A thread that does not get the lock
+ * right away spins for a short, growing while with the CPU told it is
+ * spinning.  After that it marks the lock 2 and sleeps on a futex until
+ * the holder releases.  This means that a holder that gets preempted
+ * does not make everyone else burn a whole timeslice.
+ *
+ * Locks are only shared by the threads of one process, so the futex is
+ * process private.  Platforms without futexes yield instead of sleeping.
  *
  * Returns non-zero on success.
  *
  * Warning: do not pass null pointers!
  */
 
+#define LOCK_FREE_VAL (0)
 #define ATOMIC_LOCK_VAL (1)
+#define LOCK_PARKED_VAL (2)
 
-extern int lock_acquire_try(lock_t *lock)
+/* total relax hints before parking, in doubling rounds. */
+#define LOCK_SPIN_LIMIT (128)
+
+static void cpu_relax(void);
+static void lock_park(lock_t *lock, int val);
+static void lock_unpark_one(lock_t *lock);
+
+
+void cpu_relax(void)
 {
-    int rc = __sync_lock_test_and_set((int*)lock, ATOMIC_LOCK_VAL);
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
 
-    if(rc != ATOMIC_LOCK_VAL) {
-        return 1;
-    } else {
-        return 0;
+
+void lock_park(lock_t *lock, int val)
+{
+#ifdef __linux__
+    /* returns early if the lock no longer holds val. */
+    syscall(SYS_futex, (int*)lock, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    (void)val;
+
+    if(*(volatile int*)lock == val) {
+        sched_yield();
     }
+#endif
 }
 
+
+void lock_unpark_one(lock_t *lock)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (int*)lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)lock;
+#endif
+}
+
+
+extern int lock_acquire_try(lock_t *lock)
+{
+    return __sync_bool_compare_and_swap((int*)lock, LOCK_FREE_VAL, ATOMIC_LOCK_VAL) ? 1 : 0;
+}
+
+
 int lock_acquire(lock_t *lock)
 {
-    while(!lock_acquire_try(lock)) ;
+    int spins = 1;
+
+    /* spin while the holder is running, backing off each time. */
+    while(spins <= LOCK_SPIN_LIMIT) {
+        if(*(volatile int*)lock == LOCK_FREE_VAL && lock_acquire_try(lock)) {
+            return 1;
+        }
+
+        for(int i=0; i < spins; i++) {
+            cpu_relax();
+        }
+
+        spins *= 2;
+    }
+
+    /*
+     * give up and sleep.  We take the lock as parked since we cannot
+     * tell whether there are other sleepers.  At worst that costs one
+     * spare wake up.
+     */
+    while(__sync_lock_test_and_set((int*)lock, LOCK_PARKED_VAL) != LOCK_FREE_VAL) {
+        lock_park(lock, LOCK_PARKED_VAL);
+    }
 
     return 1;
 }
@@ -743,11 +903,273 @@ int lock_acquire(lock_t *lock)
 
 extern void lock_release(lock_t *lock)
 {
-    __sync_lock_release((int*)lock);
+    /* 1 -> 0 is the uncontended case and needs no system call. */
+    if(__sync_fetch_and_sub((int*)lock, 1) != ATOMIC_LOCK_VAL) {
+        __sync_lock_release((int*)lock);
+        lock_unpark_one(lock);
+    }
     /*pdebug("released lock");*/
 }
 
 
+/*
+ * atomic_cas_int
+ *
+ * Set *val to new_val if it holds expected.  Returns non-zero if it did.
+ */
+int atomic_cas_int(volatile int *val, int expected, int new_val)
+{
+    return __sync_bool_compare_and_swap(val, expected, new_val) ? 1 : 0;
+}
+
+
+void mem_barrier(void)
+{
+    __sync_synchronize();
+}
+
+
+
+
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+/*
+ * POSIX shared memory objects.  The region lives until it is unlinked or
+ * the host reboots, so consumers can still see the last data after the
+ * creating process exits.  On Linux the regions show up in /dev/shm.
+ */
+
+#define SHM_NAME_PREFIX "/plctag_"
+#define SHM_WAIT_MS (100)
+
+struct shm_region_t {
+    int fd;
+    void *data;
+    int size;
+};
+
+
+static int shm_region_map(shm_region_p *region, int fd, int writable);
+
+
+int shm_region_create(shm_region_p *region, const char *name, int size, int *created)
+{
+    char *full_name = NULL;
+    struct stat info;
+    int fd = -1;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!region || !name || size <= 0 || !created) {
+        pdebug(DEBUG_WARN, "Bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    full_name = str_concat(SHM_NAME_PREFIX, name);
+    if(!full_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    *created = 0;
+
+    /* only one process gets to create and size the region. */
+    fd = shm_open(full_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if(fd >= 0) {
+        if(ftruncate(fd, (off_t)size) != 0) {
+            pdebug(DEBUG_WARN, "Unable to size shared memory region %s, errno=%d!", full_name, errno);
+            close(fd);
+            shm_unlink(full_name);
+            mem_free(full_name);
+            return PLCTAG_ERR_CREATE;
+        }
+
+        *created = 1;
+    } else if(errno == EEXIST) {
+        int64_t timeout = time_ms() + SHM_WAIT_MS;
+
+        fd = shm_open(full_name, O_RDWR, 0666);
+
+        /* the creator may not have set the size yet. */
+        while(fd >= 0 && fstat(fd, &info) == 0 && info.st_size == 0 && time_ms() < timeout) {
+            sleep_ms(1);
+        }
+    }
+
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory region %s, errno=%d!", full_name, errno);
+        mem_free(full_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    mem_free(full_name);
+
+    rc = shm_region_map(region, fd, 1);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+int shm_region_open(shm_region_p *region, const char *name)
+{
+    char *full_name = NULL;
+    int fd = -1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!region || !name) {
+        pdebug(DEBUG_WARN, "Bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    full_name = str_concat(SHM_NAME_PREFIX, name);
+    if(!full_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    fd = shm_open(full_name, O_RDONLY, 0);
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory region %s, errno=%d!", full_name, errno);
+        mem_free(full_name);
+        return (errno == ENOENT ? PLCTAG_ERR_NOT_FOUND : PLCTAG_ERR_OPEN);
+    }
+
+    mem_free(full_name);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return shm_region_map(region, fd, 0);
+}
+
+
+
+int shm_region_map(shm_region_p *region, int fd, int writable)
+{
+    struct stat info;
+    void *data = NULL;
+
+    if(fstat(fd, &info) != 0 || info.st_size <= 0 || info.st_size > INT_MAX) {
+        pdebug(DEBUG_WARN, "Shared memory region has no usable size!");
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, (writable ? PROT_READ | PROT_WRITE : PROT_READ), MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory region, errno=%d!", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    *region = mem_alloc((int)sizeof(struct shm_region_t));
+    if(!*region) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory region struct!");
+        munmap(data, (size_t)info.st_size);
+        close(fd);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*region)->fd = fd;
+    (*region)->data = data;
+    (*region)->size = (int)info.st_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void *shm_region_data(shm_region_p region)
+{
+    return (region ? region->data : NULL);
+}
+
+
+
+int shm_region_size(shm_region_p region)
+{
+    return (region ? region->size : 0);
+}
+
+
+
+int shm_region_close(shm_region_p *region)
+{
+    if(!region || !*region) {
+        pdebug(DEBUG_WARN, "Null region pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    munmap((*region)->data, (size_t)(*region)->size);
+    close((*region)->fd);
+
+    mem_free(*region);
+    *region = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * shm_region_unlink
+ *
+ * Remove the name of a region.  Processes that have it mapped keep it,
+ * the next create makes a new one.
+ */
+
+int shm_region_unlink(const char *name)
+{
+    char *full_name = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!name) {
+        pdebug(DEBUG_WARN, "Bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    full_name = str_concat(SHM_NAME_PREFIX, name);
+    if(!full_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(shm_unlink(full_name) != 0 && errno != ENOENT) {
+        pdebug(DEBUG_WARN, "Unable to remove shared memory region %s, errno=%d!", full_name, errno);
+        rc = PLCTAG_ERR_CLOSE;
+    }
+
+    mem_free(full_name);
+
+    return rc;
+}
+
+
+
+int process_get_id(void)
+{
+    return (int)getpid();
+}
+
+
+
+/* a process we are not allowed to signal still exists. */
+int process_is_alive(int pid)
+{
+    if(pid <= 0) {
+        return 0;
+    }
+
+    return (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
@@ -954,6 +1376,200 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a UDP socket bound to local_port, or to any free port if
+ * local_port is zero, and connect it to host:port.  After this
+ * socket_write() sends a datagram to host:port and socket_read()
+ * returns one datagram from it, or zero if none are waiting.
+ */
+
+extern int socket_connect_udp(sock_p s, const char *host, int port, int local_port)
+{
+    struct sockaddr_in local_addr;
+    struct sockaddr_in remote_addr;
+    socklen_t addr_len = sizeof(local_addr);
+    int sock_opt = 1;
+    int fd;
+    int flags;
+
+    pdebug(DEBUG_DETAIL,"Starting.");
+
+    mem_set(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons((uint16_t)port);
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &remote_addr.sin_addr) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res = NULL;
+        int rc = 0;
+
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if((rc = getaddrinfo(host, NULL, &hints, &res)) != 0 || !res) {
+            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res) {
+                freeaddrinfo(res);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        remote_addr.sin_addr.s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+
+        freeaddrinfo(res);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR,"Socket creation failed, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(char*)&sock_opt,sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket reuse option, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    mem_set(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons((uint16_t)local_port);
+
+    if(bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr))) {
+        close(fd);
+        pdebug(DEBUG_WARN, "Unable to bind UDP port %d, errno: %d", local_port, errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(connect(fd, (struct sockaddr *)&remote_addr, sizeof(remote_addr))) {
+        close(fd);
+        pdebug(DEBUG_WARN, "Unable to connect UDP socket to %s:%d, errno: %d", host, port, errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* find out which port we got. */
+    if(getsockname(fd, (struct sockaddr *)&local_addr, &addr_len)) {
+        close(fd);
+        pdebug(DEBUG_WARN, "Unable to get UDP socket address, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    flags=fcntl(fd,F_GETFL,0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = ntohs(local_addr.sin_port);
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_connect_unix
+ *
+ * Connect to a local stream socket at path.  This is used to talk
+ * to a proxy on the same machine.
+ */
+
+extern int socket_connect_unix(sock_p s, const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+    int flags;
+    int path_len = str_length(path);
+#ifdef BSD_OS_TYPE
+    int sock_opt = 1;
+#endif
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s || !path) {
+        pdebug(DEBUG_WARN, "Null socket or path pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(path_len <= 0 || path_len >= (int)sizeof(addr.sun_path)) {
+        pdebug(DEBUG_WARN, "Socket path \"%s\" is empty or too long!", path);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+#ifdef BSD_OS_TYPE
+    if(setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket SIGPIPE suppression option, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+#endif
+
+    mem_set(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, (size_t)path_len);
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        pdebug(DEBUG_WARN, "Unable to connect to %s, errno: %d", path, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* same as TCP, non-blocking once connected. */
+    flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = 0;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_local_port
+ *
+ * The local port of a UDP socket.
+ */
+
+extern int socket_local_port(sock_p s)
+{
+    if(!s || !s->is_open) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return s->port;
+}
+
+
+
+
 extern int socket_read(sock_p s, uint8_t *buf, int size)
 {
     int rc;
@@ -1086,6 +1702,23 @@ int sleep_ms(int ms)
 }
 
 
+/*
+ * sleep_us
+ *
+ * Sleep the passed number of microseconds.  The same caveats
+ * as sleep_ms() apply.
+ */
+int sleep_us(int us)
+{
+    struct timeval tv;
+
+    tv.tv_sec = us/1000000;
+    tv.tv_usec = us % 1000000;
+
+    return select(0,NULL,NULL,NULL, &tv);
+}
+
+
 /*
  * time_ms
  *
@@ -1099,3 +1732,52 @@ int64_t time_ms(void)
 
     return  ((int64_t)tv.tv_sec*1000)+ ((int64_t)tv.tv_usec/1000);
 }
+
+
+/*
+ * time_us
+ *
+ * Return the current epoch time in microseconds.
+ */
+int64_t time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+
+    return  ((int64_t)tv.tv_sec*1000000)+ (int64_t)tv.tv_usec;
+}
+
+
+/*
+ * time_mono_us
+ *
+ * Return a monotonic time in microseconds.  This does not jump when
+ * the system clock is set.  The epoch is arbitrary so only use it for
+ * differences.
+ */
+int64_t time_mono_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec*1000000) + ((int64_t)ts.tv_nsec/1000);
+}
+
+
+
+/*
+ * time_mono_ns
+ *
+ * The same clock as time_mono_us() in nanoseconds, for timing very
+ * short things.
+ */
+int64_t time_mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec*1000000000) + (int64_t)ts.tv_nsec;
+}
@@ -594,6 +594,17 @@ struct thread_t {
     int initialized;
 };
 
+/* functions to call when a thread exits, kept in a fiber local list. */
+struct thread_exit_t {
+    struct thread_exit_t *next;
+    thread_exit_func_t func;
+};
+
+static lock_t thread_exit_lock = LOCK_INIT;
+static DWORD thread_exit_index = FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI thread_exit_run(PVOID list);
+
 
 /*
  * thread_create()
@@ -747,6 +758,63 @@ extern int thread_destroy(thread_p *t)
 
 
 
+/*
+ * thread_at_exit
+ *
+ * Call func when the calling thread exits.  This works for threads the
+ * library did not create too.
+ */
+extern int thread_at_exit(thread_exit_func_t func)
+{
+    struct thread_exit_t *entry = NULL;
+
+    spin_block(&thread_exit_lock) {
+        if(thread_exit_index == FLS_OUT_OF_INDEXES) {
+            thread_exit_index = FlsAlloc(thread_exit_run);
+        }
+    }
+
+    if(thread_exit_index == FLS_OUT_OF_INDEXES) {
+        pdebug(DEBUG_WARN, "Unable to allocate thread exit slot!");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    entry = mem_alloc((int)sizeof(*entry));
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate thread exit entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    entry->func = func;
+    entry->next = FlsGetValue(thread_exit_index);
+
+    if(!FlsSetValue(thread_exit_index, entry)) {
+        pdebug(DEBUG_WARN, "Unable to set thread exit entry!");
+        mem_free(entry);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+VOID WINAPI thread_exit_run(PVOID list)
+{
+    struct thread_exit_t *entry = list;
+
+    while(entry) {
+        struct thread_exit_t *next = entry->next;
+
+        entry->func();
+        mem_free(entry);
+
+        entry = next;
+    }
+}
+
+
+
 
 
 /***************************************************************************
@@ -778,9 +846,35 @@ extern int lock_acquire_try(lock_t *lock)
 }
 
 
+/*
+ * Spin for a short, growing while with YieldProcessor() so the holder can
+ * finish, then give up the timeslice on each try.  A holder that was
+ * preempted gets to run instead of everyone spinning through their slices.
+ */
+
+#define LOCK_SPIN_LIMIT (128)
+
 extern int lock_acquire(lock_t *lock)
 {
-    while(!lock_acquire_try(lock)) ;
+    int spins = 1;
+
+    while(spins <= LOCK_SPIN_LIMIT) {
+        if(*lock == ATOMIC_UNLOCK_VAL && lock_acquire_try(lock)) {
+            return 1;
+        }
+
+        for(int i=0; i < spins; i++) {
+            YieldProcessor();
+        }
+
+        spins *= 2;
+    }
+
+    while(!lock_acquire_try(lock)) {
+        if(!SwitchToThread()) {
+            Sleep(0);
+        }
+    }
 
     return 1;
 }
@@ -792,6 +886,225 @@ extern void lock_release(lock_t *lock)
 }
 
 
+/*
+ * atomic_cas_int
+ *
+ * Set *val to new_val if it holds expected.  Returns non-zero if it did.
+ */
+int atomic_cas_int(volatile int *val, int expected, int new_val)
+{
+    return InterlockedCompareExchange((volatile LONG *)val, (LONG)new_val, (LONG)expected) == (LONG)expected ? 1 : 0;
+}
+
+
+void mem_barrier(void)
+{
+    MemoryBarrier();
+}
+
+
+
+
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+/*
+ * Named file mappings backed by the page file.  Unlike POSIX, the region
+ * goes away when the last process with it open closes it.
+ */
+
+#define SHM_NAME_PREFIX "Local\\plctag_"
+
+struct shm_region_t {
+    HANDLE mapping;
+    void *data;
+    int size;
+};
+
+
+static int shm_region_map(shm_region_p *region, HANDLE mapping, DWORD access);
+
+
+int shm_region_create(shm_region_p *region, const char *name, int size, int *created)
+{
+    char *full_name = NULL;
+    HANDLE mapping = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!region || !name || size <= 0 || !created) {
+        pdebug(DEBUG_WARN, "Bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    full_name = str_concat(SHM_NAME_PREFIX, name);
+    if(!full_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, full_name);
+    if(!mapping) {
+        pdebug(DEBUG_WARN, "Unable to create shared memory region %s, error=%d!", full_name, (int)GetLastError());
+        mem_free(full_name);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    *created = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+    mem_free(full_name);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return shm_region_map(region, mapping, FILE_MAP_ALL_ACCESS);
+}
+
+
+
+int shm_region_open(shm_region_p *region, const char *name)
+{
+    char *full_name = NULL;
+    HANDLE mapping = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!region || !name) {
+        pdebug(DEBUG_WARN, "Bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    full_name = str_concat(SHM_NAME_PREFIX, name);
+    if(!full_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, full_name);
+    if(!mapping) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory region %s, error=%d!", full_name, (int)GetLastError());
+        mem_free(full_name);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    mem_free(full_name);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return shm_region_map(region, mapping, FILE_MAP_READ);
+}
+
+
+
+int shm_region_map(shm_region_p *region, HANDLE mapping, DWORD access)
+{
+    MEMORY_BASIC_INFORMATION info;
+    void *data = NULL;
+
+    data = MapViewOfFile(mapping, access, 0, 0, 0);
+    if(!data) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory region, error=%d!", (int)GetLastError());
+        CloseHandle(mapping);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* the view is rounded up to whole pages. */
+    if(VirtualQuery(data, &info, sizeof(info)) == 0) {
+        pdebug(DEBUG_WARN, "Unable to get shared memory region size!");
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    *region = mem_alloc((int)sizeof(struct shm_region_t));
+    if(!*region) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory region struct!");
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*region)->mapping = mapping;
+    (*region)->data = data;
+    (*region)->size = (int)info.RegionSize;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void *shm_region_data(shm_region_p region)
+{
+    return (region ? region->data : NULL);
+}
+
+
+
+int shm_region_size(shm_region_p region)
+{
+    return (region ? region->size : 0);
+}
+
+
+
+int shm_region_close(shm_region_p *region)
+{
+    if(!region || !*region) {
+        pdebug(DEBUG_WARN, "Null region pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    UnmapViewOfFile((*region)->data);
+    CloseHandle((*region)->mapping);
+
+    mem_free(*region);
+    *region = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* a mapping has no name apart from its handles, it goes with the last one. */
+int shm_region_unlink(const char *name)
+{
+    (void)name;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+int process_get_id(void)
+{
+    return (int)GetCurrentProcessId();
+}
+
+
+
+/* a process we may not open still exists. */
+int process_is_alive(int pid)
+{
+    HANDLE process = NULL;
+    int alive = 0;
+
+    if(pid <= 0) {
+        return 0;
+    }
+
+    process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if(!process) {
+        return (GetLastError() == ERROR_ACCESS_DENIED);
+    }
+
+    alive = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+
+    CloseHandle(process);
+
+    return alive;
+}
+
+
 
 
 
@@ -1015,6 +1328,142 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a UDP socket bound to local_port, or to any free port if
+ * local_port is zero, and connect it to host:port.  After this
+ * socket_write() sends a datagram to host:port and socket_read()
+ * returns one datagram from it, or zero if none are waiting.
+ */
+
+extern int socket_connect_udp(sock_p s, const char *host, int port, int local_port)
+{
+    struct sockaddr_in local_addr;
+    struct sockaddr_in remote_addr;
+    int addr_len = sizeof(local_addr);
+    int sock_opt = 1;
+    u_long non_blocking=1;
+    SOCKET fd;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    memset(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons((u_short)port);
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &remote_addr.sin_addr) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res = NULL;
+        int rc = 0;
+
+        memset(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if((rc = getaddrinfo(host, NULL, &hints, &res)) != 0 || !res) {
+            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res) {
+                freeaddrinfo(res);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        remote_addr.sin_addr.s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+
+        freeaddrinfo(res);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_WARN, "Socket creation failed!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(char*)&sock_opt,sizeof(sock_opt))) {
+        closesocket(fd);
+        pdebug(DEBUG_WARN,"Error setting socket reuse option, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons((u_short)local_port);
+
+    if(bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr))) {
+        closesocket(fd);
+        pdebug(DEBUG_WARN, "Unable to bind UDP port %d!", local_port);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(connect(fd, (struct sockaddr *)&remote_addr, sizeof(remote_addr))) {
+        closesocket(fd);
+        pdebug(DEBUG_WARN, "Unable to connect UDP socket to %s:%d!", host, port);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* find out which port we got. */
+    if(getsockname(fd, (struct sockaddr *)&local_addr, &addr_len)) {
+        closesocket(fd);
+        pdebug(DEBUG_WARN, "Unable to get UDP socket address!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = ntohs(local_addr.sin_port);
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_connect_unix
+ *
+ * Local stream sockets are not supported on Windows.
+ */
+
+extern int socket_connect_unix(sock_p s, const char *path)
+{
+    (void)s;
+
+    pdebug(DEBUG_WARN, "Local socket %s is not supported on this platform!", path ? path : "(null)");
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+/*
+ * socket_local_port
+ *
+ * The local port of a UDP socket.
+ */
+
+extern int socket_local_port(sock_p s)
+{
+    if(!s || !s->is_open) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return s->port;
+}
+
+
+
 
 
 
@@ -1412,6 +1861,19 @@ int sleep_ms(int ms)
 }
 
 
+/*
+ * sleep_us
+ *
+ * Windows cannot sleep for less than a millisecond, so round up.
+ */
+
+int sleep_us(int us)
+{
+    Sleep((DWORD)((us + 999)/1000));
+    return 1;
+}
+
+
 
 /*
  * time_ms
@@ -1438,6 +1900,84 @@ int64_t time_ms(void)
 }
 
 
+/*
+ * time_us
+ *
+ * Return current system time in microsecond units.  Unlike time_ms()
+ * this is Unix epoch time, as on POSIX, because it reaches the API
+ * through PLCTAG_OP_TIME_ACQUIRED.
+ */
+
+/* 100ns increments from Jan 1, 1601 to Jan 1, 1970. */
+#define FILETIME_UNIX_EPOCH (116444736000000000LL)
+
+int64_t time_us(void)
+{
+    FILETIME ft;
+    int64_t res;
+
+    GetSystemTimeAsFileTime(&ft);
+
+    /* calculate time as 100ns increments since Jan 1, 1601. */
+    res = (int64_t)(ft.dwLowDateTime) + ((int64_t)(ft.dwHighDateTime) << 32);
+
+    /* get time in us since Jan 1, 1970 */
+
+    res = (res - FILETIME_UNIX_EPOCH) / 10;
+
+    return  res;
+}
+
+
+
+/*
+ * time_mono_us
+ *
+ * Return a monotonic time in microseconds.  This does not jump when
+ * the system clock is set.  The epoch is arbitrary so only use it for
+ * differences.
+ */
+
+int64_t time_mono_us(void)
+{
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER count;
+
+    if(freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+
+    QueryPerformanceCounter(&count);
+
+    /* split to avoid overflow of count * 1000000. */
+    return (int64_t)((count.QuadPart / freq.QuadPart) * 1000000) + (int64_t)(((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+}
+
+
+
+/*
+ * time_mono_ns
+ *
+ * The same clock as time_mono_us() in nanoseconds, for timing very
+ * short things.  The resolution is that of the performance counter.
+ */
+
+int64_t time_mono_ns(void)
+{
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER count;
+
+    if(freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+
+    QueryPerformanceCounter(&count);
+
+    /* split to avoid overflow of count * 1000000000. */
+    return (int64_t)((count.QuadPart / freq.QuadPart) * 1000000000) + (int64_t)(((count.QuadPart % freq.QuadPart) * 1000000000) / freq.QuadPart);
+}
+
+
 struct tm *localtime_r(const time_t *timep, struct tm *result)
 {
     time_t t = *timep;
@@ -185,8 +185,13 @@ extern int mutex_destroy(mutex_p *m);
 #define PLCTAG_CAT(a,b) PLCTAG_CAT2(a,b)
 #define LINE_ID(base) PLCTAG_CAT(base,__LINE__)
 
+#ifdef PLCTAG_LOCK_STATS
+#define critical_block(lock) \
+for(int64_t LINE_ID(__sync_flag_nargle_) = 1, LINE_ID(__sync_held_nargle_) = 0; LINE_ID(__sync_flag_nargle_); LINE_ID(__sync_flag_nargle_) = 0, lock_stats_mutex_unlock(lock, #lock, LINE_ID(__sync_held_nargle_)))  for(int LINE_ID(__sync_rc_nargle_) = lock_stats_mutex_lock(lock, #lock, &LINE_ID(__sync_held_nargle_)); LINE_ID(__sync_rc_nargle_) == PLCTAG_STATUS_OK && LINE_ID(__sync_flag_nargle_) ; LINE_ID(__sync_flag_nargle_) = 0)
+#else
 #define critical_block(lock) \
 for(int LINE_ID(__sync_flag_nargle_) = 1; LINE_ID(__sync_flag_nargle_); LINE_ID(__sync_flag_nargle_) = 0, mutex_unlock(lock))  for(int LINE_ID(__sync_rc_nargle_) = mutex_lock(lock); LINE_ID(__sync_rc_nargle_) == PLCTAG_STATUS_OK && LINE_ID(__sync_flag_nargle_) ; LINE_ID(__sync_flag_nargle_) = 0)
+#endif
 
 /* thread functions/defs */
 typedef struct thread_t *thread_p;
@@ -199,14 +204,23 @@ extern int thread_join(thread_p t);
 extern int thread_detach();
 extern int thread_destroy(thread_p *t);
 
+/* call func when the calling thread exits. */
+typedef void (*thread_exit_func_t)(void);
+extern int thread_at_exit(thread_exit_func_t func);
+
 #define THREAD_FUNC(func) DWORD __stdcall func(LPVOID arg)
 #define THREAD_RETURN(val) return (DWORD)val;
 
 #define THREAD_LOCAL __declspec(thread)
 
 /* atomic operations */
+#ifdef PLCTAG_LOCK_STATS
+#define spin_block(lock) \
+for(int64_t LINE_ID(__sync_flag_nargle_lock) = 1, LINE_ID(__sync_held_nargle_lock) = 0; LINE_ID(__sync_flag_nargle_lock); LINE_ID(__sync_flag_nargle_lock) = 0, lock_stats_release(lock, #lock, LINE_ID(__sync_held_nargle_lock)))  for(int LINE_ID(__sync_rc_nargle_lock) = lock_stats_acquire(lock, #lock, &LINE_ID(__sync_held_nargle_lock)); LINE_ID(__sync_rc_nargle_lock) && LINE_ID(__sync_flag_nargle_lock) ; LINE_ID(__sync_flag_nargle_lock) = 0)
+#else
 #define spin_block(lock) \
 for(int LINE_ID(__sync_flag_nargle_lock) = 1; LINE_ID(__sync_flag_nargle_lock); LINE_ID(__sync_flag_nargle_lock) = 0, lock_release(lock))  for(int LINE_ID(__sync_rc_nargle_lock) = lock_acquire(lock); LINE_ID(__sync_rc_nargle_lock) && LINE_ID(__sync_flag_nargle_lock) ; LINE_ID(__sync_flag_nargle_lock) = 0)
+#endif
 
 typedef volatile long int lock_t;
 
@@ -217,15 +231,46 @@ extern int lock_acquire_try(lock_t *lock);
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
 
+/* full memory barrier, for data shared without a lock. */
+extern void mem_barrier(void);
+
+/* compare and swap, full barrier.  Returns non-zero if *val was set. */
+extern int atomic_cas_int(volatile int *val, int expected, int new_val);
+
+/* lock contention counters, see util/lock_stats.c. */
+#ifdef PLCTAG_LOCK_STATS
+extern int lock_stats_mutex_lock(mutex_p m, const char *name, int64_t *held_start);
+extern int lock_stats_mutex_unlock(mutex_p m, const char *name, int64_t held_start);
+extern int lock_stats_acquire(lock_t *lock, const char *name, int64_t *held_start);
+extern void lock_stats_release(lock_t *lock, const char *name, int64_t held_start);
+extern void lock_stats_report(void);
+#endif
+
 /* socket functions */
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
 extern int socket_connect_tcp(sock_p s, const char *host, int port);
+extern int socket_connect_udp(sock_p s, const char *host, int port, int local_port);
+extern int socket_connect_unix(sock_p s, const char *path);
+extern int socket_local_port(sock_p s);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/* named shared memory, visible to other processes on this host. */
+typedef struct shm_region_t *shm_region_p;
+extern int shm_region_create(shm_region_p *region, const char *name, int size, int *created);
+extern int shm_region_open(shm_region_p *region, const char *name);
+extern void *shm_region_data(shm_region_p region);
+extern int shm_region_size(shm_region_p region);
+extern int shm_region_close(shm_region_p *region);
+extern int shm_region_unlink(const char *name);
+
+/* processes on this host. */
+extern int process_get_id(void);
+extern int process_is_alive(int pid);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -237,7 +282,11 @@ extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, i
 
 /* time functions */
 extern int sleep_ms(int ms);
+extern int sleep_us(int us);
 extern int64_t time_ms(void);
+extern int64_t time_us(void);
+extern int64_t time_mono_us(void);
+extern int64_t time_mono_ns(void);
 extern struct tm *localtime_r(const time_t *timep, struct tm *result);
 
 /* some functions can be simply replaced */
@@ -34,12 +34,14 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/eip_cip.h>
+#include <ab/eip_class1.h>
 #include <ab/eip_lgx_pccc.h>
 #include <ab/eip_plc5_pccc.h>
 #include <ab/eip_slc_pccc.h>
 #include <ab/eip_dhp_pccc.h>
 #include <ab/session.h>
 #include <ab/tag.h>
+#include <ab/udt.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
@@ -87,7 +89,7 @@ static int default_write(plc_tag_p tag);
 
 
 /* vtables for different kinds of tags */
-struct tag_vtable_t default_vtable = { default_abort, default_read, default_status, default_tickler, default_write };
+struct tag_vtable_t default_vtable = { default_abort, default_read, default_status, default_tickler, default_write, NULL, NULL };
 
 
 /*
@@ -185,7 +187,8 @@ plc_tag_p ab_tag_create(attr attribs)
     case AB_PROTOCOL_PLC:
         if(!path) {
             pdebug(DEBUG_DETAIL, "Setting up PLC/5 tag.");
-            tag->use_connected_msg = 0;
+            /* PCCC Execute can optionally go over a Forward Open connection. */
+            tag->use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
             tag->vtable = &plc5_vtable;
         } else {
             pdebug(DEBUG_DETAIL, "Setting up PLC/5 via DH+ bridge tag.");
@@ -199,7 +202,7 @@ plc_tag_p ab_tag_create(attr attribs)
     case AB_PROTOCOL_SLC:
     case AB_PROTOCOL_MLGX:
         pdebug(DEBUG_DETAIL, "Setting up SLC, MicroLogix tag.");
-        tag->use_connected_msg = 0;
+        tag->use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
         tag->allow_packing = 0;
         tag->vtable = &slc_vtable;
         break;
@@ -233,6 +236,26 @@ plc_tag_p ab_tag_create(attr attribs)
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         tag->vtable = &eip_cip_vtable;
 
+        /* produced tags can be consumed over a Class 1 connection instead of polled. */
+        if(attr_get_int(attribs, "consume", 0)) {
+            pdebug(DEBUG_DETAIL, "Setting up consumed Logix tag.");
+            tag->allow_packing = 0;
+            tag->vtable = &eip_class1_vtable;
+        }
+
+        /* the template ID of the tag's UDT type, if the caller knows it. */
+        if(!tag->udt_tag) {
+            int udt_id = attr_get_int(attribs, "udt_id", 0);
+
+            if(udt_id < 0 || udt_id > UDT_TYPE_ID_MASK) {
+                pdebug(DEBUG_WARN, "UDT template ID %d is out of range!", udt_id);
+                tag->status = PLCTAG_ERR_BAD_PARAM;
+                return (plc_tag_p)tag;
+            }
+
+            tag->udt_id = (uint16_t)udt_id;
+        }
+
         break;
 
     case AB_PROTOCOL_MLGX800:
@@ -249,6 +272,21 @@ plc_tag_p ab_tag_create(attr attribs)
         break;
     }
 
+    /*
+     * a local proxy holds the connection to the PLC and takes unconnected
+     * messages from us.   DH+ and Class 1 need their own connection.
+     */
+    if(str_length(attr_get_str(attribs, "proxy", "")) > 0) {
+        if(tag->vtable == &eip_dhp_pccc_vtable || tag->vtable == &eip_class1_vtable) {
+            pdebug(DEBUG_WARN, "DH+ and consumed tags cannot be used through a proxy!");
+            tag->status = PLCTAG_ERR_UNSUPPORTED;
+            return (plc_tag_p)tag;
+        }
+
+        pdebug(DEBUG_DETAIL, "Using unconnected messages through proxy.");
+        tag->use_connected_msg = 0;
+    }
+
     /* determine the total tag size if this is not a tag list. */
     if(!tag->tag_list) {
         if(!tag->elem_size) {
@@ -294,16 +332,36 @@ plc_tag_p ab_tag_create(attr attribs)
 
     pdebug(DEBUG_DETAIL, "using session=%p", tag->session);
 
+    /*
+     * A shared session keeps the transport of the tag that created it.
+     * PCCC tags can use either one, so follow the session.
+     */
+    if(tag->vtable == &plc5_vtable || tag->vtable == &slc_vtable) {
+        if(tag->use_connected_msg && !tag->session->use_connected_msg) {
+            pdebug(DEBUG_WARN, "Session is not connected, using unconnected messages.");
+            tag->use_connected_msg = 0;
+        }
+    }
+
     /*
      * check the tag name, this is protocol specific.
      */
 
-    if(!tag->tag_list && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
+    if(!tag->tag_list && !tag->udt_tag && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO,"Bad tag name!");
         tag->status = PLCTAG_ERR_BAD_PARAM;
         return (plc_tag_p)tag;
     }
 
+    if(tag->vtable == &eip_class1_vtable) {
+        rc = class1_tag_init(tag, attribs);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set up consumed tag!");
+            tag->status = rc;
+            return (plc_tag_p)tag;
+        }
+    }
+
     /* trigger the first read. */
     tag->first_read = 1;
 
@@ -458,11 +516,21 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
             if(tag->protocol_type == AB_PROTOCOL_LGX) {
                 const char *tag_name = attr_get_str(attribs, "name", NULL);
                 int tag_listing_rc = setup_tag_listing(tag, tag_name);
+                int udt_rc = PLCTAG_ERR_NOT_FOUND;
 
                 if(tag_listing_rc == PLCTAG_ERR_BAD_PARAM) {
                     pdebug(DEBUG_WARN, "Tag listing request is malformed!");
                     return PLCTAG_ERR_BAD_PARAM;
                 }
+
+                if(tag_listing_rc == PLCTAG_ERR_NOT_FOUND) {
+                    udt_rc = setup_udt_tag(tag, tag_name);
+
+                    if(udt_rc == PLCTAG_ERR_BAD_PARAM) {
+                        pdebug(DEBUG_WARN, "UDT template request is malformed!");
+                        return PLCTAG_ERR_BAD_PARAM;
+                    }
+                }
             }
         }
 
@@ -556,8 +624,26 @@ int ab_tag_abort(ab_tag_p tag)
 
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
+    tag->write_bits = 0;
     tag->offset = 0;
 
+    /* drop any partially fetched UDT template, another tag can fetch it. */
+    if(tag->udt_fetch_id) {
+        udt_fetch_release(tag->session, tag->udt_fetch_id, tag->tag_id);
+    }
+
+    tag->udt_fetch_id = 0;
+    tag->udt_get_fields = 0;
+    tag->udt_fetch_wait = 0;
+
+    if(tag->udt_raw) {
+        mem_free(tag->udt_raw);
+        tag->udt_raw = NULL;
+    }
+
+    tag->udt_raw_size = 0;
+    tag->udt_raw_offset = 0;
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -595,6 +681,32 @@ int ab_tag_status(ab_tag_p tag)
 
 
 
+/*
+ * ab_tag_save_req_times
+ *
+ * Copy the stage times of a finished request into the tag.  A read or
+ * write can take several requests, so the queue time is from the first
+ * and the rest are from the last.  Called with the request lock held.
+ */
+void ab_tag_save_req_times(ab_tag_p tag, ab_request_p req)
+{
+    if(!tag->op_times.in_flight) {
+        return;
+    }
+
+    if(!tag->op_times.queued_us) {
+        tag->op_times.queued_us = req->time_queued_us;
+    }
+
+    tag->op_times.packed_us = req->time_packed_us;
+    tag->op_times.sent_us = req->time_sent_us;
+    tag->op_times.received_us = req->time_received_us;
+    tag->op_times.unpacked_us = req->time_unpacked_us;
+    tag->op_times.acquired_us = req->time_acquired_us;
+}
+
+
+
 
 
 
@@ -621,6 +733,15 @@ void ab_tag_destroy(ab_tag_p tag)
 
     session = tag->session;
 
+    /* this needs the session to close the connection. */
+    class1_tag_destroy(tag);
+
+    /* let another tag fetch the template this one was reading. */
+    if(session && tag->udt_fetch_id) {
+        udt_fetch_release(session, tag->udt_fetch_id, tag->tag_id);
+        tag->udt_fetch_id = 0;
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
@@ -646,6 +767,11 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->data = NULL;
     }
 
+    if(tag->udt_raw) {
+        mem_free(tag->udt_raw);
+        tag->udt_raw = NULL;
+    }
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -719,6 +845,8 @@ int check_tag_name(ab_tag_p tag, const char* name)
             return rc;
         }
 
+        pccc_parse_logical_address(name, &(tag->file_type), &(tag->file_num), &(tag->elem_num), &(tag->subelem_num));
+
         break;
 
     case AB_PROTOCOL_SLC:
@@ -729,6 +857,9 @@ int check_tag_name(ab_tag_p tag, const char* name)
             return rc;
         }
 
+        /* keep the address parts around to walk large data files. */
+        pccc_parse_logical_address(name, &(tag->file_type), &(tag->file_num), &(tag->elem_num), &(tag->subelem_num));
+
         break;
 
     case AB_PROTOCOL_MLGX800:
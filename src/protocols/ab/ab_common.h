@@ -47,6 +47,7 @@ typedef struct ab_request_t *ab_request_p;
 
 extern int ab_tag_abort(ab_tag_p tag);
 extern int ab_tag_status(ab_tag_p tag);
+extern void ab_tag_save_req_times(ab_tag_p tag, ab_request_p req);
 //int ab_tag_destroy(ab_tag_p p_tag);
 extern plc_type_t get_plc_type(attr attribs);
 extern int check_cpu(ab_tag_p tag, attr attribs);
@@ -490,3 +490,86 @@ int cip_encode_tag_name(ab_tag_p tag,const char *name)
 
     return 1;
 }
+
+
+
+/*
+ * cip_get_element_index()
+ *
+ * Check whether the encoded name ends in a single array element
+ * segment directly after a symbolic segment, like foo[14] or
+ * foo.bar[3].  If it does, return the number of bytes of the name
+ * before the element segment (not counting the word count byte) and
+ * the element index.  Names with multiple dimensions or nothing to
+ * index return PLCTAG_ERR_NOT_FOUND.
+ */
+
+int cip_get_element_index(const uint8_t *encoded_name, int encoded_name_size, int *base_size, uint32_t *index)
+{
+    const uint8_t *p = encoded_name + 1;
+    const uint8_t *end = encoded_name + encoded_name_size;
+    const uint8_t *last_seg = NULL;
+    int last_was_symbolic = 0;
+    int elem_after_symbolic = 0;
+    uint32_t val = 0;
+
+    while(p < end) {
+        switch(*p) {
+        case 0x91:
+            if(p + 1 >= end) {
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            p += 2 + p[1] + (p[1] & 0x01);
+
+            last_was_symbolic = 1;
+            elem_after_symbolic = 0;
+
+            break;
+
+        case 0x28:
+        case 0x29:
+        case 0x2A:
+            elem_after_symbolic = last_was_symbolic;
+            last_was_symbolic = 0;
+            last_seg = p;
+
+            if(*p == 0x28) {
+                if(p + 2 > end) {
+                    return PLCTAG_ERR_BAD_DATA;
+                }
+
+                val = p[1];
+                p += 2;
+            } else if(*p == 0x29) {
+                if(p + 4 > end) {
+                    return PLCTAG_ERR_BAD_DATA;
+                }
+
+                val = (uint32_t)p[2] | ((uint32_t)p[3] << 8);
+                p += 4;
+            } else {
+                if(p + 6 > end) {
+                    return PLCTAG_ERR_BAD_DATA;
+                }
+
+                val = (uint32_t)p[2] | ((uint32_t)p[3] << 8) | ((uint32_t)p[4] << 16) | ((uint32_t)p[5] << 24);
+                p += 6;
+            }
+
+            break;
+
+        default:
+            return PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    if(p != end || !last_seg || !elem_after_symbolic) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    *base_size = (int)(last_seg - (encoded_name + 1));
+    *index = val;
+
+    return PLCTAG_STATUS_OK;
+}
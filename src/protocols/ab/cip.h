@@ -37,6 +37,7 @@ extern int cip_encode_path(const char *path, int needs_connection, plc_type_t pl
 
 //~ char *cip_decode_status(int status);
 extern int cip_encode_tag_name(ab_tag_p tag,const char *name);
+extern int cip_get_element_index(const uint8_t *encoded_name, int encoded_name_size, int *base_size, uint32_t *index);
 
 
 
@@ -46,6 +46,11 @@
 #define AB_EIP_OK   (0)
 #define AB_EIP_VERSION ((uint16_t)0x0001)
 
+/* encapsulation status codes */
+#define AB_EIP_ERR_INVALID_COMMAND  ((uint32_t)0x0001)
+#define AB_EIP_ERR_INVALID_SESSION  ((uint32_t)0x0064)
+#define AB_EIP_ERR_INVALID_LENGTH   ((uint32_t)0x0065)
+
 /* in milliseconds */
 #define AB_EIP_DEFAULT_TIMEOUT 2000 /* in ms */
 
@@ -66,12 +71,15 @@
 #define AB_EIP_CMD_FORWARD_OPEN_EX      ((uint8_t)0x5B)
 
 /* CIP embedded packet commands */
+#define AB_EIP_CMD_CIP_GET_ATTR_LIST    ((uint8_t)0x03)
 #define AB_EIP_CMD_CIP_MULTI            ((uint8_t)0x0A)
 #define AB_EIP_CMD_CIP_READ             ((uint8_t)0x4C)
 #define AB_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
 #define AB_EIP_CMD_CIP_READ_FRAG        ((uint8_t)0x52)
 #define AB_EIP_CMD_CIP_WRITE_FRAG       ((uint8_t)0x53)
 #define AB_EIP_CMD_CIP_LIST_TAGS        ((uint8_t)0x55)
+#define AB_EIP_CMD_CIP_RMW              ((uint8_t)0x4E) /* Read Modify Write, same code as Forward Close but on the tag */
+#define AB_EIP_CMD_CIP_READ_TEMPLATE    ((uint8_t)0x4C) /* same code as READ, but on the Template object */
 
 /* flag set when command is OK */
 #define AB_EIP_CMD_CIP_OK               ((uint8_t)0x80)
@@ -79,7 +87,9 @@
 #define AB_CIP_STATUS_OK                ((uint8_t)0x00)
 #define AB_CIP_STATUS_FRAG              ((uint8_t)0x06)
 
+#define AB_CIP_ERR_CONNECTION_FAILURE   ((uint8_t)0x01)
 #define AB_CIP_ERR_UNSUPPORTED_SERVICE  ((uint8_t)0x08)
+#define AB_CIP_ERR_TOO_MUCH_DATA        ((uint8_t)0x15)
 #define AB_CIP_ERR_PARTIAL_ERROR  ((uint8_t)0x1e)
 
 /* PCCC commands */
@@ -168,6 +178,13 @@
 
 /* transport class */
 #define AB_EIP_TRANSPORT_CLASS_T3   ((uint8_t)0xA3)
+#define AB_EIP_TRANSPORT_CLASS_T1   ((uint8_t)0x01) /* client, cyclic trigger, class 1 */
+
+/* Class 1 (implicit I/O) connections */
+#define AB_EIP_UDP_IO_PORT 2222
+#define AB_EIP_CLASS1_CONN_PARAM ((uint16_t)0x4800) /* point to point, scheduled priority, fixed size */
+#define AB_EIP_CLASS1_TIMEOUT_MULTIPLIER 0x02       /* timeout = 16 * RPI */
+#define AB_EIP_CLASS1_TIMEOUT_FACTOR (16)
 
 
 #define AB_EIP_SECS_PER_TICK 0x0A
@@ -185,6 +202,8 @@
 #define AB_EIP_ITEM_CAI ((uint16_t)0x00A1) /* connected address item */
 #define AB_EIP_ITEM_CDI ((uint16_t)0x00B1) /* connected data item */
 #define AB_EIP_ITEM_UDI ((uint16_t)0x00B2) /* Unconnected data item */
+#define AB_EIP_ITEM_SOCKADDR_T2O ((uint16_t)0x8001) /* T->O socket address info item */
+#define AB_EIP_ITEM_SEQ_ADDR ((uint16_t)0x8002) /* sequenced address item */
 
 
 /* Types of AB protocols */
@@ -960,6 +979,27 @@ START_PACK typedef struct {
 
 
 
+/* PCCC Execute reply, found after either connected or unconnected EIP framing. */
+START_PACK typedef struct {
+    /* PCCC Reply */
+    uint8_t reply_code;             /* 0xCB Execute PCCC Reply */
+    uint8_t reserved;               /* 0x00 in reply */
+    uint8_t general_status;         /* 0x00 for success */
+    uint8_t status_size;            /* number of 16-bit words of extra status, 0 if success */
+
+    /* PCCC Command Req Routing */
+    uint8_t request_id_size;        /* ALWAYS 7 */
+    uint16_le vendor_id;             /* Our CIP Vendor ID */
+    uint32_le vendor_serial_number;  /* Our CIP Vendor Serial Number */
+
+    /* PCCC Command */
+    uint8_t pccc_command;           /* CMD read, write etc. */
+    uint8_t pccc_status;            /* STS 0x00 in request */
+    uint16_le pccc_seq_num;          /* TNSW transaction/connection sequence number */
+} END_PACK pccc_reply;
+
+
+
 
 
 START_PACK typedef struct {
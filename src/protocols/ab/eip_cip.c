@@ -44,6 +44,7 @@
 #include <ab/session.h>
 #include <ab/eip_cip.h>
 #include <ab/error_codes.h>
+#include <ab/udt.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
@@ -132,19 +133,27 @@ START_PACK typedef struct {
 
 static int build_read_request_connected(ab_tag_p tag, int byte_offset);
 static int build_tag_list_request_connected(ab_tag_p tag);
+static int build_udt_request_connected(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int check_read_status_connected(ab_tag_p tag);
 static int check_read_tag_list_status_connected(ab_tag_p tag);
+static int check_read_udt_status_connected(ab_tag_p tag);
+static int process_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end);
+static int finish_udt_tag_read(ab_tag_p tag);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
+static int build_write_bits_request(ab_tag_p tag);
+static int check_write_bits_status(ab_tag_p tag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
 
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
 static int tag_write_start(ab_tag_p tag);
+static int tag_member_info(ab_tag_p tag, const char *member_path, int *offset, int *kind, int *bit_num);
+static int tag_write_bits_start(ab_tag_p tag, uint64_t set_mask, uint64_t clear_mask);
 
 /* define the exported vtable for this tag type. */
 struct tag_vtable_t eip_cip_vtable = {
@@ -152,7 +161,9 @@ struct tag_vtable_t eip_cip_vtable = {
     (tag_vtable_func)tag_read_start,
     (tag_vtable_func)ab_tag_status, /* shared */
     (tag_vtable_func)tag_tickler,
-    (tag_vtable_func)tag_write_start
+    (tag_vtable_func)tag_write_start,
+    (tag_member_info_func)tag_member_info,
+    (tag_write_bits_func)tag_write_bits_start
 };
 
 
@@ -170,9 +181,23 @@ int tag_tickler(ab_tag_p tag)
     pdebug(DEBUG_SPEW,"Starting.");
 
     if (tag->read_in_progress) {
+        /* start over once the other tag is done with the template. */
+        if(tag->udt_fetch_wait) {
+            tag->udt_fetch_wait = 0;
+            tag->read_in_progress = 0;
+
+            rc = tag_read_start(tag);
+
+            tag->status = rc;
+
+            return rc;
+        }
+
         if(tag->use_connected_msg) {
             if(tag->tag_list) {
                 rc = check_read_tag_list_status_connected(tag);
+            } else if(tag->udt_fetch_id) {
+                rc = check_read_udt_status_connected(tag);
             } else {
                 rc = check_read_status_connected(tag);
             }
@@ -188,7 +213,9 @@ int tag_tickler(ab_tag_p tag)
     }
 
     if (tag->write_in_progress) {
-        if(tag->use_connected_msg) {
+        if(tag->write_bits) {
+            rc = check_write_bits_status(tag);
+        } else if(tag->use_connected_msg) {
             rc = check_write_status_connected(tag);
         } else {
             rc = check_write_status_unconnected(tag);
@@ -230,6 +257,42 @@ int tag_read_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    /*
+     * if the tag is a UDT, make sure we have the template and all the
+     * templates it uses before we get the data.  The templates are shared
+     * across the session so this only goes to the PLC once per type.  If
+     * another tag is already reading a template, wait for it.
+     */
+    if(tag->udt_id && !tag->udt_fetch_id && (tag->first_read || tag->udt_tag)) {
+        uint16_t missing_id = udt_cache_find_missing(tag->session, tag->udt_id);
+
+        if(missing_id) {
+            if(!tag->use_connected_msg) {
+                pdebug(DEBUG_WARN, "Reading UDT templates requires a connection!");
+                return PLCTAG_ERR_UNSUPPORTED;
+            }
+
+            rc = udt_fetch_claim(tag->session, missing_id, tag->tag_id);
+            if(rc == PLCTAG_STATUS_PENDING) {
+                tag->read_in_progress = 1;
+                tag->udt_fetch_wait = 1;
+                return rc;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                return rc;
+            }
+
+            pdebug(DEBUG_DETAIL, "Fetching UDT template %d.", (int)missing_id);
+
+            tag->udt_fetch_id = missing_id;
+            tag->udt_get_fields = 1;
+        }
+    }
+
+    /* template tags are done once the templates are here. */
+    if(tag->udt_tag && !tag->udt_fetch_id) {
+        return finish_udt_tag_read(tag);
+    }
+
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
@@ -237,6 +300,8 @@ int tag_read_start(ab_tag_p tag)
     if(tag->use_connected_msg) {
         if(tag->tag_list) {
             rc = build_tag_list_request_connected(tag);
+        } else if(tag->udt_fetch_id) {
+            rc = build_udt_request_connected(tag);
         } else {
             rc = build_read_request_connected(tag, tag->offset);
         }
@@ -249,6 +314,11 @@ int tag_read_start(ab_tag_p tag)
 
         tag->read_in_progress = 0;
 
+        if(tag->udt_fetch_id) {
+            udt_fetch_release(tag->session, tag->udt_fetch_id, tag->tag_id);
+            tag->udt_fetch_id = 0;
+        }
+
         return rc;
     }
 
@@ -284,6 +354,12 @@ int tag_write_start(ab_tag_p tag)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
+    if(tag->udt_tag) {
+        pdebug(DEBUG_WARN, "A UDT template cannot be written!");
+
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     if(tag->read_in_progress || tag->write_in_progress) {
         pdebug(DEBUG_WARN, "Read or write operation already in flight!");
         return PLCTAG_ERR_BUSY;
@@ -336,6 +412,88 @@ int tag_write_start(ab_tag_p tag)
 }
 
 
+
+/*
+ * tag_member_info
+ *
+ * Called with the tag's API mutex held.  Resolve a member path against
+ * the tag's UDT template.
+ */
+
+int tag_member_info(ab_tag_p tag, const char *member_path, int *offset, int *kind, int *bit_num)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!tag->udt_id) {
+        pdebug(DEBUG_WARN, "Tag does not have a UDT template ID!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rc = udt_lookup_member(tag->session, tag->udt_id, member_path, offset, kind, bit_num);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * tag_write_bits_start
+ *
+ * Called with the tag's API mutex held.  Start a CIP Read Modify Write
+ * of the first element of the tag.  Bits in set_mask are set and bits
+ * in clear_mask are cleared by the PLC in one step, no read is needed
+ * first and other bits are not touched even if the PLC logic changes
+ * them at the same time.
+ */
+
+int tag_write_bits_start(ab_tag_p tag, uint64_t set_mask, uint64_t clear_mask)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag->tag_list || tag->udt_tag) {
+        pdebug(DEBUG_WARN, "Bits cannot be written on this kind of tag!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* the PLC only does this on integer types. */
+    if((tag->elem_size != 1 && tag->elem_size != 2 && tag->elem_size != 4 && tag->elem_size != 8)
+       || tag->elem_type == AB_TYPE_FLOAT32 || tag->elem_type == AB_TYPE_FLOAT64) {
+        pdebug(DEBUG_WARN, "Bit writes need an integer element type, element size is %d!", tag->elem_size);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->read_in_progress || tag->write_in_progress) {
+        pdebug(DEBUG_WARN, "Read or write operation already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->write_in_progress = 1;
+    tag->write_bits = 1;
+    tag->write_bits_set = set_mask;
+    tag->write_bits_clear = clear_mask;
+
+    rc = build_write_bits_request(tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build bit write request!");
+
+        tag->write_in_progress = 0;
+        tag->write_bits = 0;
+
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
 int build_read_request_connected(ab_tag_p tag, int byte_offset)
 {
     eip_cip_co_req* cip = NULL;
@@ -408,6 +566,23 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 
     req->allow_packing = tag->allow_packing;
 
+    /*
+     * whole reads of array elements can be merged by the session with
+     * other reads of the same array.
+     */
+    if(byte_offset == 0 && !tag->tag_list && !tag->udt_fetch_id && tag->elem_size > 0) {
+        int base_size = 0;
+        uint32_t index = 0;
+
+        if(cip_get_element_index(tag->encoded_name, tag->encoded_name_size, &base_size, &index) == PLCTAG_STATUS_OK) {
+            req->coalesce = AB_COALESCE_CIP;
+            req->coalesce_name_size = base_size;
+            req->coalesce_index = index;
+            req->coalesce_count = tag->elem_count;
+            req->coalesce_elem_size = tag->elem_size;
+        }
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -562,6 +737,143 @@ int build_tag_list_request_connected(ab_tag_p tag)
 
 
 
+/*
+ * build_udt_request_connected
+ *
+ * Templates are read in two steps.  First we get the template attributes
+ * to find out how big the template is.  Then we read the template data
+ * itself, possibly in several chunks.
+ *
+ * Get Attribute List:
+ *    uint8_t   0x03    Get Attribute List service
+ *    uint8_t   0x03    path size in words
+ *    uint8_t   0x20    class
+ *    uint8_t   0x6C    Template object class
+ *    uint8_t   0x25    16-bit instance
+ *    uint8_t   0x00    padding
+ *    uint16_t  id      template instance ID
+ *    uint16_t  0x04    number of attributes
+ *    uint16_t  0x04    attribute #4 - template definition size in 32-bit words
+ *    uint16_t  0x05    attribute #5 - structure size in bytes
+ *    uint16_t  0x02    attribute #2 - member count
+ *    uint16_t  0x01    attribute #1 - structure handle
+ *
+ * Read Template:
+ *    uint8_t   0x4C    Read Template service
+ *    uint8_t   0x03    path size in words
+ *    (same path as above)
+ *    uint32_t  offset  byte offset into the template data
+ *    uint16_t  size    number of bytes to read
+ */
+
+int build_udt_request_connected(ab_tag_p tag)
+{
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data_start = NULL;
+    uint8_t *data = NULL;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    /* point the request struct at the buffer */
+    cip = (eip_cip_co_req*)(req->data);
+
+    /* point to the end of the struct */
+    data_start = data = (uint8_t*)(cip + 1);
+
+    if(tag->udt_get_fields) {
+        *data = AB_EIP_CMD_CIP_GET_ATTR_LIST;
+    } else {
+        *data = AB_EIP_CMD_CIP_READ_TEMPLATE;
+    }
+    data++;
+
+    /* request path size, in 16-bit words */
+    *data = (uint8_t)3;
+    data++;
+
+    data[0] = 0x20; /* class type */
+    data[1] = 0x6C; /* Template object class */
+    data[2] = 0x25; /* 16-bit instance ID type */
+    data[3] = 0x00; /* padding */
+    data += 4;
+
+    /* now the instance ID */
+    tmp_u16 = h2le16(tag->udt_fetch_id);
+    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+    data += (int)sizeof(tmp_u16);
+
+    if(tag->udt_get_fields) {
+        uint16_t attribs[] = { 0x04, 0x05, 0x02, 0x01 }; /* MAGIC, see above. */
+
+        tmp_u16 = h2le16((uint16_t)(sizeof(attribs)/sizeof(attribs[0])));
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+
+        for(size_t i=0; i < sizeof(attribs)/sizeof(attribs[0]); i++) {
+            tmp_u16 = h2le16(attribs[i]);
+            mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+            data += (int)sizeof(tmp_u16);
+        }
+    } else {
+        tmp_u32 = h2le32((uint32_t)tag->udt_raw_offset);
+        mem_copy(data, &tmp_u32, (int)sizeof(tmp_u32));
+        data += (int)sizeof(tmp_u32);
+
+        tmp_u16 = h2le16((uint16_t)(tag->udt_raw_size - tag->udt_raw_offset));
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+    }
+
+    /* now we go back and fill in the fields of the static part */
+
+    /* encap fields */
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND); /* ALWAYS 0x0070 Connected Send*/
+
+    /* router timeout */
+    cip->router_timeout = h2le16(1); /* one second timeout, enough? */
+
+    /* Common Packet Format fields for unconnected send. */
+    cip->cpf_item_count = h2le16(2);                 /* ALWAYS 2 */
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);/* ALWAYS 0x00A1 connected address item */
+    cip->cpf_cai_item_length = h2le16(4);            /* ALWAYS 4, size of connection ID*/
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);/* ALWAYS 0x00B1 - connected Data Item */
+    cip->cpf_cdi_item_length = h2le16((uint16_t)((int)(data - data_start) + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    /* set the size of the request */
+    req->request_size = (int)((int)sizeof(*cip) + (int)(data - data_start));
+
+    req->allow_packing = tag->allow_packing;
+
+    /* add the request to the session's list. */
+    rc = session_add_request(tag->session, req);
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        tag->req = rc_dec(req);
+        return rc;
+    }
+
+    /* save the request for later */
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 {
     eip_cip_uc_req* cip;
@@ -1009,6 +1321,137 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
  * locked!
  */
 
+/*
+ * build_write_bits_request
+ *
+ * The Read Modify Write request is:
+ *
+ * uint8_t cmd
+ * LLA formatted name
+ * uint16_t size of each mask in bytes
+ * OR mask, bits to set
+ * AND mask, bits to keep
+ *
+ * It goes out the same way as the tag's other requests, connected or not.
+ */
+
+int build_write_bits_request(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
+    uint8_t *data = NULL;
+    uint8_t *embed_start = NULL;
+    int mask_size = tag->elem_size;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    if(tag->use_connected_msg) {
+        data = req->data + sizeof(eip_cip_co_req);
+    } else {
+        data = req->data + sizeof(eip_cip_uc_req);
+    }
+
+    embed_start = data;
+
+    *data = AB_EIP_CMD_CIP_RMW;
+    data++;
+
+    /* copy the tag name into the request */
+    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
+    data += tag->encoded_name_size;
+
+    *((uint16_le*)data) = h2le16((uint16_t)mask_size);
+    data += sizeof(uint16_le);
+
+    /* the masks are little endian like the data. */
+    for(int i=0; i < mask_size; i++) {
+        *data = (uint8_t)(tag->write_bits_set >> (8 * i));
+        data++;
+    }
+
+    for(int i=0; i < mask_size; i++) {
+        *data = (uint8_t)(~(tag->write_bits_clear >> (8 * i)));
+        data++;
+    }
+
+    if(tag->use_connected_msg) {
+        eip_cip_co_req *cip = (eip_cip_co_req *)(req->data);
+
+        cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        cip->router_timeout = h2le16(1);
+        cip->cpf_item_count = h2le16(2);
+        cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+        cip->cpf_cai_item_length = h2le16(4);
+        cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+        cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t*)(&cip->cpf_conn_seq_num)));
+    } else {
+        eip_cip_uc_req *cip = (eip_cip_uc_req *)(req->data);
+
+        cip->uc_cmd_length = h2le16((uint16_t)(data - embed_start));
+
+        /* the route must start on a word boundary. */
+        if((data - embed_start) & 0x01) {
+            *data = 0;
+            data++;
+        }
+
+        if(tag->session->conn_path_size > 0) {
+            *data = (tag->session->conn_path_size) / 2; /* in 16-bit words */
+            data++;
+            *data = 0; /* reserved/pad */
+            data++;
+            mem_copy(data, tag->session->conn_path, tag->session->conn_path_size);
+            data += tag->session->conn_path_size;
+        }
+
+        cip->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+        cip->router_timeout = h2le16(1);
+        cip->cpf_item_count = h2le16(2);
+        cip->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+        cip->cpf_nai_item_length = h2le16(0);
+        cip->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+        cip->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t*)(&cip->cm_service_code)));
+
+        cip->cm_service_code = AB_EIP_CMD_UNCONNECTED_SEND;
+        cip->cm_req_path_size = 2;
+        cip->cm_req_path[0] = 0x20;
+        cip->cm_req_path[1] = 0x06;
+        cip->cm_req_path[2] = 0x24;
+        cip->cm_req_path[3] = 0x01;
+        cip->secs_per_tick = AB_EIP_SECS_PER_TICK;
+        cip->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    }
+
+    /* set the size of the request */
+    req->request_size = (int)(data - (req->data));
+
+    /* a bit write is small and can go out with other requests. */
+    req->allow_packing = tag->allow_packing;
+
+    rc = session_add_request(tag->session, req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 static int check_read_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1040,6 +1483,8 @@ static int check_read_status_connected(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1288,6 +1733,8 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1456,8 +1903,364 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
 
 
-static int check_read_status_unconnected(ab_tag_p tag)
-{
+/*
+ * check_read_udt_status_connected
+ *
+ * This routine checks the outstanding template requests.  Once the attributes
+ * are in, it starts reading the template data.  Once the data is in, the
+ * template is decoded and put in the session's cache and we go back to
+ * tag_read_start() to fetch the next missing template or the tag data.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_read_udt_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    uint8_t expected_service;
+    int partial_data = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if (!tag->req) {
+        ab_tag_abort(tag);
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        ab_tag_save_req_times(tag, tag->req);
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            ab_tag_abort(tag);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    /* point to the data */
+    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+
+    /* point to the start of the data */
+    data = (tag->req->data) + sizeof(eip_cip_co_resp);
+
+    /* point the end of the data */
+    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    expected_service = (tag->udt_get_fields ? AB_EIP_CMD_CIP_GET_ATTR_LIST : AB_EIP_CMD_CIP_READ_TEMPLATE);
+
+    /* check the status */
+    do {
+        ptrdiff_t payload_size = (data_end - data);
+
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != (expected_service | AB_EIP_CMD_CIP_OK) ) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+
+        if(tag->udt_get_fields) {
+            rc = process_udt_attributes(tag, data, data_end);
+            break;
+        }
+
+        /* check to see if this is a partial response. */
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        if(payload_size > 0) {
+            /* the PLC may round up, make room if needed. */
+            if(payload_size + tag->udt_raw_offset > tag->udt_raw_size) {
+                tag->udt_raw_size = (int)payload_size + tag->udt_raw_offset;
+
+                pdebug(DEBUG_DETAIL, "Increasing template buffer size to %d bytes.", tag->udt_raw_size);
+
+                tag->udt_raw = (uint8_t*)mem_realloc(tag->udt_raw, tag->udt_raw_size);
+                if(!tag->udt_raw) {
+                    pdebug(DEBUG_WARN, "Unable to reallocate template memory!");
+                    rc = PLCTAG_ERR_NO_MEM;
+                    break;
+                }
+            }
+
+            mem_copy(tag->udt_raw + tag->udt_raw_offset, data, (int)payload_size);
+            tag->udt_raw_offset += (int)payload_size;
+        } else if(partial_data) {
+            pdebug(DEBUG_WARN, "Partial template response with no data!");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(!partial_data) {
+            udt_template_p tmpl = udt_template_create(tag->udt_fetch_id, tag->udt_handle, tag->udt_instance_size, tag->udt_member_count, tag->udt_raw, tag->udt_raw_offset);
+
+            if(!tmpl) {
+                pdebug(DEBUG_WARN, "Unable to decode UDT template %d!", (int)tag->udt_fetch_id);
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+
+            rc = udt_cache_put(tag->session, tmpl, tag->tag_id);
+            rc_dec(tmpl);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
+
+            pdebug(DEBUG_DETAIL, "Done reading UDT template %d.", (int)tag->udt_fetch_id);
+
+            mem_free(tag->udt_raw);
+            tag->udt_raw = NULL;
+            tag->udt_raw_size = 0;
+            tag->udt_raw_offset = 0;
+            tag->udt_fetch_id = 0;
+        }
+
+        /* set the return code */
+        rc = PLCTAG_STATUS_OK;
+    } while(0);
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    /* are we actually done? */
+    if (rc == PLCTAG_STATUS_OK) {
+        /* this step is done. */
+        tag->read_in_progress = 0;
+
+        /* next chunk, next template or the tag data itself. */
+        rc = tag_read_start(tag);
+    }
+
+    /* this is not an else clause because the above if could result in bad rc. */
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        /* error ! */
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+
+        /* clean up everything. */
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * process_udt_attributes
+ *
+ * Pick out the attributes from the Get Attribute List response and
+ * set up the buffer for the template data.  The response is:
+ *
+ *    uint16_t  count
+ *    count times:
+ *        uint16_t  attribute ID
+ *        uint16_t  status
+ *        value, size depends on the attribute
+ */
+
+static int process_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end)
+{
+    uint32_t def_size = 0;
+    int count = 0;
+
+    if(data_end - data < 2) {
+        pdebug(DEBUG_WARN, "Template attribute response is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    count = (int)(data[0] + (data[1] << 8));
+    data += 2;
+
+    for(int i=0; i < count; i++) {
+        uint16_t attrib_id = 0;
+        uint16_t attrib_status = 0;
+
+        if(data_end - data < 4) {
+            pdebug(DEBUG_WARN, "Template attribute response is too short!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        attrib_id = (uint16_t)(data[0] + (data[1] << 8));
+        attrib_status = (uint16_t)(data[2] + (data[3] << 8));
+        data += 4;
+
+        if(attrib_status != 0) {
+            pdebug(DEBUG_WARN, "Error %d getting attribute %d of template %d!", (int)attrib_status, (int)attrib_id, (int)tag->udt_fetch_id);
+            return PLCTAG_ERR_REMOTE_ERR;
+        }
+
+        switch(attrib_id) {
+        case 0x01: /* structure handle */
+        case 0x02: /* member count */
+            if(data_end - data < 2) {
+                pdebug(DEBUG_WARN, "Template attribute response is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            if(attrib_id == 0x01) {
+                tag->udt_handle = (uint16_t)(data[0] + (data[1] << 8));
+            } else {
+                tag->udt_member_count = (uint16_t)(data[0] + (data[1] << 8));
+            }
+
+            data += 2;
+            break;
+
+        case 0x04: /* template definition size in 32-bit words */
+        case 0x05: /* structure size in bytes */
+            if(data_end - data < 4) {
+                pdebug(DEBUG_WARN, "Template attribute response is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            if(attrib_id == 0x04) {
+                def_size = le2h32(*(uint32_le *)data);
+            } else {
+                tag->udt_instance_size = le2h32(*(uint32_le *)data);
+            }
+
+            data += 4;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unexpected template attribute %d!", (int)attrib_id);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    /* MAGIC, the definition size includes a 23 byte header we do not get. */
+    if(def_size * 4 <= 23 || def_size * 4 > INT16_MAX) {
+        pdebug(DEBUG_WARN, "Template definition size %u is not sane!", def_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    pdebug(DEBUG_DETAIL, "Template %d: handle=%04x members=%d instance size=%u definition size=%u words", (int)tag->udt_fetch_id, (int)tag->udt_handle, (int)tag->udt_member_count, tag->udt_instance_size, def_size);
+
+    if(tag->udt_raw) {
+        mem_free(tag->udt_raw);
+    }
+
+    tag->udt_raw_size = (int)(def_size * 4) - 23;
+    tag->udt_raw_offset = 0;
+    tag->udt_raw = mem_alloc(tag->udt_raw_size);
+    if(!tag->udt_raw) {
+        pdebug(DEBUG_ERROR, "Unable to allocate template buffer!");
+        tag->udt_raw_size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->udt_get_fields = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * finish_udt_tag_read
+ *
+ * A @udt/<id> tag has all its templates.  Copy the raw template data
+ * into the tag so that the application can see it as well.
+ */
+
+static int finish_udt_tag_read(ab_tag_p tag)
+{
+    udt_template_p tmpl = udt_cache_get(tag->session, tag->udt_id);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    tag->read_in_progress = 0;
+
+    if(!tmpl) {
+        pdebug(DEBUG_WARN, "UDT template %d is not in the cache!", (int)tag->udt_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->size != tmpl->raw_size) {
+        uint8_t *new_data = mem_realloc(tag->data, tmpl->raw_size);
+
+        if(!new_data) {
+            pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+            rc_dec(tmpl);
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tag->data = new_data;
+        tag->size = tag->elem_count = tmpl->raw_size;
+    }
+
+    mem_copy(tag->data, tmpl->raw, tmpl->raw_size);
+
+    rc_dec(tmpl);
+
+    tag->first_read = 0;
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+static int check_read_status_unconnected(ab_tag_p tag)
+{
     int rc = PLCTAG_STATUS_OK;
     eip_cip_uc_resp* cip_resp;
     uint8_t* data;
@@ -1487,6 +2290,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1719,6 +2524,8 @@ static int check_write_status_connected(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1834,6 +2641,8 @@ static int check_write_status_unconnected(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1863,7 +2672,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
     cip_resp = (eip_cip_uc_resp*)(tag->req->data);
 
     do {
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
             pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
@@ -1919,6 +2728,111 @@ static int check_write_status_unconnected(ab_tag_p tag)
 
 
 
+static int check_write_bits_status(ab_tag_p tag)
+{
+    uint8_t *reply = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag->req) {
+        tag->write_in_progress = 0;
+        tag->write_bits = 0;
+
+        pdebug(DEBUG_WARN,"Bit write in progress, but no request in flight!");
+
+        return PLCTAG_ERR_WRITE;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        ab_tag_save_req_times(tag, tag->req);
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->write_in_progress = 0;
+            tag->write_bits = 0;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    do {
+        eip_encap *encap = (eip_encap *)(tag->req->data);
+
+        if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
+            reply = &((eip_cip_co_resp *)(tag->req->data))->reply_service;
+        } else if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+            reply = &((eip_cip_uc_resp *)(tag->req->data))->reply_service;
+        } else {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(encap->encap_command));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(encap->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(encap->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (reply[0] != (AB_EIP_CMD_CIP_RMW | AB_EIP_CMD_CIP_OK)) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", reply[0]);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (reply[2] != AB_CIP_STATUS_OK) {
+            pdebug(DEBUG_WARN, "CIP bit write failed with status: 0x%x %s", reply[2], decode_cip_error_short(&reply[2]));
+            pdebug(DEBUG_INFO, decode_cip_error_long(&reply[2]));
+            rc = decode_cip_error_code(&reply[2]);
+            break;
+        }
+    } while(0);
+
+    /* clean up the request. */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    tag->write_in_progress = 0;
+    tag->write_bits = 0;
+
+    /* keep our copy of the data in step with the PLC. */
+    if(rc == PLCTAG_STATUS_OK && tag->data && tag->size >= tag->elem_size) {
+        for(int i=0; i < tag->elem_size; i++) {
+            tag->data[i] = (uint8_t)((tag->data[i] | (uint8_t)(tag->write_bits_set >> (8 * i))) & (uint8_t)(~(tag->write_bits_clear >> (8 * i))));
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+
 int calculate_write_data_per_packet(ab_tag_p tag)
 {
     int overhead = 0;
@@ -2088,3 +3002,46 @@ int setup_tag_listing(ab_tag_p tag, const char *name)
 
     return PLCTAG_STATUS_OK;
 }
+
+
+
+/*
+ * setup_udt_tag
+ *
+ * Check for a name of the form @udt/<template ID>.  Such a tag reads the
+ * UDT template, decodes it and puts it in the session cache.
+ */
+
+int setup_udt_tag(ab_tag_p tag, const char *name)
+{
+    const char *prefix = "@udt/";
+    int udt_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!name || str_length(name) <= str_length(prefix)) {
+        pdebug(DEBUG_INFO, "Tag is not a UDT template request.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    for(int i=0; prefix[i]; i++) {
+        if(tolower((unsigned char)name[i]) != prefix[i]) {
+            pdebug(DEBUG_INFO, "Tag is not a UDT template request.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    if(str_to_int(name + str_length("@udt/"), &udt_id) != 0 || udt_id <= 0 || udt_id > UDT_TYPE_ID_MASK) {
+        pdebug(DEBUG_WARN, "UDT template ID in %s is not valid!", name);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag->udt_tag = 1;
+    tag->udt_id = (uint16_t)udt_id;
+    tag->elem_count = 1;  /* place holder */
+    tag->elem_size = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
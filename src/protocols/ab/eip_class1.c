@@ -0,0 +1,1035 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/cip.h>
+#include <ab/tag.h>
+#include <ab/session.h>
+#include <ab/eip_class1.h>
+#include <ab/error_codes.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+/*
+ * The Forward Open for a consumed tag goes through the session like any
+ * other unconnected request.  Once it succeeds the PLC sends a datagram to
+ * our UDP socket every RPI:
+ *
+ *    CPF item count          2
+ *    sequenced address item  0x8002, length 8: connection ID, 32-bit sequence number
+ *    connected data item     0x00B1, length n: 16-bit sequence count, tag data
+ *
+ * We send the same format back, without data, as a heartbeat so that the
+ * PLC keeps the connection open.  All of this is done from the tag tickler,
+ * which runs about every millisecond.
+ *
+ * The PLC sends every connection's data to the same local port, and the
+ * OS hands each datagram to only one socket bound to it.  So all of the
+ * consumed tags talking to one PLC share a socket.  Whichever tag ticks
+ * reads everything waiting and puts each packet in the mailbox of the
+ * connection whose T->O ID it carries.  The socket calls are made outside
+ * of port_lock, the lock only covers the connection list and the
+ * mailboxes.  Datagrams are read and written whole, so several tags can
+ * use the socket at once.
+ */
+
+#define CLASS1_MAX_PACKET           (600)  /* 511 bytes of connection data plus headers */
+#define CLASS1_MAX_PACKETS_PER_TICK (16)   /* do not let a flood starve the other tags */
+#define CLASS1_MAX_CONN_SIZE        (511)  /* limit of the 9-bit size in a Forward Open */
+#define CLASS1_SOCKADDR_ITEM_SIZE   (20)   /* item type, length and 16 bytes of sockaddr_in */
+#define CLASS1_HEARTBEAT_SIZE       (20)
+#define CLASS1_MAILBOX_SIZE         (4)    /* packets held for a tag between ticks */
+
+typedef enum {
+    CLASS1_IDLE,
+    CLASS1_OPENING,
+    CLASS1_CONNECTED
+} class1_state_t;
+
+struct class1_packet_t {
+    int size;
+    uint8_t data[CLASS1_MAX_PACKET];
+};
+
+/* a UDP socket shared by all the connections to one PLC on one local port. */
+struct class1_port_t {
+    struct class1_port_t *next;
+
+    char *host;
+    int udp_port;               /* local port, zero for any free port */
+    int ref_count;
+
+    sock_p sock;
+
+    struct class1_conn_t *conns;
+};
+
+struct class1_conn_t {
+    class1_state_t state;
+
+    struct class1_port_t *port;
+    struct class1_conn_t *next_on_port;
+    int udp_port;               /* local port, zero for any free port */
+    int rpi_ms;
+    int timeout_ms;             /* the connection is dead if nothing arrives within this */
+
+    /* route to the PLC, without the Message Router suffix. */
+    uint8_t *route;
+    uint8_t route_size;
+
+    uint32_t o2t_conn_id;       /* the PLC's ID, goes in our heartbeats */
+    uint32_t t2o_conn_id;       /* our ID, the PLC puts it in the data packets */
+    uint16_t conn_serial;
+
+    uint32_t o2t_seq;           /* heartbeat sequence number */
+    uint32_t t2o_seq;           /* last data sequence number we accepted */
+    uint16_t t2o_seq_count;     /* CIP sequence count of the last data we accepted */
+    int have_data;
+
+    int64_t last_rx_ms;
+    int64_t next_heartbeat_ms;
+    int64_t retry_ms;
+
+    uint64_t packet_count;
+    uint64_t lost_count;
+
+    /* packets for this connection read by any tag on the port, oldest first.  Protected by port_lock. */
+    struct class1_packet_t mailbox[CLASS1_MAILBOX_SIZE];
+    int mailbox_first;
+    int mailbox_count;
+};
+
+
+static int class1_abort(ab_tag_p tag);
+static int class1_read(ab_tag_p tag);
+static int class1_status(ab_tag_p tag);
+static int class1_tickler(ab_tag_p tag);
+static int class1_write(ab_tag_p tag);
+
+static int encode_conn_path(ab_tag_p tag, uint8_t *data);
+static int send_forward_open(ab_tag_p tag);
+static int check_forward_open(ab_tag_p tag);
+static int send_forward_close(ab_tag_p tag);
+static void receive_packets(ab_tag_p tag);
+static void handle_packet(ab_tag_p tag, uint8_t *buf, int size);
+static int send_heartbeat(ab_tag_p tag);
+static void close_connection(ab_tag_p tag, int status);
+static int port_attach(ab_tag_p tag);
+static void port_detach(ab_tag_p tag);
+static void port_dispatch_unsafe(struct class1_port_t *port, uint8_t *buf, int size);
+static uint16_t get_le16(uint8_t *p);
+static uint32_t get_le32(uint8_t *p);
+static uint8_t *put_le16(uint8_t *p, uint16_t val);
+static uint8_t *put_le32(uint8_t *p, uint32_t val);
+
+/* define the exported vtable for this tag type. */
+struct tag_vtable_t eip_class1_vtable = {
+    (tag_vtable_func)class1_abort,
+    (tag_vtable_func)class1_read,
+    (tag_vtable_func)class1_status,
+    (tag_vtable_func)class1_tickler,
+    (tag_vtable_func)class1_write,
+    (tag_member_info_func)NULL,
+    (tag_write_bits_func)NULL
+};
+
+/* the shared sockets and the connection IDs and serial numbers are protected by port_lock. */
+static lock_t port_lock = LOCK_INIT;
+static struct class1_port_t *ports = NULL;
+static uint32_t connection_id = 0;
+static uint16_t connection_serial = 0;
+
+
+
+int class1_tag_init(ab_tag_p tag, attr attribs)
+{
+    struct class1_conn_t *conn = NULL;
+    uint16_t dhp_dest = 0;
+    int rpi_ms = attr_get_int(attribs, "rpi", CLASS1_DEFAULT_RPI_MS);
+    int udp_port = attr_get_int(attribs, "udp_port", AB_EIP_UDP_IO_PORT);
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(rpi_ms <= 0) {
+        pdebug(DEBUG_WARN, "RPI must be at least 1ms!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(udp_port < 0 || udp_port > 65535) {
+        pdebug(DEBUG_WARN, "UDP port %d is out of range!", udp_port);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(tag->size + 2 > CLASS1_MAX_CONN_SIZE) {
+        pdebug(DEBUG_WARN, "Consumed tags are limited to %d bytes of data!", CLASS1_MAX_CONN_SIZE - 2);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    conn = mem_alloc(sizeof(*conn));
+    if(!conn) {
+        pdebug(DEBUG_ERROR, "Unable to allocate Class 1 connection!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* the route only, the connection goes to the tag and not to the Message Router. */
+    rc = cip_encode_path(attr_get_str(attribs, "path", NULL), 0, tag->protocol_type, &conn->route, &conn->route_size, &dhp_dest);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode route to the PLC!");
+        mem_free(conn);
+        return rc;
+    }
+
+    /* packets are matched to connections by this ID, so it must be unique. */
+    spin_block(&port_lock) {
+        if(!connection_id) {
+            connection_id = (uint32_t)rand();
+        }
+
+        conn->t2o_conn_id = ++connection_id;
+    }
+
+    conn->state = CLASS1_IDLE;
+    conn->rpi_ms = rpi_ms;
+    conn->timeout_ms = rpi_ms * AB_EIP_CLASS1_TIMEOUT_FACTOR;
+    conn->udp_port = udp_port;
+
+    tag->class1 = conn;
+
+    /* there is no data until the first packet arrives. */
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void class1_tag_destroy(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!conn) {
+        pdebug(DEBUG_DETAIL, "Not a consumed tag.");
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Received %llu packets, lost %llu.", (unsigned long long)conn->packet_count, (unsigned long long)conn->lost_count);
+
+    close_connection(tag, PLCTAG_ERR_ABORT);
+
+    port_detach(tag);
+
+    if(conn->route) {
+        mem_free(conn->route);
+    }
+
+    mem_free(conn);
+
+    tag->class1 = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/*************************************************************************
+ **************************** API Functions ******************************
+ ************************************************************************/
+
+
+/* the connection keeps running, there is nothing to abort. */
+int class1_abort(ab_tag_p tag)
+{
+    (void)tag;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* the data is pushed to us, a read just reports what we have. */
+int class1_read(ab_tag_p tag)
+{
+    return tag->status;
+}
+
+
+
+int class1_status(ab_tag_p tag)
+{
+    return tag->status;
+}
+
+
+
+int class1_write(ab_tag_p tag)
+{
+    (void)tag;
+
+    pdebug(DEBUG_WARN, "Consumed tags cannot be written!");
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+int class1_tickler(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    int64_t now = time_ms();
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!conn) {
+        return tag->status;
+    }
+
+    switch(conn->state) {
+    case CLASS1_IDLE:
+        if(now >= conn->retry_ms) {
+            rc = send_forward_open(tag);
+            if(rc != PLCTAG_STATUS_OK) {
+                close_connection(tag, rc);
+            }
+        }
+        break;
+
+    case CLASS1_OPENING:
+        rc = check_forward_open(tag);
+        if(rc_is_error(rc)) {
+            close_connection(tag, rc);
+        }
+        break;
+
+    case CLASS1_CONNECTED:
+        receive_packets(tag);
+
+        if(now - conn->last_rx_ms > conn->timeout_ms) {
+            pdebug(DEBUG_WARN, "No data from the PLC for %dms, reconnecting.", (int)(now - conn->last_rx_ms));
+            close_connection(tag, PLCTAG_ERR_TIMEOUT);
+            break;
+        }
+
+        if(now >= conn->next_heartbeat_ms) {
+            send_heartbeat(tag);
+            conn->next_heartbeat_ms = now + conn->rpi_ms;
+        }
+        break;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return tag->status;
+}
+
+
+
+
+/*************************************************************************
+ **************************** Connection Handling ************************
+ ************************************************************************/
+
+
+/*
+ * The connection path is the route to the PLC followed by the symbolic
+ * segment of the produced tag.  Returns the size in bytes.
+ */
+
+int encode_conn_path(ab_tag_p tag, uint8_t *data)
+{
+    struct class1_conn_t *conn = tag->class1;
+
+    mem_copy(data, conn->route, conn->route_size);
+    mem_copy(data + conn->route_size, &tag->encoded_name[1], tag->encoded_name_size - 1);
+
+    return conn->route_size + tag->encoded_name_size - 1;
+}
+
+
+
+int send_forward_open(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    eip_forward_open_request_t *fo = NULL;
+    ab_request_p req = NULL;
+    uint8_t *data = NULL;
+    int path_size = 0;
+    int local_port = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* the PLC needs to know where to send the data, so open the socket first. */
+    if(!conn->port) {
+        rc = port_attach(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+    }
+
+    local_port = socket_local_port(conn->port->sock);
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    /*
+     * the PLC knows a connection by its serial number.  Use a new one for
+     * each open so that a retry is not taken for a connection that the PLC
+     * has not timed out yet.
+     */
+    spin_block(&port_lock) {
+        if(!connection_serial) {
+            connection_serial = (uint16_t)rand();
+        }
+
+        conn->conn_serial = ++connection_serial;
+    }
+
+    fo = (eip_forward_open_request_t *)(req->data);
+    data = req->data + sizeof(*fo);
+
+    path_size = encode_conn_path(tag, data);
+    data += path_size;
+
+    /* encap fields, the rest is filled in by the session. */
+    fo->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    fo->router_timeout = h2le16(1);
+
+    /* CPF parts, the last item tells the PLC where to send the data. */
+    fo->cpf_item_count = h2le16(3);
+    fo->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    fo->cpf_nai_item_length = h2le16(0);
+    fo->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    fo->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code)));
+
+    /* Connection Manager parts */
+    fo->cm_service_code = AB_EIP_CMD_FORWARD_OPEN;
+    fo->cm_req_path_size = 2;
+    fo->cm_req_path[0] = 0x20;  /* class */
+    fo->cm_req_path[1] = 0x06;  /* CM class */
+    fo->cm_req_path[2] = 0x24;  /* instance */
+    fo->cm_req_path[3] = 0x01;  /* instance 1 */
+
+    /* Forward Open Params */
+    fo->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fo->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fo->orig_to_targ_conn_id = h2le32(0);
+    fo->targ_to_orig_conn_id = h2le32(conn->t2o_conn_id);
+    fo->conn_serial_number = h2le16(conn->conn_serial);
+    fo->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fo->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fo->conn_timeout_multiplier = AB_EIP_CLASS1_TIMEOUT_MULTIPLIER;
+
+    /* our heartbeats only carry the sequence count. */
+    fo->orig_to_targ_rpi = h2le32((uint32_t)conn->rpi_ms * 1000);
+    fo->orig_to_targ_conn_params = h2le16(AB_EIP_CLASS1_CONN_PARAM | 2);
+    fo->targ_to_orig_rpi = h2le32((uint32_t)conn->rpi_ms * 1000);
+    fo->targ_to_orig_conn_params = h2le16((uint16_t)(AB_EIP_CLASS1_CONN_PARAM | (tag->size + 2)));
+    fo->transport_class = AB_EIP_TRANSPORT_CLASS_T1;
+    fo->path_size = (uint8_t)(path_size / 2);
+
+    /* T->O socket address item, sockaddr_in in network byte order. */
+    data = put_le16(data, AB_EIP_ITEM_SOCKADDR_T2O);
+    data = put_le16(data, 16);
+    *data++ = 0x00;  /* AF_INET, big endian */
+    *data++ = 0x02;
+    *data++ = (uint8_t)((local_port >> 8) & 0xFF);
+    *data++ = (uint8_t)(local_port & 0xFF);
+    mem_set(data, 0, 12);  /* any address, the PLC uses the one we came from */
+    data += 12;
+
+    req->request_size = (int)(data - req->data);
+    req->allow_packing = 0;
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add Forward Open request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    tag->req = req;
+
+    spin_block(&port_lock) {
+        conn->state = CLASS1_OPENING;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int check_forward_open(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    eip_forward_open_response_t *fo_resp = NULL;
+    uint32_t api_us = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag->req) {
+        pdebug(DEBUG_WARN, "Forward Open in progress, but no request in flight!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN, "Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            break;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        fo_resp = (eip_forward_open_response_t *)(tag->req->data);
+
+        do {
+            if(le2h16(fo_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
+                pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(fo_resp->encap_command));
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+
+            if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
+                pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(fo_resp->encap_status));
+                rc = PLCTAG_ERR_REMOTE_ERR;
+                break;
+            }
+
+            if(fo_resp->resp_service_code != (AB_EIP_CMD_FORWARD_OPEN | AB_EIP_CMD_CIP_OK)) {
+                pdebug(DEBUG_WARN, "Unexpected reply service %x to Forward Open!", fo_resp->resp_service_code);
+                rc = PLCTAG_ERR_BAD_REPLY;
+                break;
+            }
+
+            if(fo_resp->general_status != AB_EIP_OK) {
+                pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%d)", decode_cip_error_short(&fo_resp->general_status), fo_resp->general_status);
+                rc = decode_cip_error_code(&fo_resp->general_status);
+                break;
+            }
+
+            conn->o2t_conn_id = le2h32(fo_resp->orig_to_targ_conn_id);
+
+            /* the PLC may not give us the RPI we asked for. */
+            api_us = le2h32(fo_resp->targ_to_orig_api);
+            if(api_us >= 1000) {
+                conn->timeout_ms = (int)(api_us / 1000) * AB_EIP_CLASS1_TIMEOUT_FACTOR;
+            }
+        } while(0);
+    }
+
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Class 1 connection open, O->T ID %x, T->O ID %x, timeout %dms.", conn->o2t_conn_id, conn->t2o_conn_id, conn->timeout_ms);
+
+    /* packets are only put in the mailbox while we are connected. */
+    spin_block(&port_lock) {
+        conn->state = CLASS1_CONNECTED;
+        conn->mailbox_count = 0;
+    }
+
+    conn->have_data = 0;
+    conn->o2t_seq = 0;
+    conn->last_rx_ms = time_ms();
+    conn->next_heartbeat_ms = conn->last_rx_ms;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* fire and forget, if the PLC misses it the connection times out there too. */
+int send_forward_close(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    eip_forward_close_req_t *fc = NULL;
+    ab_request_p req = NULL;
+    uint8_t *data = NULL;
+    int path_size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    fc = (eip_forward_close_req_t *)(req->data);
+    data = req->data + sizeof(*fc);
+
+    path_size = encode_conn_path(tag, data);
+    data += path_size;
+
+    fc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    fc->router_timeout = h2le16(1);
+
+    fc->cpf_item_count = h2le16(2);
+    fc->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    fc->cpf_nai_item_length = h2le16(0);
+    fc->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    fc->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fc->cm_service_code)));
+
+    fc->cm_service_code = AB_EIP_CMD_FORWARD_CLOSE;
+    fc->cm_req_path_size = 2;
+    fc->cm_req_path[0] = 0x20;  /* class */
+    fc->cm_req_path[1] = 0x06;  /* CM class */
+    fc->cm_req_path[2] = 0x24;  /* instance */
+    fc->cm_req_path[3] = 0x01;  /* instance 1 */
+
+    fc->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fc->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fc->conn_serial_number = h2le16(conn->conn_serial);
+    fc->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fc->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fc->path_size = (uint8_t)(path_size / 2);
+    fc->reserved = 0;
+
+    req->request_size = (int)(data - req->data);
+    req->allow_packing = 0;
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add Forward Close request to session! rc=%d", rc);
+    }
+
+    /* nobody waits for the reply. */
+    req->abort_request = 1;
+    rc_dec(req);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * Shut down the connection, if any, and set up a retry.  The socket is
+ * kept so that the PLC can keep sending to the same port.  Packets
+ * already in the mailbox belong to the old connection.
+ */
+
+void close_connection(ab_tag_p tag, int status)
+{
+    struct class1_conn_t *conn = tag->class1;
+    int need_close = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* an open still in flight may yet succeed, so close that too. */
+    need_close = (conn->state == CLASS1_CONNECTED || (conn->state == CLASS1_OPENING && tag->req));
+
+    if(tag->req) {
+        tag->req->abort_request = 1;
+        tag->req = rc_dec(tag->req);
+    }
+
+    if(need_close && tag->session) {
+        send_forward_close(tag);
+    }
+
+    spin_block(&port_lock) {
+        conn->state = CLASS1_IDLE;
+        conn->mailbox_count = 0;
+    }
+
+    conn->retry_ms = time_ms() + CLASS1_RETRY_MS;
+
+    tag->status = status;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * Read whatever is waiting on the shared socket into the mailboxes of
+ * the connections, then handle the packets in our own mailbox.
+ */
+
+void receive_packets(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    struct class1_port_t *port = conn->port;
+    struct class1_packet_t packets[CLASS1_MAILBOX_SIZE];
+    uint8_t buf[CLASS1_MAX_PACKET];
+    int num_packets = 0;
+    int rc = 0;
+
+    /* the port stays open while our connection is on it. */
+    for(int i=0; i < CLASS1_MAX_PACKETS_PER_TICK; i++) {
+        rc = socket_read(port->sock, buf, (int)sizeof(buf));
+
+        if(rc == 0) {
+            break;
+        }
+
+        if(rc < 0) {
+            /* usually an ICMP error from a heartbeat, the timeout catches real failures. */
+            pdebug(DEBUG_DETAIL, "Error %s reading UDP socket.", plc_tag_decode_error(rc));
+            break;
+        }
+
+        spin_block(&port_lock) {
+            port_dispatch_unsafe(port, buf, rc);
+        }
+    }
+
+    spin_block(&port_lock) {
+        while(conn->mailbox_count > 0) {
+            packets[num_packets++] = conn->mailbox[conn->mailbox_first];
+
+            conn->mailbox_first = (conn->mailbox_first + 1) % CLASS1_MAILBOX_SIZE;
+            conn->mailbox_count--;
+        }
+    }
+
+    for(int i=0; i < num_packets; i++) {
+        handle_packet(tag, packets[i].data, packets[i].size);
+    }
+}
+
+
+
+void handle_packet(ab_tag_p tag, uint8_t *buf, int size)
+{
+    struct class1_conn_t *conn = tag->class1;
+    uint32_t seq = 0;
+    uint16_t seq_count = 0;
+    int data_len = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* item count, sequenced address item and the data item header. */
+    if(size < 20
+       || get_le16(buf) < 2
+       || get_le16(buf + 2) != AB_EIP_ITEM_SEQ_ADDR
+       || get_le16(buf + 4) != 8
+       || get_le16(buf + 14) != AB_EIP_ITEM_CDI) {
+        pdebug(DEBUG_DETAIL, "Ignoring malformed packet of %d bytes.", size);
+        return;
+    }
+
+    data_len = get_le16(buf + 16);
+    if(data_len < 2 || 18 + data_len > size) {
+        pdebug(DEBUG_DETAIL, "Ignoring packet with bad data length %d.", data_len);
+        return;
+    }
+
+    /* UDP can reorder, anything not newer than what we have is stale. */
+    seq = get_le32(buf + 10);
+    if(conn->have_data) {
+        int32_t diff = (int32_t)(seq - conn->t2o_seq);
+
+        if(diff <= 0) {
+            pdebug(DEBUG_DETAIL, "Dropping stale packet %u, have %u.", seq, conn->t2o_seq);
+            return;
+        }
+
+        conn->lost_count += (uint64_t)(diff - 1);
+    }
+
+    conn->t2o_seq = seq;
+    conn->last_rx_ms = time_ms();
+    conn->packet_count++;
+
+    /* the data only changes when the sequence count does. */
+    seq_count = get_le16(buf + 18);
+    if(!conn->have_data || seq_count != conn->t2o_seq_count) {
+        data_len -= 2;
+
+        if(data_len != tag->size) {
+            pdebug(DEBUG_DETAIL, "Got %d bytes of data for a %d byte tag.", data_len, tag->size);
+        }
+
+        mem_copy(tag->data, buf + 20, (data_len < tag->size ? data_len : tag->size));
+    }
+
+    conn->t2o_seq_count = seq_count;
+    conn->have_data = 1;
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
+
+int send_heartbeat(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    uint8_t buf[CLASS1_HEARTBEAT_SIZE];
+    uint8_t *data = &buf[0];
+    int rc = 0;
+
+    conn->o2t_seq++;
+
+    data = put_le16(data, 2);
+    data = put_le16(data, AB_EIP_ITEM_SEQ_ADDR);
+    data = put_le16(data, 8);
+    data = put_le32(data, conn->o2t_conn_id);
+    data = put_le32(data, conn->o2t_seq);
+    data = put_le16(data, AB_EIP_ITEM_CDI);
+    data = put_le16(data, 2);
+    data = put_le16(data, (uint16_t)conn->o2t_seq);
+
+    rc = socket_write(conn->port->sock, buf, (int)(data - buf));
+
+    if(rc < 0) {
+        pdebug(DEBUG_DETAIL, "Error %s sending heartbeat.", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Find or open the shared socket for the PLC and local port of the tag
+ * and add the tag's connection to it.
+ */
+
+int port_attach(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    const char *host = tag->session->host;
+    struct class1_port_t *port = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    spin_block(&port_lock) {
+        for(port = ports; port; port = port->next) {
+            if(port->udp_port == conn->udp_port && str_cmp_i(port->host, host) == 0) {
+                break;
+            }
+        }
+
+        if(!port) {
+            port = mem_alloc((int)sizeof(*port));
+            if(!port) {
+                pdebug(DEBUG_ERROR, "Unable to allocate shared UDP socket!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            port->host = str_dup(host);
+            port->udp_port = conn->udp_port;
+
+            if(!port->host) {
+                pdebug(DEBUG_ERROR, "Unable to copy host name!");
+                mem_free(port);
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            rc = socket_create(&port->sock);
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = socket_connect_udp(port->sock, host, AB_EIP_UDP_IO_PORT, conn->udp_port);
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to open UDP socket to %s on local port %d!", host, conn->udp_port);
+
+                if(port->sock) {
+                    socket_destroy(&port->sock);
+                }
+
+                mem_free(port->host);
+                mem_free(port);
+                break;
+            }
+
+            port->next = ports;
+            ports = port;
+        }
+
+        port->ref_count++;
+
+        conn->next_on_port = port->conns;
+        port->conns = conn;
+        conn->port = port;
+        conn->mailbox_count = 0;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/* take the tag's connection off its shared socket, closing it if it was the last. */
+void port_detach(ab_tag_p tag)
+{
+    struct class1_conn_t *conn = tag->class1;
+    struct class1_port_t *port = conn->port;
+    struct class1_port_t *dead_port = NULL;
+
+    if(!port) {
+        return;
+    }
+
+    spin_block(&port_lock) {
+        for(struct class1_conn_t **prev = &port->conns; *prev; prev = &(*prev)->next_on_port) {
+            if(*prev == conn) {
+                *prev = conn->next_on_port;
+                break;
+            }
+        }
+
+        conn->port = NULL;
+        port->ref_count--;
+
+        if(port->ref_count == 0) {
+            for(struct class1_port_t **prev = &ports; *prev; prev = &(*prev)->next) {
+                if(*prev == port) {
+                    *prev = port->next;
+                    break;
+                }
+            }
+
+            dead_port = port;
+        }
+    }
+
+    if(dead_port) {
+        socket_destroy(&dead_port->sock);
+        mem_free(dead_port->host);
+        mem_free(dead_port);
+    }
+}
+
+
+
+/*
+ * Put a packet in the mailbox of the connection it is for.  When the
+ * mailbox is full the oldest packet goes, the sequence numbers count it
+ * as lost.
+ *
+ * You must hold port_lock before calling this!
+ */
+
+void port_dispatch_unsafe(struct class1_port_t *port, uint8_t *buf, int size)
+{
+    struct class1_conn_t *conn = NULL;
+    uint32_t conn_id = 0;
+    int slot = 0;
+
+    if(size < 10 || get_le16(buf + 2) != AB_EIP_ITEM_SEQ_ADDR) {
+        pdebug(DEBUG_DETAIL, "Ignoring malformed packet of %d bytes.", size);
+        return;
+    }
+
+    conn_id = get_le32(buf + 6);
+
+    for(conn = port->conns; conn; conn = conn->next_on_port) {
+        if(conn->t2o_conn_id == conn_id) {
+            break;
+        }
+    }
+
+    if(!conn || conn->state != CLASS1_CONNECTED) {
+        pdebug(DEBUG_DETAIL, "Ignoring packet for connection %x.", conn_id);
+        return;
+    }
+
+    if(conn->mailbox_count == CLASS1_MAILBOX_SIZE) {
+        conn->mailbox_first = (conn->mailbox_first + 1) % CLASS1_MAILBOX_SIZE;
+        conn->mailbox_count--;
+    }
+
+    slot = (conn->mailbox_first + conn->mailbox_count) % CLASS1_MAILBOX_SIZE;
+
+    mem_copy(conn->mailbox[slot].data, buf, size);
+    conn->mailbox[slot].size = size;
+    conn->mailbox_count++;
+}
+
+
+
+uint16_t get_le16(uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+
+uint32_t get_le32(uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+uint8_t *put_le16(uint8_t *p, uint16_t val)
+{
+    *p++ = (uint8_t)(val & 0xFF);
+    *p++ = (uint8_t)((val >> 8) & 0xFF);
+
+    return p;
+}
+
+
+uint8_t *put_le32(uint8_t *p, uint32_t val)
+{
+    p = put_le16(p, (uint16_t)(val & 0xFFFF));
+
+    return put_le16(p, (uint16_t)((val >> 16) & 0xFFFF));
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_AB_EIP_CLASS1_H__
+#define __PLCTAG_AB_EIP_CLASS1_H__ 1
+
+#include <ab/ab_common.h>
+#include <util/attr.h>
+
+/*
+ * Class 1 consumed tags.
+ *
+ * A Logix produced tag can be consumed over an implicit (Class 1)
+ * connection.  After a Forward Open the PLC sends the tag data to us over
+ * UDP every RPI, so reads never go on the wire.  Tags created with
+ * consume=1 use this instead of polling.
+ */
+
+#define CLASS1_DEFAULT_RPI_MS   (10)
+#define CLASS1_RETRY_MS         (1000)
+
+struct class1_conn_t;
+
+extern struct tag_vtable_t eip_class1_vtable;
+
+extern int class1_tag_init(ab_tag_p tag, attr attribs);
+extern void class1_tag_destroy(ab_tag_p tag);
+
+#endif
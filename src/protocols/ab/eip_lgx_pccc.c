@@ -70,7 +70,9 @@ struct tag_vtable_t lgx_pccc_vtable = {
     (tag_vtable_func)tag_read_start,
     (tag_vtable_func)tag_status,
     (tag_vtable_func)tag_tickler,
-    (tag_vtable_func)tag_write_start
+    (tag_vtable_func)tag_write_start,
+    NULL, /* no structure members */
+    NULL  /* no bit writes */
 };
 
 static int check_read_status(ab_tag_p tag);
@@ -355,6 +357,8 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -714,6 +718,8 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
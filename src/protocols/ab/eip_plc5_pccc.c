@@ -41,36 +41,24 @@ struct tag_vtable_t plc5_vtable = {
     (tag_vtable_func)tag_read_start,
     (tag_vtable_func)tag_status,
     (tag_vtable_func)tag_tickler,
-    (tag_vtable_func)tag_write_start
+    (tag_vtable_func)tag_write_start,
+    NULL, /* no structure members */
+    NULL  /* no bit writes */
 };
 
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag);
+static int build_write_request(ab_tag_p tag);
+static int read_chunk_size(ab_tag_p tag);
+static int write_chunk_size(ab_tag_p tag);
 
+/*
+ * The PCCC Execute request.  The EIP framing in front of it depends on
+ * whether we use connected messaging, see pccc_eip_fill_header().
+ */
 START_PACK typedef struct {
-    /* encap header */
-    uint16_le encap_command;         /* ALWAYS 0x006f Unconnected Send*/
-    uint16_le encap_length;          /* packet size in bytes - 24 */
-    uint32_le encap_session_handle;  /* from session set up */
-    uint32_le encap_status;          /* always _sent_ as 0 */
-    uint64_le encap_sender_context;  /* whatever we want to set this to, used for
-                                     * identifying responses when more than one
-                                     * are in flight at once.
-                                     */
-    uint32_le encap_options;         /* 0, reserved for future use */
-
-    /* Interface Handle etc. */
-    uint32_le interface_handle;      /* ALWAYS 0 */
-    uint16_le router_timeout;        /* in seconds, 5 or 10 seems to be good.*/
-
-    /* Common Packet Format - CPF Unconnected */
-    uint16_le cpf_item_count;        /* ALWAYS 2 */
-    uint16_le cpf_nai_item_type;     /* ALWAYS 0 */
-    uint16_le cpf_nai_item_length;   /* ALWAYS 0 */
-    uint16_le cpf_udi_item_type;     /* ALWAYS 0x00B2 - Unconnected Data Item */
-    uint16_le cpf_udi_item_length;   /* REQ: fill in with length of remaining data. */
-
     /* PCCC Command Req Routing */
     uint8_t service_code;           /* ALWAYS 0x4B, Execute PCCC */
     uint8_t req_path_size;          /* ALWAYS 0x02, in 16-bit words */
@@ -146,18 +134,15 @@ int tag_tickler(ab_tag_p tag)
  * tag_read_start
  *
  * Start a PCCC tag read (PLC5).
+ *
+ * Data files larger than one packet are read as a series of word
+ * range reads.  Each one asks for the next slice of the file, by
+ * word offset, and the slices are put back together in tag->data.
  */
 
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req = NULL;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
-    int overhead;
-    int data_per_packet;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -167,6 +152,32 @@ int tag_read_start(ab_tag_p tag)
     }
 
     tag->read_in_progress = 1;
+    tag->offset = 0;
+
+    rc = build_read_request(tag);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        tag->read_in_progress = 0;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * read_chunk_size
+ *
+ * How many bytes the next range read will ask for.  Zero if nothing
+ * fits in a packet.
+ */
+
+static int read_chunk_size(ab_tag_p tag)
+{
+    int overhead;
+    int data_per_packet;
 
     /* What is the overhead in the _response_ */
     overhead =   1  /* pccc command */
@@ -175,31 +186,56 @@ int tag_read_start(ab_tag_p tag)
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
+    if(data_per_packet > PCCC_MAX_DATA_PER_PACKET) {
+        data_per_packet = PCCC_MAX_DATA_PER_PACKET;
+    }
+
+    /* transfers are in words. */
+    data_per_packet &= ~1;
+
     if(data_per_packet <= 0) {
         pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead, session_get_max_payload(tag->session));
-        tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+        return 0;
     }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!", tag->size, overhead, data_per_packet);
-        tag->read_in_progress = 0;
+    if(data_per_packet > (tag->size - tag->offset)) {
+        data_per_packet = tag->size - tag->offset;
+    }
+
+    return data_per_packet;
+}
+
+
+
+
+static int build_read_request(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int header_size = pccc_eip_header_size(tag->use_connected_msg);
+    ab_request_p req = NULL;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    int chunk_size;
+    pccc_req *pccc;
+    uint8_t *data;
+
+    pdebug(DEBUG_INFO, "Starting");
+
+    chunk_size = read_chunk_size(tag);
+    if(chunk_size <= 0) {
         return PLCTAG_ERR_TOO_LARGE;
     }
 
+    pdebug(DEBUG_DETAIL, "Reading %d bytes at offset %d of %d.", chunk_size, tag->offset, tag->size);
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->read_in_progress = 0;
         return rc;
     }
 
     /* point the struct pointers to the buffer*/
-    pccc = (pccc_req *)(req->data);
-
-    /* set up the embedded PCCC packet */
-    embed_start = (uint8_t *)(&pccc->service_code);
+    pccc = (pccc_req *)(req->data + header_size);
 
     /* Command Routing */
     pccc->service_code = AB_EIP_CMD_PCCC_EXECUTE;  /* ALWAYS 0x4B, Execute PCCC */
@@ -219,7 +255,7 @@ int tag_read_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_PLC5_RANGE_READ_FUNC;
-    pccc->pccc_transfer_offset = h2le16((uint16_t)0);
+    pccc->pccc_transfer_offset = h2le16((uint16_t)((tag->offset)/2));  /* offset in 2-byte words */
     pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     /* point to the end of the struct */
@@ -230,30 +266,33 @@ int tag_read_start(ab_tag_p tag)
     data += tag->encoded_name_size;
 
     /* amount of data to get this time */
-    *data = (uint8_t)(tag->size); /* bytes for this transfer */
+    *data = (uint8_t)(chunk_size); /* bytes for this transfer */
     data++;
 
-    /*
-     * after the embedded packet, we need to tell the message router
-     * how to get to the target device.
-     */
-
-    /* encap fields */
-    pccc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);    /* set up for unconnected sending */
-
-    /* router timeout */
-    pccc->router_timeout = h2le16(1);                 /* one second timeout, enough? */
-
-    /* Common Packet Format fields for unconnected send. */
-    pccc->cpf_item_count        = h2le16(2);                /* ALWAYS 2 */
-    pccc->cpf_nai_item_type     = h2le16(AB_EIP_ITEM_NAI);  /* ALWAYS 0 */
-    pccc->cpf_nai_item_length   = h2le16(0);                /* ALWAYS 0 */
-    pccc->cpf_udi_item_type     = h2le16(AB_EIP_ITEM_UDI);  /* ALWAYS 0x00B2 - Unconnected Data Item */
-    pccc->cpf_udi_item_length   = h2le16((uint16_t)(data - embed_start));  /* REQ: fill in with length of remaining data. */
-
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
+    /* fill in the EIP framing for the transport we use. */
+    pccc_eip_fill_header(req->data, tag->use_connected_msg, req->request_size);
+
+    /*
+     * a read of whole elements in one packet can be merged by the
+     * session with other reads of the same data file.
+     */
+    if(tag->offset == 0 && chunk_size == tag->size && tag->subelem_num < 0) {
+        int elem_bytes = (tag->file_type == PCCC_FILE_BIT ? 2 : tag->elem_size);
+
+        if(elem_bytes > 0 && (tag->size % elem_bytes) == 0) {
+            req->coalesce = AB_COALESCE_PLC5;
+            req->coalesce_file_type = (int)tag->file_type;
+            req->coalesce_file_num = tag->file_num;
+            req->coalesce_index = (uint32_t)tag->elem_num;
+            req->coalesce_count = tag->size / elem_bytes;
+            req->coalesce_elem_size = elem_bytes;
+            req->coalesce_name_offset = header_size + (int)sizeof(pccc_req);
+        }
+    }
+
     /* mark it as ready to send */
     //req->send_request = 1;
 
@@ -262,7 +301,6 @@ int tag_read_start(ab_tag_p tag)
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->read_in_progress = 0;
 
         tag->req = rc_dec(req);
 
@@ -285,16 +323,17 @@ int tag_read_start(ab_tag_p tag)
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * NOTE that we can have only one outstanding request at a time.  When
+ * a slice comes back, the request for the next one is sent right away.
  */
 
 
 static int check_read_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
+    pccc_reply *pccc;
     uint8_t *data;
     uint8_t *data_end;
+    int chunk_size;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting");
@@ -316,6 +355,8 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -341,28 +382,19 @@ static int check_read_status(ab_tag_p tag)
 
     /* the request is ours exclusively. */
 
-    pccc = (pccc_resp *)(tag->req->data);
+    /* find the PCCC reply behind the EIP framing. */
+    pccc = (pccc_reply *)pccc_eip_reply(tag->req->data, &data_end);
 
     /* point to the start of the data */
-    data = (uint8_t *)pccc + sizeof(*pccc);
-
-    /* point to the end of the data */
-    data_end = (tag->req->data + le2h16(pccc->encap_length) + sizeof(eip_encap));
+    data = (pccc ? (uint8_t *)pccc + sizeof(*pccc) : NULL);
 
     /* fake exceptions */
     do {
-        if(le2h16(pccc->encap_command) != AB_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", pccc->encap_command);
+        if(!pccc) {
             rc = PLCTAG_ERR_BAD_DATA;
             break;
         }
 
-        if(le2h32(pccc->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(pccc->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
         if(pccc->general_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: (%d) %s", pccc->general_status, decode_cip_error_long((uint8_t *)&(pccc->general_status)));
             rc = PLCTAG_ERR_REMOTE_ERR;
@@ -376,19 +408,21 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+        chunk_size = read_chunk_size(tag);
+        if((data_end - data) != chunk_size) {
+            if((int)(data_end - data) > chunk_size) {
+                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", chunk_size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", chunk_size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
             break;
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + tag->offset, data, (int)(data_end - data));
+        tag->offset += (int)(data_end - data);
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -397,7 +431,16 @@ static int check_read_status(ab_tag_p tag)
     tag->req->abort_request = 1;
     tag->req = rc_dec(tag->req);
 
+    /* more of the file to get? */
+    if(rc == PLCTAG_STATUS_OK && tag->offset < tag->size) {
+        rc = build_read_request(tag);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            return rc;
+        }
+    }
+
     tag->read_in_progress = 0;
+    tag->offset = 0;
 
     pdebug(DEBUG_SPEW, "Done.");
 
@@ -413,12 +456,6 @@ static int check_read_status(ab_tag_p tag)
 int tag_write_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
-    uint8_t *embed_start;
-    int overhead, data_per_packet;
-    ab_request_p req = NULL;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -428,6 +465,32 @@ int tag_write_start(ab_tag_p tag)
     }
 
     tag->write_in_progress = 1;
+    tag->offset = 0;
+
+    rc = build_write_request(tag);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        tag->write_in_progress = 0;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * write_chunk_size
+ *
+ * How many bytes the next range write will carry.  Zero if nothing
+ * fits in a packet.
+ */
+
+static int write_chunk_size(ab_tag_p tag)
+{
+    int overhead;
+    int data_per_packet;
 
     /* How much overhead? */
     overhead =   1  /* pccc command */
@@ -441,56 +504,66 @@ int tag_write_start(ab_tag_p tag)
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
+    if(data_per_packet > PCCC_MAX_DATA_PER_PACKET) {
+        data_per_packet = PCCC_MAX_DATA_PER_PACKET;
+    }
+
+    /* transfers are in words. */
+    data_per_packet &= ~1;
+
     if(data_per_packet <= 0) {
         pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead, session_get_max_payload(tag->session));
-        tag->write_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+        return 0;
     }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Tag size is %d, write overhead is %d, and write data per packet is %d.", session_get_max_payload(tag->session), overhead, data_per_packet);
-        tag->write_in_progress = 0;
+    if(data_per_packet > (tag->size - tag->offset)) {
+        data_per_packet = tag->size - tag->offset;
+    }
+
+    return data_per_packet;
+}
+
+
+
+
+static int build_write_request(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int header_size = pccc_eip_header_size(tag->use_connected_msg);
+    pccc_req *pccc;
+    uint8_t *data;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    int chunk_size;
+    ab_request_p req = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    chunk_size = write_chunk_size(tag);
+    if(chunk_size <= 0) {
         return PLCTAG_ERR_TOO_LARGE;
     }
 
+    pdebug(DEBUG_DETAIL, "Writing %d bytes at offset %d of %d.", chunk_size, tag->offset, tag->size);
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->write_in_progress = 0;
         return rc;
     }
 
-    pccc = (pccc_req *)(req->data);
-
-    /* set up the embedded PCCC packet */
-    embed_start = (uint8_t *)(&pccc->service_code);
+    pccc = (pccc_req *)(req->data + header_size);
 
     /* point to the end of the struct */
-    data = (req->data) + sizeof(pccc_req);
+    data = ((uint8_t *)pccc) + sizeof(pccc_req);
 
     /* copy encoded tag name into the request */
     mem_copy(data, tag->encoded_name, tag->encoded_name_size);
     data += tag->encoded_name_size;
 
     /* now copy the data to write */
-    mem_copy(data, tag->data, tag->size);
-    data += tag->size;
-
-    /* now fill in the rest of the structure. */
-
-    /* encap fields */
-    pccc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
-
-    /* router timeout */
-    pccc->router_timeout = h2le16(1);                 /* one second timeout, enough? */
-
-    /* Common Packet Format fields for unconnected send. */
-    pccc->cpf_item_count        = h2le16(2);                /* ALWAYS 2 */
-    pccc->cpf_nai_item_type     = h2le16(AB_EIP_ITEM_NAI);  /* ALWAYS 0 */
-    pccc->cpf_nai_item_length   = h2le16(0);                /* ALWAYS 0 */
-    pccc->cpf_udi_item_type     = h2le16(AB_EIP_ITEM_UDI);  /* ALWAYS 0x00B2 - Unconnected Data Item */
-    pccc->cpf_udi_item_length   = h2le16((uint16_t)(data - embed_start));  /* REQ: fill in with length of remaining data. */
+    mem_copy(data, tag->data + tag->offset, chunk_size);
+    data += chunk_size;
 
     /* Command Routing */
     pccc->service_code = AB_EIP_CMD_PCCC_EXECUTE;  /* ALWAYS 0x4B, Execute PCCC */
@@ -510,18 +583,20 @@ int tag_write_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_PLC5_RANGE_WRITE_FUNC;
-    pccc->pccc_transfer_offset = h2le16((uint16_t)0);
+    pccc->pccc_transfer_offset = h2le16((uint16_t)((tag->offset)/2));  /* offset in 2-byte words */
     pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
 
+    /* fill in the EIP framing for the transport we use. */
+    pccc_eip_fill_header(req->data, tag->use_connected_msg, req->request_size);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->write_in_progress = 0;
 
         tag->req = rc_dec(req);
 
@@ -531,9 +606,6 @@ int tag_write_start(ab_tag_p tag)
     /* save the request for later */
     tag->req = req;
 
-    /* save the request for later */
-    tag->req = req;
-
 //    tag->status = PLCTAG_STATUS_PENDING;
 
     pdebug(DEBUG_INFO, "Done.");
@@ -546,12 +618,12 @@ int tag_write_start(ab_tag_p tag)
 /*
  * check_write_status
  *
- * Fragments are not supported.
+ * Each slice is sent once the previous one has been acknowledged.
  */
 static int check_write_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
-//    uint8_t *data = NULL;
+    pccc_reply *pccc;
+    uint8_t *data_end = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -573,6 +645,8 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        ab_tag_save_req_times(tag, tag->req);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -598,26 +672,17 @@ static int check_write_status(ab_tag_p tag)
 
     /* the request is ours exclusively. */
 
-    pccc = (pccc_resp *)(tag->req->data);
-
-    /* point to the start of the data */
-//    data = (uint8_t *)pccc + sizeof(*pccc);
+    /* find the PCCC reply behind the EIP framing. */
+    pccc = (pccc_reply *)pccc_eip_reply(tag->req->data, &data_end);
 
     /* fake exception */
     do {
         /* check the response status */
-        if( le2h16(pccc->encap_command) != AB_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", pccc->encap_command);
+        if(!pccc) {
             rc = PLCTAG_ERR_BAD_DATA;
             break;
         }
 
-        if(le2h32(pccc->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(pccc->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
         if(pccc->general_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d", pccc->general_status);
             rc = PLCTAG_ERR_REMOTE_ERR;
@@ -630,13 +695,25 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        tag->offset += write_chunk_size(tag);
+
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
     /* clean up the request */
     tag->req->abort_request = 1;
     tag->req = rc_dec(tag->req);
+
+    /* more of the file to send? */
+    if(rc == PLCTAG_STATUS_OK && tag->offset < tag->size) {
+        rc = build_write_request(tag);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            return rc;
+        }
+    }
+
     tag->write_in_progress = 0;
+    tag->offset = 0;
 
     pdebug(DEBUG_SPEW, "Done.");
 
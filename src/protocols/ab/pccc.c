@@ -24,12 +24,12 @@
 #include <lib/tag.h>
 #include <platform.h>
 #include <ab/ab_common.h>
+#include <ab/defs.h>
 #include <ab/pccc.h>
 #include <util/debug.h>
 
 
 
-static int parse_pccc_logical_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *sub_elem_num);
 static int parse_pccc_file_type(const char **str, pccc_file_t *file_type);
 static int parse_pccc_file_num(const char **str, int *file_num);
 static int parse_pccc_elem_num(const char **str, int *elem_num);
@@ -142,7 +142,6 @@ static int encode_file_type(pccc_file_t file_type);
 int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size)
 {
     int rc = PLCTAG_STATUS_OK;
-    uint8_t level_byte = 0;
     int file_num = 0;
     int elem_num = 0;
     int subelem_num = 0;
@@ -157,7 +156,7 @@ int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
     *size = 0;
     *file_type = PCCC_FILE_UNKNOWN;
 
-    if((rc = parse_pccc_logical_address(name, file_type, &file_num, &elem_num, &subelem_num)) != PLCTAG_STATUS_OK) {
+    if((rc = pccc_parse_logical_address(name, file_type, &file_num, &elem_num, &subelem_num)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to parse PCCC logical addresss!");
         return rc;
     }
@@ -168,27 +167,7 @@ int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
         return PLCTAG_ERR_TOO_SMALL;
     }
 
-    /* allocate space for the level byte */
-    *size = 1;
-
-    /* do the required levels.  Remember we start at the low bit! */
-    level_byte = 0x06; /* level one and two */
-
-    /* add in the data file number. */
-    encode_data(data, size, file_num);
-
-    /* add in the element number */
-    encode_data(data, size, elem_num);
-
-    /* check to see if we need to put in a subelement. */
-    if(subelem_num >= 0) {
-        level_byte |= 0x08;
-
-        encode_data(data, size, subelem_num);
-    }
-
-    /* store the encoded levels. */
-    data[0] = level_byte;
+    plc5_encode_logical_address(data, size, file_num, elem_num, subelem_num);
 
     pdebug(DEBUG_DETAIL,"Done.");
 
@@ -212,7 +191,6 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
 {
     int rc = PLCTAG_STATUS_OK;
     int file_num = 0;
-    int encoded_file_type = 0;
     int elem_num = 0;
     int subelem_num = 0;
 
@@ -226,7 +204,7 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
     *size = 0;
     *file_type = PCCC_FILE_UNKNOWN;
 
-    if((rc = parse_pccc_logical_address(name, file_type, &file_num, &elem_num, &subelem_num)) != PLCTAG_STATUS_OK) {
+    if((rc = pccc_parse_logical_address(name, file_type, &file_num, &elem_num, &subelem_num)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to parse SLC logical addresss!");
         return rc;
     }
@@ -237,12 +215,75 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
         return PLCTAG_ERR_TOO_SMALL;
     }
 
-    encoded_file_type = encode_file_type(*file_type);
+    if((rc = slc_encode_logical_address(data, size, *file_type, file_num, elem_num, subelem_num)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    pdebug(DEBUG_DETAIL,"Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+/*
+ * Encode an already parsed PLC/5 logical address.  The buffer must
+ * hold at least 10 bytes.
+ */
+
+int plc5_encode_logical_address(uint8_t *data, int *size, int file_num, int elem_num, int subelem_num)
+{
+    uint8_t level_byte = 0;
+
+    /* allocate space for the level byte */
+    *size = 1;
+
+    /* do the required levels.  Remember we start at the low bit! */
+    level_byte = 0x06; /* level one and two */
+
+    /* add in the data file number. */
+    encode_data(data, size, file_num);
+
+    /* add in the element number */
+    encode_data(data, size, elem_num);
+
+    /* check to see if we need to put in a subelement. */
+    if(subelem_num >= 0) {
+        level_byte |= 0x08;
+
+        encode_data(data, size, subelem_num);
+    }
+
+    /* store the encoded levels. */
+    data[0] = level_byte;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * Encode an already parsed SLC logical address.  This lets the
+ * multi-packet code step the element number along a data file.
+ * The buffer must hold at least 10 bytes.
+ */
+
+int slc_encode_logical_address(uint8_t *data, int *size, pccc_file_t file_type, int file_num, int elem_num, int subelem_num)
+{
+    int encoded_file_type = encode_file_type(file_type);
+
     if(encoded_file_type == 0) {
-        pdebug(DEBUG_WARN,"SLC file type %d cannot be decoded!", *file_type);
+        pdebug(DEBUG_WARN,"SLC file type %d cannot be decoded!", file_type);
         return PLCTAG_ERR_BAD_PARAM;
     }
 
+    *size = 0;
+
     /* encode the file number */
     encode_data(data, size, file_num);
 
@@ -255,14 +296,88 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
     /* add in the sub-element number */
     encode_data(data, size, (subelem_num < 0 ? 0 : subelem_num));
 
-    pdebug(DEBUG_DETAIL,"Done.");
-
     return PLCTAG_STATUS_OK;
 }
 
 
 
 
+/*
+ * PCCC Execute requests go out either as unconnected messages or,
+ * over a Forward Open connection, as connected messages.  Only the EIP
+ * framing in front of the Execute service differs.  The connection ID
+ * and sequence number are filled in by the session when it sends.
+ */
+
+int pccc_eip_header_size(int connected)
+{
+    if(connected) {
+        return (int)sizeof(eip_cip_co_req);
+    }
+
+    /* the unconnected header without the Connection Manager fields. */
+    return (int)sizeof(eip_encap) + 4 + 2 + 2 + 4 + 4;
+}
+
+
+
+void pccc_eip_fill_header(uint8_t *data, int connected, int request_size)
+{
+    int header_size = pccc_eip_header_size(connected);
+
+    if(connected) {
+        eip_cip_co_req *co = (eip_cip_co_req *)data;
+
+        co->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        co->router_timeout = h2le16(0);            /* zero for connected sends */
+        co->cpf_item_count = h2le16(2);            /* ALWAYS 2 */
+        co->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+        co->cpf_cai_item_length = h2le16(4);       /* ALWAYS 4, size of connection ID*/
+        co->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+        co->cpf_cdi_item_length = h2le16((uint16_t)(request_size - header_size + (int)sizeof(co->cpf_conn_seq_num)));
+    } else {
+        eip_cip_uc_req *uc = (eip_cip_uc_req *)data;
+
+        uc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+        uc->router_timeout = h2le16(1);            /* one second timeout, enough? */
+        uc->cpf_item_count = h2le16(2);            /* ALWAYS 2 */
+        uc->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+        uc->cpf_nai_item_length = h2le16(0);
+        uc->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+        uc->cpf_udi_item_length = h2le16((uint16_t)(request_size - header_size));
+    }
+}
+
+
+
+/*
+ * Find the PCCC Execute reply in a response of either kind.  Returns
+ * NULL if the EIP layer reported a problem.  data_end is set to the
+ * end of the response.
+ */
+
+uint8_t *pccc_eip_reply(uint8_t *data, uint8_t **data_end)
+{
+    eip_encap *encap = (eip_encap *)data;
+    int connected = 0;
+
+    if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
+        connected = 1;
+    } else if(le2h16(encap->encap_command) != AB_EIP_UNCONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(encap->encap_command));
+        return NULL;
+    }
+
+    if(le2h32(encap->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(encap->encap_status));
+        return NULL;
+    }
+
+    *data_end = data + le2h16(encap->encap_length) + sizeof(eip_encap);
+
+    return data + pccc_eip_header_size(connected);
+}
+
 
 
 
@@ -638,7 +753,7 @@ int pccc_encode_dt_byte(uint8_t *data,int buf_size, uint32_t data_type, uint32_t
 
 
 
-static int parse_pccc_logical_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *subelem_num)
+int pccc_parse_logical_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *subelem_num)
 {
     int rc = PLCTAG_STATUS_OK;
     const char *p = name;
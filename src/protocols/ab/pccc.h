@@ -38,8 +38,21 @@ typedef enum { PCCC_FILE_UNKNOWN, PCCC_FILE_ASCII, PCCC_FILE_BIT, PCCC_FILE_BLOC
                PCCC_FILE_PID, PCCC_FILE_CONTROL, PCCC_FILE_STATUS, PCCC_FILE_SFC, PCCC_FILE_STRING, PCCC_FILE_TIMER
              } pccc_file_t;
 
+/*
+ * Most data a single PCCC read or write carries.  The read size is sent
+ * in one byte and PLC/SLC bridges cap it lower still.
+ */
+#define PCCC_MAX_DATA_PER_PACKET (236)
+
+extern int pccc_parse_logical_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *subelem_num);
+extern int plc5_encode_logical_address(uint8_t *data, int *size, int file_num, int elem_num, int subelem_num);
+extern int slc_encode_logical_address(uint8_t *data, int *size, pccc_file_t file_type, int file_num, int elem_num, int subelem_num);
+
 extern int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
 extern int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
+extern int pccc_eip_header_size(int connected);
+extern void pccc_eip_fill_header(uint8_t *data, int connected, int request_size);
+extern uint8_t *pccc_eip_reply(uint8_t *data, uint8_t **data_end);
 extern uint8_t pccc_calculate_bcc(uint8_t *data,int size);
 extern uint16_t pccc_calculate_crc16(uint8_t *data, int size);
 extern const char *pccc_decode_error(uint8_t *error_ptr);
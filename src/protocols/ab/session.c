@@ -24,11 +24,15 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/error_codes.h>
+#include <ab/pccc.h>
 #include <ab/session.h>
+#include <ab/udt.h>
 #include <util/debug.h>
+#include <util/trace.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #define MAX_REQUESTS (200)
@@ -56,15 +60,16 @@
 
 
 
-static ab_session_p session_create_unsafe(const char *host, int gw_port, const char *path, plc_type_t plc_type, int use_connected_msg);
+static ab_session_p session_create_unsafe(const char *host, int gw_port, const char *path, const char *proxy, plc_type_t plc_type, int use_connected_msg);
 static int session_init(ab_session_p session);
 //static int get_plc_type(attr attribs);
 static int add_session_unsafe(ab_session_p n);
 static int remove_session_unsafe(ab_session_p n);
-static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path);
-static int session_match_valid(const char *host, const char *path, ab_session_p session);
+static ab_session_p find_session_by_host_unsafe(const char *gateway, int port, const char *path, const char *proxy);
+static int session_match_valid(const char *host, int port, const char *path, const char *proxy, ab_session_p session);
 static int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
 static int session_open_socket(ab_session_p session);
+static int session_open_proxy_socket(ab_session_p session);
 static void session_destroy(void *session);
 static int session_register(ab_session_p session);
 static int session_close_socket(ab_session_p session);
@@ -72,9 +77,19 @@ static int session_unregister(ab_session_p session);
 static THREAD_FUNC(session_handler);
 static int purge_aborted_requests_unsafe(ab_session_p session);
 static int process_requests(ab_session_p session);
+static int batch_hold_unsafe(ab_session_p session);
+static int coalesce_requests_unsafe(ab_session_p session);
+static int build_merged_cip_read(ab_request_p merged, ab_request_p first, uint32_t lo, uint32_t hi);
+static int build_merged_pccc_read(ab_request_p merged, ab_request_p first, uint32_t lo, uint32_t hi);
+static int scatter_merged_response(ab_session_p session, ab_request_p merged);
+static int scatter_merged_pccc_response(ab_request_p merged);
+static void requeue_merged_requests(ab_session_p session, ab_request_p merged);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
+static int get_packing_space(ab_session_p session, ab_request_p first);
+static int same_packet_type(ab_request_p first, ab_request_p request);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
+static int pack_unconnected_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
 static int recv_eip_response(ab_session_p session, int timeout);
@@ -88,8 +103,15 @@ static int send_forward_open_req_ex(ab_session_p session);
 static int recv_forward_open_resp(ab_session_p session, int *max_payload_size_guess);
 static int send_forward_close_req(ab_session_p session);
 static int recv_forward_close_resp(ab_session_p session);
+static ab_request_p request_alloc(int tag_id, int request_capacity);
 static void request_destroy(void *req_arg);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
+static int rtt_bucket(int64_t rtt_us);
+static int64_t rtt_bucket_limit(int bucket);
+static int64_t rtt_percentile_unsafe(ab_session_p session, int percent);
+static void put_stats_u64(uint8_t *record, int offset, uint64_t val);
+static void put_stats_u32(uint8_t *record, int offset, uint32_t val);
+static void encode_stats_unsafe(ab_session_p session, uint8_t *record);
 
 
 static volatile mutex_p session_mutex = NULL;
@@ -195,11 +217,58 @@ int session_get_max_payload(ab_session_p session)
     return result;
 }
 
+/*
+ * session_get_stats
+ *
+ * Copy a statistics record for each session into buf.  The layout of
+ * the records is in libplctag.h.  Returns the number of bytes needed
+ * for all the records.  Only whole records that fit are copied, so call
+ * with a NULL buf to get the size first.
+ */
+
+int session_get_stats(uint8_t *buf, int buf_size)
+{
+    int needed = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(session_mutex) {
+        needed = vector_length(sessions) * PLCTAG_STATS_RECORD_SIZE;
+
+        for(int i=0; i < vector_length(sessions); i++) {
+            ab_session_p session = vector_get(sessions, i);
+            uint8_t *record = buf + (i * PLCTAG_STATS_RECORD_SIZE);
+
+            if(!buf || ((i + 1) * PLCTAG_STATS_RECORD_SIZE) > buf_size) {
+                break;
+            }
+
+            mem_set(record, 0, PLCTAG_STATS_RECORD_SIZE);
+
+            /* a new session may not have its mutex yet. */
+            if(!session->mutex) {
+                continue;
+            }
+
+            critical_block(session->mutex) {
+                encode_stats_unsafe(session, record);
+            }
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return needed;
+}
+
+
+
 int session_find_or_create(ab_session_p *tag_session, attr attribs)
 {
     /*int debug = attr_get_int(attribs,"debug",0);*/
     const char *session_gw = attr_get_str(attribs, "gateway", "");
     const char *session_path = attr_get_str(attribs, "path", "");
+    const char *session_proxy = attr_get_str(attribs, "proxy", "");
     int use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
     int session_gw_port = attr_get_int(attribs, "gateway_port", AB_EIP_DEFAULT_PORT);
     plc_type_t plc_type = get_plc_type(attribs);
@@ -209,6 +278,8 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     int rc = PLCTAG_STATUS_OK;
     int auto_disconnect_enabled = 0;
     int auto_disconnect_timeout_ms = INT_MAX;
+    int read_coalesce_gap = attr_get_int(attribs, "read_coalesce_gap", -1);
+    int batch_window_us = attr_get_int(attribs, "batch_window_us", 0);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
@@ -218,16 +289,33 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
         auto_disconnect_enabled = 1;
     }
 
+    if(batch_window_us < 0) {
+        pdebug(DEBUG_WARN, "batch_window_us must not be negative, using zero.");
+        batch_window_us = 0;
+    }
+
+    /* coalescing is off unless asked for, any negative value means not set. */
+    if(read_coalesce_gap < 0) {
+        read_coalesce_gap = -1;
+    }
+
     if(plc_type == AB_PROTOCOL_PLC && str_length(session_path) > 0) {
         /* this means it is DH+ */
         use_connected_msg = 1;
         attr_set_int(attribs, "use_connected_msg", 1);
     }
 
+    /* the proxy holds the connection to the PLC, we just send it unconnected messages. */
+    if(str_length(session_proxy) > 0 && use_connected_msg) {
+        pdebug(DEBUG_DETAIL, "Using unconnected messages to proxy %s.", session_proxy);
+        use_connected_msg = 0;
+        attr_set_int(attribs, "use_connected_msg", 0);
+    }
+
     critical_block(session_mutex) {
         /* if we are to share sessions, then look for an existing one. */
         if (shared_session) {
-            session = find_session_by_host_unsafe(session_gw, session_path);
+            session = find_session_by_host_unsafe(session_gw, session_gw_port, session_path, session_proxy);
         } else {
             /* no sharing, create a new one */
             session = AB_SESSION_NULL;
@@ -235,7 +323,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
 
         if (session == AB_SESSION_NULL) {
             pdebug(DEBUG_DETAIL, "Creating new session.");
-            session = session_create_unsafe(session_gw, session_gw_port, session_path, plc_type, use_connected_msg);
+            session = session_create_unsafe(session_gw, session_gw_port, session_path, session_proxy, plc_type, use_connected_msg);
 
             if (session == AB_SESSION_NULL) {
                 pdebug(DEBUG_WARN, "unable to create or find a session!");
@@ -243,6 +331,8 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
             } else {
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                session->read_coalesce_gap = read_coalesce_gap;
+                session->batch_window_us = batch_window_us;
 
                 new_session = 1;
             }
@@ -257,6 +347,16 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
             }
 
+            /* the batching window only goes up, the default of zero does not turn it off. */
+            if(session->batch_window_us < batch_window_us) {
+                session->batch_window_us = batch_window_us;
+            }
+
+            /* the coalescing gap only goes down, tags that do not set it leave it alone. */
+            if(read_coalesce_gap >= 0 && (session->read_coalesce_gap < 0 || session->read_coalesce_gap > read_coalesce_gap)) {
+                session->read_coalesce_gap = read_coalesce_gap;
+            }
+
             pdebug(DEBUG_DETAIL, "Reusing existing session.");
         }
     }
@@ -389,7 +489,7 @@ int remove_session(ab_session_p s)
 }
 
 
-int session_match_valid(const char *host, const char *path, ab_session_p session)
+int session_match_valid(const char *host, int port, const char *path, const char *proxy, ab_session_p session)
 {
     if(!session) {
         return 0;
@@ -404,15 +504,24 @@ int session_match_valid(const char *host, const char *path, ab_session_p session
         return 0;
     }
 
+    if(port != session->port) {
+        return 0;
+    }
+
     if(str_cmp_i(path, session->path)) {
         return 0;
     }
 
+    /* a session through a proxy is not the same as a direct one. */
+    if(str_cmp_i(proxy, session->proxy)) {
+        return 0;
+    }
+
     return 1;
 }
 
 
-ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
+ab_session_p find_session_by_host_unsafe(const char *host, int port, const char *path, const char *proxy)
 {
     for(int i=0; i < vector_length(sessions); i++) {
         ab_session_p session = vector_get(sessions, i);
@@ -420,7 +529,7 @@ ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
         /* is this session in the process of destruction? */
         session = rc_inc(session);
         if(session) {
-            if(session_match_valid(host, path, session)) {
+            if(session_match_valid(host, port, path, proxy, session)) {
                 return session;
             }
 
@@ -433,7 +542,7 @@ ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
 
 
 
-ab_session_p session_create_unsafe(const char *host, int gw_port, const char *path, plc_type_t plc_type, int use_connected_msg)
+ab_session_p session_create_unsafe(const char *host, int gw_port, const char *path, const char *proxy, plc_type_t plc_type, int use_connected_msg)
 {
     static volatile uint32_t connection_id = 0;
 
@@ -442,8 +551,6 @@ ab_session_p session_create_unsafe(const char *host, int gw_port, const char *pa
 
     pdebug(DEBUG_INFO, "Starting");
 
-    pdebug(DEBUG_DETAIL, "Warning: not using passed port %d", gw_port);
-
     session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy);
     if (!session) {
         pdebug(DEBUG_WARN, "Error allocating new session.");
@@ -457,6 +564,8 @@ ab_session_p session_create_unsafe(const char *host, int gw_port, const char *pa
         return NULL;
     }
 
+    session->port = gw_port;
+
     session->path = str_dup(path);
     if(path && str_length(path) && !session->path) {
         pdebug(DEBUG_WARN, "Unable to duplicate path string!");
@@ -464,6 +573,13 @@ ab_session_p session_create_unsafe(const char *host, int gw_port, const char *pa
         return NULL;
     }
 
+    session->proxy = str_dup(proxy ? proxy : "");
+    if(!session->proxy) {
+        pdebug(DEBUG_WARN, "Unable to duplicate proxy string!");
+        rc_dec(session);
+        return NULL;
+    }
+
     rc = cip_encode_path(path, use_connected_msg, plc_type, &session->conn_path, &session->conn_path_size, &session->dhp_dest);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO, "Unable to convert path links strings to binary path!");
@@ -593,7 +709,11 @@ int session_open_socket(ab_session_p session)
         return 0;
     }
 
-    rc = socket_connect_tcp(session->sock, session->host, AB_EIP_DEFAULT_PORT);
+    if(str_length(session->proxy) > 0) {
+        rc = session_open_proxy_socket(session);
+    } else {
+        rc = socket_connect_tcp(session->sock, session->host, session->port);
+    }
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to connect socket for session!");
@@ -607,6 +727,60 @@ int session_open_socket(ab_session_p session)
 
 
 
+/*
+ * session_open_proxy_socket()
+ *
+ * Connect to a local proxy instead of the gateway.  The proxy is
+ * either "unix:/some/path" for a local socket or "host:port".  The
+ * port defaults to the EIP port.
+ */
+
+int session_open_proxy_socket(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+    const char *proxy = session->proxy;
+    char *host = NULL;
+    char *colon = NULL;
+    int port = AB_EIP_DEFAULT_PORT;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(strncmp(proxy, "unix:", 5) == 0) {
+        rc = socket_connect_unix(session->sock, proxy + 5);
+
+        pdebug(DEBUG_INFO, "Done.");
+
+        return rc;
+    }
+
+    host = str_dup(proxy);
+    if(!host) {
+        pdebug(DEBUG_WARN, "Unable to copy proxy string!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    colon = strchr(host, ':');
+    if(colon) {
+        *colon = 0;
+
+        if(str_to_int(colon + 1, &port) != 0 || port <= 0 || port > 65535) {
+            pdebug(DEBUG_WARN, "Proxy port in \"%s\" is not valid!", proxy);
+            mem_free(host);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    rc = socket_connect_tcp(session->sock, host, port);
+
+    mem_free(host);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
 int session_register(ab_session_p session)
 {
     eip_session_reg_req *req;
@@ -734,6 +908,7 @@ void session_destroy(void *session_arg)
     remove_session(session);
 
     pdebug(DEBUG_INFO, "Session sent %"PRId64" packets.", session->packet_count);
+    pdebug(DEBUG_INFO, "Session sent %"PRIu64" request packets carrying %"PRIu64" requests.", session->bundle_count, session->bundled_request_count);
 
     /* terminate the session thread first. */
     session->terminating = 1;
@@ -791,6 +966,8 @@ void session_destroy(void *session_arg)
         session->mutex = NULL;
     }
 
+    udt_cache_destroy(session);
+
     if(session->conn_path) {
         mem_free(session->conn_path);
         session->conn_path = NULL;
@@ -806,6 +983,11 @@ void session_destroy(void *session_arg)
         session->host = NULL;
     }
 
+    if(session->proxy) {
+        mem_free(session->proxy);
+        session->proxy = NULL;
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return;
@@ -823,7 +1005,7 @@ int session_add_request_unsafe(ab_session_p session, ab_request_p req)
 {
     int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
     if(!session) {
         pdebug(DEBUG_WARN, "Session is null!");
@@ -839,12 +1021,20 @@ int session_add_request_unsafe(ab_session_p session, ab_request_p req)
 
     /* make sure the request points to the session */
 
+    req->time_queued_us = time_mono_us();
+
     /* insert into the requests vector */
     vector_put(session->requests, vector_length(session->requests), req);
 
-    pdebug(DEBUG_INFO, "Total requests in the queue: %d", vector_length(session->requests));
+    if(vector_length(session->requests) > session->stats.max_queue_depth) {
+        session->stats.max_queue_depth = vector_length(session->requests);
+    }
 
-    pdebug(DEBUG_INFO, "Done.");
+    trace_event(TRACE_REQUEST_QUEUED, req->tag_id, req->request_size, vector_length(session->requests), 0);
+
+    pdebug(DEBUG_DETAIL, "Total requests in the queue: %d", vector_length(session->requests));
+
+    pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
 }
@@ -956,6 +1146,10 @@ THREAD_FUNC(session_handler)
                 auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
                 //}
 
+                critical_block(session->mutex) {
+                    session->stats.connects++;
+                }
+
                 state = SESSION_REGISTER;
             }
             break;
@@ -1130,7 +1324,12 @@ THREAD_FUNC(session_handler)
          * doing some linked states.
          */
         if(idle && !session->terminating) {
-            sleep_ms(1);
+            /* do not oversleep a short batching window. */
+            if(session->batch_hold_us > 0 && session->batch_hold_us < 1000) {
+                sleep_us(session->batch_hold_us);
+            } else {
+                sleep_ms(1);
+            }
         }
     }
 
@@ -1142,6 +1341,8 @@ THREAD_FUNC(session_handler)
         purge_aborted_requests_unsafe(session);
     }
 
+    trace_thread_done();
+
     THREAD_RETURN(0);
 }
 
@@ -1202,6 +1403,12 @@ int process_requests(ab_session_p session)
     ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
     int num_bundled_requests = 0;
     int remaining_space = 0;
+    int packable = 0;
+    int64_t pack_time_us = 0;
+    int64_t send_time_us = 0;
+    int64_t recv_time_us = 0;
+    int64_t acquired_time_us = 0;
+    uint32_t bytes_sent = 0;
 
     debug_set_tag_id(0);
 
@@ -1218,6 +1425,7 @@ int process_requests(ab_session_p session)
     request = NULL;
     session->data_size = 0;
     session->data_offset = 0;
+    session->batch_hold_us = 0;
 
     /* grab a request off the front of the list. */
     critical_block(session->mutex) {
@@ -1228,13 +1436,23 @@ int process_requests(ab_session_p session)
 
             /* if there are still requests after purging all the aborted requests, process them. */
 
-            /* how much space do we have to work with. */
-            remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+            /* merge reads of nearby elements of the same array into one read. */
+            if(session->read_coalesce_gap >= 0 && vector_length(session->requests)) {
+                coalesce_requests_unsafe(session);
+            }
+
+            if(vector_length(session->requests) && batch_hold_unsafe(session)) {
+                pdebug(DEBUG_SPEW, "Holding %d requests for up to %dus for more to pack with them.", vector_length(session->requests), session->batch_hold_us);
+            } else if(vector_length(session->requests)) {
+                /* how much space do we have to work with. */
+                remaining_space = get_packing_space(session, vector_get(session->requests, 0));
 
-            if(vector_length(session->requests)) {
                 do {
                     request = vector_get(session->requests, 0);
 
+                    /* connected and unconnected requests cannot share a packet. */
+                    packable = request->allow_packing && (num_bundled_requests == 0 || same_packet_type(bundled_requests[0], request));
+
                     remaining_space = remaining_space - get_payload_size(request);
 
                     /*
@@ -1242,7 +1460,7 @@ int process_requests(ab_session_p session)
                      * If the request is packable, keep queuing as long as there is space.
                      */
 
-                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
+                    if(num_bundled_requests == 0 || (packable && remaining_space > 0)) {
                         //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
                         bundled_requests[num_bundled_requests] = request;
                         num_bundled_requests++;
@@ -1250,7 +1468,7 @@ int process_requests(ab_session_p session)
                         /* remove it from the queue. */
                         vector_remove(session->requests, 0);
                     }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && packable);
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
@@ -1272,6 +1490,12 @@ int process_requests(ab_session_p session)
                 break;
             }
 
+            pack_time_us = time_mono_us();
+
+            for(int i=0; i < num_bundled_requests; i++) {
+                bundled_requests[i]->time_packed_us = pack_time_us;
+            }
+
             /* fill in all the necessary parts to the request. */
             if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
@@ -1279,17 +1503,55 @@ int process_requests(ab_session_p session)
             }
 
             /* send the request */
+            send_time_us = time_mono_us();
+            bytes_sent = session->data_size;
+
             if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
                 break;
             }
 
+            for(int i=0; i < num_bundled_requests; i++) {
+                bundled_requests[i]->time_sent_us = send_time_us;
+            }
+
+            trace_event(TRACE_PACKET_SENT, 0, bytes_sent, num_bundled_requests, 0);
+
+            critical_block(session->mutex) {
+                session->bundle_count++;
+                session->bundled_request_count += (uint64_t)num_bundled_requests;
+                session->stats.bytes_sent += bytes_sent;
+            }
+
             /* wait for the response */
             if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
                 break;
             }
 
+            /* the tags see these once the response is unpacked. */
+            recv_time_us = time_mono_us();
+            acquired_time_us = time_us();
+
+            for(int i=0; i < num_bundled_requests; i++) {
+                bundled_requests[i]->time_received_us = recv_time_us;
+                bundled_requests[i]->time_acquired_us = acquired_time_us;
+            }
+
+            trace_event(TRACE_PACKET_RECEIVED, 0, session->data_size, recv_time_us - send_time_us, le2h32(((eip_encap *)(session->data))->encap_status));
+
+            critical_block(session->mutex) {
+                int64_t rtt_us = recv_time_us - send_time_us;
+
+                session->stats.packets_received++;
+                session->stats.bytes_received += session->data_size;
+                session->stats.rtt_hist[rtt_bucket(rtt_us)]++;
+
+                if(rtt_us > session->stats.rtt_max_us) {
+                    session->stats.rtt_max_us = rtt_us;
+                }
+            }
+
             /*
              * check the CIP status, but only if this is a bundled
              * response.   If it is a singleton, then we pass the
@@ -1306,6 +1568,13 @@ int process_requests(ab_session_p session)
                         pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
                         break;
                     }
+
+                    /* the router may have answered for the whole Unconnected Send instead. */
+                    if(resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
+                        pdebug(DEBUG_WARN, "Expected a multiple service response but got service %x!", resp->reply_service);
+                        rc = PLCTAG_ERR_BAD_REPLY;
+                        break;
+                    }
                 } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
                     eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
                     pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
@@ -1323,12 +1592,23 @@ int process_requests(ab_session_p session)
             for(int i=0; i < num_bundled_requests; i++) {
                 debug_set_tag_id(bundled_requests[i]->tag_id);
 
-                rc = unpack_response(session, bundled_requests[i], i);
+                /* a lone request gets the reply as is, even if it was a Multiple Service request itself. */
+                rc = unpack_response(session, bundled_requests[i], (num_bundled_requests > 1 ? i : -1));
+
+                trace_event(TRACE_REQUEST_DONE, bundled_requests[i]->tag_id, rc, bundled_requests[i]->request_size, 0);
+
                 if(rc != PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_WARN, "Unable to unpack response!");
                     break;
                 }
 
+                /* hand the data out to the original requests if we merged them. */
+                if(bundled_requests[i]->num_merged_requests > 0) {
+                    if(scatter_merged_response(session, bundled_requests[i]) != PLCTAG_STATUS_OK) {
+                        requeue_merged_requests(session, bundled_requests[i]);
+                    }
+                }
+
                 /* release our reference */
                 bundled_requests[i] = rc_dec(bundled_requests[i]);
             }
@@ -1338,8 +1618,16 @@ int process_requests(ab_session_p session)
 
         /* problem? clean up the pending requests and dump everything. */
         if(rc != PLCTAG_STATUS_OK) {
+            if(rc == PLCTAG_ERR_TIMEOUT) {
+                critical_block(session->mutex) {
+                    session->stats.timeouts++;
+                }
+            }
+
             for(int i=0; i < num_bundled_requests; i++) {
                 if(bundled_requests[i]) {
+                    trace_event(TRACE_REQUEST_DONE, bundled_requests[i]->tag_id, rc, 0, 0);
+
                     bundled_requests[i]->status = rc;
                     bundled_requests[i]->request_size = 0;
                     bundled_requests[i]->resp_received = 1;
@@ -1357,11 +1645,70 @@ int process_requests(ab_session_p session)
 }
 
 
+/*
+ * batch_hold_unsafe
+ *
+ * Decide whether to keep the queued requests a bit longer so that more
+ * requests can be packed into the same packet.  We hold until the
+ * oldest request has waited batch_window_us or until the queued
+ * requests would fill a packet, whichever is first.
+ *
+ * You must hold the session mutex before calling this!
+ */
+
+int batch_hold_unsafe(ab_session_p session)
+{
+    ab_request_p request = NULL;
+    ab_request_p first = NULL;
+    int64_t waited_us = 0;
+    int remaining_space = 0;
+
+    if(session->batch_window_us <= 0) {
+        return 0;
+    }
+
+    first = vector_get(session->requests, 0);
+
+    waited_us = time_mono_us() - first->time_queued_us;
+    if(waited_us >= session->batch_window_us) {
+        return 0;
+    }
+
+    /* if the packet is full, there is no point in waiting. */
+    remaining_space = get_packing_space(session, first);
+
+    for(int i=0; i < vector_length(session->requests) && i < MAX_REQUESTS; i++) {
+        request = vector_get(session->requests, i);
+
+        /* nothing can be packed with or past this request. */
+        if(!request->allow_packing || !same_packet_type(first, request)) {
+            return 0;
+        }
+
+        remaining_space -= get_payload_size(request);
+        if(remaining_space <= 0) {
+            return 0;
+        }
+    }
+
+    if(vector_length(session->requests) >= MAX_REQUESTS) {
+        return 0;
+    }
+
+    session->batch_hold_us = session->batch_window_us - (int)waited_us;
+
+    return 1;
+}
+
+
+
 int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(session->data);
     eip_cip_co_resp *unpacked_resp = NULL;
+    int unconnected = (le2h16(packed_resp->encap_command) == AB_EIP_UNCONNECTED_SEND);
+    uint8_t *reply_service = NULL;
     uint8_t *pkt_start = NULL;
     uint8_t *pkt_end = NULL;
     int new_eip_len = 0;
@@ -1371,8 +1718,15 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     /* clear out the request data. */
     mem_set(request->data, 0, request->request_capacity);
 
+    /* the CIP reply starts at a different place in unconnected responses. */
+    if(unconnected) {
+        reply_service = &((eip_cip_uc_resp *)(session->data))->reply_service;
+    } else {
+        reply_service = &packed_resp->reply_service;
+    }
+
     /* change what we do depending on the type. */
-    if(packed_resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
+    if(sub_packet < 0 || *reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
         /* copy the data back into the request buffer. */
         new_eip_len = (int)session->data_size;
         pdebug(DEBUG_DETAIL, "Got single response packet.  Copying %d bytes unchanged.", new_eip_len);
@@ -1401,7 +1755,7 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
         mem_copy(request->data, session->data, new_eip_len);
     } else {
-        cip_multi_resp_header *multi = (cip_multi_resp_header *)(&packed_resp->reply_service);
+        cip_multi_resp_header *multi = (cip_multi_resp_header *)reply_service;
         uint16_t total_responses = le2h16(multi->request_count);
         int pkt_len = 0;
 
@@ -1446,22 +1800,39 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
             }
         }
 
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
+        if(unconnected) {
+            eip_cip_uc_resp *unpacked_uc_resp = (eip_cip_uc_resp *)(request->data);
+
+            /* copy the header down */
+            mem_copy(request->data, session->data, (int)sizeof(eip_cip_uc_resp));
 
-        /* copy the header down */
-        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+            /* size of the new packet */
+            new_eip_len = (int)(((uint8_t *)(&unpacked_uc_resp->reply_service) + pkt_len) - (uint8_t *)(request->data));
 
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                                      /* start of the packet */
+            /* now copy the packet over that. */
+            mem_copy(&unpacked_uc_resp->reply_service, pkt_start, pkt_len);
 
-        /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
+            /* stitch up the packet sizes. */
+            unpacked_uc_resp->cpf_udi_item_length = h2le16((uint16_t)pkt_len);
+            unpacked_uc_resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+        } else {
+            /* point to the response buffer in a structured way. */
+            unpacked_resp = (eip_cip_co_resp *)(request->data);
+
+            /* copy the header down */
+            mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+
+            /* size of the new packet */
+            new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
+                                     - (uint8_t *)(request->data));                                      /* start of the packet */
+
+            /* now copy the packet over that. */
+            mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
 
-        /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+            /* stitch up the packet sizes. */
+            unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
+            unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+        }
     }
 
     pdebug(DEBUG_DETAIL, "Unpacked packet:");
@@ -1471,6 +1842,7 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     spin_block(&request->lock) {
         request->status = PLCTAG_STATUS_OK;
         request->request_size = new_eip_len;
+        request->time_unpacked_us = time_mono_us();
         request->resp_received = 1;
     }
 
@@ -1481,74 +1853,729 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
 
 
-int get_payload_size(ab_request_p request)
+/*
+ * coalesce_requests_unsafe
+ *
+ * If the request at the front of the queue is a read of array elements,
+ * look further down the queue for reads of the same array whose element
+ * ranges overlap or lie within read_coalesce_gap elements of it.  Those
+ * are pulled out of the queue and replaced by one read covering the
+ * whole range.   The original requests hang off the new one until the
+ * response is scattered back to them.
+ *
+ * We stop looking at the first request that cannot be merged so that
+ * reads are never moved ahead of writes.
+ *
+ * You must hold the session mutex before calling this!
+ */
+
+int coalesce_requests_unsafe(ab_session_p session)
 {
-    int request_data_size = 0;
-    eip_encap *header = (eip_encap *)(request->data);
-    eip_cip_co_req *co_req = NULL;
+    ab_request_p first = vector_get(session->requests, 0);
+    ab_request_p members[MAX_REQUESTS] = {NULL};
+    int member_index[MAX_REQUESTS] = {0};
+    int num_members = 0;
+    int scan_end = 0;
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    uint32_t max_elems = 0;
+    uint32_t gap = 0;
+    int changed = 0;
+    ab_request_p merged = NULL;
+    uint8_t *first_name = NULL;
+    int rc = PLCTAG_STATUS_OK;
 
-    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
-        co_req = (eip_cip_co_req *)(request->data);
-        /* get length of new request */
-        request_data_size = le2h16(co_req->cpf_cdi_item_length)
-                            - 2  /* for connection sequence ID */
-                            + 2  /* for multipacket offset */
-                            ;
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!first || !first->coalesce || first->abort_request) {
+        pdebug(DEBUG_SPEW, "Done.  Nothing to merge.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* the result must come back in one packet. */
+    if(first->coalesce == AB_COALESCE_CIP) {
+        max_elems = (uint32_t)((session->max_payload_size - 16) / first->coalesce_elem_size);
     } else {
-        pdebug(DEBUG_WARN, "Not a supported type EIP packet type %d!", le2h16(header->encap_command));
-        request_data_size = INT_MAX;
+        max_elems = (uint32_t)(PCCC_MAX_DATA_PER_PACKET / first->coalesce_elem_size);
     }
+    gap = (uint32_t)session->read_coalesce_gap;
 
-    return request_data_size;
-}
+    lo = first->coalesce_index;
+    hi = first->coalesce_index + (uint32_t)first->coalesce_count;
 
+    if(hi - lo > max_elems) {
+        pdebug(DEBUG_SPEW, "Done.  Request is too large to merge.");
+        return PLCTAG_STATUS_OK;
+    }
 
+    members[0] = first;
+    member_index[0] = 0;
+    num_members = 1;
 
+    /* find how far down the queue we can look. */
+    for(scan_end = 1; scan_end < vector_length(session->requests); scan_end++) {
+        ab_request_p req = vector_get(session->requests, scan_end);
 
-int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests)
-{
-    eip_cip_co_req *new_req = NULL;
-    eip_cip_co_req *packed_req = NULL;
-    /* FIXME - is this the right way to check? */
-    int header_size = 0;
-    cip_multi_req_header *multi_header = NULL;
-    int current_offset = 0;
-    uint8_t *pkt_start = NULL;
-    int pkt_len = 0;
-    uint8_t *first_pkt_data = NULL;
-    uint8_t *next_pkt_data = NULL;
+        if(!req->coalesce) {
+            break;
+        }
+    }
 
-    pdebug(DEBUG_INFO, "Starting.");
+    /* grow the range until nothing else fits. Ranges can join out of order. */
+    first_name = first->data + sizeof(eip_cip_co_req) + 2;
 
-    debug_set_tag_id(requests[0]->tag_id);
+    do {
+        changed = 0;
+
+        for(int i=1; i < scan_end && num_members < MAX_REQUESTS; i++) {
+            ab_request_p req = vector_get(session->requests, i);
+            uint32_t req_lo = 0;
+            uint32_t req_hi = 0;
+            uint32_t new_lo = 0;
+            uint32_t new_hi = 0;
+            int already = 0;
+
+            for(int j=1; j < num_members; j++) {
+                if(member_index[j] == i) {
+                    already = 1;
+                    break;
+                }
+            }
 
-    /* get the header info from the first request. Just copy the whole thing. */
-    mem_copy(session->data, requests[0]->data, requests[0]->request_size);
-    session->data_size = (uint32_t)requests[0]->request_size;
+            if(already || req->abort_request) {
+                continue;
+            }
 
-    /* special case the case where there is just one request. */
-    if(num_requests == 1) {
-        pdebug(DEBUG_INFO, "Only one request, so done.");
+            if(req->coalesce != first->coalesce || req->coalesce_elem_size != first->coalesce_elem_size) {
+                continue;
+            }
 
-        debug_set_tag_id(0);
+            if(first->coalesce == AB_COALESCE_CIP) {
+                if(req->coalesce_name_size != first->coalesce_name_size
+                   || mem_cmp(req->data + sizeof(eip_cip_co_req) + 2, first->coalesce_name_size, first_name, first->coalesce_name_size)) {
+                    continue;
+                }
+            } else {
+                /* PCCC, same data file. */
+                if(req->coalesce_file_type != first->coalesce_file_type || req->coalesce_file_num != first->coalesce_file_num) {
+                    continue;
+                }
+            }
 
-        return PLCTAG_STATUS_OK;
-    }
+            req_lo = req->coalesce_index;
+            req_hi = req->coalesce_index + (uint32_t)req->coalesce_count;
 
-    /* set up multi-packet header. */
+            /* too far away? */
+            if(req_lo > hi + gap || req_hi + gap < lo) {
+                continue;
+            }
 
-    header_size = (int)(sizeof(cip_multi_req_header)
-                        + (sizeof(uint16_le) * (size_t)num_requests)); /* offsets for each request. */
+            new_lo = (req_lo < lo ? req_lo : lo);
+            new_hi = (req_hi > hi ? req_hi : hi);
 
-    pdebug(DEBUG_DETAIL, "header size %d", header_size);
+            if(new_hi - new_lo > max_elems) {
+                continue;
+            }
 
-    packed_req = (eip_cip_co_req *)(session->data);
+            lo = new_lo;
+            hi = new_hi;
 
-    /* make room in the request packet in the session for the header. */
-    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
-    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
+            members[num_members] = req;
+            member_index[num_members] = i;
+            num_members++;
 
-    pdebug(DEBUG_DETAIL, "packet 0 is of length %d.", pkt_len);
+            changed = 1;
+        }
+    } while(changed);
+
+    if(num_members < 2) {
+        pdebug(DEBUG_SPEW, "Done.  No other reads to merge.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    merged = request_alloc(first->tag_id, first->request_capacity);
+    if(!merged) {
+        pdebug(DEBUG_WARN, "Unable to allocate merged request, sending reads separately.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    merged->merged_requests = (ab_request_p *)mem_alloc((int)(sizeof(ab_request_p) * (size_t)num_members));
+    if(!merged->merged_requests) {
+        pdebug(DEBUG_WARN, "Unable to allocate merged request list, sending reads separately.");
+        rc_dec(merged);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(first->coalesce == AB_COALESCE_CIP) {
+        rc = build_merged_cip_read(merged, first, lo, hi);
+    } else {
+        rc = build_merged_pccc_read(merged, first, lo, hi);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build merged request, sending reads separately.");
+        rc_dec(merged);
+        return rc;
+    }
+
+    merged->allow_packing = 1;
+    merged->time_queued_us = first->time_queued_us;
+
+    /* the queue's references move to the merged request. */
+    for(int i=0; i < num_members; i++) {
+        merged->merged_requests[i] = members[i];
+        merged->allow_packing = merged->allow_packing && members[i]->allow_packing;
+    }
+
+    merged->num_merged_requests = num_members;
+
+    /* take the others out of the queue, back to front so the indexes stay valid. */
+    for(int i = scan_end - 1; i > 0; i--) {
+        for(int j=1; j < num_members; j++) {
+            if(member_index[j] == i) {
+                vector_remove(session->requests, i);
+                break;
+            }
+        }
+    }
+
+    /* the merged request takes the place of the first one. */
+    vector_put(session->requests, 0, merged);
+
+    pdebug(DEBUG_DETAIL, "Merged %d reads into one read of %u elements starting at %u.", num_members, (unsigned int)(hi - lo), (unsigned int)lo);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * build_merged_cip_read
+ *
+ * Fill in a CIP fragmented read of elements lo up to hi of the
+ * array the first request reads.
+ */
+
+int build_merged_cip_read(ab_request_p merged, ab_request_p first, uint32_t lo, uint32_t hi)
+{
+    eip_cip_co_req *cip = NULL;
+    uint8_t *data = NULL;
+    uint8_t *name_start = NULL;
+    uint8_t *first_name = first->data + sizeof(eip_cip_co_req) + 2;
+
+    /* copy the EIP header from the first request, then build a new read. */
+    mem_copy(merged->data, first->data, (int)sizeof(eip_cip_co_req));
+
+    cip = (eip_cip_co_req *)(merged->data);
+    data = merged->data + sizeof(eip_cip_co_req);
+
+    *data = AB_EIP_CMD_CIP_READ_FRAG;
+    data++;
+
+    /* word count, fixed up below. */
+    name_start = data;
+    data++;
+
+    mem_copy(data, first_name, first->coalesce_name_size);
+    data += first->coalesce_name_size;
+
+    if(lo > 0xFFFF) {
+        *data++ = 0x2A;
+        *data++ = 0;
+        *data++ = (uint8_t)(lo & 0xFF);
+        *data++ = (uint8_t)((lo >> 8) & 0xFF);
+        *data++ = (uint8_t)((lo >> 16) & 0xFF);
+        *data++ = (uint8_t)((lo >> 24) & 0xFF);
+    } else if(lo > 0xFF) {
+        *data++ = 0x29;
+        *data++ = 0;
+        *data++ = (uint8_t)(lo & 0xFF);
+        *data++ = (uint8_t)((lo >> 8) & 0xFF);
+    } else {
+        *data++ = 0x28;
+        *data++ = (uint8_t)lo;
+    }
+
+    *name_start = (uint8_t)((data - (name_start + 1))/2);
+
+    *((uint16_le*)data) = h2le16((uint16_t)(hi - lo));
+    data += sizeof(uint16_le);
+
+    *((uint32_le*)data) = h2le32(0);
+    data += sizeof(uint32_le);
+
+    cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t*)(&cip->cpf_conn_seq_num)));
+
+    merged->request_size = (int)(data - merged->data);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * build_merged_pccc_read
+ *
+ * Fill in a PCCC read of elements lo up to hi of the data file the
+ * first request reads.  Everything before the address is the same as
+ * in the first request, apart from the sizes.
+ */
+
+int build_merged_pccc_read(ab_request_p merged, ab_request_p first, uint32_t lo, uint32_t hi)
+{
+    int connected = (le2h16(((eip_encap *)(first->data))->encap_command) == AB_EIP_CONNECTED_SEND);
+    int name_offset = first->coalesce_name_offset;
+    int byte_count = (int)(hi - lo) * first->coalesce_elem_size;
+    int name_size = 0;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    mem_copy(merged->data, first->data, name_offset);
+    data = merged->data + name_offset;
+
+    if(first->coalesce == AB_COALESCE_PLC5) {
+        rc = plc5_encode_logical_address(data, &name_size, first->coalesce_file_num, (int)lo, -1);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        data += name_size;
+
+        /* total transfer size in words before the address, bytes this time after it. */
+        *((uint16_le *)(merged->data + name_offset - 2)) = h2le16((uint16_t)(byte_count / 2));
+        *data = (uint8_t)byte_count;
+        data++;
+    } else {
+        rc = slc_encode_logical_address(data, &name_size, (pccc_file_t)first->coalesce_file_type, first->coalesce_file_num, (int)lo, -1);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        data += name_size;
+
+        /* transfer size in bytes just before the address. */
+        merged->data[name_offset - 1] = (uint8_t)byte_count;
+    }
+
+    merged->request_size = (int)(data - merged->data);
+
+    pccc_eip_fill_header(merged->data, connected, merged->request_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * scatter_merged_response
+ *
+ * Copy the parts of a merged read response back into each of the
+ * original requests as if each had been sent alone.  If the response
+ * is not a complete, successful read of the size we expect, return an
+ * error and leave the original requests alone.
+ */
+
+int scatter_merged_response(ab_session_p session, ab_request_p merged)
+{
+    eip_cip_co_resp *resp = (eip_cip_co_resp *)(merged->data);
+    uint8_t *data = merged->data + sizeof(eip_cip_co_resp);
+    uint8_t *data_end = NULL;
+    int type_size = 0;
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    int elem_size = merged->merged_requests[0]->coalesce_elem_size;
+
+    (void)session;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(merged->merged_requests[0]->coalesce != AB_COALESCE_CIP) {
+        return scatter_merged_pccc_response(merged);
+    }
+
+    if(merged->request_size < (int)sizeof(eip_cip_co_resp)) {
+        pdebug(DEBUG_DETAIL, "Merged response is too short.");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    data_end = merged->data + le2h16(resp->encap_length) + sizeof(eip_encap);
+
+    if(le2h16(resp->encap_command) != AB_EIP_CONNECTED_SEND
+       || le2h32(resp->encap_status) != AB_EIP_OK
+       || resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
+       || resp->status != AB_CIP_STATUS_OK
+       || data_end <= data) {
+        pdebug(DEBUG_DETAIL, "Merged read did not complete in one packet.");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    /* figure out how much type information precedes the data. */
+    if(*data >= AB_CIP_DATA_BIT && *data <= AB_CIP_DATA_STRINGI) {
+        type_size = 2;
+    } else if(*data == AB_CIP_DATA_ABREV_STRUCT || *data == AB_CIP_DATA_ABREV_ARRAY ||
+              *data == AB_CIP_DATA_FULL_STRUCT || *data == AB_CIP_DATA_FULL_ARRAY) {
+        type_size = *(data + 1) + 2;
+    } else {
+        pdebug(DEBUG_DETAIL, "Unsupported data type %x in merged response.", (int)*data);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    for(int i=0; i < merged->num_merged_requests; i++) {
+        ab_request_p req = merged->merged_requests[i];
+
+        if(req->coalesce_index < lo) {
+            lo = req->coalesce_index;
+        }
+
+        if(req->coalesce_index + (uint32_t)req->coalesce_count > hi) {
+            hi = req->coalesce_index + (uint32_t)req->coalesce_count;
+        }
+    }
+
+    if((data_end - data) - type_size != (int)(hi - lo) * elem_size) {
+        pdebug(DEBUG_DETAIL, "Merged response has %d bytes of data, expected %d.", (int)(data_end - data) - type_size, (int)(hi - lo) * elem_size);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    for(int i=0; i < merged->num_merged_requests; i++) {
+        ab_request_p req = merged->merged_requests[i];
+        eip_cip_co_resp *req_resp = (eip_cip_co_resp *)(req->data);
+        int slice_size = req->coalesce_count * elem_size;
+        int new_eip_len = (int)sizeof(eip_cip_co_resp) + type_size + slice_size;
+
+        debug_set_tag_id(req->tag_id);
+
+        if(new_eip_len > req->request_capacity) {
+            int rc = session_request_increase_buffer(req, new_eip_len);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                /* the ones before this got their data, this one fails. */
+                spin_block(&req->lock) {
+                    req->status = rc;
+                    req->request_size = 0;
+                    req->resp_received = 1;
+                }
+
+                merged->merged_requests[i] = rc_dec(req);
+
+                continue;
+            }
+
+            req_resp = (eip_cip_co_resp *)(req->data);
+        }
+
+        mem_set(req->data, 0, req->request_capacity);
+        mem_copy(req->data, merged->data, (int)sizeof(eip_cip_co_resp));
+        mem_copy(req->data + sizeof(eip_cip_co_resp), data, type_size);
+        mem_copy(req->data + sizeof(eip_cip_co_resp) + type_size,
+                 data + type_size + (int)(req->coalesce_index - lo) * elem_size,
+                 slice_size);
+
+        req_resp->cpf_cdi_item_length = h2le16((uint16_t)(new_eip_len - (int)((uint8_t *)(&req_resp->reply_service) - req->data) + (int)sizeof(uint16_le)));
+        req_resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+
+        spin_block(&req->lock) {
+            req->status = PLCTAG_STATUS_OK;
+            req->request_size = new_eip_len;
+            req->time_packed_us = merged->time_packed_us;
+            req->time_sent_us = merged->time_sent_us;
+            req->time_received_us = merged->time_received_us;
+            req->time_acquired_us = merged->time_acquired_us;
+            req->time_unpacked_us = time_mono_us();
+            req->resp_received = 1;
+        }
+
+        merged->merged_requests[i] = rc_dec(req);
+    }
+
+    merged->num_merged_requests = 0;
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * scatter_merged_pccc_response
+ *
+ * The PCCC version of scatter_merged_response.  Each original request
+ * gets the PCCC reply header followed by its own elements.
+ */
+
+int scatter_merged_pccc_response(ab_request_p merged)
+{
+    pccc_reply *reply = NULL;
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    int header_size = 0;
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    int elem_size = merged->merged_requests[0]->coalesce_elem_size;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(merged->request_size < pccc_eip_header_size(0) + (int)sizeof(pccc_reply)) {
+        pdebug(DEBUG_DETAIL, "Merged response is too short.");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    reply = (pccc_reply *)pccc_eip_reply(merged->data, &data_end);
+
+    if(!reply || reply->general_status != AB_EIP_OK || reply->pccc_status != AB_EIP_OK) {
+        pdebug(DEBUG_DETAIL, "Merged PCCC read failed.");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    /* everything up to the data is copied to each request. */
+    data = (uint8_t *)reply + sizeof(pccc_reply);
+    header_size = (int)(data - merged->data);
+
+    for(int i=0; i < merged->num_merged_requests; i++) {
+        ab_request_p req = merged->merged_requests[i];
+
+        if(req->coalesce_index < lo) {
+            lo = req->coalesce_index;
+        }
+
+        if(req->coalesce_index + (uint32_t)req->coalesce_count > hi) {
+            hi = req->coalesce_index + (uint32_t)req->coalesce_count;
+        }
+    }
+
+    if((int)(data_end - data) != (int)(hi - lo) * elem_size) {
+        pdebug(DEBUG_DETAIL, "Merged response has %d bytes of data, expected %d.", (int)(data_end - data), (int)(hi - lo) * elem_size);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    for(int i=0; i < merged->num_merged_requests; i++) {
+        ab_request_p req = merged->merged_requests[i];
+        int slice_size = req->coalesce_count * elem_size;
+        int new_eip_len = header_size + slice_size;
+
+        debug_set_tag_id(req->tag_id);
+
+        if(new_eip_len > req->request_capacity) {
+            int rc = session_request_increase_buffer(req, new_eip_len);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                /* the ones before this got their data, this one fails. */
+                spin_block(&req->lock) {
+                    req->status = rc;
+                    req->request_size = 0;
+                    req->resp_received = 1;
+                }
+
+                merged->merged_requests[i] = rc_dec(req);
+
+                continue;
+            }
+        }
+
+        mem_set(req->data, 0, req->request_capacity);
+        mem_copy(req->data, merged->data, header_size);
+        mem_copy(req->data + header_size, data + (int)(req->coalesce_index - lo) * elem_size, slice_size);
+
+        /* the tags only look at the EIP length to find the end of the data. */
+        ((eip_encap *)(req->data))->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+
+        spin_block(&req->lock) {
+            req->status = PLCTAG_STATUS_OK;
+            req->request_size = new_eip_len;
+            req->time_packed_us = merged->time_packed_us;
+            req->time_sent_us = merged->time_sent_us;
+            req->time_received_us = merged->time_received_us;
+            req->time_acquired_us = merged->time_acquired_us;
+            req->time_unpacked_us = time_mono_us();
+            req->resp_received = 1;
+        }
+
+        merged->merged_requests[i] = rc_dec(req);
+    }
+
+    merged->num_merged_requests = 0;
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * requeue_merged_requests
+ *
+ * The merged read did not work out.  Put the original requests back
+ * at the front of the queue, in their original order, and send them
+ * one by one.
+ */
+
+void requeue_merged_requests(ab_session_p session, ab_request_p merged)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(session->mutex) {
+        for(int i = merged->num_merged_requests - 1; i >= 0; i--) {
+            ab_request_p req = merged->merged_requests[i];
+            int len = vector_length(session->requests);
+
+            if(!req) {
+                continue;
+            }
+
+            req->coalesce = AB_COALESCE_NONE;
+
+            /* no insert for vectors, shift everything up one. */
+            for(int j = len; j > 0; j--) {
+                vector_put(session->requests, j, vector_get(session->requests, j-1));
+            }
+
+            vector_put(session->requests, 0, req);
+
+            merged->merged_requests[i] = NULL;
+        }
+
+        merged->num_merged_requests = 0;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int get_payload_size(ab_request_p request)
+{
+    int request_data_size = 0;
+    eip_encap *header = (eip_encap *)(request->data);
+    eip_cip_co_req *co_req = NULL;
+    eip_cip_uc_req *uc_req = NULL;
+
+    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
+        co_req = (eip_cip_co_req *)(request->data);
+        /* get length of new request */
+        request_data_size = le2h16(co_req->cpf_cdi_item_length)
+                            - 2  /* for connection sequence ID */
+                            + 2  /* for multipacket offset */
+                            ;
+    } else if(le2h16(header->encap_command) == AB_EIP_UNCONNECTED_SEND && request->request_size >= (int)sizeof(eip_cip_uc_req)
+              && ((eip_cip_uc_req *)(request->data))->cm_service_code == AB_EIP_CMD_UNCONNECTED_SEND) {
+        uc_req = (eip_cip_uc_req *)(request->data);
+        /* only the embedded packet goes into the multiple service packet. */
+        request_data_size = le2h16(uc_req->uc_cmd_length)
+                            + 2  /* for multipacket offset */
+                            ;
+    } else {
+        /* PCCC Execute and such are not CIP requests we can pack. */
+        pdebug(DEBUG_DETAIL, "Not a packable EIP packet type %d!", le2h16(header->encap_command));
+        request_data_size = INT_MAX;
+    }
+
+    return request_data_size;
+}
+
+
+
+/*
+ * get_packing_space
+ *
+ * How much room the Multiple Service Packet has for requests packed
+ * behind its header.  An unconnected packet also carries the
+ * Unconnected Send fields, a possible pad byte and the route to the PLC.
+ */
+
+int get_packing_space(ab_session_p session, ab_request_p first)
+{
+    int space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+
+    if(le2h16(((eip_encap *)(first->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        space -= (int)(sizeof(eip_cip_uc_req) - offsetof(eip_cip_uc_req, cm_service_code))
+                 + 1 /* pad */
+                 + 2 /* route size and reserved byte */
+                 + session->conn_path_size;
+    }
+
+    return space;
+}
+
+
+
+/*
+ * same_packet_type
+ *
+ * Requests can only share a packet if they are sent the same way.
+ */
+
+int same_packet_type(ab_request_p first, ab_request_p request)
+{
+    return le2h16(((eip_encap *)(first->data))->encap_command) == le2h16(((eip_encap *)(request->data))->encap_command);
+}
+
+
+
+
+int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    eip_cip_co_req *new_req = NULL;
+    eip_cip_co_req *packed_req = NULL;
+    /* FIXME - is this the right way to check? */
+    int header_size = 0;
+    cip_multi_req_header *multi_header = NULL;
+    int current_offset = 0;
+    uint8_t *pkt_start = NULL;
+    int pkt_len = 0;
+    uint8_t *first_pkt_data = NULL;
+    uint8_t *next_pkt_data = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    debug_set_tag_id(requests[0]->tag_id);
+
+    /* get the header info from the first request. Just copy the whole thing. */
+    mem_copy(session->data, requests[0]->data, requests[0]->request_size);
+    session->data_size = (uint32_t)requests[0]->request_size;
+
+    /* special case the case where there is just one request. */
+    if(num_requests == 1) {
+        pdebug(DEBUG_INFO, "Only one request, so done.");
+
+        debug_set_tag_id(0);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* unconnected requests have the route after the embedded packet. */
+    if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        int rc = pack_unconnected_requests(session, requests, num_requests);
+
+        debug_set_tag_id(0);
+
+        pdebug(DEBUG_INFO, "Done.");
+
+        return rc;
+    }
+
+    /* set up multi-packet header. */
+
+    header_size = (int)(sizeof(cip_multi_req_header)
+                        + (sizeof(uint16_le) * (size_t)num_requests)); /* offsets for each request. */
+
+    pdebug(DEBUG_DETAIL, "header size %d", header_size);
+
+    packed_req = (eip_cip_co_req *)(session->data);
+
+    /* make room in the request packet in the session for the header. */
+    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
+    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
+
+    pdebug(DEBUG_DETAIL, "packet 0 is of length %d.", pkt_len);
 
     /* point to where we want the current packet to start. */
     first_pkt_data = pkt_start + header_size;
@@ -1615,6 +2642,89 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
 
 
 
+/*
+ * pack_unconnected_requests
+ *
+ * Build one Unconnected Send whose embedded packet is a Multiple
+ * Service Packet holding the embedded packets of all the requests.  All
+ * requests on a session share the same route to the PLC.
+ *
+ * The session buffer already holds a copy of the first request.
+ */
+
+int pack_unconnected_requests(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    eip_cip_uc_req *packed_req = (eip_cip_uc_req *)(session->data);
+    cip_multi_req_header *multi_header = NULL;
+    uint8_t *data = NULL;
+    uint8_t *embed_start = NULL;
+    int current_offset = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* set up multi-packet header. */
+    embed_start = session->data + sizeof(eip_cip_uc_req);
+    multi_header = (cip_multi_req_header *)embed_start;
+    multi_header->service_code = AB_EIP_CMD_CIP_MULTI;
+    multi_header->req_path_size = 0x02; /* length of path in words */
+    multi_header->req_path[0] = 0x20; /* Class */
+    multi_header->req_path[1] = 0x02; /* MR */
+    multi_header->req_path[2] = 0x24; /* Instance */
+    multi_header->req_path[3] = 0x01; /* #1 */
+    multi_header->request_count = h2le16((uint16_t)num_requests);
+
+    data = embed_start + sizeof(cip_multi_req_header) + (sizeof(uint16_le) * (size_t)num_requests);
+    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
+
+    /* copy in the embedded packet of each request. */
+    for(int i=0; i < num_requests; i++) {
+        eip_cip_uc_req *new_req = (eip_cip_uc_req *)(requests[i]->data);
+        int pkt_len = (int)le2h16(new_req->uc_cmd_length);
+
+        debug_set_tag_id(requests[i]->tag_id);
+
+        pdebug(DEBUG_DETAIL, "packet %d is of length %d.", i, pkt_len);
+
+        multi_header->request_offsets[i] = h2le16((uint16_t)current_offset);
+
+        mem_copy(data, requests[i]->data + sizeof(eip_cip_uc_req), pkt_len);
+
+        data += pkt_len;
+        current_offset += pkt_len;
+    }
+
+    packed_req->uc_cmd_length = h2le16((uint16_t)(data - embed_start));
+
+    /* the route must start on a word boundary. */
+    if((data - embed_start) & 0x01) {
+        *data = 0;
+        data++;
+    }
+
+    /* routing information, the same as the requests carry. */
+    if(session->conn_path_size > 0) {
+        *data = (session->conn_path_size) / 2; /* in 16-bit words */
+        data++;
+        *data = 0; /* reserved/pad */
+        data++;
+        mem_copy(data, session->conn_path, session->conn_path_size);
+        data += session->conn_path_size;
+    }
+
+    /* stitch up the CPF and EIP packet lengths */
+    packed_req->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&packed_req->cm_service_code)));
+    packed_req->encap_length = h2le16((uint16_t)((size_t)(data - session->data) - sizeof(eip_encap)));
+
+    /* set the total data size */
+    session->data_size = (uint32_t)(data - session->data);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int prepare_request(ab_session_p session)
 {
     eip_encap *encap = NULL;
@@ -1645,7 +2755,9 @@ int prepare_request(ab_session_p session)
         //request->session_seq_id = session->session_seq_id;
         encap->encap_sender_context = h2le64(session->session_seq_id); /* link up the request seq ID and the packet seq ID */
 
-        pdebug(DEBUG_INFO, "Preparing unconnected packet with session sequence ID %llx", session->session_seq_id);
+        pdebug(DEBUG_DETAIL, "Preparing unconnected packet with session sequence ID %llx", session->session_seq_id);
+
+        trace_event(TRACE_PACKET_PREPARED, 0, session->data_size, session->session_seq_id, 0);
     } else if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
         eip_cip_co_req *conn_req = (eip_cip_co_req *)(session->data);
 
@@ -1657,17 +2769,18 @@ int prepare_request(ab_session_p session)
         session->conn_seq_num++;
         conn_req->cpf_conn_seq_num = h2le16(session->conn_seq_num);
 
-        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", session->orig_connection_id, session->conn_seq_num, session->conn_seq_num);
+        pdebug(DEBUG_DETAIL, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", session->orig_connection_id, session->conn_seq_num, session->conn_seq_num);
+
+        trace_event(TRACE_PACKET_PREPARED, 0, session->data_size, session->conn_seq_num, 1);
     } else {
         pdebug(DEBUG_WARN, "Unsupported packet type %x!", le2h16(encap->encap_command));
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    /* display the data */
-    pdebug(DEBUG_INFO, "Prepared packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)session->data_size);
+    /* send_eip_request() dumps the bytes. */
+    pdebug(DEBUG_DETAIL, "Prepared packet of size %d", session->data_size);
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
@@ -2348,40 +3461,57 @@ int recv_forward_close_resp(ab_session_p session)
 int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p res;
-    size_t request_capacity = 0;
-    uint8_t *buffer = NULL;
+    int request_capacity = 0;
 
     critical_block(session->mutex) {
-        request_capacity = (size_t)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
+        request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
     }
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    buffer = (uint8_t *)mem_alloc((int)request_capacity);
+    *req = request_alloc(tag_id, request_capacity);
+    if(!*req) {
+        pdebug(DEBUG_WARN, "Unable to allocate request!");
+        rc = PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * request_alloc
+ *
+ * Allocate a request and its buffer.  This does not touch the session
+ * so it can be called with the session mutex held.
+ */
+
+ab_request_p request_alloc(int tag_id, int request_capacity)
+{
+    ab_request_p res;
+    uint8_t *buffer = NULL;
+
+    buffer = (uint8_t *)mem_alloc(request_capacity);
     if(!buffer) {
         pdebug(DEBUG_WARN, "Unable to allocate request buffer!");
-        *req = NULL;
-        return PLCTAG_ERR_NO_MEM;
+        return NULL;
     }
 
     res = (ab_request_p)rc_alloc((int)sizeof(struct ab_request_t), request_destroy);
     if (!res) {
         mem_free(buffer);
-        *req = NULL;
-        rc = PLCTAG_ERR_NO_MEM;
-    } else {
-        res->data = buffer;
-        res->tag_id = tag_id;
-        res->request_capacity = (int)request_capacity;
-        res->lock = LOCK_INIT;
-
-        *req = res;
+        return NULL;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    res->data = buffer;
+    res->tag_id = tag_id;
+    res->request_capacity = request_capacity;
+    res->lock = LOCK_INIT;
 
-    return rc;
+    return res;
 }
 
 
@@ -2402,6 +3532,30 @@ void request_destroy(void *req_arg)
 
     req->abort_request = 1;
 
+    /*
+     * if this was a merged read that never got its response
+     * scattered, fail the original requests.
+     */
+    if(req->merged_requests) {
+        for(int i=0; i < req->num_merged_requests; i++) {
+            ab_request_p member = req->merged_requests[i];
+
+            if(member) {
+                spin_block(&member->lock) {
+                    member->status = (req->status != PLCTAG_STATUS_OK ? req->status : PLCTAG_ERR_ABORT);
+                    member->request_size = 0;
+                    member->resp_received = 1;
+                }
+
+                rc_dec(member);
+            }
+        }
+
+        mem_free(req->merged_requests);
+        req->merged_requests = NULL;
+        req->num_merged_requests = 0;
+    }
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
@@ -2432,3 +3586,121 @@ int session_request_increase_buffer(ab_request_p request, int new_capacity)
 
     return PLCTAG_STATUS_OK;
 }
+
+
+
+/*
+ * Round trip times go in histogram buckets with four buckets for each
+ * power of two.  Times under four microseconds get their own buckets.
+ */
+
+int rtt_bucket(int64_t rtt_us)
+{
+    int msb = 0;
+    int bucket = 0;
+
+    if(rtt_us < 4) {
+        return (rtt_us < 0 ? 0 : (int)rtt_us);
+    }
+
+    for(int64_t tmp = rtt_us; tmp > 1; tmp >>= 1) {
+        msb++;
+    }
+
+    bucket = (msb * 4) + (int)((rtt_us >> (msb - 2)) & 0x03);
+
+    return (bucket < SESSION_RTT_BUCKETS ? bucket : SESSION_RTT_BUCKETS - 1);
+}
+
+
+
+/* the largest time that goes in the bucket. */
+int64_t rtt_bucket_limit(int bucket)
+{
+    int msb = bucket / 4;
+
+    if(bucket < 4) {
+        return bucket;
+    }
+
+    return ((int64_t)(4 + (bucket % 4) + 1) << (msb - 2)) - 1;
+}
+
+
+
+int64_t rtt_percentile_unsafe(ab_session_p session, int percent)
+{
+    uint64_t total = 0;
+    uint64_t count = 0;
+    uint64_t target = 0;
+
+    for(int i=0; i < SESSION_RTT_BUCKETS; i++) {
+        total += session->stats.rtt_hist[i];
+    }
+
+    if(total == 0) {
+        return 0;
+    }
+
+    /* round up so that p99 of a few samples is the largest. */
+    target = ((total * (uint64_t)percent) + 99) / 100;
+
+    for(int i=0; i < SESSION_RTT_BUCKETS; i++) {
+        count += session->stats.rtt_hist[i];
+
+        if(count >= target) {
+            int64_t limit = rtt_bucket_limit(i);
+
+            return (limit < session->stats.rtt_max_us ? limit : session->stats.rtt_max_us);
+        }
+    }
+
+    return session->stats.rtt_max_us;
+}
+
+
+
+void put_stats_u64(uint8_t *record, int offset, uint64_t val)
+{
+    for(int i=0; i < 8; i++) {
+        record[offset + i] = (uint8_t)(val >> (8 * i));
+    }
+}
+
+
+
+void put_stats_u32(uint8_t *record, int offset, uint32_t val)
+{
+    for(int i=0; i < 4; i++) {
+        record[offset + i] = (uint8_t)(val >> (8 * i));
+    }
+}
+
+
+
+/*
+ * Fill in one statistics record.
+ *
+ * You must hold the session mutex before calling this!
+ */
+
+void encode_stats_unsafe(ab_session_p session, uint8_t *record)
+{
+    put_stats_u64(record, PLCTAG_STATS_REQUESTS_SENT, session->bundled_request_count);
+    put_stats_u64(record, PLCTAG_STATS_PACKETS_SENT, session->bundle_count);
+    put_stats_u64(record, PLCTAG_STATS_PACKETS_RECEIVED, session->stats.packets_received);
+    put_stats_u64(record, PLCTAG_STATS_BYTES_SENT, session->stats.bytes_sent);
+    put_stats_u64(record, PLCTAG_STATS_BYTES_RECEIVED, session->stats.bytes_received);
+    put_stats_u64(record, PLCTAG_STATS_RECONNECTS, (session->stats.connects > 0 ? session->stats.connects - 1 : 0));
+    put_stats_u64(record, PLCTAG_STATS_TIMEOUTS, session->stats.timeouts);
+    put_stats_u64(record, PLCTAG_STATS_RTT_P50_US, (uint64_t)rtt_percentile_unsafe(session, 50));
+    put_stats_u64(record, PLCTAG_STATS_RTT_P99_US, (uint64_t)rtt_percentile_unsafe(session, 99));
+    put_stats_u64(record, PLCTAG_STATS_RTT_MAX_US, (uint64_t)session->stats.rtt_max_us);
+    put_stats_u32(record, PLCTAG_STATS_QUEUE_DEPTH, (uint32_t)vector_length(session->requests));
+    put_stats_u32(record, PLCTAG_STATS_MAX_QUEUE_DEPTH, (uint32_t)session->stats.max_queue_depth);
+    put_stats_u32(record, PLCTAG_STATS_MAX_PAYLOAD, (uint32_t)session->max_payload_size);
+    put_stats_u32(record, PLCTAG_STATS_CONNECTED, (uint32_t)(session->targ_connection_id != 0));
+
+    /* the record was cleared so this stays zero terminated. */
+    str_copy((char *)(record + PLCTAG_STATS_GATEWAY), PLCTAG_STATS_GATEWAY_SIZE - 1, session->host);
+}
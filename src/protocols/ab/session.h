@@ -30,6 +30,7 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
 #include <util/vector.h>
 
@@ -42,6 +43,21 @@
 #define SESSION_MIN_REQUESTS    (10)
 #define SESSION_INC_REQUESTS    (10)
 
+/* round trip histogram, four buckets per power of two microseconds. */
+#define SESSION_RTT_BUCKETS     (128)
+
+/* counters for the session, all protected by the session mutex. */
+struct ab_session_stats_t {
+    uint64_t packets_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t connects;
+    uint64_t timeouts;
+    int max_queue_depth;
+    int64_t rtt_max_us;
+    uint32_t rtt_hist[SESSION_RTT_BUCKETS];
+};
+
 
 struct ab_session_t {
 //    int status;
@@ -53,6 +69,9 @@ struct ab_session_t {
     char *path;
     sock_p sock;
 
+    /* local proxy to connect to instead of the gateway, "host:port" or "unix:/path". */
+    char *proxy;
+
     /* connection variables. */
     int use_connected_msg;
     uint32_t orig_connection_id;
@@ -85,6 +104,10 @@ struct ab_session_t {
 
     uint64_t packet_count;
 
+    /* how many request packets we sent and how many requests they carried. */
+    uint64_t bundle_count;
+    uint64_t bundled_request_count;
+
     thread_p handler_thread;
     volatile int terminating;
     mutex_p mutex;
@@ -92,8 +115,33 @@ struct ab_session_t {
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+
+    /* max gap in elements between array reads we merge, negative when off. */
+    int read_coalesce_gap;
+
+    /*
+     * hold the oldest request up to this long so more can be packed
+     * with it.  batch_hold_us is how much of the window is left.
+     */
+    int batch_window_us;
+    int batch_hold_us;
+
+    /* UDT templates read from this PLC, by template ID. */
+    hashtable_p udt_templates;
+
+    /* the tag reading each template right now, by template ID. */
+    hashtable_p udt_fetches;
+
+    /* read with session_get_stats(). */
+    struct ab_session_stats_t stats;
 };
 
+/* what kind of read a request is for coalescing. */
+#define AB_COALESCE_NONE (0)
+#define AB_COALESCE_CIP  (1)
+#define AB_COALESCE_PLC5 (2)
+#define AB_COALESCE_SLC  (3)
+
 struct ab_request_t {
     /* used to force interlocks with other threads. */
     lock_t lock;
@@ -111,8 +159,37 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
-    /* time stamp for debugging output */
-    int64_t time_sent;
+    /*
+     * read coalescing.   Set by the tag on simple connected reads
+     * of one or more elements of a one dimensional array.  The base
+     * name is the encoded name up to the element segment.
+     *
+     * PCCC reads of whole elements of a data file use the file type
+     * and number instead of the name.  The encoded address starts at
+     * coalesce_name_offset in the request.
+     */
+    int coalesce;
+    int coalesce_name_size;
+    uint32_t coalesce_index;
+    int coalesce_count;
+    int coalesce_elem_size;
+    int coalesce_file_type;
+    int coalesce_file_num;
+    int coalesce_name_offset;
+
+    /* the original requests when the session merged several into this one. */
+    ab_request_p *merged_requests;
+    int num_merged_requests;
+
+    /* when the request went through each stage, from time_mono_us(). */
+    int64_t time_queued_us;
+    int64_t time_packed_us;
+    int64_t time_sent_us;
+    int64_t time_received_us;
+    int64_t time_unpacked_us;
+
+    /* time_us() when the response came in. */
+    int64_t time_acquired_us;
 
     /* used by the background thread for incrementally getting data */
     int request_size; /* total bytes, not just data */
@@ -132,5 +209,6 @@ extern int session_find_or_create(ab_session_p *session, attr attribs);
 extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
+extern int session_get_stats(uint8_t *buf, int buf_size);
 
 #endif
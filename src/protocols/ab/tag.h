@@ -88,18 +88,40 @@ struct ab_tag_t {
 
     /* number of elements and size of each in the tag. */
     pccc_file_t file_type;
+    int file_num;               /* PCCC logical address, subelem_num is -1 if none */
+    int elem_num;
+    int subelem_num;
     elem_type_t elem_type;
     int elem_count;
     int elem_size;
     int tag_list;
     uint32_t next_id;
 
+    /* UDT template handling */
+    int udt_tag;                /* this tag reads a template, the name is @udt/<id> */
+    uint16_t udt_id;            /* template ID of the tag's type, zero if not known */
+    uint16_t udt_fetch_id;      /* template being fetched right now, zero if none */
+    int udt_get_fields;         /* getting the template attributes, not the template data */
+    int udt_fetch_wait;         /* another tag is fetching a template this one needs */
+    uint16_t udt_handle;
+    uint16_t udt_member_count;
+    uint32_t udt_instance_size;
+    uint8_t *udt_raw;
+    int udt_raw_size;
+    int udt_raw_offset;
+
     /* requests */
     int pre_write_read;
     int first_read;
+    int write_bits;             /* the write in flight is a Read Modify Write of the masks below */
+    uint64_t write_bits_set;
+    uint64_t write_bits_clear;
     ab_request_p req;
     int offset;
 
+    /* Class 1 consumed tag connection, NULL for polled tags. */
+    struct class1_conn_t *class1;
+
     int allow_packing;
 
     /* flags for operations */
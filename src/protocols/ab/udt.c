@@ -0,0 +1,713 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <limits.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <ab/defs.h>
+#include <ab/session.h>
+#include <ab/udt.h>
+#include <util/debug.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+
+
+/*
+ * The raw template data, as returned by the Read Template service, is laid
+ * out as follows:
+ *
+ *    member definitions, member_count of them:
+ *        uint16_t  info      array size, or bit number for a BOOL
+ *        uint16_t  type      CIP type code, see the UDT_TYPE_xyz masks
+ *        uint32_t  offset    byte offset within the structure
+ *
+ *    template name, zero terminated.  It looks like "NAME;n..." and we
+ *    only keep the part before the semicolon.
+ *
+ *    member names, zero terminated, member_count of them.
+ */
+
+START_PACK typedef struct {
+    uint16_le info;
+    uint16_le type;
+    uint32_le offset;
+} END_PACK udt_member_def;
+
+
+#define UDT_CACHE_INITIAL_SIZE (8)
+
+
+static void udt_template_destroy(void *tmpl_arg);
+static char *get_raw_string(uint8_t *raw, int raw_size, int *pos);
+static int member_kind(uint16_t type, int *elem_size);
+static udt_template_p udt_cache_get_unsafe(ab_session_p session, uint16_t id);
+static uint16_t find_missing_unsafe(ab_session_p session, uint16_t id, int depth);
+static int lookup_member_unsafe(ab_session_p session, uint16_t id, const char *path, int *offset, int *kind, int *bit_num);
+static void udt_fetch_release_unsafe(ab_session_p session, uint16_t id, int32_t tag_id);
+
+
+
+udt_template_p udt_template_create(uint16_t id, uint16_t handle, uint32_t instance_size, uint16_t member_count, uint8_t *raw, int raw_size)
+{
+    udt_template_p tmpl = NULL;
+    int pos = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!raw || raw_size < (int)(member_count * sizeof(udt_member_def))) {
+        pdebug(DEBUG_WARN, "Template data for UDT %d is too short for %d members!", (int)id, (int)member_count);
+        return NULL;
+    }
+
+    tmpl = rc_alloc((int)sizeof(struct udt_template_t), udt_template_destroy);
+    if(!tmpl) {
+        pdebug(DEBUG_ERROR, "Unable to allocate UDT template!");
+        return NULL;
+    }
+
+    tmpl->id = id;
+    tmpl->handle = handle;
+    tmpl->instance_size = instance_size;
+    tmpl->member_count = member_count;
+
+    tmpl->raw = mem_alloc(raw_size);
+    if(!tmpl->raw) {
+        pdebug(DEBUG_ERROR, "Unable to allocate raw template buffer!");
+        return rc_dec(tmpl);
+    }
+
+    mem_copy(tmpl->raw, raw, raw_size);
+    tmpl->raw_size = raw_size;
+
+    if(member_count > 0) {
+        tmpl->members = mem_alloc((int)(member_count * sizeof(struct udt_member_t)));
+        if(!tmpl->members) {
+            pdebug(DEBUG_ERROR, "Unable to allocate UDT member table!");
+            return rc_dec(tmpl);
+        }
+    }
+
+    /* first the fixed size member definitions. */
+    for(int i=0; i < member_count; i++) {
+        udt_member_def *def = (udt_member_def *)(tmpl->raw + pos);
+
+        tmpl->members[i].info = le2h16(def->info);
+        tmpl->members[i].type = le2h16(def->type);
+        tmpl->members[i].offset = le2h32(def->offset);
+
+        pos += (int)sizeof(udt_member_def);
+    }
+
+    /* then the template name. */
+    tmpl->name = get_raw_string(tmpl->raw, tmpl->raw_size, &pos);
+    if(!tmpl->name) {
+        pdebug(DEBUG_WARN, "Template data for UDT %d has no name!", (int)id);
+        return rc_dec(tmpl);
+    }
+
+    for(char *p = tmpl->name; *p; p++) {
+        if(*p == ';') {
+            *p = 0;
+            break;
+        }
+    }
+
+    /* and the member names. */
+    for(int i=0; i < member_count; i++) {
+        tmpl->members[i].name = get_raw_string(tmpl->raw, tmpl->raw_size, &pos);
+        if(!tmpl->members[i].name) {
+            pdebug(DEBUG_WARN, "Template data for UDT %s is missing the name of member %d!", tmpl->name, i);
+            return rc_dec(tmpl);
+        }
+
+        pdebug(DEBUG_DETAIL, "UDT %s member %s type=%04x info=%d offset=%u", tmpl->name, tmpl->members[i].name, (int)tmpl->members[i].type, (int)tmpl->members[i].info, tmpl->members[i].offset);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return tmpl;
+}
+
+
+
+/*
+ * udt_cache_put
+ *
+ * Add a template to the session's cache.  The cache takes its own
+ * reference.  If another tag got there first, keep the existing one.
+ * The fetch claim of the tag, if any, is released.
+ */
+
+int udt_cache_put(ab_session_p session, udt_template_p tmpl, int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!session || !tmpl) {
+        pdebug(DEBUG_WARN, "Null session or template pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->mutex) {
+        if(!session->udt_templates) {
+            session->udt_templates = hashtable_create(UDT_CACHE_INITIAL_SIZE);
+            if(!session->udt_templates) {
+                pdebug(DEBUG_ERROR, "Unable to allocate UDT template cache!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        if(hashtable_get(session->udt_templates, (int64_t)tmpl->id)) {
+            pdebug(DEBUG_DETAIL, "UDT %d already cached.", (int)tmpl->id);
+            break;
+        }
+
+        rc = hashtable_put(session->udt_templates, (int64_t)tmpl->id, rc_inc(tmpl));
+        if(rc != PLCTAG_STATUS_OK) {
+            rc_dec(tmpl);
+        }
+    }
+
+    /* tags waiting for it pick it up from the cache. */
+    critical_block(session->mutex) {
+        udt_fetch_release_unsafe(session, tmpl->id, tag_id);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * udt_cache_get
+ *
+ * Returns a strong reference to the cached template or NULL.
+ */
+
+udt_template_p udt_cache_get(ab_session_p session, uint16_t id)
+{
+    udt_template_p tmpl = NULL;
+
+    if(!session) {
+        return NULL;
+    }
+
+    critical_block(session->mutex) {
+        tmpl = rc_inc(udt_cache_get_unsafe(session, id));
+    }
+
+    return tmpl;
+}
+
+
+
+/*
+ * udt_cache_find_missing
+ *
+ * Walk the template and all nested templates it uses.  Return the ID
+ * of the first one that is not cached yet or zero if we have them all.
+ */
+
+uint16_t udt_cache_find_missing(ab_session_p session, uint16_t id)
+{
+    uint16_t result = 0;
+
+    if(!session || !id) {
+        return 0;
+    }
+
+    critical_block(session->mutex) {
+        result = find_missing_unsafe(session, id, 0);
+    }
+
+    return result;
+}
+
+
+
+/*
+ * udt_fetch_claim
+ *
+ * Only one tag at a time reads a template from the PLC.  Returns
+ * PLCTAG_STATUS_OK if the tag should read it and PLCTAG_STATUS_PENDING
+ * if another tag is already reading it.  In that case wait until
+ * udt_cache_find_missing() no longer returns it, or claim it again in
+ * case the other tag gave up.
+ */
+
+int udt_fetch_claim(ab_session_p session, uint16_t id, int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!session || !id || tag_id <= 0) {
+        pdebug(DEBUG_WARN, "Bad session, template ID or tag ID!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(session->mutex) {
+        int32_t holder = 0;
+
+        if(!session->udt_fetches) {
+            session->udt_fetches = hashtable_create(UDT_CACHE_INITIAL_SIZE);
+            if(!session->udt_fetches) {
+                pdebug(DEBUG_ERROR, "Unable to allocate UDT fetch table!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        holder = (int32_t)(intptr_t)hashtable_get(session->udt_fetches, (int64_t)id);
+
+        if(holder && holder != tag_id) {
+            pdebug(DEBUG_DETAIL, "Tag %d is already reading UDT template %d.", (int)holder, (int)id);
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(!holder) {
+            rc = hashtable_put(session->udt_fetches, (int64_t)id, (void *)(intptr_t)tag_id);
+        }
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * udt_fetch_release
+ *
+ * The tag is no longer reading the template, either because it is done
+ * or because it gave up.
+ */
+
+void udt_fetch_release(ab_session_p session, uint16_t id, int32_t tag_id)
+{
+    if(!session || !id) {
+        return;
+    }
+
+    critical_block(session->mutex) {
+        udt_fetch_release_unsafe(session, id, tag_id);
+    }
+}
+
+
+
+/*
+ * udt_cache_destroy
+ *
+ * Called when the session is destroyed.  No one else can see the session
+ * at that point.
+ */
+
+void udt_cache_destroy(ab_session_p session)
+{
+    int capacity = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!session || !session->udt_templates) {
+        return;
+    }
+
+    capacity = hashtable_capacity(session->udt_templates);
+
+    for(int i=0; i < capacity; i++) {
+        udt_template_p tmpl = hashtable_get_index(session->udt_templates, i);
+
+        if(tmpl) {
+            rc_dec(tmpl);
+        }
+    }
+
+    hashtable_destroy(session->udt_templates);
+    session->udt_templates = NULL;
+
+    if(session->udt_fetches) {
+        hashtable_destroy(session->udt_fetches);
+        session->udt_fetches = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * udt_lookup_member
+ *
+ * Resolve a member path like "Axis.Status[2]" against the UDT template
+ * with the passed ID.  Path segments are separated by periods and may
+ * have a single array index.
+ */
+
+int udt_lookup_member(ab_session_p session, uint16_t id, const char *path, int *offset, int *kind, int *bit_num)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!session || !path) {
+        pdebug(DEBUG_WARN, "Null session or path!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *offset = 0;
+    *kind = PLCTAG_MEMBER_UNKNOWN;
+    *bit_num = 0;
+
+    critical_block(session->mutex) {
+        rc = lookup_member_unsafe(session, id, path, offset, kind, bit_num);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+
+/***********************************************************************
+ *************************** Helper Functions **************************
+ **********************************************************************/
+
+
+void udt_template_destroy(void *tmpl_arg)
+{
+    udt_template_p tmpl = tmpl_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tmpl) {
+        pdebug(DEBUG_WARN, "Null template pointer!");
+        return;
+    }
+
+    /* the names point into the raw data. */
+    if(tmpl->members) {
+        mem_free(tmpl->members);
+        tmpl->members = NULL;
+    }
+
+    if(tmpl->raw) {
+        mem_free(tmpl->raw);
+        tmpl->raw = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * get_raw_string
+ *
+ * Return a pointer to the zero terminated string at pos and move pos
+ * past it.  Returns NULL if the string runs off the end of the data.
+ */
+
+char *get_raw_string(uint8_t *raw, int raw_size, int *pos)
+{
+    int start = *pos;
+
+    for(int i = start; i < raw_size; i++) {
+        if(raw[i] == 0) {
+            *pos = i + 1;
+            return (char *)(raw + start);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * member_kind
+ *
+ * Map the CIP type code to the accessor kind and element size.
+ */
+
+int member_kind(uint16_t type, int *elem_size)
+{
+    if(type & UDT_TYPE_STRUCT_FLAG) {
+        *elem_size = 0;
+        return PLCTAG_MEMBER_STRUCT;
+    }
+
+    switch((uint8_t)(type & 0xFF)) {
+    case AB_CIP_DATA_BIT:
+        *elem_size = 1;
+        return PLCTAG_MEMBER_BIT;
+
+    case AB_CIP_DATA_SINT:
+        *elem_size = 1;
+        return PLCTAG_MEMBER_INT8;
+
+    case AB_CIP_DATA_USINT:
+    case AB_CIP_DATA_BYTE:
+        *elem_size = 1;
+        return PLCTAG_MEMBER_UINT8;
+
+    case AB_CIP_DATA_INT:
+        *elem_size = 2;
+        return PLCTAG_MEMBER_INT16;
+
+    case AB_CIP_DATA_UINT:
+    case AB_CIP_DATA_WORD:
+        *elem_size = 2;
+        return PLCTAG_MEMBER_UINT16;
+
+    case AB_CIP_DATA_DINT:
+        *elem_size = 4;
+        return PLCTAG_MEMBER_INT32;
+
+    case AB_CIP_DATA_UDINT:
+    case AB_CIP_DATA_DWORD:
+        *elem_size = 4;
+        return PLCTAG_MEMBER_UINT32;
+
+    case AB_CIP_DATA_LINT:
+        *elem_size = 8;
+        return PLCTAG_MEMBER_INT64;
+
+    case AB_CIP_DATA_ULINT:
+    case AB_CIP_DATA_LWORD:
+        *elem_size = 8;
+        return PLCTAG_MEMBER_UINT64;
+
+    case AB_CIP_DATA_REAL:
+        *elem_size = 4;
+        return PLCTAG_MEMBER_FLOAT32;
+
+    case AB_CIP_DATA_LREAL:
+        *elem_size = 8;
+        return PLCTAG_MEMBER_FLOAT64;
+
+    default:
+        *elem_size = 0;
+        return PLCTAG_MEMBER_UNKNOWN;
+    }
+}
+
+
+
+udt_template_p udt_cache_get_unsafe(ab_session_p session, uint16_t id)
+{
+    if(!session->udt_templates || !id) {
+        return NULL;
+    }
+
+    return hashtable_get(session->udt_templates, (int64_t)id);
+}
+
+
+
+void udt_fetch_release_unsafe(ab_session_p session, uint16_t id, int32_t tag_id)
+{
+    if(session->udt_fetches && (int32_t)(intptr_t)hashtable_get(session->udt_fetches, (int64_t)id) == tag_id) {
+        hashtable_remove(session->udt_fetches, (int64_t)id);
+    }
+}
+
+
+
+uint16_t find_missing_unsafe(ab_session_p session, uint16_t id, int depth)
+{
+    udt_template_p tmpl = udt_cache_get_unsafe(session, id);
+
+    if(!tmpl) {
+        return id;
+    }
+
+    if(depth >= UDT_MAX_NESTING) {
+        pdebug(DEBUG_WARN, "UDT %s is nested too deeply!", tmpl->name);
+        return 0;
+    }
+
+    for(int i=0; i < tmpl->member_count; i++) {
+        if(tmpl->members[i].type & UDT_TYPE_STRUCT_FLAG) {
+            uint16_t missing = find_missing_unsafe(session, (uint16_t)(tmpl->members[i].type & UDT_TYPE_ID_MASK), depth + 1);
+
+            if(missing) {
+                return missing;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+
+int lookup_member_unsafe(ab_session_p session, uint16_t id, const char *path, int *offset, int *kind, int *bit_num)
+{
+    const char *p = path;
+    udt_template_p tmpl = NULL;
+    int depth = 0;
+
+    while(*p) {
+        udt_member_p member = NULL;
+        const char *name_start = p;
+        int name_len = 0;
+        int elem_size = 0;
+        int member_type = 0;
+
+        tmpl = udt_cache_get_unsafe(session, id);
+        if(!tmpl) {
+            pdebug(DEBUG_DETAIL, "UDT %d is not cached yet.", (int)id);
+            return PLCTAG_ERR_NO_DATA;
+        }
+
+        if(depth++ >= UDT_MAX_NESTING) {
+            pdebug(DEBUG_WARN, "Member path %s is too deep!", path);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        /* find the end of the member name. */
+        while(*p && *p != '.' && *p != '[') {
+            p++;
+        }
+
+        name_len = (int)(p - name_start);
+
+        for(int i=0; i < tmpl->member_count && !member; i++) {
+            char *name = tmpl->members[i].name;
+            int match = 1;
+
+            for(int j=0; j < name_len && match; j++) {
+                match = (name[j] && tolower((unsigned char)name[j]) == tolower((unsigned char)name_start[j]));
+            }
+
+            if(match && name[name_len] == 0) {
+                member = &tmpl->members[i];
+            }
+        }
+
+        if(!member) {
+            pdebug(DEBUG_WARN, "Member path %s not found in UDT %s!", path, tmpl->name);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        *offset += (int)member->offset;
+        member_type = member_kind(member->type, &elem_size);
+
+        if(member_type == PLCTAG_MEMBER_STRUCT) {
+            udt_template_p sub_tmpl = udt_cache_get_unsafe(session, (uint16_t)(member->type & UDT_TYPE_ID_MASK));
+
+            if(!sub_tmpl) {
+                pdebug(DEBUG_DETAIL, "Nested UDT %d is not cached yet.", (int)(member->type & UDT_TYPE_ID_MASK));
+                return PLCTAG_ERR_NO_DATA;
+            }
+
+            elem_size = (int)sub_tmpl->instance_size;
+        }
+
+        if(member_type == PLCTAG_MEMBER_BIT) {
+            /* host SINT plus bit number. */
+            *bit_num = (int)member->info;
+        } else {
+            *bit_num = 0;
+        }
+
+        /* handle an array index. */
+        if(*p == '[') {
+            int index = 0;
+
+            if(!(member->type & UDT_TYPE_ARRAY_MASK)) {
+                pdebug(DEBUG_WARN, "Member %s in path %s is not an array!", member->name, path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            p++;
+
+            if(!isdigit((unsigned char)*p)) {
+                pdebug(DEBUG_WARN, "Bad array index in member path %s!", path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            while(isdigit((unsigned char)*p)) {
+                if(index > (INT_MAX - 9) / 10) {
+                    pdebug(DEBUG_WARN, "Array index too large in member path %s!", path);
+                    return PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+
+                index = (index * 10) + (*p - '0');
+                p++;
+            }
+
+            if(*p != ']') {
+                pdebug(DEBUG_WARN, "Bad array index in member path %s!", path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            p++;
+
+            if((member->type & 0xFF) == AB_CIP_DATA_DWORD) {
+                /* BOOL arrays are packed into DWORDs. */
+                if(index < 0 || (index / 32) >= (int)member->info) {
+                    pdebug(DEBUG_WARN, "Array index %d out of bounds in member path %s!", index, path);
+                    return PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+
+                /* the byte that holds the bit, the DWORDs are little endian. */
+                *offset += ((index / 32) * 4) + ((index % 32) / 8);
+                *bit_num = index % 8;
+                member_type = PLCTAG_MEMBER_BIT;
+            } else {
+                if(index < 0 || index >= (int)member->info) {
+                    pdebug(DEBUG_WARN, "Array index %d out of bounds in member path %s!", index, path);
+                    return PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+
+                *offset += index * elem_size;
+            }
+        }
+
+        *kind = member_type;
+
+        if(*p == '.') {
+            if(member_type != PLCTAG_MEMBER_STRUCT) {
+                pdebug(DEBUG_WARN, "Member %s in path %s is not a structure!", member->name, path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            id = (uint16_t)(member->type & UDT_TYPE_ID_MASK);
+            p++;
+        } else if(*p) {
+            pdebug(DEBUG_WARN, "Unexpected character in member path %s!", path);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    if(!tmpl) {
+        pdebug(DEBUG_WARN, "Empty member path!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_AB_UDT_H__
+#define __PLCTAG_AB_UDT_H__ 1
+
+#include <ab/ab_common.h>
+#include <ab/defs.h>
+
+/*
+ * UDT template handling.
+ *
+ * Logix PLCs describe each UDT with an instance of the Template object
+ * (class 0x6C).  We fetch the template once per session and keep a decoded
+ * member table around so that all tags of the same type share it.
+ */
+
+/* bits in the member type word from the template. */
+#define UDT_TYPE_STRUCT_FLAG    ((uint16_t)0x8000)
+#define UDT_TYPE_ARRAY_MASK     ((uint16_t)0x6000)
+#define UDT_TYPE_ID_MASK        ((uint16_t)0x0FFF)
+
+/* how deep we follow nested UDTs. */
+#define UDT_MAX_NESTING         (16)
+
+struct udt_member_t {
+    char *name;
+    uint16_t type;      /* raw type word from the template */
+    uint16_t info;      /* array element count or bit number for BOOL */
+    uint32_t offset;    /* byte offset from the start of the UDT instance */
+};
+
+typedef struct udt_member_t *udt_member_p;
+
+struct udt_template_t {
+    uint16_t id;
+    uint16_t handle;            /* structure handle, what the PLC returns in abbreviated type info */
+    uint32_t instance_size;     /* bytes in one instance of the UDT */
+    uint16_t member_count;
+    char *name;
+
+    /* the member table, decoded from the raw data. */
+    struct udt_member_t *members;
+
+    /* the raw template data as read from the PLC. */
+    int raw_size;
+    uint8_t *raw;
+};
+
+typedef struct udt_template_t *udt_template_p;
+
+
+extern udt_template_p udt_template_create(uint16_t id, uint16_t handle, uint32_t instance_size, uint16_t member_count, uint8_t *raw, int raw_size);
+
+extern int udt_cache_put(ab_session_p session, udt_template_p tmpl, int32_t tag_id);
+extern udt_template_p udt_cache_get(ab_session_p session, uint16_t id);
+extern uint16_t udt_cache_find_missing(ab_session_p session, uint16_t id);
+extern void udt_cache_destroy(ab_session_p session);
+
+extern int udt_fetch_claim(ab_session_p session, uint16_t id, int32_t tag_id);
+extern void udt_fetch_release(ab_session_p session, uint16_t id, int32_t tag_id);
+
+extern int udt_lookup_member(ab_session_p session, uint16_t id, const char *path, int *offset, int *kind, int *bit_num);
+
+#endif
@@ -27,6 +27,7 @@
 #include <system/tag.h>
 #include <lib/init.h>
 #include <util/rc.h>
+#include <ab/session.h>
 
 
 /* we'll need to set these per protocol type.
@@ -46,13 +47,16 @@ static int system_tag_abort(plc_tag_p tag);
 static int system_tag_read(plc_tag_p tag);
 static int system_tag_status(plc_tag_p tag);
 static int system_tag_write(plc_tag_p tag);
+static int system_tag_read_stats(system_tag_p tag);
 
 struct tag_vtable_t system_tag_vtable = {
         /* abort */     system_tag_abort,
         /* read */      system_tag_read,
         /* status */    system_tag_status,
         /* tickler */   (tag_vtable_func)(intptr_t)(0),
-        /* write */     system_tag_write
+        /* write */     system_tag_write,
+        /* member_info */ NULL,
+        /* write_bits */ NULL
     };
 
 
@@ -69,6 +73,12 @@ plc_tag_p system_tag_create(attr attribs)
         return PLC_TAG_P_NULL;
     }
 
+    /* @stats replaces its buffer during a read, a background refresh reads into a buffer it does not own. */
+    if(str_cmp_i(name, "@stats") == 0 && attr_get_int(attribs, "read_cache_stale", 0)) {
+        pdebug(DEBUG_WARN, "The @stats tag does not support read_cache_stale!");
+        return PLC_TAG_P_NULL;
+    }
+
     pdebug(DEBUG_DETAIL,"Creating special tag %s", name);
 
     /*
@@ -99,6 +109,11 @@ plc_tag_p system_tag_create(attr attribs)
     /* set the endian-ness */
     tag->endian = PLCTAG_DATA_LITTLE_ENDIAN;
 
+    /* take a first snapshot so that the size is right. */
+    if(str_cmp_i(&tag->name[0],"@stats") == 0) {
+        system_tag_read_stats(tag);
+    }
+
     pdebug(DEBUG_INFO,"Done");
 
     return (plc_tag_p)tag;
@@ -122,6 +137,11 @@ static void system_tag_destroy(plc_tag_p ptag)
         return;
     }
 
+    if(tag->stats_data) {
+        mem_free(tag->stats_data);
+        tag->stats_data = NULL;
+    }
+
     //mem_free(tag);
 
     return;
@@ -154,11 +174,53 @@ static int system_tag_read(plc_tag_p ptag)
         return PLCTAG_STATUS_OK;
     }
 
+    if(str_cmp_i(&tag->name[0],"@stats") == 0) {
+        return system_tag_read_stats(tag);
+    }
+
     pdebug(DEBUG_WARN,"Unknown system tag %s", tag->name);
     return PLCTAG_ERR_UNSUPPORTED;
 }
 
 
+/*
+ * The tag data becomes one record per session.  The size changes as
+ * sessions come and go.
+ */
+static int system_tag_read_stats(system_tag_p tag)
+{
+    int size = session_get_stats(NULL, 0);
+    int needed = 0;
+
+    pdebug(DEBUG_DETAIL,"Starting.");
+
+    if(size > 0) {
+        uint8_t *new_data = (uint8_t *)mem_realloc(tag->stats_data, size);
+
+        if(!new_data) {
+            pdebug(DEBUG_WARN,"Unable to allocate %d bytes for session statistics!", size);
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tag->stats_data = new_data;
+
+        /* sessions can come and go in between, only whole records that fit are copied. */
+        needed = session_get_stats(tag->stats_data, size);
+        if(needed < size) {
+            size = needed;
+        }
+
+        tag->data = tag->stats_data;
+    }
+
+    tag->size = size;
+
+    pdebug(DEBUG_DETAIL,"Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 static int system_tag_status(plc_tag_p tag)
 {
     tag->status = PLCTAG_STATUS_OK;
@@ -174,8 +236,8 @@ static int system_tag_write(plc_tag_p ptag)
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    /* the version is static */
-    if(str_cmp_i(&tag->name[0],"version") == 0) {
+    /* the version and statistics are read only. */
+    if(str_cmp_i(&tag->name[0],"version") == 0 || str_cmp_i(&tag->name[0],"@stats") == 0) {
         return PLCTAG_ERR_NOT_IMPLEMENTED;
     }
 
@@ -35,6 +35,9 @@ struct system_tag_t {
 
     char name[MAX_SYSTEM_TAG_NAME];
     uint8_t backing_data[MAX_SYSTEM_TAG_SIZE];
+
+    /* @stats snapshots do not fit in the backing data. */
+    uint8_t *stats_data;
 };
 
 typedef struct system_tag_t *system_tag_p;
@@ -0,0 +1,221 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "log.h"
+#include "tags.h"
+
+
+/*
+ * The config file is one setting per line.  Blank lines and lines
+ * starting with # are skipped.
+ *
+ *   port 44818
+ *   port 45000-45099
+ *   conn_size 511
+ *   rtt_us 2000
+ *   jitter_us 500
+ *   max_rate 2000
+ *   tag TestDINTArray DINT 10
+ *   tag Temperatures REAL 500
+ *
+ * The tag types are BOOL, SINT, INT, DINT, LINT, REAL and LREAL and the
+ * UDTs SIM_MOTOR and SIM_AXIS, see tags.c.  The
+ * other settings are in the table below, see config.h for what they
+ * mean.  Each one can also be given on the command line, conn_size as
+ * --conn-size and so on.
+ */
+
+#define MAX_LINE (512)
+
+typedef struct {
+    const char *name;
+    int is_double;
+    size_t offset;
+    double min;
+    double max;
+} setting;
+
+static const setting settings[] = {
+    { "conn_size",  0, offsetof(sim_config, conn_size),  MIN_CONN_SIZE, MAX_CONN_SIZE },
+    { "delay_us",   0, offsetof(sim_config, delay_us),   0, 60000000 },
+    { "rtt_us",     0, offsetof(sim_config, rtt_us),     0, 60000000 },
+    { "jitter_us",  0, offsetof(sim_config, jitter_us),  0, 60000000 },
+    { "max_rate",   0, offsetof(sim_config, max_rate),   0, 1000000 },
+    { "stall_prob", 1, offsetof(sim_config, stall_prob), 0, 1 },
+    { "stall_ms",   0, offsetof(sim_config, stall_ms),   0, 600000 },
+    { "drop_prob",  1, offsetof(sim_config, drop_prob),  0, 1 },
+    { "seed",       0, offsetof(sim_config, seed),       0, 2147483647 },
+    { NULL, 0, 0, 0, 0 }
+};
+
+static int parse_tag_line(char *args);
+
+
+
+void config_init(sim_config *config)
+{
+    memset(config, 0, sizeof(*config));
+
+    config->conn_size = DEFAULT_CONN_SIZE;
+    config->seed = 1;
+}
+
+
+
+/* add a port or an inclusive range like 45000-45099.  Returns 1 on success. */
+int config_add_ports(sim_config *config, const char *range)
+{
+    char *end = NULL;
+    long first = strtol(range, &end, 10);
+    long last = first;
+
+    if(end == range) {
+        log_error("Bad port \"%s\"!\n", range);
+        return 0;
+    }
+
+    if(*end == '-') {
+        const char *last_str = end + 1;
+
+        last = strtol(last_str, &end, 10);
+        if(end == last_str) {
+            log_error("Bad port range \"%s\"!\n", range);
+            return 0;
+        }
+    }
+
+    if(*end != 0 || first < 1 || last > 65535 || last < first) {
+        log_error("Bad port range \"%s\"!\n", range);
+        return 0;
+    }
+
+    if(config->num_ports + (last - first + 1) > MAX_PORTS) {
+        log_error("Too many ports, at most %d are supported!\n", MAX_PORTS);
+        return 0;
+    }
+
+    for(long port = first; port <= last; port++) {
+        config->ports[config->num_ports++] = (uint16_t)port;
+    }
+
+    return 1;
+}
+
+
+/* set one of the settings in the table by name.  Returns 1 on success. */
+int config_set(sim_config *config, const char *name, const char *value)
+{
+    const setting *set = NULL;
+    char *end = NULL;
+    double val = 0;
+
+    for(int i=0; settings[i].name; i++) {
+        if(strcmp(settings[i].name, name) == 0) {
+            set = &settings[i];
+            break;
+        }
+    }
+
+    if(!set) {
+        log_error("Unknown setting \"%s\"!\n", name);
+        return 0;
+    }
+
+    val = (set->is_double ? strtod(value, &end) : (double)strtol(value, &end, 10));
+
+    if(end == value || *end != 0 || val < set->min || val > set->max) {
+        log_error("Bad value \"%s\" for %s, it must be from %.10g to %.10g!\n", value, name, set->min, set->max);
+        return 0;
+    }
+
+    if(set->is_double) {
+        *(double *)((char *)config + set->offset) = val;
+    } else {
+        *(int *)((char *)config + set->offset) = (int)val;
+    }
+
+    return 1;
+}
+
+
+/* returns 1 on success. */
+int config_load(sim_config *config, const char *file_name)
+{
+    FILE *f = fopen(file_name, "r");
+    char line[MAX_LINE];
+    int line_num = 0;
+    int ok = 1;
+
+    if(!f) {
+        log_error("Unable to open config file %s!\n", file_name);
+        return 0;
+    }
+
+    while(ok && fgets(line, sizeof(line), f)) {
+        char *key = NULL;
+        char *args = NULL;
+
+        line_num++;
+
+        key = strtok(line, " \t\r\n");
+        if(!key || key[0] == '#') {
+            continue;
+        }
+
+        args = strtok(NULL, "\r\n");
+
+        if(strcmp(key, "port") == 0) {
+            char *range = (args ? strtok(args, " \t") : NULL);
+
+            ok = (range && config_add_ports(config, range));
+        } else if(strcmp(key, "tag") == 0) {
+            ok = (args && parse_tag_line(args));
+        } else {
+            char *value = (args ? strtok(args, " \t") : NULL);
+
+            if(!value) {
+                log_error("Setting \"%s\" needs a value!\n", key);
+            }
+
+            ok = (value && config_set(config, key, value));
+        }
+
+        if(!ok) {
+            log_error("Error in %s at line %d.\n", file_name, line_num);
+        }
+    }
+
+    fclose(f);
+
+    return ok;
+}
+
+
+/* <name> <type> <element count> */
+int parse_tag_line(char *args)
+{
+    char *name = strtok(args, " \t");
+    char *type_name = strtok(NULL, " \t");
+    char *count_str = strtok(NULL, " \t");
+    char *end = NULL;
+    long elem_count = 0;
+
+    if(!name || !type_name || !count_str) {
+        log_error("A tag needs a name, a type and an element count!\n");
+        return 0;
+    }
+
+    elem_count = strtol(count_str, &end, 10);
+    if(*end != 0 || elem_count < 1 || elem_count > UINT16_MAX) {
+        log_error("Bad element count \"%s\" for tag %s!\n", count_str, name);
+        return 0;
+    }
+
+    if(!add_tag(name, type_name, (int)elem_count)) {
+        log_error("Unable to add tag %s!\n", name);
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_PORTS (4096)
+#define DEFAULT_PORT (44818)
+
+/*
+ * Connection sizes, in bytes of connected data.  That is the CIP
+ * message and its two byte sequence count.  An L7x or L8x takes up to
+ * 4002 bytes through Forward Open Extended.  Sizes up to 511 act like
+ * an older controller that only knows the plain Forward Open.
+ */
+#define DEFAULT_CONN_SIZE (4002)
+#define MIN_CONN_SIZE (100)
+#define MAX_CONN_SIZE (4002)
+#define MAX_SMALL_CONN_SIZE (511)
+
+/*
+ * Settings from the command line and the config file.  Each listening
+ * port acts as a separate controller, they all share the tags.
+ */
+typedef struct {
+    uint16_t ports[MAX_PORTS];
+    int num_ports;
+
+    int conn_size;
+
+    /*
+     * Network and controller emulation, all off when zero.  See
+     * emulation.h for how they combine.
+     */
+    int delay_us;       /* processing time added to every response */
+    int rtt_us;         /* mean network round trip */
+    int jitter_us;      /* standard deviation of the round trip */
+    int max_rate;       /* requests per second each controller can serve */
+    double stall_prob;  /* chance that a request stalls the controller */
+    int stall_ms;       /* how long a stall lasts */
+    double drop_prob;   /* chance that a request is never answered */
+    int seed;           /* for the random numbers, so runs can be repeated */
+} sim_config;
+
+
+extern void config_init(sim_config *config);
+extern int config_add_ports(sim_config *config, const char *range);
+extern int config_set(sim_config *config, const char *name, const char *value);
+extern int config_load(sim_config *config, const char *file_name);
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <time.h>
+#include "emulation.h"
+#include "log.h"
+
+
+static double random_uniform(void);
+static double random_normal(void);
+static void heap_swap(int a, int b);
+static void heap_up(int pos);
+static void heap_down(int pos);
+
+static uint64_t random_state = 1;
+
+/* a binary min heap on due time, 1 based. */
+static sim_timer **heap = NULL;
+static int heap_size = 0;
+static int heap_capacity = 0;
+
+
+
+void emulation_init(const sim_config *config)
+{
+    /* xorshift must not start at zero. */
+    random_state = (uint64_t)config->seed * 2654435761u + 1;
+}
+
+
+int emulation_active(const sim_config *config)
+{
+    return config->delay_us > 0 || config->rtt_us > 0 || config->jitter_us > 0 || config->max_rate > 0
+           || config->stall_prob > 0 || config->drop_prob > 0;
+}
+
+
+int64_t emulation_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+/*
+ * Work out when the response to a request that arrived at now_us goes
+ * out.  Returns 0 if the request is dropped, which only happens when it
+ * is droppable.  The CPU time is used either way.
+ */
+int emulate_request(const sim_config *config, controller *ctl, int droppable, int64_t now_us, int64_t *due_us)
+{
+    int64_t start_us = (ctl->cpu_free_us > now_us ? ctl->cpu_free_us : now_us);
+    int64_t rtt_us = config->rtt_us;
+
+    if(config->stall_prob > 0 && random_uniform() < config->stall_prob) {
+        log("emulate_request() controller stalls for %dms.\n", config->stall_ms);
+        start_us += (int64_t)config->stall_ms * 1000;
+    }
+
+    if(config->max_rate > 0) {
+        start_us += 1000000 / config->max_rate;
+    }
+
+    ctl->cpu_free_us = start_us;
+
+    if(config->jitter_us > 0) {
+        rtt_us += (int64_t)(random_normal() * config->jitter_us);
+
+        if(rtt_us < 0) {
+            rtt_us = 0;
+        }
+    }
+
+    *due_us = start_us + config->delay_us + rtt_us;
+
+    if(droppable && config->drop_prob > 0 && random_uniform() < config->drop_prob) {
+        log("emulate_request() dropping the request.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* xorshift64*, in [0, 1). */
+double random_uniform(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return (double)((random_state * 2685821657736338717ull) >> 11) / 9007199254740992.0;
+}
+
+
+/* close enough to a standard normal, the sum of twelve uniforms less six. */
+double random_normal(void)
+{
+    double sum = 0;
+
+    for(int i=0; i < 12; i++) {
+        sum += random_uniform();
+    }
+
+    return sum - 6.0;
+}
+
+
+
+
+/*
+ * Timers.  Sessions with held back responses schedule a timer for the
+ * first one and the event loop sleeps until the earliest timer.
+ */
+
+void timer_schedule(sim_timer *timer, int64_t due_us)
+{
+    if(timer->heap_pos) {
+        int64_t old_due_us = timer->due_us;
+
+        timer->due_us = due_us;
+
+        if(due_us < old_due_us) {
+            heap_up(timer->heap_pos);
+        } else {
+            heap_down(timer->heap_pos);
+        }
+
+        return;
+    }
+
+    if(heap_size + 1 >= heap_capacity) {
+        int new_capacity = (heap_capacity ? heap_capacity * 2 : 256);
+        sim_timer **new_heap = (sim_timer **)realloc(heap, (size_t)new_capacity * sizeof(*new_heap));
+
+        if(!new_heap) {
+            log_error("timer_schedule() unable to grow the timer heap!\n");
+            return;
+        }
+
+        heap = new_heap;
+        heap_capacity = new_capacity;
+    }
+
+    timer->due_us = due_us;
+    heap_size++;
+    heap[heap_size] = timer;
+    timer->heap_pos = heap_size;
+
+    heap_up(heap_size);
+}
+
+
+void timer_cancel(sim_timer *timer)
+{
+    int pos = timer->heap_pos;
+
+    if(!pos) {
+        return;
+    }
+
+    heap_swap(pos, heap_size);
+    heap_size--;
+    timer->heap_pos = 0;
+
+    if(pos <= heap_size) {
+        heap_up(pos);
+        heap_down(pos);
+    }
+}
+
+
+/* the earliest timer, still scheduled.  NULL if there are none. */
+sim_timer *timer_next(void)
+{
+    return (heap_size > 0 ? heap[1] : NULL);
+}
+
+
+void heap_swap(int a, int b)
+{
+    sim_timer *tmp = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = tmp;
+
+    heap[a]->heap_pos = a;
+    heap[b]->heap_pos = b;
+}
+
+
+void heap_up(int pos)
+{
+    while(pos > 1 && heap[pos]->due_us < heap[pos / 2]->due_us) {
+        heap_swap(pos, pos / 2);
+        pos = pos / 2;
+    }
+}
+
+
+void heap_down(int pos)
+{
+    while(1) {
+        int smallest = pos;
+        int left = pos * 2;
+        int right = left + 1;
+
+        if(left <= heap_size && heap[left]->due_us < heap[smallest]->due_us) {
+            smallest = left;
+        }
+
+        if(right <= heap_size && heap[right]->due_us < heap[smallest]->due_us) {
+            smallest = right;
+        }
+
+        if(smallest == pos) {
+            return;
+        }
+
+        heap_swap(pos, smallest);
+        pos = smallest;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Network and controller emulation.  Loopback answers in microseconds,
+ * which hides pipelining, batching and timeouts, so responses can be
+ * held back to look like a controller on a plant network.
+ *
+ * Each port is one controller with one communications CPU.  A request
+ * waits until that CPU is free, stalls it now and then, uses it for
+ * 1/max_rate seconds and is then answered after the processing delay
+ * and a network round trip.  A Multiple Service Packet is one request.
+ * Some requests are never answered at all.  Responses on a session
+ * still go out in order, as they would on one TCP connection.
+ */
+
+typedef struct {
+    int64_t cpu_free_us;    /* when the communications CPU is next free */
+} controller;
+
+
+/* a point in time to do something for owner.  Zero it before first use. */
+typedef struct {
+    int64_t due_us;
+    int heap_pos;           /* 1 based, 0 when not scheduled */
+    void *owner;
+} sim_timer;
+
+
+extern void emulation_init(const sim_config *config);
+extern int emulation_active(const sim_config *config);
+extern int64_t emulation_now_us(void);
+extern int emulate_request(const sim_config *config, controller *ctl, int droppable, int64_t now_us, int64_t *due_us);
+
+extern void timer_schedule(sim_timer *timer, int64_t due_us);
+extern void timer_cancel(sim_timer *timer);
+extern sim_timer *timer_next(void);
@@ -1,7 +1,11 @@
-
 #pragma once
 
 #include <stdio.h>
 
-#define log(...) fprintf(stderr, __VA_ARGS__)
+/* packet level chatter, only printed with -v. */
+extern int log_verbose;
+
+#define log(...) do { if(log_verbose) fprintf(stderr, __VA_ARGS__); } while(0)
 
+/* always printed. */
+#define log_error(...) fprintf(stderr, __VA_ARGS__)
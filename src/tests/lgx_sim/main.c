@@ -1,5 +1,19 @@
 /*
  *  Compile with -pthread
+ *
+ *  lgx_sim [-v] [--config <file>] [--port <port>[-<last port>]]...
+ *          [--<setting> <value>]...
+ *
+ *  One thread serves all the sessions from an epoll event loop.  Every
+ *  listening port acts as its own controller, so a single process can
+ *  stand in for hundreds of PLCs.  Ports given on the command line
+ *  replace those in the config file, other settings override it.  The
+ *  settings are the ones in config.c with - for _, like --conn-size or
+ *  --rtt-us.  Without a config file the two test arrays and a UDT array
+ *  are served on port 44818.
+ *
+ *  With any of the emulation settings on, responses are held back and
+ *  a timerfd wakes the loop when the next one is due.
  */
 
 #include <stdio.h>
@@ -7,24 +21,55 @@
 #include <string.h> /* memset() */
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
-#include <pthread.h>
+#include "config.h"
+#include "emulation.h"
 #include "log.h"
 #include "session.h"
 #include "tags.h"
 
-#define PORT    44818 /* Port to listen on */
-#define BACKLOG     10  /* Passed to listen() */
+#define BACKLOG     SOMAXCONN  /* Passed to listen() */
+#define MAX_EVENTS  (256)
 
-static int init_socket(int *sock);
-void *client_handler(void *pnewsock);
+typedef struct {
+    event_source source;
+    int sock;
+    uint16_t port;
+
+    /* each port is a controller. */
+    controller ctl;
+} listener;
+
+typedef struct {
+    event_source source;
+    int fd;
+} timer_source;
+
+int log_verbose = 0;
+
+static int init_socket(int *sock, uint16_t port);
+static int set_nonblocking(int sock);
+static void accept_sessions(int epoll_fd, listener *l, const sim_config *config);
+static void update_session_events(int epoll_fd, session_context *session);
+static int init_timer(int epoll_fd, timer_source *timer);
+static void send_due_responses(int epoll_fd);
+static void arm_timer(timer_source *timer);
+static int parse_args(int argc, char **argv, sim_config *config);
+static void raise_file_limit(void);
+static void usage(void);
+
+static uint32_t session_handle = 1;
 
 
-int init_socket(int *sock)
+int init_socket(int *sock, uint16_t port)
 {
     int reuseaddr = 1;
     struct sockaddr_in listen_addr;
@@ -32,99 +77,407 @@ int init_socket(int *sock)
     /* open a TCP socket using IPv4 protocol */
     *sock = socket (PF_INET, SOCK_STREAM, 0);
     if (*sock == -1) {
-        log("socket() failed.\n");
+        log_error("socket() failed.\n");
         return 0;
     }
 
     /* Enable the socket to reuse the address */
     if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == -1) {
-        log("setsockopt() failed!\n");
+        log_error("setsockopt() failed!\n");
         return 0;
     }
 
     /* describe where we want to listen: on any network. */
     memset(&listen_addr, 0, sizeof(listen_addr));
     listen_addr.sin_family = AF_INET;
-    listen_addr.sin_port = htons(PORT);
+    listen_addr.sin_port = htons(port);
     listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     if (bind(*sock, (struct sockaddr *) &listen_addr, sizeof (listen_addr)) < 0) {
-        log("bind() failed!\n");
-        log("errno = %d\n", errno);
+        log_error("bind() to port %d failed!\n", port);
+        log_error("errno = %d\n", errno);
         return 0;
     }
 
     /* Listen */
     if (listen(*sock, BACKLOG) == -1) {
-        log("listen");
+        log_error("listen");
         return 0;
     }
 
-    return 1;
+    return set_nonblocking(*sock);
 }
 
 
-
-
-int main(void)
+int set_nonblocking(int sock)
 {
-    int sock;
-    pthread_t thread;
-    session_context *session = NULL;
-    uint32_t session_handle = 1;
+    int flags = fcntl(sock, F_GETFL, 0);
 
-    if(!init_socket(&sock)) {
-        log("init_socket() failed!\n");
-        return 1;
+    if(flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        log_error("Unable to make socket non-blocking!\n");
+        return 0;
     }
 
-    init_tags();
+    return 1;
+}
+
 
-    /* Main loop */
-    while (1) {
+
+void accept_sessions(int epoll_fd, listener *l, const sim_config *config)
+{
+    while(1) {
         socklen_t size = sizeof(struct sockaddr_in);
         struct sockaddr_in client_addr;
+        struct epoll_event event;
+        session_context *session = NULL;
         int newsock;
 
         /* get the client information. */
         memset(&client_addr, 0, sizeof client_addr);
-        newsock = accept(sock, (struct sockaddr*)&client_addr, &size);
-
+        newsock = accept(l->sock, (struct sockaddr*)&client_addr, &size);
 
         if (newsock == -1) {
-            log("accept() failed!\n");
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_error("accept() failed, errno = %d!\n", errno);
+            }
+
+            return;
+        }
+
+        log("Got a connection from %s on port %d to port %d\n", inet_ntoa(client_addr.sin_addr), htons(client_addr.sin_port), l->port);
+
+        if(!set_nonblocking(newsock)) {
+            close(newsock);
+            continue;
+        }
+
+        session = session_create(newsock, session_handle, config, &l->ctl);
+        if(!session) {
+            close(newsock);
+            continue;
+        }
+
+        /* note that the connection ID uses the next value too. */
+        session_handle += 2;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, newsock, &event) < 0) {
+            log_error("Unable to watch the new session!\n");
+            session_destroy(session);
+        }
+    }
+}
+
+
+/* only wait for writable while there are responses the socket did not take. */
+void update_session_events(int epoll_fd, session_context *session)
+{
+    int want_write = session_has_output(session);
+    struct epoll_event event;
+
+    if(want_write == session->waiting_for_write) {
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    event.data.ptr = session;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->sock, &event);
+
+    session->waiting_for_write = want_write;
+}
+
+
+int init_timer(int epoll_fd, timer_source *timer)
+{
+    struct epoll_event event;
+
+    timer->source = SOURCE_TIMER;
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+    if(timer->fd < 0) {
+        log_error("timerfd_create() failed!\n");
+        return 0;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = timer;
+
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer->fd, &event) < 0) {
+        log_error("Unable to watch the timer!\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void send_due_responses(int epoll_fd)
+{
+    int64_t now_us = emulation_now_us();
+    sim_timer *timer = NULL;
+
+    /* sending reschedules or cancels the session's timer. */
+    while((timer = timer_next()) && timer->due_us <= now_us) {
+        session_context *session = (session_context *)timer->owner;
+
+        if(session_send_due(session, now_us)) {
+            update_session_events(epoll_fd, session);
         } else {
-            log("Got a connection from %s on port %d\n", inet_ntoa(client_addr.sin_addr), htons(client_addr.sin_port));
-
-            /*
-             * set up a new session.  We allocate it here to get rid of possible
-             * threading race conditions.
-             */
-            session = (session_context *)calloc(1, sizeof(session_context));
-            if (session) {
-                session->session_handle = session_handle++;
-                session->connection_id = session_handle; /* note that post-increment
-                                                          * will make this different
-                                                          * from the session_handle
-                                                          * value.
-                                                          */
-                session->sock = newsock;
-
-                /* create a thread to handle the client. */
-                if (pthread_create(&thread, NULL, session_handler, session) != 0) {
-                    log("Failed to create thread\n");
-                    break;
-                }
+            log("Closing session %u.\n", session->session_handle);
+            session_destroy(session);
+        }
+    }
+}
+
+
+/* wake up for the earliest timer, or never if there is none. */
+void arm_timer(timer_source *timer)
+{
+    sim_timer *next = timer_next();
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    if(next) {
+        spec.it_value.tv_sec = (time_t)(next->due_us / 1000000);
+        spec.it_value.tv_nsec = (long)((next->due_us % 1000000) * 1000);
+
+        /* zero would disarm it. */
+        if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+
+/* every session is a socket. */
+void raise_file_limit(void)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+
+void usage(void)
+{
+    log_error("Usage: lgx_sim [-v] [--config <file>] [--port <port>[-<last port>]]... [--<setting> <value>]...\n");
+}
+
 
-                /* we want the thread to clean itself up. */
-                pthread_detach(thread);
+/*
+ * The config files are read first so that the rest of the command line
+ * overrides them.  Returns 1 on success.
+ */
+int parse_args(int argc, char **argv, sim_config *config)
+{
+    int cli_ports = 0;
+
+    for(int i=1; i < argc; i++) {
+        if(strcmp(argv[i], "-v") == 0) {
+            log_verbose = 1;
+        } else if(i + 1 < argc && strcmp(argv[i], "--config") == 0) {
+            if(!config_load(config, argv[++i])) {
+                return 0;
+            }
+        } else if(i + 1 < argc && strncmp(argv[i], "--", 2) == 0) {
+            i++;
+        } else {
+            usage();
+            return 0;
+        }
+    }
+
+    for(int i=1; i < argc; i++) {
+        char name[64];
+
+        if(strcmp(argv[i], "-v") == 0) {
+            continue;
+        }
+
+        if(strcmp(argv[i], "--config") == 0) {
+            i++;
+            continue;
+        }
+
+        if(strcmp(argv[i], "--port") == 0) {
+            if(!cli_ports) {
+                config->num_ports = 0;
+                cli_ports = 1;
+            }
+
+            if(!config_add_ports(config, argv[++i])) {
+                return 0;
+            }
+
+            continue;
+        }
+
+        /* --conn-size is the setting conn_size. */
+        snprintf(name, sizeof(name), "%s", argv[i] + 2);
+
+        for(char *p = name; *p; p++) {
+            if(*p == '-') {
+                *p = '_';
+            }
+        }
+
+        if(!config_set(config, name, argv[++i])) {
+            usage();
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+    static sim_config config;
+    static timer_source timer;
+    listener *listeners = NULL;
+    struct epoll_event events[MAX_EVENTS];
+    int epoll_fd = -1;
+    int emulating = 0;
+
+    config_init(&config);
+
+    if(!parse_args(argc, argv, &config)) {
+        return 1;
+    }
+
+    if(config.num_ports == 0) {
+        config.ports[config.num_ports++] = DEFAULT_PORT;
+    }
+
+    if(tag_count() == 0) {
+        init_tags();
+    }
+
+    raise_file_limit();
+
+    epoll_fd = epoll_create(MAX_EVENTS);
+    if(epoll_fd < 0) {
+        log_error("epoll_create() failed!\n");
+        return 1;
+    }
+
+    listeners = (listener *)calloc((size_t)config.num_ports, sizeof(listener));
+    if(!listeners) {
+        log_error("Unable to allocate listeners!\n");
+        return 1;
+    }
+
+    for(int i=0; i < config.num_ports; i++) {
+        struct epoll_event event;
+
+        listeners[i].source = SOURCE_LISTENER;
+        listeners[i].port = config.ports[i];
+
+        if(!init_socket(&listeners[i].sock, listeners[i].port)) {
+            log_error("init_socket() failed!\n");
+            return 1;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &listeners[i];
+
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i].sock, &event) < 0) {
+            log_error("Unable to watch port %d!\n", listeners[i].port);
+            return 1;
+        }
+    }
+
+    emulating = emulation_active(&config);
+
+    if(emulating) {
+        emulation_init(&config);
+
+        if(!init_timer(epoll_fd, &timer)) {
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "lgx_sim serving %d tags on %d port(s) starting at %d, connection size %d.\n", tag_count(), config.num_ports, config.ports[0], config.conn_size);
+
+    if(emulating) {
+        fprintf(stderr, "Emulating delay %dus, round trip %dus +/- %dus, %d requests/s, stall %g for %dms, drop %g.\n",
+                config.delay_us, config.rtt_us, config.jitter_us, config.max_rate, config.stall_prob, config.stall_ms, config.drop_prob);
+    }
+
+    /* Main loop */
+    while (1) {
+        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+        if(num_events < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            log_error("epoll_wait() failed!\n");
+            break;
+        }
+
+        for(int i=0; i < num_events; i++) {
+            event_source *source = (event_source *)events[i].data.ptr;
+
+            if(*source == SOURCE_LISTENER) {
+                accept_sessions(epoll_fd, (listener *)source, &config);
+            } else if(*source == SOURCE_TIMER) {
+                uint64_t expirations = 0;
+
+                /* the due responses are sent below. */
+                if(read(timer.fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    log_error("Unable to read the timer!\n");
+                }
             } else {
-                log("Unable to allocated new session!\n");
-                break;
+                session_context *session = (session_context *)source;
+                int keep = 1;
+
+                if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    keep = 0;
+                }
+
+                if(keep && (events[i].events & EPOLLIN)) {
+                    keep = session_read(session);
+                }
+
+                if(keep && (events[i].events & EPOLLOUT)) {
+                    keep = session_flush(session);
+                }
+
+                if(keep) {
+                    update_session_events(epoll_fd, session);
+                } else {
+                    log("Closing session %u.\n", session->session_handle);
+
+                    /* closing the socket removes it from the epoll set. */
+                    session_destroy(session);
+                }
             }
         }
+
+        if(emulating) {
+            send_due_responses(epoll_fd);
+            arm_timer(&timer);
+        }
     }
 
-    close(sock);
+    close(epoll_fd);
 
     return 0;
 }
@@ -15,28 +15,85 @@
 #define CIP_CMD_FORWARD_CLOSE        ((uint8_t)0x4E)
 #define CIP_CMD_FORWARD_OPEN         ((uint8_t)0x54)
 #define CIP_CMD_FORWARD_OPEN_EX      ((uint8_t)0x5B)
+#define CIP_CMD_UNCONNECTED_SEND     ((uint8_t)0x52) /* to the connection manager, not a tag */
 #define CIP_CMD_READ                 ((uint8_t)0x4C)
 #define CIP_CMD_WRITE                ((uint8_t)0x4D)
 #define CIP_CMD_READ_FRAG            ((uint8_t)0x52)
 #define CIP_CMD_WRITE_FRAG           ((uint8_t)0x53)
+#define CIP_CMD_READ_MODIFY_WRITE    ((uint8_t)0x4E) /* on a tag, not the connection manager */
+#define CIP_CMD_MULTI                ((uint8_t)0x0A)
+#define CIP_CMD_LIST_TAGS            ((uint8_t)0x55)
+#define CIP_CMD_GET_ATTR_LIST        ((uint8_t)0x03)
+#define CIP_CMD_READ_TEMPLATE        ((uint8_t)0x4C) /* on the Template class, not a tag */
 
 
 
 #define CIP_CMD_OK                   ((uint8_t)0x80)
 
 #define CIP_STATUS_OK               ((uint8_t)0)
+#define CIP_STATUS_CONN_FAILURE     ((uint8_t)0x01)
+#define CIP_STATUS_PATH_SEGMENT     ((uint8_t)0x04)
+#define CIP_STATUS_PATH_UNKNOWN     ((uint8_t)0x05)
 #define CIP_STATUS_FRAG             ((uint8_t)0x06)
+#define CIP_STATUS_UNSUPPORTED      ((uint8_t)0x08)
+#define CIP_STATUS_REPLY_TOO_LARGE  ((uint8_t)0x11)
+#define CIP_STATUS_NOT_ENOUGH_DATA  ((uint8_t)0x13)
+#define CIP_STATUS_ATTR_UNSUPPORTED ((uint8_t)0x14)
+#define CIP_STATUS_TOO_MUCH_DATA    ((uint8_t)0x15)
+#define CIP_STATUS_EMBEDDED_ERROR   ((uint8_t)0x1E) /* some request in a Multiple Service Packet failed */
+#define CIP_STATUS_BAD_PARAM        ((uint8_t)0x20)
+#define CIP_STATUS_GENERAL          ((uint8_t)0xFF) /* Logix specific, see the extended status */
+
+/* extended status words. */
+#define CIP_EXT_CONN_SIZE           ((uint16_t)0x0109) /* followed by the size that is supported */
+#define CIP_EXT_BEYOND_END          ((uint16_t)0x2105)
+#define CIP_EXT_TYPE_MISMATCH       ((uint16_t)0x2107)
 
 /* CPF Item Types */
 #define CPF_ITEM_NAI ((uint16_t)0x0000) /* NULL Address Item */
 #define CPF_ITEM_CAI ((uint16_t)0x00A1) /* connected address item */
 #define CPF_ITEM_CDI ((uint16_t)0x00B1) /* connected data item */
 #define CPF_ITEM_UDI ((uint16_t)0x00B2) /* Unconnected data item */
+#define CPF_ITEM_SOCKADDR_T2O ((uint16_t)0x8001) /* T->O socket address info item */
+#define CPF_ITEM_SEQ_ADDR ((uint16_t)0x8002) /* sequenced address item */
 
 #define CIP_SYMBOLIC_SEGMENT  ((uint8_t)0x91)
 #define CIP_NUMERIC_SEGMENT_ONE_BYTE  ((uint8_t)0x28)
 #define CIP_NUMERIC_SEGMENT_TWO_BYTES  ((uint8_t)0x29)
 #define CIP_NUMERIC_SEGMENT_FOUR_BYTES  ((uint8_t)0x2A)
+#define CIP_CLASS_SEGMENT  ((uint8_t)0x20)
+#define CIP_INSTANCE_SEGMENT_ONE_BYTE  ((uint8_t)0x24)
+#define CIP_INSTANCE_SEGMENT_TWO_BYTES  ((uint8_t)0x25)
+
+#define CIP_CLASS_MESSAGE_ROUTER  ((uint8_t)0x02)
+#define CIP_CLASS_CONNECTION_MANAGER  ((uint8_t)0x06)
+#define CIP_CLASS_SYMBOL  ((uint8_t)0x6B)
+#define CIP_CLASS_TEMPLATE  ((uint8_t)0x6C)
+
+/* Symbol object attributes used for tag listing. */
+#define SYMBOL_ATTR_NAME  (1)
+#define SYMBOL_ATTR_TYPE  (2)
+#define SYMBOL_ATTR_ELEM_SIZE  (7)
+#define SYMBOL_ATTR_DIMS  (8)
+#define SYMBOL_TYPE_ONE_DIM  ((uint16_t)0x2000) /* array dimension count in bits 13 and 14 */
+#define SYMBOL_TYPE_STRUCT  ((uint16_t)0x8000) /* the low 12 bits are the template ID */
+
+/* Template object attributes. */
+#define TEMPLATE_ATTR_HANDLE  (1)
+#define TEMPLATE_ATTR_MEMBER_COUNT  (2)
+#define TEMPLATE_ATTR_DEF_SIZE  (4)
+#define TEMPLATE_ATTR_INSTANCE_SIZE  (5)
+#define TEMPLATE_DEF_HEADER_SIZE  (23) /* counted in the definition size, never sent */
+
+/* the type in a read reply for a UDT is this, a length byte of 2 and the structure handle. */
+#define CIP_DATA_ABBREV_STRUCT  ((uint8_t)0xA0)
+
+/* a CIP reply is the reply service, a reserved byte, the status and the extended status size. */
+#define CIP_REPLY_HEADER_SIZE  (4)
+#define CIP_ERROR_REPLY_SIZE  (CIP_REPLY_HEADER_SIZE + 2)
+
+/* the largest unconnected CIP reply a Logix controller sends. */
+#define CIP_UNCONNECTED_MAX_SIZE  (504)
 
 
 
@@ -92,6 +149,49 @@ typedef struct {
 
 
 
+typedef struct {
+    uint16_t command;
+    uint16_t length;
+    uint32_t session_handle;
+    uint32_t status;
+    uint64_t sender_context;
+    uint32_t options;
+
+    /* Interface Handle etc. */
+    uint32_t interface_handle;      /* ALWAYS 0 */
+    uint16_t router_timeout;        /* in seconds */
+
+    /* Common Packet Format - CPF Unconnected */
+    uint16_t cpf_item_count;        /* 2, or 3 with a socket address item after the path */
+    uint16_t cpf_nai_item_type;     /* ALWAYS 0 */
+    uint16_t cpf_nai_item_length;   /* ALWAYS 0 */
+    uint16_t cpf_udi_item_type;     /* ALWAYS 0x00B2 - Unconnected Data Item */
+    uint16_t cpf_udi_item_length;   /* REQ: fill in with length of remaining data. */
+
+    /* CM Service Request - Connection Manager */
+    uint8_t cm_service_code;        /* ALWAYS 0x54 Forward Open Request */
+    uint8_t cm_req_path_size;       /* ALWAYS 2, size in words of path, next field */
+    uint8_t cm_req_path[4];         /* ALWAYS 0x20,0x06,0x24,0x01 for CM, instance 1*/
+
+    /* Forward Open Params */
+    uint8_t secs_per_tick;          /* seconds per tick */
+    uint8_t timeout_ticks;          /* timeout = srd_secs_per_tick * src_timeout_ticks */
+    uint32_t orig_to_targ_conn_id;  /* 0, returned by target in reply. */
+    uint32_t targ_to_orig_conn_id;  /* the client's ID for this connection */
+    uint16_t conn_serial_number;    /* our connection serial number */
+    uint16_t orig_vendor_id;        /* our unique vendor ID */
+    uint32_t orig_serial_number;    /* our unique serial number */
+    uint8_t conn_timeout_multiplier;/* timeout = mult * RPI */
+    uint8_t reserved[3];            /* reserved, set to 0 */
+    uint32_t orig_to_targ_rpi;      /* us to target RPI - Request Packet Interval in microseconds */
+    uint16_t orig_to_targ_conn_params;
+    uint32_t targ_to_orig_rpi;      /* target to us RPI, in microseconds */
+    uint16_t targ_to_orig_conn_params;
+    uint8_t transport_class;        /* 0xA3 for explicit messages, 0x01 for Class 1 I/O */
+    uint8_t path_size;              /* size of connection path in 16-bit words */
+} __attribute__((packed)) forward_open_request;
+
+
 typedef struct {
     uint16_t command;
     uint16_t length;
@@ -181,6 +281,41 @@ typedef struct {
 } __attribute__((packed)) forward_open_response;
 
 
+/* a failed Forward Open or Forward Open Extended. */
+typedef struct {
+    uint16_t command;
+    uint16_t length;
+    uint32_t session_handle;
+    uint32_t status;
+    uint64_t sender_context;
+    uint32_t options;
+
+    /* Interface Handle etc. */
+    uint32_t interface_handle;      /* ALWAYS 0 */
+    uint16_t router_timeout;        /* in seconds */
+
+    /* Common Packet Format - CPF Unconnected */
+    uint16_t cpf_item_count;        /* ALWAYS 2 */
+    uint16_t cpf_nai_item_type;     /* ALWAYS 0 */
+    uint16_t cpf_nai_item_length;   /* ALWAYS 0 */
+    uint16_t cpf_udi_item_type;     /* ALWAYS 0x00B2 - Unconnected Data Item */
+    uint16_t cpf_udi_item_length;   /* REQ: fill in with length of remaining data. */
+
+    /* Forward Open Reply */
+    uint8_t resp_service_code;      /* returned as 0xD4 or 0xDB */
+    uint8_t reserved1;
+    uint8_t general_status;         /* CIP_STATUS_CONN_FAILURE */
+    uint8_t status_size;            /* 2, the extended status and the supported size */
+    uint16_t ext_status;            /* CIP_EXT_CONN_SIZE */
+    uint16_t supported_size;        /* the largest connection size the target takes */
+    uint16_t conn_serial_number;    /* our connection serial number from request */
+    uint16_t orig_vendor_id;        /* our unique vendor ID from request*/
+    uint32_t orig_serial_number;    /* our unique serial number from request*/
+    uint8_t remaining_path_size;
+    uint8_t reserved2;
+} __attribute__((packed)) forward_open_error_response;
+
+
 typedef struct {
     uint16_t command;
     uint16_t length;
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "log.h"
+#include "packet.h"
+#include "producer.h"
+
+
+#define UDP_IO_PORT (2222)
+#define MAX_DATAGRAM (600)
+
+
+struct producer_t {
+    pthread_t thread;
+    volatile int stop;
+
+    tag_data *tag;
+    struct sockaddr_in dest;
+    uint32_t conn_id;
+    uint16_t conn_serial;
+    uint32_t rpi_us;
+};
+
+
+static void *producer_handler(void *prod_arg);
+static void init_io_socket(void);
+static uint8_t *put_le16(uint8_t *p, uint16_t val);
+static uint8_t *put_le32(uint8_t *p, uint32_t val);
+
+
+/* all data goes out from port 2222, like a real PLC. */
+static int io_sock = -1;
+static pthread_once_t io_sock_once = PTHREAD_ONCE_INIT;
+
+
+
+
+producer *producer_start(tag_data *tag, struct sockaddr_in *dest, uint32_t conn_id, uint16_t conn_serial, uint32_t rpi_us)
+{
+    producer *prod = NULL;
+
+    pthread_once(&io_sock_once, init_io_socket);
+
+    if(io_sock < 0) {
+        log("producer_start() no UDP socket!\n");
+        return NULL;
+    }
+
+    prod = (producer *)calloc(1, sizeof(*prod));
+    if(!prod) {
+        log("producer_start() unable to allocate producer!\n");
+        return NULL;
+    }
+
+    prod->tag = tag;
+    prod->dest = *dest;
+    prod->conn_id = conn_id;
+    prod->conn_serial = conn_serial;
+    prod->rpi_us = (rpi_us ? rpi_us : 1000);
+
+    if(pthread_create(&prod->thread, NULL, producer_handler, prod) != 0) {
+        log("producer_start() unable to create thread!\n");
+        free(prod);
+        return NULL;
+    }
+
+    log("producer_start() producing %s to %s:%d every %uus.\n", tag->name, inet_ntoa(dest->sin_addr), ntohs(dest->sin_port), prod->rpi_us);
+
+    return prod;
+}
+
+
+uint16_t producer_serial(producer *prod)
+{
+    return prod->conn_serial;
+}
+
+
+void producer_stop(producer *prod)
+{
+    if(!prod) {
+        return;
+    }
+
+    prod->stop = 1;
+
+    pthread_join(prod->thread, NULL);
+
+    log("producer_stop() stopped producing %s.\n", prod->tag->name);
+
+    free(prod);
+}
+
+
+
+void *producer_handler(void *prod_arg)
+{
+    producer *prod = (producer *)prod_arg;
+    size_t data_size = (size_t)prod->tag->elem_count * prod->tag->elem_size;
+    uint8_t *last_data = (uint8_t *)calloc(1, data_size);
+    uint8_t buf[MAX_DATAGRAM];
+    uint32_t seq = 0;
+    uint16_t seq_count = 0;
+    struct timespec delay;
+
+    delay.tv_sec = prod->rpi_us / 1000000;
+    delay.tv_nsec = (long)(prod->rpi_us % 1000000) * 1000;
+
+    if(!last_data || data_size + 20 > sizeof(buf)) {
+        log("producer_handler() tag %s is too large to produce!\n", prod->tag->name);
+        free(last_data);
+        return NULL;
+    }
+
+    while(!prod->stop) {
+        uint8_t *data = buf;
+
+        /* the sequence count only changes with the data. */
+        if(seq == 0 || memcmp(last_data, prod->tag->data, data_size) != 0) {
+            memcpy(last_data, prod->tag->data, data_size);
+            seq_count++;
+        }
+
+        seq++;
+
+        data = put_le16(data, 2);
+        data = put_le16(data, CPF_ITEM_SEQ_ADDR);
+        data = put_le16(data, 8);
+        data = put_le32(data, prod->conn_id);
+        data = put_le32(data, seq);
+        data = put_le16(data, CPF_ITEM_CDI);
+        data = put_le16(data, (uint16_t)(data_size + 2));
+        data = put_le16(data, seq_count);
+        memcpy(data, last_data, data_size);
+        data += data_size;
+
+        if(sendto(io_sock, buf, (size_t)(data - buf), 0, (struct sockaddr *)&prod->dest, sizeof(prod->dest)) < 0) {
+            log("producer_handler() sendto() failed!\n");
+        }
+
+        nanosleep(&delay, NULL);
+    }
+
+    free(last_data);
+
+    return NULL;
+}
+
+
+
+void init_io_socket(void)
+{
+    int reuseaddr = 1;
+    struct sockaddr_in addr;
+
+    io_sock = socket(PF_INET, SOCK_DGRAM, 0);
+    if(io_sock < 0) {
+        log("init_io_socket() socket() failed!\n");
+        return;
+    }
+
+    setsockopt(io_sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDP_IO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    /* heartbeats from the consumers are sent here, we just ignore them. */
+    if(bind(io_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log("init_io_socket() bind() to port %d failed!\n", UDP_IO_PORT);
+        close(io_sock);
+        io_sock = -1;
+    }
+}
+
+
+uint8_t *put_le16(uint8_t *p, uint16_t val)
+{
+    *p++ = (uint8_t)(val & 0xFF);
+    *p++ = (uint8_t)((val >> 8) & 0xFF);
+
+    return p;
+}
+
+
+uint8_t *put_le32(uint8_t *p, uint32_t val)
+{
+    p = put_le16(p, (uint16_t)(val & 0xFFFF));
+
+    return put_le16(p, (uint16_t)((val >> 16) & 0xFFFF));
+}
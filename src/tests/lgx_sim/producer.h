@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "tags.h"
+
+/*
+ * Class 1 producer.  Sends the tag data to the consumer over UDP every RPI
+ * until stopped.
+ */
+
+typedef struct producer_t producer;
+
+extern producer *producer_start(tag_data *tag, struct sockaddr_in *dest, uint32_t conn_id, uint16_t conn_serial, uint32_t rpi_us);
+extern uint16_t producer_serial(producer *prod);
+extern void producer_stop(producer *prod);
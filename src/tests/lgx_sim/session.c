@@ -1,7 +1,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "log.h"
 #include "packet.h"
 #include "session.h"
@@ -10,18 +13,40 @@
 
 
 static void print_buf(uint8_t *buf, size_t data_len);
+static int process_input(session_context *session);
+static void session_send(session_context *session, uint8_t *data, size_t len);
+static void queue_output(session_context *session, uint8_t *data, size_t len);
 static int process_packet(session_context *session);
 static void register_session(session_context *session);
 
 static void process_unconnected_data(session_context *session);
+static void handle_forward_open(session_context *session);
 static void handle_forward_open_ex(session_context *session);
 static void handle_forward_close(session_context *session);
+static void handle_unconnected_send(session_context *session);
+static void accept_message_connection(session_context *session, uint8_t service, int conn_size, uint32_t targ_to_orig_rpi);
+static void reject_forward_open(session_context *session, uint8_t service, uint8_t status, int supported_size);
 
 static void process_connected_data(session_context *session);
-static void handle_cip_read(session_context *session);
-static void handle_cip_write(session_context *session);
+static int handle_cip_request(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_read(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_write(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_read_modify_write(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_multi(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_list_tags(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_template_attrs(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int handle_cip_read_template(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space);
+static int cip_reply_header(uint8_t *resp, uint8_t service, uint8_t status);
+static int cip_error_reply(uint8_t *resp, uint8_t service, uint8_t status, uint16_t ext_status);
+static uint8_t find_request_tag(uint8_t *req, int req_len, tag_data **tag, int *item_offset, uint8_t **data);
+static int is_template_request(uint8_t *req, int req_len);
+static uint8_t find_request_udt(uint8_t *req, int req_len, udt_data **udt, uint8_t **data);
 
 static uint8_t *read_tag_path(uint8_t *buf, char **tag_name, int *item);
+static int get_le16(const uint8_t *data);
+static uint32_t get_le32(const uint8_t *data);
+static void put_le16(uint8_t *data, uint16_t val);
+static void put_le32(uint8_t *data, uint32_t val);
 
 
 //static _Atomic uint32_t session_id;
@@ -29,34 +54,258 @@ static uint8_t *read_tag_path(uint8_t *buf, char **tag_name, int *item);
 
 
 
-void *session_handler(void *session_arg)
+session_context *session_create(int sock, uint32_t session_handle, const sim_config *config, controller *ctl)
 {
-    int continue_running = 1;
-    session_context *session = (session_context *)session_arg;
+    session_context *session = (session_context *)calloc(1, sizeof(session_context));
 
-    while(continue_running) {
-        ssize_t rc = read(session->sock, session->buf, BUFFER_LEN);
+    if(!session) {
+        log_error("Unable to allocate new session!\n");
+        return NULL;
+    }
+
+    session->source = SOURCE_SESSION;
+    session->sock = sock;
+    session->config = config;
+    session->ctl = ctl;
+    session->timer.owner = session;
+    session->session_handle = session_handle;
+    session->connection_id = session_handle + 1;
+
+    return session;
+}
+
+
+/*
+ * Read what the socket has and handle every whole packet in it.  TCP
+ * does not keep the packet boundaries, so partial packets wait in the
+ * input buffer for the rest.  Returns 0 when the session should close.
+ */
+int session_read(session_context *session)
+{
+    while(1) {
+        ssize_t rc = recv(session->sock, session->in_buf + session->in_len, IN_BUFFER_LEN - session->in_len, 0);
+
+        if(rc == 0) {
+            log("session_read() client closed the connection.\n");
+            return 0;
+        }
 
         if(rc < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
             log("read() failed!\n");
-            break;
+            return 0;
+        }
+
+        session->in_len += (size_t)rc; /* safe cast because we checked for negative above */
+
+        if(!process_input(session)) {
+            return 0;
+        }
+    }
+
+    return session_flush(session);
+}
+
+
+/* send what the socket will take.  Returns 0 on error. */
+int session_flush(session_context *session)
+{
+    size_t sent = 0;
+
+    if(session->out_failed) {
+        return 0;
+    }
+
+    while(sent < session->out_len) {
+        ssize_t rc = send(session->sock, session->out_buf + sent, session->out_len - sent, MSG_NOSIGNAL);
+
+        if(rc < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            log("send() failed!\n");
+            return 0;
+        }
+
+        sent += (size_t)rc;
+    }
+
+    memmove(session->out_buf, session->out_buf + sent, session->out_len - sent);
+    session->out_len -= sent;
+
+    return 1;
+}
+
+
+/* move the held back responses that are due to the output and send.  Returns 0 on error. */
+int session_send_due(session_context *session, int64_t now_us)
+{
+    while(session->delayed_head && session->delayed_head->due_us <= now_us) {
+        delayed_response *resp = session->delayed_head;
+
+        session->delayed_head = resp->next;
+        if(!session->delayed_head) {
+            session->delayed_tail = NULL;
         }
 
-        log("session_handler() got packet:\n");
-        print_buf(session->buf, (size_t)rc); /* safe cast because we checked for negative above */
+        session->delayed_len -= resp->len;
 
-        session->buf_len = (uint16_t)rc;
+        queue_output(session, resp->data, resp->len);
 
-        continue_running = process_packet(session);
+        free(resp);
     }
 
-    log("client handler thread terminating.\n");
+    if(session->delayed_head) {
+        timer_schedule(&session->timer, session->delayed_head->due_us);
+    } else {
+        timer_cancel(&session->timer);
+    }
+
+    return session_flush(session);
+}
+
+
+int session_has_output(session_context *session)
+{
+    return session->out_len > 0;
+}
+
+
+void session_destroy(session_context *session)
+{
+    for(int i=0; i < MAX_PRODUCERS; i++) {
+        producer_stop(session->producers[i]);
+    }
 
     close(session->sock);
 
+    timer_cancel(&session->timer);
+
+    while(session->delayed_head) {
+        delayed_response *resp = session->delayed_head;
+
+        session->delayed_head = resp->next;
+        free(resp);
+    }
+
+    free(session->out_buf);
     free(session);
+}
+
+
+int process_input(session_context *session)
+{
+    size_t used = 0;
+
+    while(session->in_len - used >= sizeof(eip_header)) {
+        eip_header *header = (eip_header *)(session->in_buf + used);
+        size_t packet_len = sizeof(eip_header) + header->length;
+
+        if(packet_len > BUFFER_LEN) {
+            log_error("process_input() packet of %d bytes is larger than the buffer!\n", (int)packet_len);
+            return 0;
+        }
+
+        if(session->in_len - used < packet_len) {
+            break;
+        }
+
+        memcpy(session->buf, session->in_buf + used, packet_len);
+        session->buf_len = (uint16_t)packet_len;
+        used += packet_len;
+
+        log("process_input() got packet:\n");
+        print_buf(session->buf, packet_len);
+
+        if(!process_packet(session)) {
+            return 0;
+        }
+    }
+
+    memmove(session->in_buf, session->in_buf + used, session->in_len - used);
+    session->in_len -= used;
+
+    return 1;
+}
+
+
+/*
+ * queue a response.  With the emulation on it is held back until the
+ * time worked out for the packet it answers.
+ */
+void session_send(session_context *session, uint8_t *data, size_t len)
+{
+    delayed_response *resp = NULL;
+
+    if(session->drop_response) {
+        return;
+    }
+
+    if(!emulation_active(session->config)) {
+        queue_output(session, data, len);
+        return;
+    }
+
+    if(session->out_len + session->delayed_len + len > MAX_OUT_BUFFER || !(resp = (delayed_response *)malloc(sizeof(*resp) + len))) {
+        log_error("session_send() client is not reading, dropping the session!\n");
+        session->out_failed = 1;
+        return;
+    }
 
-    return NULL;
+    resp->next = NULL;
+    resp->due_us = session->response_due_us;
+    resp->len = len;
+    memcpy(resp->data, data, len);
+
+    if(session->delayed_tail) {
+        session->delayed_tail->next = resp;
+    } else {
+        session->delayed_head = resp;
+    }
+
+    session->delayed_tail = resp;
+    session->delayed_len += len;
+
+    if(!session->timer.heap_pos) {
+        timer_schedule(&session->timer, resp->due_us);
+    }
+}
+
+
+void queue_output(session_context *session, uint8_t *data, size_t len)
+{
+    if(session->out_len + len > session->out_capacity) {
+        size_t new_capacity = (session->out_capacity ? session->out_capacity * 2 : BUFFER_LEN);
+        uint8_t *new_buf = NULL;
+
+        while(new_capacity < session->out_len + len) {
+            new_capacity *= 2;
+        }
+
+        if(new_capacity > MAX_OUT_BUFFER || !(new_buf = (uint8_t *)realloc(session->out_buf, new_capacity))) {
+            log_error("queue_output() client is not reading, dropping the session!\n");
+            session->out_failed = 1;
+            return;
+        }
+
+        session->out_buf = new_buf;
+        session->out_capacity = new_capacity;
+    }
+
+    memcpy(session->out_buf + session->out_len, data, len);
+    session->out_len += len;
 }
 
 
@@ -74,6 +323,23 @@ int process_packet(session_context *session)
         return 0;
     }
 
+    session->drop_response = 0;
+
+    if(emulation_active(session->config)) {
+        /* only requests for data are dropped, not the session and connection set up. */
+        int droppable = (header->command == EIP_CONNECTED_SEND);
+        int64_t due_us = 0;
+
+        session->drop_response = !emulate_request(session->config, session->ctl, droppable, emulation_now_us(), &due_us);
+
+        /* one TCP connection does not reorder. */
+        if(session->delayed_tail && due_us < session->delayed_tail->due_us) {
+            due_us = session->delayed_tail->due_us;
+        }
+
+        session->response_due_us = due_us;
+    }
+
     switch(header->command) {
     case EIP_REGISTER_SESSION:
         register_session(session);
@@ -87,6 +353,10 @@ int process_packet(session_context *session)
         process_connected_data(session);
         break;
 
+    case EIP_UNREGISTER_SESSION:
+        log("process_packet() client unregistered the session.\n");
+        return 0;
+
     default:
         log("process_packet() got unsupported packet type %x!\n",header->command);
         break;
@@ -99,443 +369,1205 @@ int process_packet(session_context *session)
 void register_session(session_context *session)
 {
     session_registration *reg = (session_registration*)session->buf;
-    ssize_t rc = 0;
 
     log("register_session() got request:\n");
     print_buf(session->buf, sizeof(*reg));
 
-    reg->session_handle = session->session_handle;
+    reg->session_handle = session->session_handle;
+
+    log("register_session() sending response:\n");
+    print_buf(session->buf, sizeof(*reg));
+
+    session_send(session, session->buf, sizeof(*reg));
+}
+
+
+void process_unconnected_data(session_context *session)
+{
+    unconnected_message *header = (unconnected_message *)session->buf;
+
+    switch(header->service_code) {
+    case CIP_CMD_FORWARD_OPEN:
+        handle_forward_open(session);
+        break;
+
+    case CIP_CMD_FORWARD_OPEN_EX:
+        handle_forward_open_ex(session);
+        break;
+
+    case CIP_CMD_FORWARD_CLOSE:
+        handle_forward_close(session);
+        break;
+
+    case CIP_CMD_UNCONNECTED_SEND:
+        handle_unconnected_send(session);
+        break;
+
+    default:
+        log("process_unconnected_data() unsupported service code %x!\n", header->service_code);
+        print_buf(session->buf,sizeof(eip_header) + header->length);
+
+        break;
+    }
+}
+
+
+
+
+
+/*
+ * Class 3 connections are handled like Forward Open Extended ones.
+ * Class 1 connections go to a produced tag.  The connection path is the
+ * route followed by the tag name, and the client tells us its UDP port
+ * in a socket address item after the path.
+ */
+
+void handle_forward_open(session_context *session)
+{
+    forward_open_request *req = (forward_open_request *)session->buf;
+    forward_open_response resp;
+    uint8_t *path = session->buf + sizeof(*req);
+    uint8_t *path_end = path + (req->path_size * 2);
+    uint8_t *data_end = session->buf + sizeof(eip_header) + req->length;
+    char tag_name[256];
+    tag_data *tag = NULL;
+    struct sockaddr_in dest;
+    socklen_t dest_len = sizeof(dest);
+    int slot = -1;
+
+    log("handle_forward_open() got request:\n");
+    print_buf(session->buf, sizeof(eip_header) + req->length);
+
+    if((req->transport_class & 0x0F) == 3) {
+        int conn_size = req->orig_to_targ_conn_params & 0x1FF;
+
+        if(conn_size > session->config->conn_size) {
+            log("handle_forward_open() requested packet size, %d, is too large!\n", conn_size);
+            reject_forward_open(session, CIP_CMD_FORWARD_OPEN, CIP_STATUS_CONN_FAILURE, session->config->conn_size);
+            return;
+        }
+
+        accept_message_connection(session, CIP_CMD_FORWARD_OPEN, conn_size, req->targ_to_orig_rpi);
+        return;
+    }
+
+    if((req->transport_class & 0x0F) != 1) {
+        log("handle_forward_open() only Class 1 and Class 3 connections are supported, got transport class %x!\n", req->transport_class);
+        return;
+    }
+
+    if(path_end > data_end) {
+        log("handle_forward_open() path is longer than the packet!\n");
+        return;
+    }
+
+    /* skip the port and logical segments of the route. */
+    while(path < path_end && *path != CIP_SYMBOLIC_SEGMENT) {
+        path += 2;
+    }
+
+    if(path + 2 > path_end || path + 2 + path[1] > path_end) {
+        log("handle_forward_open() no tag name in path!\n");
+        return;
+    }
+
+    memcpy(tag_name, path + 2, path[1]);
+    tag_name[path[1]] = 0;
+
+    tag = find_tag(tag_name);
+    if(!tag) {
+        log("handle_forward_open() tag %s not found!\n", tag_name);
+        return;
+    }
+
+    /* send to the address the client came from, on the port it asked for. */
+    memset(&dest, 0, sizeof(dest));
+    getpeername(session->sock, (struct sockaddr *)&dest, &dest_len);
+    dest.sin_port = htons(2222);
+
+    if(req->cpf_item_count >= 3 && path_end + 8 <= data_end
+       && (path_end[0] | (path_end[1] << 8)) == CPF_ITEM_SOCKADDR_T2O) {
+        memcpy(&dest.sin_port, path_end + 6, 2); /* already in network order */
+    }
+
+    for(int i=0; i < MAX_PRODUCERS; i++) {
+        if(!session->producers[i]) {
+            slot = i;
+            break;
+        }
+    }
+
+    if(slot < 0) {
+        log("handle_forward_open() too many Class 1 connections!\n");
+        return;
+    }
+
+    session->producers[slot] = producer_start(tag, &dest, req->targ_to_orig_conn_id, req->conn_serial_number, req->targ_to_orig_rpi);
+    if(!session->producers[slot]) {
+        return;
+    }
+
+    memset(&resp, 0, sizeof(resp));
+
+    resp.command = req->command;
+    resp.session_handle = req->session_handle;
+    resp.sender_context = req->sender_context;
+
+    resp.length = sizeof(resp) - sizeof(eip_header);
+
+    resp.interface_handle = req->interface_handle;
+    resp.router_timeout = req->router_timeout;
+
+    resp.cpf_item_count = 2;
+    resp.cpf_udi_item_type = CPF_ITEM_UDI;
+    resp.cpf_udi_item_length = (uint8_t*)(&resp + 1) - (uint8_t *)(&resp.resp_service_code);
+
+    resp.resp_service_code = CIP_CMD_FORWARD_OPEN | CIP_CMD_RESPONSE;
+    resp.general_status = 0;
+    resp.status_size = 0;
+    resp.orig_to_targ_conn_id = session->connection_id++;
+    resp.targ_to_orig_conn_id = req->targ_to_orig_conn_id;
+    resp.conn_serial_number = req->conn_serial_number;
+    resp.orig_vendor_id = req->orig_vendor_id;
+    resp.orig_serial_number = req->orig_serial_number;
+    resp.orig_to_targ_api = req->orig_to_targ_rpi;
+    resp.targ_to_orig_api = req->targ_to_orig_rpi;
+    resp.app_data_size = 0;
+
+    memcpy(session->buf, &resp, sizeof(resp));
+
+    log("handle_forward_open() sending response:\n");
+    print_buf(session->buf, sizeof(resp));
+
+    session_send(session, session->buf, sizeof(resp));
+}
+
+
+
+/*
+ * Class 3 connections carry the connected messages.  The controller
+ * turns down a connection larger than its connection size and says
+ * what size it would take, which is how the library finds the size to
+ * use.  Controllers with a connection size of 511 or less predate
+ * Forward Open Extended and do not support it.
+ */
+
+void handle_forward_open_ex(session_context *session)
+{
+    forward_open_ex_request *req = (forward_open_ex_request *)session->buf;
+    int conn_size = (int)(req->orig_to_targ_conn_params_ex & 0xFFFF);
+
+    log("handle_forward_open_ex() got request:\n");
+    print_buf(session->buf, sizeof(eip_header) + req->length);
+
+    if(session->config->conn_size <= MAX_SMALL_CONN_SIZE) {
+        log("handle_forward_open_ex() Forward Open Extended is not supported with a connection size of %d.\n", session->config->conn_size);
+        reject_forward_open(session, CIP_CMD_FORWARD_OPEN_EX, CIP_STATUS_UNSUPPORTED, 0);
+        return;
+    }
+
+    if(conn_size > session->config->conn_size) {
+        log("handle_forward_open_ex() requested packet size, %d, is too large!\n", conn_size);
+        reject_forward_open(session, CIP_CMD_FORWARD_OPEN_EX, CIP_STATUS_CONN_FAILURE, session->config->conn_size);
+        return;
+    }
+
+    accept_message_connection(session, CIP_CMD_FORWARD_OPEN_EX, conn_size, req->targ_to_orig_rpi);
+}
+
+
+
+/* the Forward Open and Forward Open Extended requests are the same up to the connection parameters. */
+void accept_message_connection(session_context *session, uint8_t service, int conn_size, uint32_t targ_to_orig_rpi)
+{
+    forward_open_request *req = (forward_open_request *)session->buf;
+    forward_open_response resp;
+
+    session->max_packet_size = (uint16_t)conn_size;
+
+    memset(&resp, 0, sizeof(resp));
+
+    resp.command = req->command;
+    resp.session_handle = req->session_handle;
+    resp.sender_context = req->sender_context;
+
+    resp.length = sizeof(resp) - sizeof(eip_header);
+
+    resp.interface_handle = req->interface_handle;
+    resp.router_timeout = req->router_timeout;
+
+    resp.cpf_item_count = 2;
+    resp.cpf_udi_item_type = CPF_ITEM_UDI;
+    resp.cpf_udi_item_length = (uint8_t*)(&resp + 1) - (uint8_t *)(&resp.resp_service_code);
+
+    resp.resp_service_code = service | CIP_CMD_RESPONSE;
+    resp.general_status = 0;
+    resp.status_size = 0;
+    /* make the connection ID global, seems that way on LGX??? */
+    resp.orig_to_targ_conn_id = session->connection_id++;
+    resp.targ_to_orig_conn_id = req->targ_to_orig_conn_id;
+    resp.conn_serial_number = req->conn_serial_number;
+    resp.orig_vendor_id = req->orig_vendor_id;
+    resp.orig_serial_number = req->orig_serial_number;
+    resp.orig_to_targ_api = req->orig_to_targ_rpi;
+    resp.targ_to_orig_api = targ_to_orig_rpi;
+    resp.app_data_size = 0;
+
+    log("accept_message_connection() called with remote connection ID %x and local connection ID %x, connection size %d\n", resp.targ_to_orig_conn_id, resp.orig_to_targ_conn_id, conn_size);
+
+    session->connection_id_targ = req->targ_to_orig_conn_id;
+
+    memcpy(session->buf, &resp, sizeof(resp));
+
+    log("accept_message_connection() sending response:\n");
+    print_buf(session->buf, sizeof(resp));
+
+    session_send(session, session->buf, sizeof(resp));
+}
+
+
+
+/* a supported size adds the connection size extended status. */
+void reject_forward_open(session_context *session, uint8_t service, uint8_t status, int supported_size)
+{
+    forward_open_request *req = (forward_open_request *)session->buf;
+    forward_open_error_response resp;
+    size_t resp_len = sizeof(resp);
+
+    memset(&resp, 0, sizeof(resp));
+
+    resp.command = req->command;
+    resp.session_handle = req->session_handle;
+    resp.sender_context = req->sender_context;
+
+    resp.interface_handle = req->interface_handle;
+    resp.router_timeout = req->router_timeout;
+
+    resp.cpf_item_count = 2;
+    resp.cpf_udi_item_type = CPF_ITEM_UDI;
+
+    resp.resp_service_code = service | CIP_CMD_RESPONSE;
+    resp.general_status = status;
+
+    if(supported_size > 0) {
+        resp.status_size = 2;
+        resp.ext_status = CIP_EXT_CONN_SIZE;
+        resp.supported_size = (uint16_t)supported_size;
+        resp.conn_serial_number = req->conn_serial_number;
+        resp.orig_vendor_id = req->orig_vendor_id;
+        resp.orig_serial_number = req->orig_serial_number;
+    } else {
+        /* just the status. */
+        resp_len = offsetof(forward_open_error_response, ext_status);
+    }
+
+    resp.length = (uint16_t)(resp_len - sizeof(eip_header));
+    resp.cpf_udi_item_length = (uint16_t)(resp_len - offsetof(forward_open_error_response, resp_service_code));
+
+    memcpy(session->buf, &resp, resp_len);
+
+    log("reject_forward_open() sending response:\n");
+    print_buf(session->buf, resp_len);
+
+    session_send(session, session->buf, resp_len);
+}
+
+
+
+void handle_forward_close(session_context *session)
+{
+    forward_close_request *req = (forward_close_request *)session->buf;
+    forward_close_response resp;
+    uint8_t *data_end = session->buf + sizeof(eip_header) + req->length;
+    uint8_t *path_start = session->buf + sizeof(*req);
+    ssize_t path_size = data_end - path_start;
+    uint8_t path_data[path_size];
+
+    log("handle_forward_close() got request:\n");
+    print_buf(session->buf, sizeof(eip_header) + req->length);
+
+    memset(&resp, 0, sizeof(resp));
+
+    memcpy(path_data, path_start, (size_t)path_size); /* FIXME - check if negative first! */
+
+    log("handle_forward_close() path_size=%d\n",(int)path_size);
+    print_buf(path_data, (size_t)path_size);
+
+    /* stop producing if this closes a Class 1 connection. */
+    for(int i=0; i < MAX_PRODUCERS; i++) {
+        if(session->producers[i] && producer_serial(session->producers[i]) == req->conn_serial_number) {
+            producer_stop(session->producers[i]);
+            session->producers[i] = NULL;
+        }
+    }
+
+    resp.command = req->command;
+    resp.session_handle = req->session_handle;
+    resp.sender_context = req->sender_context;
+
+    resp.length = (uint16_t)((size_t)path_size + sizeof(resp) - sizeof(eip_header));
+
+    resp.interface_handle = req->interface_handle;
+    resp.router_timeout = req->router_timeout;
+
+    resp.cpf_item_count = 2;
+    resp.cpf_udi_item_type = CPF_ITEM_UDI;
+    resp.cpf_udi_item_length = (uint8_t*)(&resp + 1) - (uint8_t *)(&resp.resp_service_code);
+
+    resp.resp_service_code = CIP_CMD_FORWARD_CLOSE | CIP_CMD_RESPONSE;
+    resp.general_status = 0;
+    resp.status_size = 0;
+
+    resp.conn_serial_number = req->conn_serial_number;
+    resp.orig_vendor_id = req->orig_vendor_id;
+    resp.orig_serial_number = req->orig_serial_number;
+
+    memcpy(session->buf, &resp, sizeof(resp));
+    memcpy(session->buf + sizeof(resp), path_data, (size_t)path_size);
+
+    log("handle_forward_close() sending response:\n");
+    print_buf(session->buf, sizeof(resp) + (size_t)path_size);
+
+    session_send(session, session->buf, sizeof(resp) + (size_t)path_size);
+}
+
+
+
+
+
+/*
+ * Unconnected Send to the Connection Manager.  The request is:
+ *
+ *    uint8_t   0x52 service
+ *    uint8_t   path size in words, the path is to the Connection Manager
+ *    uint8_t   seconds per tick
+ *    uint8_t   timeout ticks
+ *    uint16_t  size of the embedded request
+ *    the embedded request, padded to an even size
+ *    the route to the controller, which is ignored
+ *
+ * The embedded request is handled like a connected one and its reply
+ * is sent back on its own in the unconnected data item.
+ */
+
+void handle_unconnected_send(session_context *session)
+{
+    static const uint8_t cm_path[] = { CIP_CLASS_SEGMENT, CIP_CLASS_CONNECTION_MANAGER, CIP_INSTANCE_SEGMENT_ONE_BYTE, 0x01 };
+    unconnected_message *req = (unconnected_message *)session->buf;
+    unconnected_message *resp = (unconnected_message *)session->resp_buf;
+    uint8_t *cm_req = &req->service_code;
+    uint8_t *req_end = session->buf + session->buf_len;
+    uint8_t *embedded = cm_req + 2 + sizeof(cm_path) + 4;
+    uint8_t *cip_resp = &resp->service_code;
+    int embedded_len = 0;
+    int cip_resp_len = 0;
+    size_t resp_len = 0;
+
+    if(embedded > req_end || cm_req[1] != sizeof(cm_path)/2 || memcmp(cm_req + 2, cm_path, sizeof(cm_path)) != 0) {
+        log("handle_unconnected_send() request is not to the Connection Manager!\n");
+        cip_resp_len = cip_error_reply(cip_resp, CIP_CMD_UNCONNECTED_SEND, CIP_STATUS_PATH_SEGMENT, 0);
+    } else {
+        embedded_len = get_le16(embedded - 2);
+
+        if(embedded_len < 1 || embedded + embedded_len > req_end) {
+            log("handle_unconnected_send() embedded request of %d bytes does not fit in the packet!\n", embedded_len);
+            cip_resp_len = cip_error_reply(cip_resp, CIP_CMD_UNCONNECTED_SEND, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+        } else {
+            cip_resp_len = handle_cip_request(session, embedded, embedded_len, cip_resp, CIP_UNCONNECTED_MAX_SIZE);
+        }
+    }
+
+    resp_len = offsetof(unconnected_message, service_code) + (size_t)cip_resp_len;
+
+    resp->command = req->command;
+    resp->length = (uint16_t)(resp_len - sizeof(eip_header));
+    resp->session_handle = req->session_handle;
+    resp->status = 0;
+    resp->sender_context = req->sender_context;
+    resp->options = req->options;
+    resp->interface_handle = req->interface_handle;
+    resp->router_timeout = req->router_timeout;
+    resp->cpf_item_count = 2;
+    resp->cpf_nai_item_type = CPF_ITEM_NAI;
+    resp->cpf_nai_item_length = 0;
+    resp->cpf_udi_item_type = CPF_ITEM_UDI;
+    resp->cpf_udi_item_length = (uint16_t)cip_resp_len;
+
+    log("handle_unconnected_send() sending response:\n");
+    print_buf(session->resp_buf, resp_len);
+
+    session_send(session, session->resp_buf, resp_len);
+}
+
+
+
+
+
+/*
+ * Connected messages.  The handlers below only see the CIP part of the
+ * request and build the CIP part of the reply in resp_buf.  Each one is
+ * told how much reply space it has.  At the top level that is the
+ * connection size less the sequence count, inside a Multiple Service Packet it is what the
+ * requests before it left over.  Replies that do not fit are cut short
+ * the way a Logix controller does it, so the library's packing and
+ * fragmentation get exercised.
+ */
+
+void process_connected_data(session_context *session)
+{
+    connected_message *req = (connected_message *)session->buf;
+    connected_message_cip_resp *resp = (connected_message_cip_resp *)session->resp_buf;
+    uint8_t *cip_req = &req->service_code;
+    int cip_req_len = (int)session->buf_len - (int)(cip_req - session->buf);
+    int cip_limit = session->max_packet_size - (int)sizeof(req->cpf_conn_seq_num);
+    int cip_resp_len = 0;
+    size_t resp_len = 0;
+
+    if(session->max_packet_size == 0) {
+        log("process_connected_data() got connected data without a connection!\n");
+        return;
+    }
+
+    if(cip_req_len < 1) {
+        log("process_connected_data() packet has no CIP request!\n");
+        return;
+    }
+
+    if(cip_req_len > cip_limit) {
+        log("process_connected_data() request of %d bytes does not fit in the connection size %d!\n", cip_req_len, (int)session->max_packet_size);
+        cip_resp_len = cip_error_reply(&resp->service_code, *cip_req, CIP_STATUS_TOO_MUCH_DATA, 0);
+    } else {
+        cip_resp_len = handle_cip_request(session, cip_req, cip_req_len, &resp->service_code, cip_limit);
+    }
+
+    resp_len = offsetof(connected_message_cip_resp, service_code) + (size_t)cip_resp_len;
+
+    resp->command = req->command;
+    resp->length = (uint16_t)(resp_len - sizeof(eip_header));
+    resp->session_handle = req->session_handle;
+    resp->status = 0;
+    resp->sender_context = req->sender_context;
+    resp->options = req->options;
+    resp->interface_handle = req->interface_handle;
+    resp->router_timeout = req->router_timeout;
+    resp->cpf_item_count = 2;
+    resp->cpf_cai_item_type = CPF_ITEM_CAI;
+    resp->cpf_cai_item_length = 4;
+    resp->cpf_targ_conn_id = session->connection_id_targ;
+    resp->cpf_cdi_item_type = CPF_ITEM_CDI;
+    resp->cpf_cdi_item_length = (uint16_t)(cip_resp_len + (int)sizeof(resp->cpf_conn_seq_num));
+    resp->cpf_conn_seq_num = req->cpf_conn_seq_num;
+
+    log("process_connected_data() sending response:\n");
+    print_buf(session->resp_buf, resp_len);
+
+    session_send(session, session->resp_buf, resp_len);
+}
+
+
+
+/* returns the length of the CIP reply. */
+int handle_cip_request(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
+{
+    /* Read Template has the same service code as a tag read. */
+    if(is_template_request(req, req_len)) {
+        switch(req[0]) {
+        case CIP_CMD_GET_ATTR_LIST:
+            return handle_cip_template_attrs(session, req, req_len, resp, resp_space);
+
+        case CIP_CMD_READ_TEMPLATE:
+            return handle_cip_read_template(session, req, req_len, resp, resp_space);
+
+        default:
+            log("handle_cip_request() unsupported Template service code %x!\n", req[0]);
+            return cip_error_reply(resp, req[0], CIP_STATUS_UNSUPPORTED, 0);
+        }
+    }
+
+    switch(req[0]) {
+    case CIP_CMD_READ:
+    case CIP_CMD_READ_FRAG:
+        return handle_cip_read(session, req, req_len, resp, resp_space);
+
+    case CIP_CMD_WRITE:
+    case CIP_CMD_WRITE_FRAG:
+        return handle_cip_write(session, req, req_len, resp, resp_space);
+
+    case CIP_CMD_READ_MODIFY_WRITE:
+        return handle_cip_read_modify_write(session, req, req_len, resp, resp_space);
+
+    case CIP_CMD_MULTI:
+        return handle_cip_multi(session, req, req_len, resp, resp_space);
+
+    case CIP_CMD_LIST_TAGS:
+        return handle_cip_list_tags(session, req, req_len, resp, resp_space);
+
+    default:
+        log("handle_cip_request() unsupported service code %x!\n", req[0]);
+        return cip_error_reply(resp, req[0], CIP_STATUS_UNSUPPORTED, 0);
+    }
+}
+
+
+
+int handle_cip_read(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
+{
+    uint8_t service = req[0];
+    uint8_t *req_end = req + req_len;
+    uint8_t *data = NULL;
+    tag_data *tag = NULL;
+    int item_offset = 0;
+    int elem_count = 0;
+    uint32_t byte_offset = 0;
+    int total_size = 0;
+    int remaining = 0;
+    int size_that_fits = 0;
+    int resp_len = 0;
+    uint8_t status = CIP_STATUS_OK;
+
+    (void)session;
+
+    log("handle_cip_read() starting.\n");
+
+    status = find_request_tag(req, req_len, &tag, &item_offset, &data);
+    if(status != CIP_STATUS_OK) {
+        return cip_error_reply(resp, service, status, 0);
+    }
+
+    if(req_end - data < (service == CIP_CMD_READ_FRAG ? 6 : 2)) {
+        return cip_error_reply(resp, service, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
+
+    /* read the number of elements to read */
+    elem_count = get_le16(data);
+    data += 2;
+
+    if(service == CIP_CMD_READ_FRAG) {
+        byte_offset = get_le32(data);
+        data += 4;
+    }
+
+    log("handle_cip_read() tag %s, item %d, elem_count %d, byte offset %u.\n", tag->name, item_offset, elem_count, byte_offset);
+
+    total_size = elem_count * tag->elem_size;
+
+    if(elem_count < 1 || item_offset + elem_count > tag->elem_count || byte_offset >= (uint32_t)total_size) {
+        log("handle_cip_read() read is past the end of tag %s!\n", tag->name);
+        return cip_error_reply(resp, service, CIP_STATUS_GENERAL, CIP_EXT_BEYOND_END);
+    }
+
+    /* whole elements only, after the reply header and the type. */
+    remaining = total_size - (int)byte_offset;
+    size_that_fits = ((resp_space - CIP_REPLY_HEADER_SIZE - tag->data_type_size) / tag->elem_size) * tag->elem_size;
+
+    if(size_that_fits <= 0) {
+        log("handle_cip_read() no room for any data in the reply!\n");
+        return cip_error_reply(resp, service, CIP_STATUS_REPLY_TOO_LARGE, 0);
+    }
+
+    if(size_that_fits >= remaining) {
+        size_that_fits = remaining;
+    } else {
+        status = CIP_STATUS_FRAG;
+    }
+
+    resp_len = cip_reply_header(resp, service, status);
+
+    memcpy(resp + resp_len, tag->data_type, (size_t)tag->data_type_size);
+    resp_len += tag->data_type_size;
+
+    memcpy(resp + resp_len, tag->data + (item_offset * tag->elem_size) + (int)byte_offset, (size_t)size_that_fits);
+    resp_len += size_that_fits;
+
+    log("handle_cip_read() done.\n");
+
+    return resp_len;
+}
+
+
+
+/* a Logix controller answers every write fragment with plain success. */
+int handle_cip_write(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
+{
+    uint8_t service = req[0];
+    uint8_t *req_end = req + req_len;
+    uint8_t *data = NULL;
+    tag_data *tag = NULL;
+    int item_offset = 0;
+    int elem_count = 0;
+    uint32_t byte_offset = 0;
+    int total_size = 0;
+    int data_len = 0;
+    uint8_t status = CIP_STATUS_OK;
+
+    (void)session;
+    (void)resp_space;
+
+    log("handle_cip_write() starting.\n");
+
+    status = find_request_tag(req, req_len, &tag, &item_offset, &data);
+    if(status != CIP_STATUS_OK) {
+        return cip_error_reply(resp, service, status, 0);
+    }
+
+    if(req_end - data < tag->data_type_size + (service == CIP_CMD_WRITE_FRAG ? 6 : 2)) {
+        return cip_error_reply(resp, service, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
+
+    /* check the data type, for a UDT that includes the structure handle. */
+    if(memcmp(data, tag->data_type, (size_t)tag->data_type_size) != 0) {
+        log("handle_cip_write() tag data type not matching.  Expected %x %x but got %x %x!\n", tag->data_type[0], tag->data_type[1], data[0], data[1]);
+        return cip_error_reply(resp, service, CIP_STATUS_GENERAL, CIP_EXT_TYPE_MISMATCH);
+    }
+
+    data += tag->data_type_size;
+
+    /* read the number of elements to write */
+    elem_count = get_le16(data);
+    data += 2;
+
+    if(service == CIP_CMD_WRITE_FRAG) {
+        byte_offset = get_le32(data);
+        data += 4;
+    }
+
+    data_len = (int)(req_end - data);
+    total_size = elem_count * tag->elem_size;
+
+    log("handle_cip_write() tag %s, item %d, elem_count %d, byte offset %u, %d bytes of data.\n", tag->name, item_offset, elem_count, byte_offset, data_len);
+
+    if(elem_count < 1 || item_offset + elem_count > tag->elem_count || byte_offset > (uint32_t)total_size || (int)byte_offset + data_len > total_size) {
+        log("handle_cip_write() write is past the end of tag %s!\n", tag->name);
+        return cip_error_reply(resp, service, CIP_STATUS_GENERAL, CIP_EXT_BEYOND_END);
+    }
+
+    memcpy(tag->data + (item_offset * tag->elem_size) + (int)byte_offset, data, (size_t)data_len);
+
+    log("handle_cip_write() done.\n");
+
+    return cip_reply_header(resp, service, CIP_STATUS_OK);
+}
+
+
+
+int handle_cip_read_modify_write(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
+{
+    uint8_t service = req[0];
+    uint8_t *req_end = req + req_len;
+    uint8_t *data = NULL;
+    uint8_t *or_mask = NULL;
+    uint8_t *and_mask = NULL;
+    tag_data *tag = NULL;
+    int item_offset = 0;
+    int mask_size = 0;
+    int base_offset = 0;
+    uint8_t status = CIP_STATUS_OK;
+
+    (void)session;
+    (void)resp_space;
 
-    log("register_session() sending response:\n");
-    print_buf(session->buf, sizeof(*reg));
+    log("handle_cip_read_modify_write() starting.\n");
 
-    rc = write(session->sock, session->buf, sizeof(*reg));
-    if(rc != sizeof(*reg)) {
-        log("Amount written, %d, does not equal the response size, %d!\n", (int)rc, (int)sizeof(*reg));
+    status = find_request_tag(req, req_len, &tag, &item_offset, &data);
+    if(status != CIP_STATUS_OK) {
+        return cip_error_reply(resp, service, status, 0);
     }
-}
 
+    if(req_end - data < 2) {
+        return cip_error_reply(resp, service, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
 
-void process_unconnected_data(session_context *session)
-{
-    unconnected_message *header = (unconnected_message *)session->buf;
+    /* the masks cover one element. */
+    mask_size = get_le16(data);
+    data += 2;
 
-    switch(header->service_code) {
-    case CIP_CMD_FORWARD_OPEN_EX:
-        handle_forward_open_ex(session);
-        break;
+    or_mask = data;
+    and_mask = data + mask_size;
 
-    case CIP_CMD_FORWARD_CLOSE:
-        handle_forward_close(session);
-        break;
+    base_offset = item_offset * tag->elem_size;
 
-    default:
-        log("process_unconnected_data() unsupported service code %x!\n", header->service_code);
-        print_buf(session->buf,sizeof(eip_header) + header->length);
+    if(mask_size > tag->elem_size || item_offset >= tag->elem_count || and_mask + mask_size > req_end) {
+        log("handle_cip_read_modify_write() bad mask size %d or item %d!\n", mask_size, item_offset);
+        return cip_error_reply(resp, service, CIP_STATUS_BAD_PARAM, 0);
+    }
 
-        break;
+    for(int i=0; i < mask_size; i++) {
+        tag->data[base_offset + i] = (uint8_t)((tag->data[base_offset + i] | or_mask[i]) & and_mask[i]);
     }
-}
 
+    log("handle_cip_read_modify_write() done.\n");
 
+    return cip_reply_header(resp, service, CIP_STATUS_OK);
+}
 
 
 
-void handle_forward_open_ex(session_context *session)
+/*
+ * Multiple Service Packet.  The request is the service, a path to the
+ * Message Router, the number of requests and their offsets from the
+ * count.  The reply has the same shape.  Each request is answered with
+ * the space left after the replies before it, less the space for an
+ * error reply from each request after it.
+ */
+
+int handle_cip_multi(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
 {
-    forward_open_ex_request *req = (forward_open_ex_request *)session->buf;
-    forward_open_response resp;
-    ssize_t rc = 0;
+    static const uint8_t router_path[] = { CIP_CLASS_SEGMENT, CIP_CLASS_MESSAGE_ROUTER, CIP_INSTANCE_SEGMENT_ONE_BYTE, 0x01 };
+    uint8_t *counts = req + 2 + sizeof(router_path);
+    int counts_len = req_len - (int)(counts - req);
+    int num_requests = 0;
+    int resp_len = 0;
+    int failed = 0;
+
+    log("handle_cip_multi() starting.\n");
+
+    if(req_len < (int)(counts - req) + 2 || req[1] != sizeof(router_path)/2 || memcmp(req + 2, router_path, sizeof(router_path)) != 0) {
+        log("handle_cip_multi() request is not to the Message Router!\n");
+        return cip_error_reply(resp, CIP_CMD_MULTI, CIP_STATUS_PATH_SEGMENT, 0);
+    }
 
-    log("handle_forward_open_ex() got request:\n");
-    print_buf(session->buf, sizeof(eip_header) + req->length);
+    num_requests = get_le16(counts);
 
-    if((req->orig_to_targ_conn_params_ex & 0xFFFF) > BUFFER_LEN) {
-        log("Requested packet size, %d, is too large!\n", (int)(req->orig_to_targ_conn_params_ex & 0xFFFF));
-        return;
+    /* check all the offsets before doing anything. */
+    if(num_requests < 1 || 2 + (num_requests * 2) > counts_len) {
+        log("handle_cip_multi() bad request count %d!\n", num_requests);
+        return cip_error_reply(resp, CIP_CMD_MULTI, CIP_STATUS_NOT_ENOUGH_DATA, 0);
     }
 
-    session->max_packet_size = req->orig_to_targ_conn_params_ex & 0xFFFF;
+    for(int i=0; i < num_requests; i++) {
+        int start = get_le16(counts + 2 + (i * 2));
+        int end = (i + 1 < num_requests ? get_le16(counts + 2 + ((i + 1) * 2)) : counts_len);
 
-    memset(&resp, 0, sizeof(resp));
+        if(start < 2 + (num_requests * 2) || end <= start || end > counts_len) {
+            log("handle_cip_multi() bad offset for request %d!\n", i);
+            return cip_error_reply(resp, CIP_CMD_MULTI, CIP_STATUS_BAD_PARAM, 0);
+        }
+    }
 
-    resp.command = req->command;
-    resp.session_handle = req->session_handle;
-    resp.sender_context = req->sender_context;
+    resp_len = CIP_REPLY_HEADER_SIZE + 2 + (num_requests * 2);
 
-    resp.length = sizeof(resp) - sizeof(eip_header);
+    if(resp_len + (num_requests * CIP_ERROR_REPLY_SIZE) > resp_space) {
+        log("handle_cip_multi() no room for %d replies!\n", num_requests);
+        return cip_error_reply(resp, CIP_CMD_MULTI, CIP_STATUS_REPLY_TOO_LARGE, 0);
+    }
 
-    resp.interface_handle = req->interface_handle;
-    resp.router_timeout = req->router_timeout;
+    put_le16(resp + CIP_REPLY_HEADER_SIZE, (uint16_t)num_requests);
 
-    resp.cpf_item_count = 2;
-    resp.cpf_udi_item_type = CPF_ITEM_UDI;
-    resp.cpf_udi_item_length = (uint8_t*)(&resp + 1) - (uint8_t *)(&resp.resp_service_code);
+    for(int i=0; i < num_requests; i++) {
+        int start = get_le16(counts + 2 + (i * 2));
+        int end = (i + 1 < num_requests ? get_le16(counts + 2 + ((i + 1) * 2)) : counts_len);
+        uint8_t *sub_req = counts + start;
+        uint8_t *sub_resp = resp + resp_len;
+        int sub_space = resp_space - resp_len - ((num_requests - i - 1) * CIP_ERROR_REPLY_SIZE);
 
-    resp.resp_service_code = CIP_CMD_FORWARD_OPEN | CIP_CMD_RESPONSE;
-    resp.general_status = 0;
-    resp.status_size = 0;
-    /* make the connection ID global, seems that way on LGX??? */
-    resp.orig_to_targ_conn_id = session->connection_id++;
-    resp.targ_to_orig_conn_id = req->targ_to_orig_conn_id;
-    resp.conn_serial_number = req->conn_serial_number;
-    resp.orig_vendor_id = req->orig_vendor_id;
-    resp.orig_serial_number = req->orig_serial_number;
-    resp.orig_to_targ_api = req->orig_to_targ_rpi;
-    resp.targ_to_orig_api = req->targ_to_orig_rpi;
-    resp.app_data_size = 0;
+        put_le16(resp + CIP_REPLY_HEADER_SIZE + 2 + (i * 2), (uint16_t)(resp_len - CIP_REPLY_HEADER_SIZE));
 
-    log("handle_forward_open_ex() called with remote connection ID %x and local connection ID %x\n", resp.targ_to_orig_conn_id, resp.orig_to_targ_conn_id);
+        if(sub_req[0] == CIP_CMD_MULTI) {
+            resp_len += cip_error_reply(sub_resp, CIP_CMD_MULTI, CIP_STATUS_UNSUPPORTED, 0);
+        } else {
+            resp_len += handle_cip_request(session, sub_req, end - start, sub_resp, sub_space);
+        }
 
-    session->connection_id_targ = req->targ_to_orig_conn_id;
+        if(sub_resp[2] != CIP_STATUS_OK && sub_resp[2] != CIP_STATUS_FRAG) {
+            failed = 1;
+        }
+    }
 
-    memcpy(session->buf, &resp, sizeof(resp));
+    cip_reply_header(resp, CIP_CMD_MULTI, (failed ? CIP_STATUS_EMBEDDED_ERROR : CIP_STATUS_OK));
 
-    log("handle_forward_open_ex() sending response:\n");
-    print_buf(session->buf, sizeof(resp));
+    log("handle_cip_multi() done with %d requests.\n", num_requests);
 
-    rc = write(session->sock, session->buf, sizeof(resp));
-    if(rc != sizeof(resp)) {
-        log("Amount written, %d, does not equal the response size, %d!\n", (int)rc, (int)sizeof(resp));
-    }
+    return resp_len;
 }
 
 
 
-void handle_forward_close(session_context *session)
-{
-    forward_close_request *req = (forward_close_request *)session->buf;
-    forward_close_response resp;
-    ssize_t rc = 0;
-    uint8_t *data_end = session->buf + sizeof(eip_header) + req->length;
-    uint8_t *path_start = session->buf + sizeof(*req);
-    ssize_t path_size = data_end - path_start;
-    uint8_t path_data[path_size];
-
-    log("handle_forward_close() got request:\n");
-    print_buf(session->buf, sizeof(eip_header) + req->length);
+/*
+ * Tag listing, Get Instance Attribute List on the Symbol class.  The
+ * path is the class and the instance to start at.  Each entry in the
+ * reply is the instance ID followed by the attributes in the order they
+ * were asked for.  As many entries as fit are sent and the status says
+ * whether there are more.  There are no programs, so program scoped
+ * listings are not found.
+ */
 
-    memset(&resp, 0, sizeof(resp));
+int handle_cip_list_tags(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
+{
+    uint8_t *req_end = req + req_len;
+    uint8_t *path = req + 2;
+    uint8_t *path_end = NULL;
+    uint8_t *attrs = NULL;
+    int num_attrs = 0;
+    uint32_t instance_id = 0;
+    tag_data *tag = NULL;
+    int resp_len = 0;
 
-    memcpy(path_data, path_start, (size_t)path_size); /* FIXME - check if negative first! */
+    (void)session;
 
-    log("handle_forward_close() path_size=%d\n",(int)path_size);
-    print_buf(path_data, (size_t)path_size);
+    log("handle_cip_list_tags() starting.\n");
 
-    resp.command = req->command;
-    resp.session_handle = req->session_handle;
-    resp.sender_context = req->sender_context;
+    if(req_len < 2 || path + (req[1] * 2) > req_end) {
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
 
-    resp.length = (uint16_t)((size_t)path_size + sizeof(resp) - sizeof(eip_header));
+    path_end = path + (req[1] * 2);
 
-    resp.interface_handle = req->interface_handle;
-    resp.router_timeout = req->router_timeout;
+    if(path < path_end && path[0] == CIP_SYMBOLIC_SEGMENT) {
+        log("handle_cip_list_tags() program tags are not supported!\n");
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_PATH_UNKNOWN, 0);
+    }
 
-    resp.cpf_item_count = 2;
-    resp.cpf_udi_item_type = CPF_ITEM_UDI;
-    resp.cpf_udi_item_length = (uint8_t*)(&resp + 1) - (uint8_t *)(&resp.resp_service_code);
+    if(path_end - path == 4 && path[0] == CIP_CLASS_SEGMENT && path[1] == CIP_CLASS_SYMBOL && path[2] == CIP_INSTANCE_SEGMENT_ONE_BYTE) {
+        instance_id = path[3];
+    } else if(path_end - path == 6 && path[0] == CIP_CLASS_SEGMENT && path[1] == CIP_CLASS_SYMBOL && path[2] == CIP_INSTANCE_SEGMENT_TWO_BYTES) {
+        instance_id = (uint32_t)get_le16(path + 4);
+    } else {
+        log("handle_cip_list_tags() path is not to the Symbol class!\n");
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_PATH_SEGMENT, 0);
+    }
 
-    resp.resp_service_code = CIP_CMD_FORWARD_CLOSE | CIP_CMD_RESPONSE;
-    resp.general_status = 0;
-    resp.status_size = 0;
+    if(req_end - path_end < 2) {
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
 
-    resp.conn_serial_number = req->conn_serial_number;
-    resp.orig_vendor_id = req->orig_vendor_id;
-    resp.orig_serial_number = req->orig_serial_number;
+    num_attrs = get_le16(path_end);
+    attrs = path_end + 2;
 
-    memcpy(session->buf, &resp, sizeof(resp));
-    memcpy(session->buf + sizeof(resp), path_data, (size_t)path_size);
+    if(attrs + (num_attrs * 2) > req_end) {
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
 
-    log("handle_forward_close() sending response:\n");
-    print_buf(session->buf, sizeof(resp) + (size_t)path_size);
+    for(int i=0; i < num_attrs; i++) {
+        int attr = get_le16(attrs + (i * 2));
 
-    rc = write(session->sock, session->buf, sizeof(resp) + (size_t)path_size);
-    if(rc != (int)(sizeof(resp) + (size_t)path_size)) {
-        log("Amount written, %d, does not equal the response size, %d!\n", (int)rc, (int)(sizeof(resp) + (size_t)path_size));
+        if(attr != SYMBOL_ATTR_NAME && attr != SYMBOL_ATTR_TYPE && attr != SYMBOL_ATTR_ELEM_SIZE && attr != SYMBOL_ATTR_DIMS) {
+            log("handle_cip_list_tags() attribute %d is not supported!\n", attr);
+            return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_ATTR_UNSUPPORTED, 0);
+        }
     }
-}
 
+    log("handle_cip_list_tags() listing from instance %u.\n", instance_id);
+
+    resp_len = CIP_REPLY_HEADER_SIZE;
 
+    for(tag = find_tag_from_instance(instance_id); tag; tag = find_tag_from_instance(tag->instance_id + 1)) {
+        int name_len = (int)strlen(tag->name);
+        int entry_len = 4;
+        uint8_t *entry = NULL;
 
+        for(int i=0; i < num_attrs; i++) {
+            switch(get_le16(attrs + (i * 2))) {
+            case SYMBOL_ATTR_NAME: entry_len += 2 + name_len; break;
+            case SYMBOL_ATTR_DIMS: entry_len += 12; break;
+            default: entry_len += 2; break;
+            }
+        }
 
+        if(resp_len + entry_len > resp_space) {
+            break;
+        }
 
-void process_connected_data(session_context *session)
-{
-    connected_message *header = (connected_message *)session->buf;
+        entry = resp + resp_len;
+
+        put_le32(entry, tag->instance_id);
+        entry += 4;
+
+        for(int i=0; i < num_attrs; i++) {
+            switch(get_le16(attrs + (i * 2))) {
+            case SYMBOL_ATTR_NAME:
+                put_le16(entry, (uint16_t)name_len);
+                memcpy(entry + 2, tag->name, (size_t)name_len);
+                entry += 2 + name_len;
+                break;
+
+            case SYMBOL_ATTR_TYPE:
+                /* single elements are not arrays. */
+                put_le16(entry, (uint16_t)((tag->udt ? (SYMBOL_TYPE_STRUCT | tag->udt->id) : tag->data_type[0]) | (tag->elem_count > 1 ? SYMBOL_TYPE_ONE_DIM : 0)));
+                entry += 2;
+                break;
+
+            case SYMBOL_ATTR_ELEM_SIZE:
+                put_le16(entry, tag->elem_size);
+                entry += 2;
+                break;
+
+            case SYMBOL_ATTR_DIMS:
+                put_le32(entry, (tag->elem_count > 1 ? tag->elem_count : 0));
+                put_le32(entry + 4, 0);
+                put_le32(entry + 8, 0);
+                entry += 12;
+                break;
+            }
+        }
 
-    switch(header->service_code) {
-    case CIP_CMD_READ:
-    case CIP_CMD_READ_FRAG:
-        handle_cip_read(session);
-        break;
+        resp_len += entry_len;
+    }
 
-    case CIP_CMD_WRITE:
-    case CIP_CMD_WRITE_FRAG:
-        handle_cip_write(session);
-        break;
+    if(tag && resp_len == CIP_REPLY_HEADER_SIZE) {
+        log("handle_cip_list_tags() no room for any entries in the reply!\n");
+        return cip_error_reply(resp, CIP_CMD_LIST_TAGS, CIP_STATUS_REPLY_TOO_LARGE, 0);
+    }
 
+    cip_reply_header(resp, CIP_CMD_LIST_TAGS, (tag ? CIP_STATUS_FRAG : CIP_STATUS_OK));
 
-    default:
-        log("process_connected_data() unsupported service code %x!\n", header->service_code);
-        print_buf(session->buf,sizeof(eip_header) + header->length);
+    log("handle_cip_list_tags() done.\n");
 
-        break;
-    }
+    return resp_len;
 }
 
 
 
+/*
+ * Template attributes, Get Attribute List on a Template instance.  The
+ * request has the number of attributes and their IDs.  Each is answered
+ * with its ID, a status word and the value if the status is zero.
+ */
 
-void handle_cip_read(session_context *session)
+int handle_cip_template_attrs(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
 {
-    int rc = 0;
-    connected_message *req = (connected_message *)(session->buf);
-    connected_message_cip_resp resp;
-    connected_message_cip_resp *resp_ptr = NULL;
+    uint8_t *req_end = req + req_len;
     uint8_t *data = NULL;
-    char *tag_name = NULL;
-    int item_offset = 0;
-    int elem_count = 0;
-    int byte_offset = 0;
-    tag_data *tag = NULL;
-    int data_remaining = 0;
-//    int items_remaining = 0;
-    int data_avail = 0;
-    int items_that_fit = 0;
-    int base_offset = 0;
+    udt_data *udt = NULL;
+    int num_attrs = 0;
+    int resp_len = 0;
+    uint8_t status = CIP_STATUS_OK;
 
-    log("Starting.");
+    (void)session;
 
-    memset(&resp, 0, sizeof(resp));
+    log("handle_cip_template_attrs() starting.\n");
 
-    resp.command = req->command;
-    resp.sender_context = req->sender_context;
-    resp.options = req->options;
-    resp.interface_handle = req->interface_handle;
-    resp.router_timeout = req->router_timeout;
-    resp.cpf_item_count = 2;
-    resp.cpf_cai_item_type = CPF_ITEM_CAI;
-    resp.cpf_cai_item_length = 4;
-    resp.cpf_targ_conn_id = session->connection_id_targ;
-    resp.cpf_cdi_item_type = CPF_ITEM_CDI;
-    resp.cpf_cdi_item_length = 0; /* patch this later! */
-    resp.cpf_conn_seq_num = req->cpf_conn_seq_num;
-    resp.service_code = req->service_code | CIP_CMD_OK;
-
-    data = (uint8_t*)(&(req->service_code)) + 1;
-
-    /* read the tag path. */
-    data = read_tag_path(data, &tag_name, &item_offset);
-    if(!data) {
-        log("Unable to read tag path data!");
-        return;
+    status = find_request_udt(req, req_len, &udt, &data);
+    if(status != CIP_STATUS_OK) {
+        return cip_error_reply(resp, CIP_CMD_GET_ATTR_LIST, status, 0);
     }
 
-    tag = find_tag(tag_name);
-
-    free(tag_name);
-
-    if(!tag) {
-        log("tag %s not found!\n", tag_name);
-        return;
+    if(req_end - data < 2) {
+        return cip_error_reply(resp, CIP_CMD_GET_ATTR_LIST, CIP_STATUS_NOT_ENOUGH_DATA, 0);
     }
 
-    /* read the number of elements to read */
-    elem_count = (data[0]) + ((data[1]) << 8);
+    num_attrs = get_le16(data);
     data += 2;
 
-    log("tag elem_count=%d\n",elem_count);
-
-    if(req->service_code == CIP_CMD_READ_FRAG) {
-        byte_offset =  (data[0])
-                       + ((data[1]) << 8)
-                       + ((data[2]) << 16)
-                       + ((data[3]) << 24);
-        data += 4;
-
-        log("tag byte offset=%d\n", byte_offset);
+    if(data + (num_attrs * 2) > req_end) {
+        return cip_error_reply(resp, CIP_CMD_GET_ATTR_LIST, CIP_STATUS_NOT_ENOUGH_DATA, 0);
     }
 
-    if(item_offset + elem_count > tag->elem_count) {
-        log("handle_tag_read() number of items requested is too many.  Item offset is %d, number of items requested is %d and total items is %d\n", item_offset, elem_count, tag->elem_count);
-        return;
+    /* at most eight bytes per attribute. */
+    if(CIP_REPLY_HEADER_SIZE + 2 + (num_attrs * 8) > resp_space) {
+        return cip_error_reply(resp, CIP_CMD_GET_ATTR_LIST, CIP_STATUS_REPLY_TOO_LARGE, 0);
     }
 
-    base_offset = (item_offset * tag->elem_size) + byte_offset;
+    resp_len = cip_reply_header(resp, CIP_CMD_GET_ATTR_LIST, CIP_STATUS_OK);
 
-    log("reading %d elements of tag %s starting at offset %d.\n", elem_count, tag_name, base_offset);
+    put_le16(resp + resp_len, (uint16_t)num_attrs);
+    resp_len += 2;
 
-    /* copy data into response */
-    memcpy(session->buf, &resp, sizeof(resp));
-
-    resp_ptr = (connected_message_cip_resp *)(session->buf);
-    data = (uint8_t*)(resp_ptr+1);
+    for(int i=0; i < num_attrs; i++) {
+        int attr = get_le16(data + (i * 2));
+        uint8_t *entry = resp + resp_len;
 
-    memcpy(data, tag->data_type, 2);
-    data += 2;
+        put_le16(entry, (uint16_t)attr);
+        put_le16(entry + 2, 0);
+        resp_len += 4;
 
-    /* how much data is left to read? */
-    data_remaining = (elem_count * tag->elem_size) - byte_offset;
-//    items_remaining = data_remaining / tag->elem_size;
+        switch(attr) {
+        case TEMPLATE_ATTR_HANDLE:
+            put_le16(entry + 4, udt->handle);
+            resp_len += 2;
+            break;
 
-    /* how much can we actually send? */
-    data_avail = session->max_packet_size - 8; /* MAGIC overhead */
-    items_that_fit = data_avail / tag->elem_size;
+        case TEMPLATE_ATTR_MEMBER_COUNT:
+            put_le16(entry + 4, udt->member_count);
+            resp_len += 2;
+            break;
 
-    if((int)((items_that_fit * tag->elem_size) + byte_offset) > (int)(elem_count * tag->elem_size)) {
-        items_that_fit = (((elem_count * tag->elem_size) - byte_offset) / tag->elem_size);
-        log("Clamping number of items to write to %d\n", items_that_fit);
-    }
+        case TEMPLATE_ATTR_DEF_SIZE:
+            put_le32(entry + 4, (uint32_t)(udt->raw_size + TEMPLATE_DEF_HEADER_SIZE) / 4);
+            resp_len += 4;
+            break;
 
-    memcpy(data, &tag->data[base_offset], (size_t)items_that_fit * tag->elem_size);
-    data += (items_that_fit * tag->elem_size);
+        case TEMPLATE_ATTR_INSTANCE_SIZE:
+            put_le32(entry + 4, udt->instance_size);
+            resp_len += 4;
+            break;
 
-    /* set the status based on whether there is more to read or not. */
-    if(data_remaining > data_avail) {
-        resp_ptr->cip_status = CIP_STATUS_FRAG;
-    } else {
-        resp_ptr->cip_status = CIP_STATUS_OK;
+        default:
+            log("handle_cip_template_attrs() attribute %d is not supported!\n", attr);
+            put_le16(entry + 2, CIP_STATUS_ATTR_UNSUPPORTED);
+            break;
+        }
     }
 
-    resp_ptr->length = (uint16_t)(data - (uint8_t*)&(resp_ptr->interface_handle));
-    resp_ptr->cpf_cdi_item_length = (uint16_t)(data - (uint8_t*)(&(resp_ptr->cpf_conn_seq_num)));
+    log("handle_cip_template_attrs() done.\n");
 
-    log("handle_cip_read() sending response:\n");
-    print_buf(session->buf, (size_t)(data - session->buf));
+    return resp_len;
+}
 
-    rc = (int)write(session->sock, session->buf, (size_t)(data - session->buf));
-    if(rc != (int)(data - session->buf)) {
-        log("Amount written, %d, does not equal the response size, %d!\n", (int)rc, (int)(data - session->buf));
-    }
 
-    log("Done.\n");
-}
 
+/*
+ * Read Template.  The request has the byte offset into the definition
+ * and the number of bytes wanted.  As many 32-bit words as fit are sent
+ * and the status says whether there is more.
+ */
 
-void handle_cip_write(session_context *session)
+int handle_cip_read_template(session_context *session, uint8_t *req, int req_len, uint8_t *resp, int resp_space)
 {
-    int rc = 0;
-    connected_message *req = (connected_message *)(session->buf);
-    connected_message_cip_resp resp;
-//    connected_message_cip_resp *resp_ptr = NULL;
+    uint8_t *req_end = req + req_len;
     uint8_t *data = NULL;
-    char *tag_name = NULL;
-    int item_offset = 0;
-    int elem_count = 0;
-    int byte_offset = 0;
-    tag_data *tag = NULL;
-    int data_remaining = 0;
-//    int items_remaining = 0;
-    int data_avail = 0;
-//    int items_that_fit = 0;
-    int base_offset = 0;
+    udt_data *udt = NULL;
+    uint32_t byte_offset = 0;
+    int size = 0;
+    int size_that_fits = 0;
+    int resp_len = 0;
+    uint8_t status = CIP_STATUS_OK;
 
-    log("Starting.");
+    (void)session;
 
-    memset(&resp, 0, sizeof(resp));
+    log("handle_cip_read_template() starting.\n");
 
-    resp.command = req->command;
-    resp.sender_context = req->sender_context;
-    resp.options = req->options;
-    resp.interface_handle = req->interface_handle;
-    resp.router_timeout = req->router_timeout;
-    resp.cpf_item_count = 2;
-    resp.cpf_cai_item_type = CPF_ITEM_CAI;
-    resp.cpf_cai_item_length = 4;
-    resp.cpf_targ_conn_id = session->connection_id_targ;
-    resp.cpf_cdi_item_type = CPF_ITEM_CDI;
-    resp.cpf_cdi_item_length = 0; /* patch this later! */
-    resp.cpf_conn_seq_num = req->cpf_conn_seq_num;
-    resp.cpf_conn_seq_num = req->cpf_conn_seq_num;
-    resp.service_code = req->service_code | CIP_CMD_OK;
-
-    data = (uint8_t*)(&(req->service_code)) + 1;
-
-    /* read the tag name. */
-    data = read_tag_path(data, &tag_name, &item_offset);
-    if(!data) {
-        log("Unable to read tag path data!");
-        return;
+    status = find_request_udt(req, req_len, &udt, &data);
+    if(status != CIP_STATUS_OK) {
+        return cip_error_reply(resp, CIP_CMD_READ_TEMPLATE, status, 0);
     }
 
-    tag = find_tag(tag_name);
+    if(req_end - data < 6) {
+        return cip_error_reply(resp, CIP_CMD_READ_TEMPLATE, CIP_STATUS_NOT_ENOUGH_DATA, 0);
+    }
 
-    free(tag_name);
+    byte_offset = get_le32(data);
+    size = get_le16(data + 4);
 
-    if(!tag) {
-        log("tag %s not found!\n", tag_name);
-        return;
+    log("handle_cip_read_template() template %s, byte offset %u, %d bytes.\n", udt->name, byte_offset, size);
+
+    if(byte_offset >= (uint32_t)udt->raw_size) {
+        log("handle_cip_read_template() read is past the end of template %s!\n", udt->name);
+        return cip_error_reply(resp, CIP_CMD_READ_TEMPLATE, CIP_STATUS_GENERAL, CIP_EXT_BEYOND_END);
     }
 
-    /* check the data type. */
-    if(data[0] != tag->data_type[0]) {
-        log("tag data type not matching.  Expected %x but got %x!\n", tag->data_type[0], data[0]);
-        return;
+    if(size > udt->raw_size - (int)byte_offset) {
+        size = udt->raw_size - (int)byte_offset;
     }
 
-    if(data[1] != tag->data_type[1]) {
-        log("tag data type not matching.  Expected %x but got %x!\n", tag->data_type[1], data[1]);
-        return;
+    size_that_fits = ((resp_space - CIP_REPLY_HEADER_SIZE) / 4) * 4;
+
+    if(size_that_fits <= 0) {
+        log("handle_cip_read_template() no room for any data in the reply!\n");
+        return cip_error_reply(resp, CIP_CMD_READ_TEMPLATE, CIP_STATUS_REPLY_TOO_LARGE, 0);
     }
 
-    data += 2;
+    if(size_that_fits >= size) {
+        size_that_fits = size;
+    }
 
-    /* read the number of elements to write */
-    elem_count = (data[0]) + ((data[1]) << 8);
-    data += 2;
+    resp_len = cip_reply_header(resp, CIP_CMD_READ_TEMPLATE, ((int)byte_offset + size_that_fits < udt->raw_size ? CIP_STATUS_FRAG : CIP_STATUS_OK));
 
-    log("tag elem_count=%d\n",elem_count);
+    memcpy(resp + resp_len, udt->raw + byte_offset, (size_t)size_that_fits);
+    resp_len += size_that_fits;
 
-    if(req->service_code == CIP_CMD_WRITE_FRAG) {
-        byte_offset =  (data[0])
-                       +((data[1]) << 8)
-                       +((data[2]) << 16)
-                       +((data[3]) << 24);
-        data += 4;
+    log("handle_cip_read_template() done.\n");
 
-        log("tag byte offset=%d\n", byte_offset);
-    }
+    return resp_len;
+}
 
-    if(item_offset + elem_count > tag->elem_count) {
-        log("handle_tag_write() number of items requested is too many.  Item offset is %d, number of items requested is %d and total items is %d\n", item_offset, elem_count, tag->elem_count);
-        return;
+
+
+/* reply service, reserved byte, status and no extended status.  Returns the length. */
+int cip_reply_header(uint8_t *resp, uint8_t service, uint8_t status)
+{
+    resp[0] = service | CIP_CMD_OK;
+    resp[1] = 0;
+    resp[2] = status;
+    resp[3] = 0;
+
+    return CIP_REPLY_HEADER_SIZE;
+}
+
+
+/* a reply with no data, with one word of extended status if it is not zero. */
+int cip_error_reply(uint8_t *resp, uint8_t service, uint8_t status, uint16_t ext_status)
+{
+    int resp_len = cip_reply_header(resp, service, status);
+
+    if(ext_status) {
+        resp[3] = 1;
+        put_le16(resp + resp_len, ext_status);
+        resp_len += 2;
     }
 
-    base_offset = (item_offset * tag->elem_size) + byte_offset;
+    return resp_len;
+}
+
 
-    log("writing %d elements of tag %s starting at offset %d.\n", elem_count, tag->name, base_offset);
 
-    data_avail = session->buf_len - (int)(data - session->buf);
+/* does the request path start with the Template class? */
+int is_template_request(uint8_t *req, int req_len)
+{
+    return (req_len >= 4 && req[2] == CIP_CLASS_SEGMENT && req[3] == CIP_CLASS_TEMPLATE);
+}
 
-    /* FIXME - must check to see if data_avail is negative! */
-    memcpy(tag->data + base_offset, data, (size_t)data_avail);
 
-    /* how much data is left to write? */
-    data_remaining = (elem_count * tag->elem_size) - byte_offset - data_avail;
+/*
+ * The path of a Template request is the class and a 16-bit instance
+ * that is the template ID.  On success *data points just past the path.
+ * Returns the CIP status.
+ */
 
-    log("handle_cip_write() elem_count=%d, tag->elem_size=%d, byte_offset=%d, base_offset=%d, data_avail=%d\n",elem_count, tag->elem_size, byte_offset, base_offset, data_avail);
+uint8_t find_request_udt(uint8_t *req, int req_len, udt_data **udt, uint8_t **data)
+{
+    uint16_t id = 0;
 
-    /* set the status based on whether there is more to write or not. */
-    if(data_remaining > 0) {
-        resp.cip_status = CIP_STATUS_FRAG;
-    } else {
-        resp.cip_status = CIP_STATUS_OK;
+    if(req_len < 8 || req[1] != 3 || req[4] != CIP_INSTANCE_SEGMENT_TWO_BYTES) {
+        log("find_request_udt() path is not to a Template instance!\n");
+        return CIP_STATUS_PATH_SEGMENT;
     }
 
-    resp.length = (sizeof(resp) - sizeof(eip_header));
-    resp.cpf_cdi_item_length = ((uint8_t*)(&resp.cip_status_words) - (uint8_t*)(&(resp.cpf_conn_seq_num)))+1;
+    id = (uint16_t)get_le16(req + 6);
 
-    memcpy(session->buf, &resp, sizeof(resp));
+    *udt = find_udt(id);
+    if(!*udt) {
+        log("find_request_udt() no template %d!\n", (int)id);
+        return CIP_STATUS_PATH_UNKNOWN;
+    }
 
-    log("handle_cip_write() sending response:\n");
-    print_buf(session->buf, sizeof(resp));
+    *data = req + 8;
+
+    return CIP_STATUS_OK;
+}
+
+
+
+/*
+ * Read the tag path at the start of a request to a tag.  On success
+ * *data points just past the path.  Returns the CIP status.
+ */
+
+uint8_t find_request_tag(uint8_t *req, int req_len, tag_data **tag, int *item_offset, uint8_t **data)
+{
+    char *tag_name = NULL;
+
+    if(req_len < 2 || 2 + (req[1] * 2) > req_len) {
+        log("find_request_tag() request is too short for its path!\n");
+        return CIP_STATUS_NOT_ENOUGH_DATA;
+    }
 
-    rc = (int)write(session->sock, session->buf, sizeof(resp));
-    if(rc != sizeof(resp)) {
-        log("Amount written, %d, does not equal the response size, %d!\n", (int)rc, (int)(sizeof(resp)));
+    *data = read_tag_path(req + 1, &tag_name, item_offset);
+    if(!*data) {
+        log("find_request_tag() unable to read tag path data!\n");
+        return CIP_STATUS_PATH_SEGMENT;
     }
 
-    log("Done.\n");
+    *tag = find_tag(tag_name);
+
+    if(!*tag) {
+        log("find_request_tag() tag %s not found!\n", tag_name);
+        free(tag_name);
+        return CIP_STATUS_PATH_UNKNOWN;
+    }
+
+    free(tag_name);
+
+    return CIP_STATUS_OK;
 }
 
 
@@ -563,6 +1595,11 @@ uint8_t *read_tag_path(uint8_t *buf, char **tag_name, int *item_offset)
         name_len = buf[index];
         index++;
 
+        if(index + name_len > path_len + 1) {
+            log("read_tag_path() name of length %d does not fit in the path!\n", name_len);
+            return NULL;
+        }
+
         log("read_tag_path() reading symbolic segment of length %d\n", name_len);
 
         *tag_name = (char *)calloc(1, (size_t)(name_len+1));
@@ -635,6 +1672,35 @@ uint8_t *read_tag_path(uint8_t *buf, char **tag_name, int *item_offset)
 
 
 
+int get_le16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+
+uint32_t get_le32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+
+void put_le16(uint8_t *data, uint16_t val)
+{
+    data[0] = (uint8_t)(val & 0xFF);
+    data[1] = (uint8_t)(val >> 8);
+}
+
+
+void put_le32(uint8_t *data, uint32_t val)
+{
+    data[0] = (uint8_t)(val & 0xFF);
+    data[1] = (uint8_t)((val >> 8) & 0xFF);
+    data[2] = (uint8_t)((val >> 16) & 0xFF);
+    data[3] = (uint8_t)(val >> 24);
+}
+
+
+
 void print_buf(uint8_t *buf, size_t data_len)
 {
     int index = 0;
@@ -643,6 +1709,10 @@ void print_buf(uint8_t *buf, size_t data_len)
     int num_rows = 0;
     int total_bytes = 0;
 
+    if(!log_verbose) {
+        return;
+    }
+
     if(!buf) {
         log("buffer is null.\n");
         return;
@@ -1,27 +1,87 @@
-
 #pragma once
 
 //#include "buffer.h"
+#include <stddef.h>
+#include "config.h"
+#include "emulation.h"
+#include "producer.h"
 
 
 #define BUFFER_LEN (4096)
+#define IN_BUFFER_LEN (BUFFER_LEN * 2)
+#define MAX_OUT_BUFFER (1024 * 1024)
+#define MAX_PRODUCERS (16)
+
+
+/* the first member of everything registered with the event loop. */
+typedef enum { SOURCE_LISTENER, SOURCE_SESSION, SOURCE_TIMER } event_source;
+
+
+/* a response held back by the emulation until it is due. */
+typedef struct delayed_response_t {
+    struct delayed_response_t *next;
+    int64_t due_us;
+    size_t len;
+    uint8_t data[];
+} delayed_response;
 
 
 typedef struct {
+    event_source source;
     int sock;
 
+    const sim_config *config;
+    controller *ctl;
+
     uint64_t sender_context;
     uint32_t session_handle;
     uint32_t connection_id;
     uint32_t connection_id_targ;
     uint16_t connection_seq;
 
+    /* connection size from the Forward Open.  It covers the sequence count and the CIP message, either way. */
     uint16_t max_packet_size;
 
+    /* Class 1 connections opened through this session. */
+    producer *producers[MAX_PRODUCERS];
+
+    /*
+     * the packet being handled.  Most responses are built in place,
+     * connected and Unconnected Send responses are built in resp_buf.
+     */
     uint8_t buf[BUFFER_LEN];
     uint16_t buf_len;
+    uint8_t resp_buf[BUFFER_LEN];
+
+    /* bytes read from the socket that do not make a whole packet yet. */
+    uint8_t in_buf[IN_BUFFER_LEN];
+    size_t in_len;
+
+    /* responses the socket has not taken yet. */
+    uint8_t *out_buf;
+    size_t out_len;
+    size_t out_capacity;
+    int out_failed;
+
+    /* whether the event loop is waiting for the socket to be writable. */
+    int waiting_for_write;
+
+    /* when the responses to the packet being handled go out, and whether they are dropped. */
+    int64_t response_due_us;
+    int drop_response;
+
+    /* held back responses, in order, and the timer for the first. */
+    delayed_response *delayed_head;
+    delayed_response *delayed_tail;
+    size_t delayed_len;
+    sim_timer timer;
 } session_context;
 
 
 
-extern void *session_handler(void *session_arg);
+extern session_context *session_create(int sock, uint32_t session_handle, const sim_config *config, controller *ctl);
+extern int session_read(session_context *session);
+extern int session_flush(session_context *session);
+extern int session_send_due(session_context *session, int64_t now_us);
+extern int session_has_output(session_context *session);
+extern void session_destroy(session_context *session);
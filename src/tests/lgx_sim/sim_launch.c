@@ -0,0 +1,90 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim_launch.h"
+
+
+#define START_TIMEOUT_MS (5000)
+#define POLL_MS (10)
+
+
+static int sim_listening(int port);
+
+
+
+pid_t sim_start(const char *sim_path, int port)
+{
+    char port_str[16];
+    struct timespec wait = { 0, POLL_MS * 1000000L };
+    pid_t pid = 0;
+
+    assert(!sim_listening(port));
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    pid = fork();
+    assert(pid >= 0);
+
+    if(pid == 0) {
+        /* the simulator logs every packet, throw that away. */
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if(null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        /* do not outlive a failed check. */
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+        execl(sim_path, sim_path, "--port", port_str, (char *)NULL);
+
+        _exit(127);
+    }
+
+    for(int waited = 0; !sim_listening(port); waited += POLL_MS) {
+        assert(waited < START_TIMEOUT_MS);
+        assert(waitpid(pid, NULL, WNOHANG) == 0);
+        nanosleep(&wait, NULL);
+    }
+
+    return pid;
+}
+
+
+void sim_stop(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+
+int sim_listening(int port)
+{
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int rc = 0;
+
+    assert(sock >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    rc = (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    close(sock);
+
+    return rc;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <sys/types.h>
+
+/*
+ * Start lgx_sim for a test, serving the default tags on one port of the
+ * loopback interface.  The checks use assert(), so the simulator is told
+ * to exit if the test dies.
+ */
+
+extern pid_t sim_start(const char *sim_path, int port);
+extern void sim_stop(pid_t pid);
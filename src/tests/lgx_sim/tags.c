@@ -1,43 +1,213 @@
-
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include "log.h"
+#include "packet.h"
 #include "tags.h"
 
 
-tag_data *tags = NULL;
-size_t num_tags = 0;
+/*
+ * The tag database.  Tags are looked up on every request, so they are
+ * kept in a chained hash table keyed on the name.  Logix names are not
+ * case sensitive and neither is the lookup.
+ */
+
+#define TAG_BUCKETS (4096)
+
+typedef struct {
+    const char *name;
+    uint8_t type_code;
+    uint16_t elem_size;
+} tag_type;
+
+static const tag_type tag_types[] = {
+    { "BOOL",  0xC1, 1 },
+    { "SINT",  0xC2, 1 },
+    { "INT",   0xC3, 2 },
+    { "DINT",  0xC4, 4 },
+    { "LINT",  0xC5, 8 },
+    { "REAL",  0xCA, 4 },
+    { "LREAL", 0xCB, 8 },
+    { NULL, 0, 0 }
+};
+
+/*
+ * The UDTs, usable as tag types.  The members are laid out the way a
+ * Logix controller does it: a BOOL is a bit in a hidden SINT and a BOOL
+ * array is a DWORD array (0xD3) whose info is the number of DWORDs.  A
+ * nested UDT has the structure flag and the template ID as its type.
+ */
+
+#define SIM_MOTOR_ID (0x0101)
+#define SIM_AXIS_ID  (0x0102)
+
+typedef struct {
+    const char *name;
+    uint16_t info;
+    uint16_t type;
+    uint32_t offset;
+} udt_member;
+
+typedef struct {
+    const char *name;
+    uint16_t id;
+    uint16_t handle;
+    uint32_t instance_size;
+    const udt_member *members;
+} udt_type;
+
+static const udt_member sim_motor_members[] = {
+    { "Speed",                0, 0x00C4, 0 },
+    { "Flags",                2, 0x20D3, 4 },
+    { "ZZZZZZZZZZSIM_MOTOR2", 0, 0x00C2, 12 },
+    { "Running",              3, 0x00C1, 12 },
+    { "Temp",                 0, 0x00CA, 16 },
+    { NULL, 0, 0, 0 }
+};
+
+static const udt_member sim_axis_members[] = {
+    { "Position", 0, 0x00CA, 0 },
+    { "Motor",    0, SYMBOL_TYPE_STRUCT | SIM_MOTOR_ID, 4 },
+    { NULL, 0, 0, 0 }
+};
+
+static const udt_type udt_types[] = {
+    { "SIM_MOTOR", SIM_MOTOR_ID, 0x3C2A, 20, sim_motor_members },
+    { "SIM_AXIS",  SIM_AXIS_ID,  0x7E51, 24, sim_axis_members },
+    { NULL, 0, 0, 0, NULL }
+};
+
+#define NUM_UDTS ((int)(sizeof(udt_types)/sizeof(udt_types[0])) - 1)
+
+static udt_data udts[NUM_UDTS];
+
+static tag_data *tag_buckets[TAG_BUCKETS];
+
+/* the tags in instance order, tag_list[i] is instance i+1. */
+static tag_data **tag_list = NULL;
+static int tag_list_capacity = 0;
+static int num_tags = 0;
+
+static uint32_t hash_name(const char *name);
+static udt_data *find_udt_by_name(const char *name);
+static int build_udt(const udt_type *type, udt_data *udt);
+
+
 
 void init_tags()
 {
-    num_tags = 2;
+    add_tag("TestDINTArray", "DINT", 10);
+    add_tag("TestBigArray", "DINT", 1000);
+    add_tag("TestAxes", "SIM_AXIS", 2);
+}
+
+
+/* returns 1 on success, 0 if the type is unknown, the name is taken or memory ran out. */
+int add_tag(const char *name, const char *type_name, int elem_count)
+{
+    const tag_type *type = NULL;
+    const udt_data *udt = NULL;
+    tag_data *tag = NULL;
+    uint32_t bucket = 0;
+
+    for(int i=0; tag_types[i].name; i++) {
+        if(strcasecmp(tag_types[i].name, type_name) == 0) {
+            type = &tag_types[i];
+            break;
+        }
+    }
+
+    if(!type) {
+        udt = find_udt_by_name(type_name);
+    }
+
+    if(!type && !udt) {
+        log_error("add_tag() unknown type %s for tag %s!\n", type_name, name);
+        return 0;
+    }
+
+    if(elem_count < 1 || elem_count > UINT16_MAX) {
+        log_error("add_tag() element count %d for tag %s is out of range!\n", elem_count, name);
+        return 0;
+    }
+
+    if(find_tag(name)) {
+        log_error("add_tag() tag %s already exists!\n", name);
+        return 0;
+    }
+
+    if(num_tags == tag_list_capacity) {
+        int new_capacity = (tag_list_capacity ? tag_list_capacity * 2 : 64);
+        tag_data **new_list = (tag_data **)realloc(tag_list, (size_t)new_capacity * sizeof(*new_list));
+
+        if(!new_list) {
+            return 0;
+        }
+
+        tag_list = new_list;
+        tag_list_capacity = new_capacity;
+    }
+
+    tag = (tag_data *)calloc(1, sizeof(*tag));
+    if(!tag) {
+        return 0;
+    }
+
+    tag->name = strdup(name);
+    tag->elem_count = (uint16_t)elem_count;
 
-    tags = (tag_data *)calloc(num_tags, sizeof(tag_data));
+    if(udt) {
+        tag->data_type[0] = CIP_DATA_ABBREV_STRUCT;
+        tag->data_type[1] = 0x02;
+        tag->data_type[2] = (uint8_t)(udt->handle & 0xFF);
+        tag->data_type[3] = (uint8_t)(udt->handle >> 8);
+        tag->data_type_size = 4;
+        tag->elem_size = (uint16_t)udt->instance_size;
+        tag->udt = udt;
+    } else {
+        tag->data_type[0] = type->type_code;
+        tag->data_type[1] = 0x00;
+        tag->data_type_size = 2;
+        tag->elem_size = type->elem_size;
+    }
 
-    tags[0].name = "TestDINTArray";
-    tags[0].data_type[0] = 0xc4;
-    tags[0].data_type[1] = 0x00;
-    tags[0].elem_count = 10;
-    tags[0].elem_size = 4;
-    tags[0].data = (uint8_t *)calloc(tags[0].elem_size, tags[0].elem_count);
+    tag->data = (uint8_t *)calloc(tag->elem_size, tag->elem_count);
 
-    tags[1].name = "TestBigArray";
-    tags[1].data_type[0] = 0xc4;
-    tags[1].data_type[1] = 0x00;
-    tags[1].elem_count = 1000;
-    tags[1].elem_size = 4;
-    tags[1].data = (uint8_t *)calloc(tags[1].elem_size, tags[1].elem_count);
+    if(!tag->name || !tag->data) {
+        free((char *)tag->name);
+        free(tag->data);
+        free(tag);
+        return 0;
+    }
 
+    bucket = hash_name(name) % TAG_BUCKETS;
+    tag->next = tag_buckets[bucket];
+    tag_buckets[bucket] = tag;
+
+    tag_list[num_tags] = tag;
+    num_tags++;
+    tag->instance_id = (uint32_t)num_tags;
+
+    return 1;
+}
+
+
+int tag_count(void)
+{
+    return num_tags;
 }
 
 
 tag_data *find_tag(const char *tag_name)
 {
+    tag_data *tag = NULL;
+
     log("find_data() finding tag %s\n", tag_name);
 
-    for(size_t i=0; i<num_tags; i++) {
-        if(strcmp(tags[i].name, tag_name) == 0) {
-            return &(tags[i]);
+    for(tag = tag_buckets[hash_name(tag_name) % TAG_BUCKETS]; tag; tag = tag->next) {
+        if(strcasecmp(tag->name, tag_name) == 0) {
+            return tag;
         }
     }
 
@@ -45,3 +215,126 @@ tag_data *find_tag(const char *tag_name)
 
     return NULL;
 }
+
+
+/* the tag with the lowest instance ID at or after the one given, NULL past the last one. */
+tag_data *find_tag_from_instance(uint32_t instance_id)
+{
+    if(instance_id < 1) {
+        instance_id = 1;
+    }
+
+    if(instance_id > (uint32_t)num_tags) {
+        return NULL;
+    }
+
+    return tag_list[instance_id - 1];
+}
+
+
+udt_data *find_udt(uint16_t id)
+{
+    for(int i=0; i < NUM_UDTS; i++) {
+        if(udt_types[i].id == id) {
+            return (build_udt(&udt_types[i], &udts[i]) ? &udts[i] : NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+udt_data *find_udt_by_name(const char *name)
+{
+    for(int i=0; i < NUM_UDTS; i++) {
+        if(strcasecmp(udt_types[i].name, name) == 0) {
+            return find_udt(udt_types[i].id);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Build the definition the first time the UDT is used.  The definition
+ * size attribute counts a header that is never sent and is in 32-bit
+ * words, so the data is padded with zeros to fill the last word.
+ * Returns 1 on success, 0 if memory ran out.
+ */
+int build_udt(const udt_type *type, udt_data *udt)
+{
+    int member_count = 0;
+    int raw_len = 0;
+    int def_words = 0;
+    uint8_t *p = NULL;
+
+    if(udt->raw) {
+        return 1;
+    }
+
+    for(member_count = 0; type->members[member_count].name; member_count++) {
+        raw_len += 8 + (int)strlen(type->members[member_count].name) + 1;
+    }
+
+    /* the name is followed by ";n" and some other flags we do not care about. */
+    raw_len += (int)strlen(type->name) + 3;
+
+    def_words = (raw_len + TEMPLATE_DEF_HEADER_SIZE + 3) / 4;
+
+    udt->raw_size = (def_words * 4) - TEMPLATE_DEF_HEADER_SIZE;
+    udt->raw = (uint8_t *)calloc(1, (size_t)udt->raw_size);
+    if(!udt->raw) {
+        return 0;
+    }
+
+    p = udt->raw;
+
+    for(int i=0; i < member_count; i++) {
+        const udt_member *member = &type->members[i];
+
+        p[0] = (uint8_t)(member->info & 0xFF);
+        p[1] = (uint8_t)(member->info >> 8);
+        p[2] = (uint8_t)(member->type & 0xFF);
+        p[3] = (uint8_t)(member->type >> 8);
+        p[4] = (uint8_t)(member->offset & 0xFF);
+        p[5] = (uint8_t)((member->offset >> 8) & 0xFF);
+        p[6] = (uint8_t)((member->offset >> 16) & 0xFF);
+        p[7] = (uint8_t)((member->offset >> 24) & 0xFF);
+        p += 8;
+    }
+
+    memcpy(p, type->name, strlen(type->name));
+    p += strlen(type->name);
+    memcpy(p, ";n", 3);
+    p += 3;
+
+    for(int i=0; i < member_count; i++) {
+        size_t len = strlen(type->members[i].name) + 1;
+
+        memcpy(p, type->members[i].name, len);
+        p += len;
+    }
+
+    udt->name = type->name;
+    udt->id = type->id;
+    udt->handle = type->handle;
+    udt->member_count = (uint16_t)member_count;
+    udt->instance_size = type->instance_size;
+
+    return 1;
+}
+
+
+/* FNV-1a over the upper cased name. */
+uint32_t hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for(const char *p = name; *p; p++) {
+        hash ^= (uint32_t)toupper((unsigned char)*p);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
@@ -2,18 +2,43 @@
 
 #include <stdint.h>
 
-typedef struct {
+/*
+ * A UDT, served by the Template object.  The instance ID is the template
+ * ID.  raw is the definition as Read Template returns it: the member
+ * definitions, the name and then the member names.
+ */
+typedef struct udt_data_t {
     const char *name;
-    uint8_t data_type[2];
+    uint16_t id;
+    uint16_t handle;
+    uint16_t member_count;
+    uint32_t instance_size;
+    uint8_t *raw;
+    int raw_size;
+} udt_data;
+
+typedef struct tag_data_t {
+    const char *name;
+    uint8_t data_type[4];
+    int data_type_size;
     uint16_t elem_count;
     uint16_t elem_size;
     uint8_t *data;
-} tag_data;
 
+    /* the UDT of the tag, NULL for atomic types. */
+    const udt_data *udt;
 
-extern tag_data *tags;
+    /* Symbol object instance, for tag listing.  Numbered from 1 in the order the tags were added. */
+    uint32_t instance_id;
 
-extern void init_tags();
-extern tag_data *find_tag(const char *tag_name);
+    /* hash chain. */
+    struct tag_data_t *next;
+} tag_data;
 
 
+extern void init_tags();
+extern int add_tag(const char *name, const char *type_name, int elem_count);
+extern int tag_count(void);
+extern tag_data *find_tag(const char *tag_name);
+extern tag_data *find_tag_from_instance(uint32_t instance_id);
+extern udt_data *find_udt(uint16_t id);
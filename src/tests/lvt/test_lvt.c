@@ -0,0 +1,213 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Last value table tests.  Publishers run in child processes, this process
+ * only consumes and never creates a tag.
+ */
+
+/* the checks call the library, keep them in release builds. */
+#undef NDEBUG
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../../lib/libplctag.h"
+
+#define KEY "version"
+#define DATA_TIMEOUT (5000)
+
+/* offsets into the region, see lvt.c. */
+#define HEADER_LOCK_OFFSET (16)
+#define FIRST_SLOT_OFFSET (56)
+#define SLOT_LOCK_OFFSET (4)
+
+
+static char table_name[64];
+static char shm_name[80];
+
+
+/*
+ * Publish the version tag in a child.  Exits with 0 if the read was
+ * published, 1 if the tag could not be created.  If leave_dirty is set
+ * the child skips the library shutdown, as if it had crashed.
+ */
+
+static pid_t run_publisher(const char *extra, int leave_dirty)
+{
+    pid_t pid = fork();
+
+    assert(pid >= 0);
+
+    if(pid == 0) {
+        char attribs[256];
+        int32_t tag = 0;
+
+        snprintf(attribs, sizeof(attribs), "make=system&family=library&name=version&publish=%s&publish_key=%s%s", table_name, KEY, extra);
+
+        tag = plc_tag_create(attribs, DATA_TIMEOUT);
+        if(tag < 0) {
+            if(leave_dirty) {
+                _exit(1);
+            }
+
+            exit(1);
+        }
+
+        if(plc_tag_read(tag, DATA_TIMEOUT) != PLCTAG_STATUS_OK) {
+            _exit(2);
+        }
+
+        if(leave_dirty) {
+            _exit(0);
+        }
+
+        plc_tag_destroy(tag);
+
+        exit(0);
+    }
+
+    return pid;
+}
+
+
+static int wait_publisher(pid_t pid)
+{
+    int status = 0;
+
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status));
+
+    return WEXITSTATUS(status);
+}
+
+
+static void check_read(int32_t table)
+{
+    uint8_t buf[64];
+    int64_t when = 0;
+    int slot = plc_tag_lvt_find(table, KEY);
+    int rc = 0;
+
+    assert(slot >= 0);
+
+    rc = plc_tag_lvt_read(table, slot, buf, (int)sizeof(buf), &when);
+    assert(rc > 0);
+    assert(when > 0);
+    assert(buf[0] >= '0' && buf[0] <= '9');
+}
+
+
+/* pretend a dead process holds the header lock and was writing the first slot. */
+static void wedge_table(pid_t dead)
+{
+    int fd = shm_open(shm_name, O_RDWR, 0);
+    uint8_t *data = NULL;
+    volatile int32_t *header_lock = NULL;
+    volatile uint32_t *seq = NULL;
+    volatile int32_t *slot_lock = NULL;
+
+    assert(fd >= 0);
+
+    data = mmap(NULL, FIRST_SLOT_OFFSET + 64, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(data != MAP_FAILED);
+
+    header_lock = (volatile int32_t *)(data + HEADER_LOCK_OFFSET);
+    seq = (volatile uint32_t *)(data + FIRST_SLOT_OFFSET);
+    slot_lock = (volatile int32_t *)(data + FIRST_SLOT_OFFSET + SLOT_LOCK_OFFSET);
+
+    *header_lock = (int32_t)dead;
+    *slot_lock = (int32_t)dead;
+    *seq |= 1;
+
+    munmap(data, FIRST_SLOT_OFFSET + 64);
+    close(fd);
+}
+
+
+int main(int argc, const char **argv)
+{
+    int32_t table = 0;
+    int32_t old_table = 0;
+    uint8_t buf[64];
+    pid_t dead = 0;
+
+    (void)argc;
+    (void)argv;
+
+    snprintf(table_name, sizeof(table_name), "test_lvt_%d", (int)getpid());
+    snprintf(shm_name, sizeof(shm_name), "/plctag_%s", table_name);
+
+    shm_unlink(shm_name);
+
+    /* a consumer that never created a tag can open an existing table. */
+    assert(plc_tag_lvt_open(table_name) == PLCTAG_ERR_NOT_FOUND);
+    assert(wait_publisher(run_publisher("", 0)) == 0);
+
+    table = plc_tag_lvt_open(table_name);
+    assert(table > 0);
+    check_read(table);
+    assert(plc_tag_lvt_close(table) == PLCTAG_STATUS_OK);
+    assert(plc_tag_lvt_read(table, 0, buf, (int)sizeof(buf), NULL) == PLCTAG_ERR_BAD_PARAM);
+
+    shm_unlink(shm_name);
+
+    /* a table with slots too small, left by a dead publisher, is replaced. */
+    assert(wait_publisher(run_publisher("&publish_slot_size=4", 1)) == 1);
+
+    old_table = plc_tag_lvt_open(table_name);
+    assert(old_table > 0);
+    assert(plc_tag_lvt_find(old_table, KEY) == PLCTAG_ERR_NOT_FOUND);
+
+    assert(wait_publisher(run_publisher("", 0)) == 0);
+
+    assert(plc_tag_lvt_find(old_table, KEY) == PLCTAG_ERR_BAD_CONNECTION);
+    assert(plc_tag_lvt_read(old_table, 0, buf, (int)sizeof(buf), NULL) == PLCTAG_ERR_BAD_CONNECTION);
+    assert(plc_tag_lvt_close(old_table) == PLCTAG_STATUS_OK);
+
+    table = plc_tag_lvt_open(table_name);
+    assert(table > 0);
+    check_read(table);
+
+    /* locks held by a dead process and a half written slot do not wedge the table. */
+    dead = run_publisher("", 1);
+    assert(wait_publisher(dead) == 0);
+
+    wedge_table(dead);
+    assert(plc_tag_lvt_read(table, 0, buf, (int)sizeof(buf), NULL) == PLCTAG_ERR_BUSY);
+
+    assert(wait_publisher(run_publisher("", 0)) == 0);
+    check_read(table);
+
+    assert(plc_tag_lvt_close(table) == PLCTAG_STATUS_OK);
+
+    shm_unlink(shm_name);
+
+    printf("All last value table tests passed.\n");
+
+    return 0;
+}
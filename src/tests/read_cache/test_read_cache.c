@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Read cache tests.  The debug system tag reads the library debug level
+ * and its reads finish at once, so a stale read refreshes synchronously.
+ * A second, uncached, handle changes the level behind the cached one.
+ */
+
+/* the checks call the library, keep them in release builds. */
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "../../lib/libplctag.h"
+
+#define DATA_TIMEOUT (1000)
+#define CACHE_MS (50)
+
+
+static void wait_for_expiry(void)
+{
+    struct timespec wait = { 0, CACHE_MS * 2 * 1000000L };
+
+    nanosleep(&wait, NULL);
+}
+
+
+static void set_level(int32_t setter, int level)
+{
+    assert(plc_tag_set_int32(setter, 0, level) == PLCTAG_STATUS_OK);
+    assert(plc_tag_write(setter, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+}
+
+
+int main(int argc, const char **argv)
+{
+    int32_t setter = 0;
+    int32_t cached = 0;
+    char attribs[128];
+
+    (void)argc;
+    (void)argv;
+
+    setter = plc_tag_create("protocol=system&name=debug", DATA_TIMEOUT);
+    assert(setter > 0);
+
+    snprintf(attribs, sizeof(attribs), "protocol=system&name=debug&read_cache_ms=%d&read_cache_stale=1", CACHE_MS);
+    cached = plc_tag_create(attribs, DATA_TIMEOUT);
+    assert(cached > 0);
+
+    set_level(setter, PLCTAG_DEBUG_ERROR);
+
+    /* the first read is a normal one. */
+    assert(plc_tag_read(cached, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_int32(cached, 0) == PLCTAG_DEBUG_ERROR);
+
+    /* while the cache is fresh the old value stays. */
+    set_level(setter, PLCTAG_DEBUG_WARN);
+    assert(plc_tag_read(cached, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_int32(cached, 0) == PLCTAG_DEBUG_ERROR);
+
+    /* an expired cache refreshes, and a refresh that finishes at once is seen at once. */
+    wait_for_expiry();
+    assert(plc_tag_read(cached, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_int32(cached, 0) == PLCTAG_DEBUG_WARN);
+
+    /* and the cache is fresh again with the new value. */
+    set_level(setter, PLCTAG_DEBUG_NONE);
+    assert(plc_tag_read(cached, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_int32(cached, 0) == PLCTAG_DEBUG_WARN);
+
+    wait_for_expiry();
+    assert(plc_tag_read(cached, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_int32(cached, 0) == PLCTAG_DEBUG_NONE);
+
+    plc_tag_destroy(cached);
+    plc_tag_destroy(setter);
+
+    printf("All read cache tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * UDT template tests against lgx_sim, whose path is the only argument.
+ * TestAxes is two SIM_AXIS, each a REAL and a nested SIM_MOTOR, see
+ * src/tests/lgx_sim/tags.c for the layout.
+ */
+
+/* the checks call the library, keep them in release builds. */
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "../../lib/libplctag.h"
+#include "../lgx_sim/sim_launch.h"
+
+#define SIM_PORT (44831)
+#define SIM_PORT_STR "44831"
+#define DATA_TIMEOUT (5000)
+
+#define SIM_AXIS_ID "258"
+#define AXIS_SIZE (24)
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&gateway_port=" SIM_PORT_STR "&path=1,0&cpu=lgx&name=TestAxes&elem_size=24&elem_count=2&udt_id=" SIM_AXIS_ID
+
+/* two templates, each the attributes and one read of the definition, then the data. */
+#define TEMPLATE_REQUESTS (4)
+
+
+static void sleep_ms(int ms)
+{
+    struct timespec wait = { ms / 1000, (ms % 1000) * 1000000L };
+
+    nanosleep(&wait, NULL);
+}
+
+
+static uint64_t requests_sent(int32_t stats)
+{
+    assert(plc_tag_read(stats, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_size(stats) == PLCTAG_STATS_RECORD_SIZE);
+
+    return plc_tag_get_uint64(stats, PLCTAG_STATS_REQUESTS_SENT);
+}
+
+
+static void wait_read(int32_t tag)
+{
+    int rc = PLCTAG_STATUS_PENDING;
+
+    for(int i=0; rc == PLCTAG_STATUS_PENDING; i++) {
+        assert(i < DATA_TIMEOUT);
+        sleep_ms(1);
+        rc = plc_tag_status(tag);
+    }
+
+    assert(rc == PLCTAG_STATUS_OK);
+}
+
+
+static void check_member(int32_t tag, const char *path, int expected_offset, int expected_kind, int expected_bit)
+{
+    int offset = -1;
+    int kind = -1;
+    int bit_num = -1;
+
+    assert(plc_tag_get_member_info(tag, path, &offset, &kind, &bit_num) == PLCTAG_STATUS_OK);
+    assert(offset == expected_offset);
+    assert(kind == expected_kind);
+    assert(bit_num == expected_bit);
+}
+
+
+int main(int argc, const char **argv)
+{
+    pid_t sim = 0;
+    int32_t stats = 0;
+    int32_t first = 0;
+    int32_t second = 0;
+    uint64_t sent = 0;
+    int offset = 0;
+    int kind = 0;
+    int bit_num = 0;
+
+    assert(argc == 2);
+
+    sim = sim_start(argv[1], SIM_PORT);
+
+    stats = plc_tag_create("protocol=system&name=@stats", DATA_TIMEOUT);
+    assert(stats > 0);
+
+    first = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    assert(first > 0);
+
+    second = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    assert(second > 0);
+
+    assert(plc_tag_get_member_info(first, "Position", &offset, &kind, &bit_num) == PLCTAG_ERR_NO_DATA);
+
+    /* two tags of the same type reading at once fetch each template once. */
+    sent = requests_sent(stats);
+
+    assert(plc_tag_read(first, 0) == PLCTAG_STATUS_PENDING);
+    assert(plc_tag_read(second, 0) == PLCTAG_STATUS_PENDING);
+    wait_read(first);
+    wait_read(second);
+
+    assert(requests_sent(stats) - sent == TEMPLATE_REQUESTS + 2);
+
+    /* the layout, BOOLs are a bit within the byte at the offset. */
+    check_member(first, "Position", 0, PLCTAG_MEMBER_FLOAT32, 0);
+    check_member(first, "Motor", 4, PLCTAG_MEMBER_STRUCT, 0);
+    check_member(first, "Motor.Speed", 4, PLCTAG_MEMBER_INT32, 0);
+    check_member(first, "Motor.Flags[0]", 8, PLCTAG_MEMBER_BIT, 0);
+    check_member(first, "Motor.Flags[13]", 9, PLCTAG_MEMBER_BIT, 5);
+    check_member(first, "Motor.Flags[35]", 12, PLCTAG_MEMBER_BIT, 3);
+    check_member(first, "Motor.Running", 16, PLCTAG_MEMBER_BIT, 3);
+    check_member(first, "Motor.Temp", 20, PLCTAG_MEMBER_FLOAT32, 0);
+    check_member(second, "Motor.Flags[63]", 15, PLCTAG_MEMBER_BIT, 7);
+
+    assert(plc_tag_get_member_info(first, "Motor.Flags[64]", &offset, &kind, &bit_num) == PLCTAG_ERR_OUT_OF_BOUNDS);
+    assert(plc_tag_get_member_info(first, "Motor.Torque", &offset, &kind, &bit_num) == PLCTAG_ERR_NOT_FOUND);
+
+    /* the offsets find the data, in the second element too. */
+    assert(plc_tag_get_member_info(first, "Motor.Flags[35]", &offset, &kind, &bit_num) == PLCTAG_STATUS_OK);
+    assert(plc_tag_set_uint8(first, AXIS_SIZE + offset, (uint8_t)(1 << bit_num)) == PLCTAG_STATUS_OK);
+    assert(plc_tag_set_int32(first, AXIS_SIZE + 4, 1750) == PLCTAG_STATUS_OK);
+    assert(plc_tag_write(first, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+
+    assert(plc_tag_read(second, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_uint32(second, AXIS_SIZE + 12) == (1u << 3));
+    assert(plc_tag_get_int32(second, AXIS_SIZE + 4) == 1750);
+    assert(plc_tag_get_uint32(second, 12) == 0);
+
+    plc_tag_destroy(second);
+    plc_tag_destroy(first);
+    plc_tag_destroy(stats);
+
+    sim_stop(sim);
+
+    printf("All UDT tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plc_tag_write_bits() tests against lgx_sim, whose path is the only
+ * argument.  Each way of talking to the PLC changes bits in its own
+ * element of TestDINTArray and a plain tag on the whole array checks
+ * that nothing else changed.
+ */
+
+/* the checks call the library, keep them in release builds. */
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../../lib/libplctag.h"
+#include "../lgx_sim/sim_launch.h"
+
+#define SIM_PORT (44832)
+#define SIM_PORT_STR "44832"
+#define DATA_TIMEOUT (5000)
+
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&gateway_port=" SIM_PORT_STR "&path=1,0&cpu=lgx&elem_size=4"
+#define ELEM_COUNT (10)
+
+#define START_VALUE (0x5A5A5A5Au)
+#define SET_MASK (0x00000F02u)
+#define CLEAR_MASK (0x0F000002u)   /* bit 1 is in both, so it is cleared */
+#define END_VALUE (0x505A5F58u)
+
+
+static int32_t create_tag(const char *name, int elem_count, int connected)
+{
+    char attribs[256];
+    int32_t tag = 0;
+
+    snprintf(attribs, sizeof(attribs), TAG_ATTRIBS "&name=%s&elem_count=%d&use_connected_msg=%d", name, elem_count, connected);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    assert(tag > 0);
+
+    return tag;
+}
+
+
+static void check_write_bits(int32_t array, int connected)
+{
+    int index = (connected ? 2 : 5);
+    char name[32];
+    int32_t tag = 0;
+
+    snprintf(name, sizeof(name), "TestDINTArray[%d]", index);
+    tag = create_tag(name, 1, connected);
+
+    /* a known pattern in the whole array. */
+    for(int i=0; i < ELEM_COUNT; i++) {
+        assert(plc_tag_set_uint32(array, i * 4, START_VALUE) == PLCTAG_STATUS_OK);
+    }
+
+    assert(plc_tag_write(array, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_read(tag, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+
+    assert(plc_tag_write_bits(tag, SET_MASK, CLEAR_MASK, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+
+    /* the local copy follows without another read. */
+    assert(plc_tag_get_uint32(tag, 0) == END_VALUE);
+
+    assert(plc_tag_read(array, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+
+    for(int i=0; i < ELEM_COUNT; i++) {
+        assert(plc_tag_get_uint32(array, i * 4) == (i == index ? END_VALUE : START_VALUE));
+    }
+
+    /* setting bits that are set and clearing bits that are clear changes nothing. */
+    assert(plc_tag_write_bits(tag, END_VALUE, ~(uint64_t)END_VALUE, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_read(tag, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+    assert(plc_tag_get_uint32(tag, 0) == END_VALUE);
+
+    plc_tag_destroy(tag);
+}
+
+
+int main(int argc, const char **argv)
+{
+    pid_t sim = 0;
+    int32_t array = 0;
+
+    assert(argc == 2);
+
+    sim = sim_start(argv[1], SIM_PORT);
+
+    /* the connected tag first, the session only opens a connection if its first tag wants one. */
+    array = create_tag("TestDINTArray", ELEM_COUNT, 1);
+
+    check_write_bits(array, 1);
+    check_write_bits(array, 0);
+
+    plc_tag_destroy(array);
+
+    sim_stop(sim);
+
+    printf("All write bits tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * lock_bench
+ *
+ * Compare the platform lock and the atomic reference counts against the
+ * plain test-and-set spin they replaced.
+ *
+ *   lock_bench [threads] [total operations]
+ *
+ * The default is four threads per CPU so that lock holders get preempted,
+ * which is where a pure spin falls over.  Each case prints the wall time
+ * and the nanoseconds per operation over all threads.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/rc.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#define DEFAULT_THREADS_PER_CPU (4)
+#define DEFAULT_TOTAL_OPS (2000000)
+
+/* work done while holding the lock, roughly a hashtable lookup. */
+#define CRITICAL_WORK (50)
+
+typedef enum { CASE_SPIN_LOCK, CASE_PLATFORM_LOCK, CASE_SPIN_REFCOUNT, CASE_ATOMIC_REFCOUNT } bench_case_t;
+
+static const char *case_names[] = {
+    "test-and-set spin lock",
+    "lock_acquire/lock_release",
+    "spin locked ref count",
+    "rc_inc/rc_dec"
+};
+
+/* the old lock_acquire(). */
+typedef struct { volatile int lock; volatile int count; } spin_ref_t;
+
+static volatile int start_flag = 0;
+static volatile int spin_lock_val = 0;
+static lock_t platform_lock = LOCK_INIT;
+static volatile int64_t shared_counter = 0;
+static spin_ref_t spin_ref;
+static void *atomic_ref = NULL;
+
+static bench_case_t current_case;
+static int ops_per_thread = 0;
+
+
+static void spin_acquire(volatile int *lock)
+{
+    while(__sync_lock_test_and_set(lock, 1) == 1) ;
+}
+
+static void spin_release(volatile int *lock)
+{
+    __sync_lock_release(lock);
+}
+
+
+static void critical_work(void)
+{
+    for(int i=0; i < CRITICAL_WORK; i++) {
+        shared_counter++;
+    }
+}
+
+
+static void ref_cleanup(void *data)
+{
+    (void)data;
+}
+
+
+
+static THREAD_FUNC(bench_thread)
+{
+    (void)arg;
+
+    while(!start_flag) {
+        sched_yield();
+    }
+
+    for(int i=0; i < ops_per_thread; i++) {
+        switch(current_case) {
+            case CASE_SPIN_LOCK:
+                spin_acquire(&spin_lock_val);
+                critical_work();
+                spin_release(&spin_lock_val);
+                break;
+
+            case CASE_PLATFORM_LOCK:
+                spin_block(&platform_lock) {
+                    critical_work();
+                }
+                break;
+
+            case CASE_SPIN_REFCOUNT:
+                spin_acquire(&spin_ref.lock);
+                spin_ref.count++;
+                spin_release(&spin_ref.lock);
+
+                spin_acquire(&spin_ref.lock);
+                spin_ref.count--;
+                spin_release(&spin_ref.lock);
+                break;
+
+            case CASE_ATOMIC_REFCOUNT:
+                rc_inc(atomic_ref);
+                rc_dec(atomic_ref);
+                break;
+        }
+    }
+
+    THREAD_RETURN(0);
+}
+
+
+
+static int run_case(bench_case_t which, int num_threads)
+{
+    thread_p *threads = NULL;
+    int64_t start_ns = 0;
+    int64_t elapsed_ns = 0;
+    int64_t total_ops = (int64_t)ops_per_thread * num_threads;
+
+    threads = mem_alloc((int)sizeof(*threads) * num_threads);
+    if(!threads) {
+        fprintf(stderr, "Unable to allocate thread array!\n");
+        return 1;
+    }
+
+    current_case = which;
+    shared_counter = 0;
+    start_flag = 0;
+
+    for(int i=0; i < num_threads; i++) {
+        if(thread_create(&threads[i], bench_thread, 32*1024, NULL) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to create thread %d!\n", i);
+            exit(1);
+        }
+    }
+
+    start_ns = time_mono_ns();
+    start_flag = 1;
+
+    for(int i=0; i < num_threads; i++) {
+        thread_join(threads[i]);
+        thread_destroy(&threads[i]);
+    }
+
+    elapsed_ns = time_mono_ns() - start_ns;
+
+    mem_free(threads);
+
+    if((which == CASE_SPIN_LOCK || which == CASE_PLATFORM_LOCK) && shared_counter != total_ops * CRITICAL_WORK) {
+        fprintf(stderr, "%s: lost updates, counter is %" PRId64 " expected %" PRId64 "!\n", case_names[which], shared_counter, total_ops * CRITICAL_WORK);
+        return 1;
+    }
+
+    printf("%-28s %10.1f ms %10.1f ns/op\n", case_names[which], (double)elapsed_ns / 1000000.0, (double)elapsed_ns / (double)total_ops);
+
+    return 0;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = (int)(cpus > 0 ? cpus : 1) * DEFAULT_THREADS_PER_CPU;
+    int total_ops = DEFAULT_TOTAL_OPS;
+    int rc = 0;
+
+    if(argc > 1) {
+        num_threads = atoi(argv[1]);
+    }
+
+    if(argc > 2) {
+        total_ops = atoi(argv[2]);
+    }
+
+    if(argc > 3 || num_threads <= 0 || total_ops <= 0) {
+        fprintf(stderr, "Usage: lock_bench [threads] [total operations]\n");
+        return 1;
+    }
+
+    ops_per_thread = total_ops / num_threads;
+    if(ops_per_thread <= 0) {
+        ops_per_thread = 1;
+    }
+
+    atomic_ref = rc_alloc(16, ref_cleanup);
+    if(!atomic_ref) {
+        fprintf(stderr, "Unable to allocate the reference counted block!\n");
+        return 1;
+    }
+
+    printf("%d threads on %ld CPUs, %d operations per thread\n", num_threads, cpus, ops_per_thread);
+
+    rc |= run_case(CASE_SPIN_LOCK, num_threads);
+    rc |= run_case(CASE_PLATFORM_LOCK, num_threads);
+    rc |= run_case(CASE_SPIN_REFCOUNT, num_threads);
+    rc |= run_case(CASE_ATOMIC_REFCOUNT, num_threads);
+
+    rc_dec(atomic_ref);
+
+    return rc;
+}
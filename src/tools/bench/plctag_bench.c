@@ -0,0 +1,750 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plctag_bench
+ *
+ * End to end benchmark of the library against lgx_sim on the loopback
+ * interface.
+ *
+ *   plctag_bench [--sim <lgx_sim path>] [--external] [--scenario <name>]
+ *                [--iterations <n>] [--tags <n>] [--sessions <n>]
+ *                [--conn-size <bytes>] [--rtt-us <us>] [--jitter-us <us>]
+ *                [--delay-us <us>] [--max-rate <requests/s>]
+ *                [--stall-prob <p>] [--stall-ms <ms>] [--drop-prob <p>]
+ *
+ * By default the simulator next to this program is started and stopped
+ * again at the end.  --external uses a simulator that is already running.
+ * --conn-size and the emulation settings are passed on to the simulator
+ * it starts, to limit the connection size like a smaller controller
+ * would or to add network latency and a controller CPU budget.
+ *
+ * Each scenario prints one JSON object on its own line on stdout with the
+ * throughput and latency percentiles.  Progress goes to stderr.  Latency
+ * is taken from plc_tag_get_op_time() for reads and writes, so it is the
+ * time inside the library, and from the wall clock for tag creation.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+
+#define SIM_HOST "127.0.0.1"
+#define SIM_PORT (44818)
+#define SIM_START_TIMEOUT_MS (5000)
+
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=" SIM_HOST "&path=1,0&cpu=lgx&elem_size=4"
+
+#define DATA_TIMEOUT (5000)
+
+#define DEFAULT_ITERATIONS (1000)
+#define DEFAULT_SCAN_TAGS (100)
+#define DEFAULT_SESSIONS (1000)
+#define SESSION_ROUNDS (10)
+
+/* sizes of the lgx_sim tags. */
+#define SMALL_ARRAY_NAME "TestDINTArray"
+#define SMALL_ARRAY_ELEMS (10)
+#define BIG_ARRAY_NAME "TestBigArray"
+#define BIG_ARRAY_ELEMS (1000)
+
+
+typedef struct {
+    const char *scenario;
+    int64_t ops;
+    int64_t errors;
+    int64_t start_us;
+    int64_t end_us;
+    int64_t *latency_us;
+    int64_t latency_count;
+    int64_t latency_capacity;
+} bench_result_t;
+
+typedef int (*scenario_func)(bench_result_t *result);
+
+typedef struct {
+    const char *name;
+    scenario_func func;
+} scenario_t;
+
+
+static int bench_read(bench_result_t *result);
+static int bench_scan(bench_result_t *result);
+static int bench_packed_scan(bench_result_t *result);
+static int run_scan(bench_result_t *result, const char *extra);
+static int bench_large_read(bench_result_t *result);
+static int bench_write(bench_result_t *result);
+static int bench_sessions(bench_result_t *result);
+static int bench_create_storm(bench_result_t *result);
+
+static scenario_t scenarios[] = {
+    { "read", bench_read },
+    { "scan", bench_scan },
+    { "packed_scan", bench_packed_scan },
+    { "large_read", bench_large_read },
+    { "write", bench_write },
+    { "sessions", bench_sessions },
+    { "create_storm", bench_create_storm },
+    { NULL, NULL }
+};
+
+static int iterations = DEFAULT_ITERATIONS;
+static int scan_tags = DEFAULT_SCAN_TAGS;
+static int session_count = DEFAULT_SESSIONS;
+
+static pid_t sim_pid = 0;
+
+/* settings passed on to the simulator, and the command line for it. */
+static const char *sim_settings[] = {
+    "--conn-size", "--rtt-us", "--jitter-us", "--delay-us", "--max-rate",
+    "--stall-prob", "--stall-ms", "--drop-prob", NULL
+};
+
+#define MAX_SIM_ARGS (32)
+static char *sim_argv[MAX_SIM_ARGS];
+static int sim_argc = 1;
+
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_bench [--sim <lgx_sim path>] [--external] [--scenario <name>]\n"
+                    "                    [--iterations <n>] [--tags <n>] [--sessions <n>]\n"
+                    "                    [--conn-size <bytes>] [--rtt-us <us>] [--jitter-us <us>]\n"
+                    "                    [--delay-us <us>] [--max-rate <requests/s>]\n"
+                    "                    [--stall-prob <p>] [--stall-ms <ms>] [--drop-prob <p>]\n"
+                    "Scenarios:");
+
+    for(int i=0; scenarios[i].name; i++) {
+        fprintf(stderr, " %s", scenarios[i].name);
+    }
+
+    fprintf(stderr, "\n");
+}
+
+
+
+/*
+ * Results.
+ */
+
+static int add_latency(bench_result_t *result, int64_t latency_us)
+{
+    if(result->latency_count >= result->latency_capacity) {
+        int64_t new_capacity = (result->latency_capacity ? result->latency_capacity * 2 : 1024);
+        int64_t *new_buf = realloc(result->latency_us, sizeof(int64_t) * (size_t)new_capacity);
+
+        if(!new_buf) {
+            fprintf(stderr, "Unable to grow the latency buffer!\n");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        result->latency_us = new_buf;
+        result->latency_capacity = new_capacity;
+    }
+
+    result->latency_us[result->latency_count++] = latency_us;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* record the outcome of the last read or write of a tag. */
+static void add_op(bench_result_t *result, int32_t tag, int rc)
+{
+    result->ops++;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        result->errors++;
+        return;
+    }
+
+    add_latency(result, plc_tag_get_op_time(tag, PLCTAG_OP_TIME_COMPLETED) - plc_tag_get_op_time(tag, PLCTAG_OP_TIME_STARTED));
+}
+
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t va = *(const int64_t *)a;
+    int64_t vb = *(const int64_t *)b;
+
+    return (va < vb ? -1 : (va > vb ? 1 : 0));
+}
+
+
+static int64_t percentile(bench_result_t *result, double pct)
+{
+    int64_t index = 0;
+
+    if(result->latency_count == 0) {
+        return 0;
+    }
+
+    index = (int64_t)((pct / 100.0) * (double)(result->latency_count - 1) + 0.5);
+
+    return result->latency_us[index];
+}
+
+
+static void print_result(bench_result_t *result)
+{
+    double seconds = (double)(result->end_us - result->start_us) / 1000000.0;
+
+    qsort(result->latency_us, (size_t)result->latency_count, sizeof(int64_t), compare_int64);
+
+    printf("{\"scenario\":\"%s\",\"ops\":%" PRId64 ",\"errors\":%" PRId64 ",\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"latency_us\":{\"min\":%" PRId64 ",\"p50\":%" PRId64 ",\"p90\":%" PRId64 ",\"p99\":%" PRId64 ",\"p999\":%" PRId64 ",\"max\":%" PRId64 "}}\n",
+           result->scenario,
+           result->ops,
+           result->errors,
+           seconds,
+           (seconds > 0.0 ? (double)result->ops / seconds : 0.0),
+           percentile(result, 0.0),
+           percentile(result, 50.0),
+           percentile(result, 90.0),
+           percentile(result, 99.0),
+           percentile(result, 99.9),
+           percentile(result, 100.0));
+
+    fflush(stdout);
+}
+
+
+
+/*
+ * Tag helpers.
+ */
+
+static int32_t create_tag(const char *name, int elem_count, const char *extra, int timeout)
+{
+    char attribs[256];
+
+    snprintf(attribs, sizeof(attribs), TAG_ATTRIBS "&elem_count=%d&name=%s%s", elem_count, name, extra);
+
+    return plc_tag_create(attribs, timeout);
+}
+
+
+/* wait for all the tags to finish what they are doing.  Returns the count still pending. */
+static int wait_all(int32_t *tags, int count, int timeout_ms)
+{
+    int64_t end_us = time_mono_us() + (int64_t)timeout_ms * 1000;
+    int pending = 0;
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < count; i++) {
+            if(tags[i] >= 0 && plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                pending++;
+            }
+        }
+
+        if(pending) {
+            sleep_us(50);
+        }
+    } while(pending && time_mono_us() < end_us);
+
+    return pending;
+}
+
+
+/* record the reads of a round.  Those still pending are timeouts and are aborted for the next round. */
+static void finish_all(bench_result_t *result, int32_t *tags, int count)
+{
+    for(int i=0; i < count; i++) {
+        int rc = plc_tag_status(tags[i]);
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            plc_tag_abort(tags[i]);
+            rc = PLCTAG_ERR_TIMEOUT;
+        }
+
+        add_op(result, tags[i], rc);
+    }
+}
+
+
+static void destroy_all(int32_t *tags, int count)
+{
+    for(int i=0; i < count; i++) {
+        if(tags[i] >= 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+}
+
+
+
+/*
+ * Scenarios.
+ */
+
+/* one small tag read over and over. */
+int bench_read(bench_result_t *result)
+{
+    int32_t tag = create_tag(SMALL_ARRAY_NAME, SMALL_ARRAY_ELEMS, "", DATA_TIMEOUT);
+
+    if(tag < 0) {
+        fprintf(stderr, "Unable to create tag: %s!\n", plc_tag_decode_error(tag));
+        return tag;
+    }
+
+    result->start_us = time_mono_us();
+
+    for(int i=0; i < iterations; i++) {
+        add_op(result, tag, plc_tag_read(tag, DATA_TIMEOUT));
+    }
+
+    result->end_us = time_mono_us();
+
+    plc_tag_destroy(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * many single element tags read together, the way an HMI scans.  Reads
+ * of neighbouring elements are merged into one read.
+ */
+int bench_scan(bench_result_t *result)
+{
+    return run_scan(result, "&read_coalesce_gap=0");
+}
+
+
+/*
+ * The same scan without merging the reads of neighbouring elements, so
+ * every read is its own request and they go out in Multiple Service
+ * Packets.
+ */
+int bench_packed_scan(bench_result_t *result)
+{
+    return run_scan(result, "");
+}
+
+
+int run_scan(bench_result_t *result, const char *extra)
+{
+    int32_t *tags = calloc((size_t)scan_tags, sizeof(int32_t));
+    char name[64];
+    int scans = iterations / scan_tags;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tags) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(scans < 1) {
+        scans = 1;
+    }
+
+    for(int i=0; i < scan_tags; i++) {
+        snprintf(name, sizeof(name), BIG_ARRAY_NAME "[%d]", i % BIG_ARRAY_ELEMS);
+
+        tags[i] = create_tag(name, 1, extra, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Unable to create tag %s: %s!\n", name, plc_tag_decode_error(tags[i]));
+            rc = tags[i];
+            break;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        result->start_us = time_mono_us();
+
+        for(int s=0; s < scans; s++) {
+            for(int i=0; i < scan_tags; i++) {
+                plc_tag_read(tags[i], 0);
+            }
+
+            wait_all(tags, scan_tags, DATA_TIMEOUT);
+
+            finish_all(result, tags, scan_tags);
+        }
+
+        result->end_us = time_mono_us();
+    }
+
+    destroy_all(tags, scan_tags);
+    free(tags);
+
+    return rc;
+}
+
+
+/* a read that needs several fragments. */
+int bench_large_read(bench_result_t *result)
+{
+    int32_t tag = create_tag(BIG_ARRAY_NAME, BIG_ARRAY_ELEMS, "", DATA_TIMEOUT);
+    int count = iterations / 10;
+
+    if(tag < 0) {
+        fprintf(stderr, "Unable to create tag: %s!\n", plc_tag_decode_error(tag));
+        return tag;
+    }
+
+    if(count < 1) {
+        count = 1;
+    }
+
+    result->start_us = time_mono_us();
+
+    for(int i=0; i < count; i++) {
+        add_op(result, tag, plc_tag_read(tag, DATA_TIMEOUT));
+    }
+
+    result->end_us = time_mono_us();
+
+    plc_tag_destroy(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int bench_write(bench_result_t *result)
+{
+    int32_t tag = create_tag(SMALL_ARRAY_NAME, SMALL_ARRAY_ELEMS, "", DATA_TIMEOUT);
+
+    if(tag < 0) {
+        fprintf(stderr, "Unable to create tag: %s!\n", plc_tag_decode_error(tag));
+        return tag;
+    }
+
+    result->start_us = time_mono_us();
+
+    for(int i=0; i < iterations; i++) {
+        for(int elem=0; elem < SMALL_ARRAY_ELEMS; elem++) {
+            plc_tag_set_int32(tag, elem * 4, i + elem);
+        }
+
+        add_op(result, tag, plc_tag_write(tag, DATA_TIMEOUT));
+    }
+
+    result->end_us = time_mono_us();
+
+    plc_tag_destroy(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * Every tag gets its own session and connection.  The time to connect
+ * them all is not counted, the reads afterwards are.
+ */
+int bench_sessions(bench_result_t *result)
+{
+    int32_t *tags = calloc((size_t)session_count, sizeof(int32_t));
+    int64_t setup_start_us = time_mono_us();
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tags) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(int i=0; i < session_count; i++) {
+        tags[i] = create_tag(SMALL_ARRAY_NAME, 1, "&share_session=0", 0);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Unable to create tag %d: %s!\n", i, plc_tag_decode_error(tags[i]));
+            rc = tags[i];
+            break;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        /* the first read waits for each connection. */
+        wait_all(tags, session_count, DATA_TIMEOUT * 2);
+
+        for(int i=0; i < session_count; i++) {
+            plc_tag_read(tags[i], 0);
+        }
+
+        wait_all(tags, session_count, DATA_TIMEOUT * 2);
+
+        fprintf(stderr, "  %d sessions connected in %.3f s\n", session_count, (double)(time_mono_us() - setup_start_us) / 1000000.0);
+
+        result->start_us = time_mono_us();
+
+        for(int round=0; round < SESSION_ROUNDS; round++) {
+            for(int i=0; i < session_count; i++) {
+                plc_tag_read(tags[i], 0);
+            }
+
+            wait_all(tags, session_count, DATA_TIMEOUT);
+
+            finish_all(result, tags, session_count);
+        }
+
+        result->end_us = time_mono_us();
+    }
+
+    destroy_all(tags, session_count);
+    free(tags);
+
+    return rc;
+}
+
+
+/* create, read and destroy a tag as fast as possible on a shared session. */
+int bench_create_storm(bench_result_t *result)
+{
+    char name[64];
+    int count = iterations / 2;
+
+    /* hold the session open so only the tag set up is measured. */
+    int32_t anchor = create_tag(SMALL_ARRAY_NAME, 1, "", DATA_TIMEOUT);
+
+    if(anchor < 0) {
+        fprintf(stderr, "Unable to create tag: %s!\n", plc_tag_decode_error(anchor));
+        return anchor;
+    }
+
+    plc_tag_read(anchor, DATA_TIMEOUT);
+
+    if(count < 1) {
+        count = 1;
+    }
+
+    result->start_us = time_mono_us();
+
+    for(int i=0; i < count; i++) {
+        int64_t start_us = time_mono_us();
+        int32_t tag = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        snprintf(name, sizeof(name), BIG_ARRAY_NAME "[%d]", i % BIG_ARRAY_ELEMS);
+
+        tag = create_tag(name, 1, "", DATA_TIMEOUT);
+        if(tag < 0) {
+            rc = tag;
+        } else {
+            rc = plc_tag_read(tag, DATA_TIMEOUT);
+            plc_tag_destroy(tag);
+        }
+
+        result->ops++;
+
+        if(rc != PLCTAG_STATUS_OK) {
+            result->errors++;
+        } else {
+            add_latency(result, time_mono_us() - start_us);
+        }
+    }
+
+    result->end_us = time_mono_us();
+
+    plc_tag_destroy(anchor);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Simulator control.
+ */
+
+static int sim_listening(void)
+{
+    sock_p sock = NULL;
+    int rc = 0;
+
+    if(socket_create(&sock) != PLCTAG_STATUS_OK) {
+        return 0;
+    }
+
+    rc = (socket_connect_tcp(sock, SIM_HOST, SIM_PORT) == PLCTAG_STATUS_OK);
+
+    socket_destroy(&sock);
+
+    return rc;
+}
+
+
+static int start_sim(const char *sim_path)
+{
+    int64_t end_us = 0;
+
+    if(sim_listening()) {
+        fprintf(stderr, "Something is already listening on port %d, use --external to benchmark against it.\n", SIM_PORT);
+        return PLCTAG_ERR_DUPLICATE;
+    }
+
+    sim_pid = fork();
+    if(sim_pid < 0) {
+        fprintf(stderr, "Unable to fork the simulator!\n");
+        sim_pid = 0;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(sim_pid == 0) {
+        /* the simulator logs every packet, throw that away. */
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if(null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        sim_argv[0] = (char *)sim_path;
+
+        execv(sim_path, sim_argv);
+
+        _exit(127);
+    }
+
+    end_us = time_mono_us() + SIM_START_TIMEOUT_MS * 1000;
+
+    while(!sim_listening()) {
+        if(time_mono_us() > end_us || waitpid(sim_pid, NULL, WNOHANG) == sim_pid) {
+            fprintf(stderr, "Simulator %s did not start!\n", sim_path);
+            sim_pid = 0;
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        sleep_ms(10);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static void stop_sim(void)
+{
+    if(sim_pid > 0) {
+        kill(sim_pid, SIGTERM);
+        waitpid(sim_pid, NULL, 0);
+        sim_pid = 0;
+    }
+}
+
+
+static int is_sim_setting(const char *arg)
+{
+    for(int i=0; sim_settings[i]; i++) {
+        if(strcmp(arg, sim_settings[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* every separate session is a socket, and so is its peer if the simulator is our child. */
+static void raise_file_limit(void)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+
+
+int main(int argc, char **argv)
+{
+    char sim_path[1024];
+    const char *only_scenario = NULL;
+    int external = 0;
+    int rc = 0;
+
+    /* default to the simulator built next to us. */
+    snprintf(sim_path, sizeof(sim_path), "%s", argv[0]);
+    if(strrchr(sim_path, '/')) {
+        snprintf(strrchr(sim_path, '/') + 1, sizeof(sim_path) - (size_t)(strrchr(sim_path, '/') + 1 - sim_path), "lgx_sim");
+    } else {
+        snprintf(sim_path, sizeof(sim_path), "./lgx_sim");
+    }
+
+    for(int i=1; i < argc; i++) {
+        if(strcmp(argv[i], "--external") == 0) {
+            external = 1;
+        } else if(i + 1 < argc && strcmp(argv[i], "--sim") == 0) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "--scenario") == 0) {
+            only_scenario = argv[++i];
+        } else if(i + 1 < argc && strcmp(argv[i], "--iterations") == 0) {
+            iterations = atoi(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "--tags") == 0) {
+            scan_tags = atoi(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "--sessions") == 0) {
+            session_count = atoi(argv[++i]);
+        } else if(i + 1 < argc && is_sim_setting(argv[i]) && sim_argc + 2 < MAX_SIM_ARGS) {
+            sim_argv[sim_argc++] = argv[i];
+            sim_argv[sim_argc++] = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if(iterations <= 0 || scan_tags <= 0 || session_count <= 0) {
+        usage();
+        return 1;
+    }
+
+    raise_file_limit();
+
+    if(!external && start_sim(sim_path) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    for(int i=0; scenarios[i].name; i++) {
+        bench_result_t result;
+
+        if(only_scenario && strcmp(only_scenario, scenarios[i].name) != 0) {
+            continue;
+        }
+
+        fprintf(stderr, "Running %s.\n", scenarios[i].name);
+
+        memset(&result, 0, sizeof(result));
+        result.scenario = scenarios[i].name;
+
+        if(scenarios[i].func(&result) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Scenario %s failed!\n", scenarios[i].name);
+            rc = 1;
+        } else {
+            print_result(&result);
+        }
+
+        free(result.latency_us);
+    }
+
+    stop_sim();
+
+    return rc;
+}
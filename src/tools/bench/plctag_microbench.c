@@ -0,0 +1,426 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plctag_microbench
+ *
+ * Time the in-process hot paths one at a time, without any network.
+ *
+ *   plctag_microbench [--threads <max>] [--ops <per thread>] [--bench <name>]
+ *
+ * Each benchmark is run with 1, 2, 4 ... threads up to the maximum, which
+ * defaults to the number of CPUs.  Every thread does the same number of
+ * operations on shared state, the way the library is used.  The output has
+ * one line per run:
+ *
+ *   ns/op         wall time divided by all operations
+ *   thread ns/op  wall time divided by the operations of one thread
+ *   scaling       throughput relative to one thread
+ *
+ * The tag benchmarks use a system tag, so lookup_tag() and the accessors
+ * run without a PLC.  lookup_tag() is static and is timed through
+ * plc_tag_get_size(), which does nothing else but take the API mutex.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/attr.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+#include <ab/tag.h>
+#include <ab/cip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+
+#define DEFAULT_OPS (200000)
+#define HASHTABLE_ENTRIES (1000)
+
+#define SYSTEM_TAG_ATTRIBS "protocol=system&name=version"
+#define ATTRIB_STRING "protocol=ab_eip&gateway=10.206.1.39&path=1,0&cpu=LGX&elem_size=4&elem_count=10&name=TestDINTArray"
+#define ENCODE_TAG_NAME "Program:MainProgram.MyUDT[12].Member[3]"
+
+typedef struct {
+    int index;
+    struct ab_tag_t *ab_tag;
+} bench_thread_t;
+
+typedef int (*bench_setup_func)(void);
+typedef void (*bench_op_func)(bench_thread_t *thread, int i);
+typedef void (*bench_teardown_func)(void);
+
+typedef struct {
+    const char *name;
+    bench_setup_func setup;
+    bench_op_func op;
+    bench_teardown_func teardown;
+} bench_t;
+
+
+static int setup_tag(void);
+static void teardown_tag(void);
+static int setup_hashtable(void);
+static void teardown_hashtable(void);
+static int setup_rc(void);
+static void teardown_rc(void);
+
+static void op_lookup_tag(bench_thread_t *thread, int i);
+static void op_get_int32(bench_thread_t *thread, int i);
+static void op_set_int32(bench_thread_t *thread, int i);
+static void op_get_float32(bench_thread_t *thread, int i);
+static void op_hashtable_get(bench_thread_t *thread, int i);
+static void op_attr_create(bench_thread_t *thread, int i);
+static void op_cip_encode_tag_name(bench_thread_t *thread, int i);
+static void op_rc_inc_dec(bench_thread_t *thread, int i);
+
+static bench_t benches[] = {
+    { "lookup_tag", setup_tag, op_lookup_tag, teardown_tag },
+    { "plc_tag_get_int32", setup_tag, op_get_int32, teardown_tag },
+    { "plc_tag_set_int32", setup_tag, op_set_int32, teardown_tag },
+    { "plc_tag_get_float32", setup_tag, op_get_float32, teardown_tag },
+    { "hashtable_get", setup_hashtable, op_hashtable_get, teardown_hashtable },
+    { "attr_create_from_str", NULL, op_attr_create, NULL },
+    { "cip_encode_tag_name", NULL, op_cip_encode_tag_name, NULL },
+    { "rc_inc/rc_dec", setup_rc, op_rc_inc_dec, teardown_rc },
+    { NULL, NULL, NULL, NULL }
+};
+
+static int32_t bench_tag = 0;
+static hashtable_p bench_table = NULL;
+static void *bench_ref = NULL;
+
+static volatile int start_flag = 0;
+static volatile int sink = 0;
+
+static bench_t *current_bench = NULL;
+static int ops_per_thread = DEFAULT_OPS;
+
+
+
+/*
+ * Set up and tear down.
+ */
+
+int setup_tag(void)
+{
+    bench_tag = plc_tag_create(SYSTEM_TAG_ATTRIBS, 0);
+
+    if(bench_tag < 0) {
+        fprintf(stderr, "Unable to create system tag: %s!\n", plc_tag_decode_error(bench_tag));
+        return bench_tag;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void teardown_tag(void)
+{
+    plc_tag_destroy(bench_tag);
+}
+
+
+int setup_hashtable(void)
+{
+    bench_table = hashtable_create(HASHTABLE_ENTRIES);
+
+    if(!bench_table) {
+        fprintf(stderr, "Unable to create hashtable!\n");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* the values only have to be non-NULL. */
+    for(int i=0; i < HASHTABLE_ENTRIES; i++) {
+        hashtable_put(bench_table, (int64_t)i * 7919, &bench_table);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void teardown_hashtable(void)
+{
+    hashtable_destroy(bench_table);
+    bench_table = NULL;
+}
+
+
+static void bench_ref_cleanup(void *data)
+{
+    (void)data;
+}
+
+
+int setup_rc(void)
+{
+    bench_ref = rc_alloc(16, bench_ref_cleanup);
+
+    if(!bench_ref) {
+        fprintf(stderr, "Unable to allocate reference counted block!\n");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void teardown_rc(void)
+{
+    rc_dec(bench_ref);
+    bench_ref = NULL;
+}
+
+
+
+/*
+ * The operations.
+ */
+
+void op_lookup_tag(bench_thread_t *thread, int i)
+{
+    (void)thread;
+    (void)i;
+
+    sink = plc_tag_get_size(bench_tag);
+}
+
+
+void op_get_int32(bench_thread_t *thread, int i)
+{
+    (void)thread;
+    (void)i;
+
+    sink = plc_tag_get_int32(bench_tag, 0);
+}
+
+
+void op_set_int32(bench_thread_t *thread, int i)
+{
+    (void)thread;
+
+    plc_tag_set_int32(bench_tag, 4, i);
+}
+
+
+void op_get_float32(bench_thread_t *thread, int i)
+{
+    (void)thread;
+    (void)i;
+
+    sink = (int)plc_tag_get_float32(bench_tag, 8);
+}
+
+
+void op_hashtable_get(bench_thread_t *thread, int i)
+{
+    (void)thread;
+
+    sink = (hashtable_get(bench_table, (int64_t)(i % HASHTABLE_ENTRIES) * 7919) != NULL);
+}
+
+
+void op_attr_create(bench_thread_t *thread, int i)
+{
+    attr attribs = attr_create_from_str(ATTRIB_STRING);
+
+    (void)thread;
+    (void)i;
+
+    attr_destroy(attribs);
+}
+
+
+void op_cip_encode_tag_name(bench_thread_t *thread, int i)
+{
+    (void)i;
+
+    sink = cip_encode_tag_name(thread->ab_tag, ENCODE_TAG_NAME);
+}
+
+
+void op_rc_inc_dec(bench_thread_t *thread, int i)
+{
+    (void)thread;
+    (void)i;
+
+    rc_dec(rc_inc(bench_ref));
+}
+
+
+
+/*
+ * Running.
+ */
+
+static THREAD_FUNC(bench_thread)
+{
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bench_op_func op = current_bench->op;
+
+    while(!start_flag) {
+        sched_yield();
+    }
+
+    for(int i=0; i < ops_per_thread; i++) {
+        op(thread, i);
+    }
+
+    THREAD_RETURN(0);
+}
+
+
+/* returns the wall time in nanoseconds. */
+static int64_t run_threads(int num_threads)
+{
+    thread_p threads[num_threads];
+    bench_thread_t args[num_threads];
+    int64_t start_ns = 0;
+
+    start_flag = 0;
+
+    for(int i=0; i < num_threads; i++) {
+        args[i].index = i;
+        args[i].ab_tag = mem_alloc((int)sizeof(struct ab_tag_t));
+
+        if(!args[i].ab_tag || thread_create(&threads[i], bench_thread, 32*1024, &args[i]) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to start thread %d!\n", i);
+            exit(1);
+        }
+    }
+
+    start_ns = time_mono_ns();
+    start_flag = 1;
+
+    for(int i=0; i < num_threads; i++) {
+        thread_join(threads[i]);
+        thread_destroy(&threads[i]);
+        mem_free(args[i].ab_tag);
+    }
+
+    return time_mono_ns() - start_ns;
+}
+
+
+static int next_thread_count(int num_threads, int max_threads)
+{
+    if(num_threads < max_threads && num_threads * 2 > max_threads) {
+        return max_threads;
+    }
+
+    return num_threads * 2;
+}
+
+
+static int run_bench(bench_t *bench, int max_threads)
+{
+    double single_ops_per_ns = 0.0;
+
+    current_bench = bench;
+
+    if(bench->setup && bench->setup() != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* powers of two, then the maximum itself. */
+    for(int num_threads = 1; num_threads <= max_threads; num_threads = next_thread_count(num_threads, max_threads)) {
+        int64_t elapsed_ns = run_threads(num_threads);
+        double total_ops = (double)ops_per_thread * num_threads;
+        double ops_per_ns = total_ops / (double)elapsed_ns;
+
+        if(num_threads == 1) {
+            single_ops_per_ns = ops_per_ns;
+        }
+
+        printf("%-22s %8d %12.1f %14.1f %10.2f\n",
+               bench->name,
+               num_threads,
+               (double)elapsed_ns / total_ops,
+               (double)elapsed_ns / (double)ops_per_thread,
+               ops_per_ns / single_ops_per_ns);
+
+        fflush(stdout);
+    }
+
+    if(bench->teardown) {
+        bench->teardown();
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_microbench [--threads <max>] [--ops <per thread>] [--bench <name>]\n"
+                    "Benchmarks:");
+
+    for(int i=0; benches[i].name; i++) {
+        fprintf(stderr, " %s", benches[i].name);
+    }
+
+    fprintf(stderr, "\n");
+}
+
+
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (int)(cpus > 0 ? cpus : 1);
+    const char *only_bench = NULL;
+    int rc = 0;
+
+    for(int i=1; i < argc; i++) {
+        if(i + 1 < argc && strcmp(argv[i], "--threads") == 0) {
+            max_threads = atoi(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "--ops") == 0) {
+            ops_per_thread = atoi(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "--bench") == 0) {
+            only_bench = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if(max_threads <= 0 || ops_per_thread <= 0) {
+        usage();
+        return 1;
+    }
+
+    printf("%-22s %8s %12s %14s %10s\n", "benchmark", "threads", "ns/op", "thread ns/op", "scaling");
+
+    for(int i=0; benches[i].name; i++) {
+        if(only_bench && strcmp(only_bench, benches[i].name) != 0) {
+            continue;
+        }
+
+        if(run_bench(&benches[i], max_threads) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Benchmark %s failed!\n", benches[i].name);
+            rc = 1;
+        }
+    }
+
+    return rc;
+}
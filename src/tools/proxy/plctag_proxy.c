@@ -0,0 +1,907 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plctag_proxy
+ *
+ * Share PLC sessions across processes.  Each argument describes one PLC
+ * with the same attribute string format a tag uses plus where to listen:
+ *
+ *   plctag_proxy "listen=unix:/tmp/plc1.sock&gateway=10.1.2.3&path=1,0&cpu=lgx"
+ *   plctag_proxy "listen=127.0.0.1:44819&gateway=10.1.2.3&path=1,0&cpu=lgx"
+ *
+ * Clients set proxy=unix:/tmp/plc1.sock or proxy=127.0.0.1:44819 in their
+ * tag attributes and send unconnected messages to us.   We hold one
+ * connected session per PLC and push every client's requests through it
+ * so they are packed together.   Replies go back to each client as they
+ * arrive, not necessarily in the order the requests came in.
+ *
+ * Only loopback addresses and local sockets are accepted for listening.
+ * There is no authentication.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <lib/init.h>
+#include <ab/ab_common.h>
+#include <ab/defs.h>
+#include <ab/session.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+#define PROXY_MAX_LISTENERS (32)
+#define PROXY_MAX_PENDING   (64)
+#define PROXY_BUF_SIZE      (MAX_PACKET_SIZE_EX)
+#define PROXY_BACKLOG       (16)
+#define PROXY_IDLE_WAIT_MS  (100)
+#define PROXY_BUSY_WAIT_MS  (1)
+
+
+struct proxy_listener_t {
+    attr attribs;
+    const char *listen_spec;
+    char *unix_path;
+    int fd;
+    int allow_packing;
+    ab_session_p session;
+    pthread_t thread;
+};
+
+typedef struct proxy_listener_t *proxy_listener_p;
+
+
+struct proxy_pending_t {
+    ab_request_p req;
+    uint64_le sender_context;
+    uint8_t service;
+};
+
+
+struct proxy_client_t {
+    int fd;
+    proxy_listener_p listener;
+    ab_session_p session;
+    uint32_t session_handle;
+    int registered;
+    int closing;
+
+    struct proxy_pending_t pending[PROXY_MAX_PENDING];
+    int num_pending;
+
+    int buf_used;
+    uint8_t buf[PROXY_BUF_SIZE];
+    uint8_t out[PROXY_BUF_SIZE];
+};
+
+typedef struct proxy_client_t *proxy_client_p;
+
+
+static struct proxy_listener_t listeners[PROXY_MAX_LISTENERS];
+static int num_listeners = 0;
+static volatile sig_atomic_t terminating = 0;
+
+static pthread_mutex_t client_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int num_clients = 0;
+static uint32_t next_session_handle = 0;
+
+
+static void usage(void);
+static void handle_signal(int sig);
+static int listener_open(proxy_listener_p listener);
+static void listener_close(proxy_listener_p listener);
+static void *listener_thread(void *arg);
+static void *client_thread(void *arg);
+static int client_read(proxy_client_p client, int wait_ms);
+static int client_process_packets(proxy_client_p client);
+static int client_handle_packet(proxy_client_p client, uint8_t *pkt, int pkt_len);
+static int client_handle_unconnected(proxy_client_p client, uint8_t *pkt, int pkt_len);
+static int client_check_pending(proxy_client_p client);
+static int client_send_reply(proxy_client_p client, struct proxy_pending_t *pending);
+static int client_send_cip_error(proxy_client_p client, uint64_le sender_context, uint8_t service, uint8_t status);
+static int client_send_uc_reply(proxy_client_p client, uint64_le sender_context, uint8_t *cip, int cip_len);
+static int client_send_encap_error(proxy_client_p client, eip_encap *encap, uint32_t status);
+static int client_send(proxy_client_p client, uint8_t *data, int size);
+static void client_abort_pending(proxy_client_p client);
+
+
+
+int main(int argc, char **argv)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int first_spec = 1;
+    struct sigaction act;
+
+    if(argc > 2 && strcmp(argv[1], "-d") == 0) {
+        set_debug_level(atoi(argv[2]));
+        first_spec = 3;
+    }
+
+    if(first_spec >= argc) {
+        usage();
+        return 1;
+    }
+
+    if((argc - first_spec) > PROXY_MAX_LISTENERS) {
+        fprintf(stderr, "At most %d PLCs can be proxied.\n", PROXY_MAX_LISTENERS);
+        return 1;
+    }
+
+    mem_set(&act, 0, sizeof(act));
+    act.sa_handler = handle_signal;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to initialize the library, %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    next_session_handle = (uint32_t)rand();
+
+    for(int i = first_spec; i < argc; i++) {
+        proxy_listener_p listener = &listeners[num_listeners];
+
+        mem_set(listener, 0, sizeof(*listener));
+        listener->fd = -1;
+
+        listener->attribs = attr_create_from_str(argv[i]);
+        if(!listener->attribs) {
+            fprintf(stderr, "Unable to parse \"%s\"!\n", argv[i]);
+            rc = PLCTAG_ERR_BAD_PARAM;
+            break;
+        }
+
+        num_listeners++;
+
+        listener->listen_spec = attr_get_str(listener->attribs, "listen", NULL);
+        if(!listener->listen_spec || !attr_get_str(listener->attribs, "gateway", NULL)) {
+            fprintf(stderr, "Both listen and gateway are required in \"%s\"!\n", argv[i]);
+            rc = PLCTAG_ERR_BAD_PARAM;
+            break;
+        }
+
+        if(get_plc_type(listener->attribs) == AB_PROTOCOL_LGX_PCCC) {
+            fprintf(stderr, "PCCC-mapped Logix tags cannot be proxied!\n");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        listener->allow_packing = attr_get_int(listener->attribs, "allow_packing", 1);
+
+        /* the whole point is one connection to the PLC for everyone. */
+        attr_set_int(listener->attribs, "use_connected_msg", 1);
+
+        rc = session_find_or_create(&listener->session, listener->attribs);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to create session for \"%s\", %s!\n", argv[i], plc_tag_decode_error(rc));
+            break;
+        }
+
+        rc = listener_open(listener);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to listen on %s, %s!\n", listener->listen_spec, plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(pthread_create(&listener->thread, NULL, listener_thread, listener)) {
+            fprintf(stderr, "Unable to start listener thread for %s!\n", listener->listen_spec);
+            listener_close(listener);
+            rc = PLCTAG_ERR_CREATE;
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        terminating = 1;
+    }
+
+    while(!terminating) {
+        sleep_ms(PROXY_IDLE_WAIT_MS);
+    }
+
+    pdebug(DEBUG_INFO, "Shutting down.");
+
+    for(int i = 0; i < num_listeners; i++) {
+        if(listeners[i].fd >= 0) {
+            pthread_join(listeners[i].thread, NULL);
+            listener_close(&listeners[i]);
+        }
+    }
+
+    /* client threads see the terminating flag and leave. */
+    for(;;) {
+        int remaining = 0;
+
+        pthread_mutex_lock(&client_mutex);
+        remaining = num_clients;
+        pthread_mutex_unlock(&client_mutex);
+
+        if(!remaining) {
+            break;
+        }
+
+        sleep_ms(PROXY_BUSY_WAIT_MS);
+    }
+
+    for(int i = 0; i < num_listeners; i++) {
+        if(listeners[i].session) {
+            listeners[i].session = rc_dec(listeners[i].session);
+        }
+
+        attr_destroy(listeners[i].attribs);
+    }
+
+    return (rc == PLCTAG_STATUS_OK ? 0 : 1);
+}
+
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_proxy [-d <debug level>] <PLC> [<PLC> ...]\n"
+                    "\n"
+                    "Each PLC is an attribute string like a tag's, with where to listen:\n"
+                    "\n"
+                    "  \"listen=unix:/tmp/plc1.sock&gateway=10.1.2.3&path=1,0&cpu=lgx\"\n"
+                    "  \"listen=127.0.0.1:44819&gateway=10.1.2.3&path=1,0&cpu=lgx\"\n"
+                    "\n"
+                    "Session attributes such as batch_window_us and read_coalesce_gap apply\n"
+                    "to the shared session.  allow_packing=0 turns off request packing.\n"
+                    "\n"
+                    "Clients add proxy=unix:/tmp/plc1.sock or proxy=127.0.0.1:44819 to their tags.\n");
+}
+
+
+
+void handle_signal(int sig)
+{
+    (void)sig;
+
+    terminating = 1;
+}
+
+
+
+/*
+ * listener_open
+ *
+ * Bind and listen on the local socket or the loopback address and port
+ * in the listen attribute.
+ */
+
+int listener_open(proxy_listener_p listener)
+{
+    const char *spec = listener->listen_spec;
+    int fd = -1;
+    int sock_opt = 1;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        struct stat path_stat;
+        const char *path = spec + 5;
+
+        if(str_length(path) <= 0 || str_length(path) >= (int)sizeof(addr.sun_path)) {
+            pdebug(DEBUG_WARN, "Local socket path \"%s\" is empty or too long!", path);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        /* a socket file left over from an earlier run would stop bind(), anything else is not ours. */
+        if(lstat(path, &path_stat) == 0) {
+            if(!S_ISSOCK(path_stat.st_mode)) {
+                pdebug(DEBUG_WARN, "Local socket path \"%s\" exists and is not a socket!", path);
+                return PLCTAG_ERR_DUPLICATE;
+            }
+
+            if(unlink(path) != 0) {
+                pdebug(DEBUG_WARN, "Unable to remove old socket file %s, errno: %d", path, errno);
+                return PLCTAG_ERR_OPEN;
+            }
+        } else if(errno != ENOENT) {
+            pdebug(DEBUG_WARN, "Unable to check local socket path %s, errno: %d", path, errno);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) {
+            pdebug(DEBUG_ERROR, "Unable to create socket, errno: %d", errno);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        mem_set(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path, (size_t)str_length(path));
+
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            pdebug(DEBUG_WARN, "Unable to bind to %s, errno: %d", path, errno);
+            close(fd);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        listener->unix_path = str_dup(path);
+    } else {
+        struct sockaddr_in addr;
+        char *host = str_dup(spec);
+        char *colon = NULL;
+        int port = AB_EIP_DEFAULT_PORT;
+
+        if(!host) {
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        colon = strchr(host, ':');
+        if(colon) {
+            *colon = 0;
+
+            if(str_to_int(colon + 1, &port) != 0 || port <= 0 || port > 65535) {
+                pdebug(DEBUG_WARN, "Port in \"%s\" is not valid!", spec);
+                mem_free(host);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+        }
+
+        mem_set(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+
+        if(inet_pton(AF_INET, host, &addr.sin_addr) <= 0 || (ntohl(addr.sin_addr.s_addr) >> 24) != 127) {
+            pdebug(DEBUG_WARN, "Only loopback addresses are allowed, not \"%s\"!", host);
+            mem_free(host);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        mem_free(host);
+
+        fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if(fd < 0) {
+            pdebug(DEBUG_ERROR, "Unable to create socket, errno: %d", errno);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&sock_opt, sizeof(sock_opt));
+
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            pdebug(DEBUG_WARN, "Unable to bind to %s, errno: %d", spec, errno);
+            close(fd);
+            return PLCTAG_ERR_OPEN;
+        }
+    }
+
+    if(listen(fd, PROXY_BACKLOG) < 0) {
+        pdebug(DEBUG_WARN, "Unable to listen on %s, errno: %d", spec, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    listener->fd = fd;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void listener_close(proxy_listener_p listener)
+{
+    if(listener->fd >= 0) {
+        close(listener->fd);
+        listener->fd = -1;
+    }
+
+    if(listener->unix_path) {
+        unlink(listener->unix_path);
+        mem_free(listener->unix_path);
+        listener->unix_path = NULL;
+    }
+}
+
+
+
+void *listener_thread(void *arg)
+{
+    proxy_listener_p listener = (proxy_listener_p)arg;
+
+    pdebug(DEBUG_INFO, "Listening on %s.", listener->listen_spec);
+
+    while(!terminating) {
+        struct pollfd pfd;
+        proxy_client_p client = NULL;
+        pthread_t thread;
+        int fd = -1;
+
+        pfd.fd = listener->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if(poll(&pfd, 1, PROXY_IDLE_WAIT_MS) <= 0) {
+            continue;
+        }
+
+        fd = accept(listener->fd, NULL, NULL);
+        if(fd < 0) {
+            pdebug(DEBUG_WARN, "Error accepting connection, errno: %d", errno);
+            continue;
+        }
+
+        client = (proxy_client_p)mem_alloc((int)sizeof(*client));
+        if(!client) {
+            pdebug(DEBUG_WARN, "Unable to allocate client!");
+            close(fd);
+            continue;
+        }
+
+        client->fd = fd;
+        client->listener = listener;
+        client->session = rc_inc(listener->session);
+
+        pthread_mutex_lock(&client_mutex);
+        client->session_handle = ++next_session_handle;
+        num_clients++;
+        pthread_mutex_unlock(&client_mutex);
+
+        if(pthread_create(&thread, NULL, client_thread, client)) {
+            pdebug(DEBUG_WARN, "Unable to start client thread!");
+
+            pthread_mutex_lock(&client_mutex);
+            num_clients--;
+            pthread_mutex_unlock(&client_mutex);
+
+            rc_dec(client->session);
+            close(fd);
+            mem_free(client);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    pdebug(DEBUG_INFO, "Done listening on %s.", listener->listen_spec);
+
+    return NULL;
+}
+
+
+
+/*
+ * client_thread
+ *
+ * Read requests from one client and hand them to the shared session.
+ * Send each reply back as soon as the session has it.
+ */
+
+void *client_thread(void *arg)
+{
+    proxy_client_p client = (proxy_client_p)arg;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Client %u connected on %s.", client->session_handle, client->listener->listen_spec);
+
+    while(!terminating && !client->closing && rc == PLCTAG_STATUS_OK) {
+        /* do not take more requests until we have room for them. */
+        if(client->num_pending < PROXY_MAX_PENDING) {
+            rc = client_read(client, (client->num_pending ? PROXY_BUSY_WAIT_MS : PROXY_IDLE_WAIT_MS));
+        } else {
+            sleep_ms(PROXY_BUSY_WAIT_MS);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = client_process_packets(client);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = client_check_pending(client);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Client %u disconnected.", client->session_handle);
+
+    client_abort_pending(client);
+
+    close(client->fd);
+    rc_dec(client->session);
+    mem_free(client);
+
+    pthread_mutex_lock(&client_mutex);
+    num_clients--;
+    pthread_mutex_unlock(&client_mutex);
+
+    return NULL;
+}
+
+
+
+int client_read(proxy_client_p client, int wait_ms)
+{
+    struct pollfd pfd;
+    int rc = 0;
+
+    pfd.fd = client->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    rc = poll(&pfd, 1, wait_ms);
+    if(rc < 0) {
+        return (errno == EINTR ? PLCTAG_STATUS_OK : PLCTAG_ERR_READ);
+    }
+
+    if(rc == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    rc = (int)recv(client->fd, client->buf + client->buf_used, (size_t)(PROXY_BUF_SIZE - client->buf_used), 0);
+    if(rc <= 0) {
+        /* zero is an orderly shutdown by the client. */
+        return PLCTAG_ERR_READ;
+    }
+
+    client->buf_used += rc;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int client_process_packets(proxy_client_p client)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    while(!client->closing && client->num_pending < PROXY_MAX_PENDING && client->buf_used >= (int)sizeof(eip_encap)) {
+        eip_encap *encap = (eip_encap *)client->buf;
+        int pkt_len = (int)sizeof(eip_encap) + (int)le2h16(encap->encap_length);
+
+        if(pkt_len > PROXY_BUF_SIZE) {
+            pdebug(DEBUG_WARN, "Client packet of %d bytes is too large!", pkt_len);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        if(client->buf_used < pkt_len) {
+            break;
+        }
+
+        rc = client_handle_packet(client, client->buf, pkt_len);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        client->buf_used -= pkt_len;
+        memmove(client->buf, client->buf + pkt_len, (size_t)client->buf_used);
+    }
+
+    return rc;
+}
+
+
+
+int client_handle_packet(proxy_client_p client, uint8_t *pkt, int pkt_len)
+{
+    eip_encap *encap = (eip_encap *)pkt;
+    uint16_t command = le2h16(encap->encap_command);
+
+    pdebug(DEBUG_DETAIL, "Client %u sent command %x.", client->session_handle, (int)command);
+
+    switch(command) {
+    case AB_EIP_REGISTER_SESSION:
+        if(pkt_len != (int)sizeof(eip_session_reg_req)) {
+            return client_send_encap_error(client, encap, AB_EIP_ERR_INVALID_LENGTH);
+        }
+
+        client->registered = 1;
+        encap->encap_session_handle = h2le32(client->session_handle);
+        encap->encap_status = h2le32(AB_EIP_OK);
+
+        return client_send(client, pkt, pkt_len);
+
+    case AB_EIP_UNREGISTER_SESSION:
+        client->closing = 1;
+        return PLCTAG_STATUS_OK;
+
+    case AB_EIP_UNCONNECTED_SEND:
+        if(!client->registered || le2h32(encap->encap_session_handle) != client->session_handle) {
+            return client_send_encap_error(client, encap, AB_EIP_ERR_INVALID_SESSION);
+        }
+
+        return client_handle_unconnected(client, pkt, pkt_len);
+
+    default:
+        pdebug(DEBUG_WARN, "Unsupported command %x from client %u.", (int)command, client->session_handle);
+        return client_send_encap_error(client, encap, AB_EIP_ERR_INVALID_COMMAND);
+    }
+}
+
+
+
+/*
+ * client_handle_unconnected
+ *
+ * Take the CIP request out of the client's unconnected message and
+ * queue it on the shared session as a connected request.  Requests
+ * wrapped in an Unconnected Send to the Connection Manager are
+ * unwrapped.  The client's route is ignored, the session has its own.
+ */
+
+int client_handle_unconnected(proxy_client_p client, uint8_t *pkt, int pkt_len)
+{
+    eip_cip_uc_req *uc = (eip_cip_uc_req *)pkt;
+    uint8_t *pkt_end = pkt + pkt_len;
+    uint8_t *cip = &uc->cm_service_code;
+    int cip_len = 0;
+    ab_request_p req = NULL;
+    eip_cip_co_req *co = NULL;
+    struct proxy_pending_t *pending = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(pkt_len < (int)offsetof(eip_cip_uc_req, cm_service_code) + 1
+       || le2h16(uc->cpf_item_count) != 2
+       || le2h16(uc->cpf_nai_item_type) != AB_EIP_ITEM_NAI
+       || le2h16(uc->cpf_udi_item_type) != AB_EIP_ITEM_UDI
+       || cip + le2h16(uc->cpf_udi_item_length) > pkt_end) {
+        pdebug(DEBUG_WARN, "Malformed unconnected message from client %u!", client->session_handle);
+        return client_send_encap_error(client, (eip_encap *)pkt, AB_EIP_ERR_INVALID_LENGTH);
+    }
+
+    cip_len = le2h16(uc->cpf_udi_item_length);
+
+    if(uc->cm_service_code == AB_EIP_CMD_UNCONNECTED_SEND && pkt_len >= (int)sizeof(eip_cip_uc_req)
+       && uc->cm_req_path[0] == 0x20 && uc->cm_req_path[1] == 0x06) {
+        cip = pkt + sizeof(eip_cip_uc_req);
+        cip_len = le2h16(uc->uc_cmd_length);
+
+        if(cip + cip_len > pkt_end) {
+            pdebug(DEBUG_WARN, "Embedded request from client %u runs past the end of the packet!", client->session_handle);
+            return client_send_encap_error(client, (eip_encap *)pkt, AB_EIP_ERR_INVALID_LENGTH);
+        }
+    }
+
+    if(cip_len <= 0) {
+        return client_send_encap_error(client, (eip_encap *)pkt, AB_EIP_ERR_INVALID_LENGTH);
+    }
+
+    rc = session_create_request(client->session, (int)client->session_handle, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if((int)sizeof(eip_cip_co_req) + cip_len > req->request_capacity) {
+        pdebug(DEBUG_WARN, "Request of %d bytes from client %u is too large for the PLC connection!", cip_len, client->session_handle);
+        rc_dec(req);
+        return client_send_cip_error(client, uc->encap_sender_context, cip[0], AB_CIP_ERR_TOO_MUCH_DATA);
+    }
+
+    co = (eip_cip_co_req *)(req->data);
+
+    co->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+    co->router_timeout = h2le16(0);            /* zero for connected sends */
+    co->cpf_item_count = h2le16(2);            /* ALWAYS 2 */
+    co->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+    co->cpf_cai_item_length = h2le16(4);       /* ALWAYS 4, size of connection ID*/
+    co->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    co->cpf_cdi_item_length = h2le16((uint16_t)(cip_len + (int)sizeof(co->cpf_conn_seq_num)));
+
+    mem_copy(req->data + sizeof(eip_cip_co_req), cip, cip_len);
+
+    req->request_size = (int)sizeof(eip_cip_co_req) + cip_len;
+
+    /* a Multiple Service request cannot be packed into another one. */
+    req->allow_packing = (client->listener->allow_packing && cip[0] != AB_EIP_CMD_CIP_MULTI);
+
+    pending = &client->pending[client->num_pending];
+    pending->req = req;
+    pending->sender_context = uc->encap_sender_context;
+    pending->service = cip[0];
+
+    rc = session_add_request(client->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue request, %s!", plc_tag_decode_error(rc));
+        rc_dec(req);
+        return client_send_cip_error(client, uc->encap_sender_context, cip[0], AB_CIP_ERR_CONNECTION_FAILURE);
+    }
+
+    client->num_pending++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int client_check_pending(proxy_client_p client)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int i = 0;
+
+    while(i < client->num_pending) {
+        ab_request_p req = client->pending[i].req;
+        int done = 0;
+
+        spin_block(&req->lock) {
+            done = req->resp_received;
+        }
+
+        if(!done) {
+            i++;
+            continue;
+        }
+
+        rc = client_send_reply(client, &client->pending[i]);
+
+        req->abort_request = 1;
+        rc_dec(req);
+
+        client->num_pending--;
+        memmove(&client->pending[i], &client->pending[i+1], sizeof(client->pending[0]) * (size_t)(client->num_pending - i));
+
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * client_send_reply
+ *
+ * The session leaves a connected reply in the request buffer.  Send
+ * the CIP part of it back to the client as an unconnected reply.
+ */
+
+int client_send_reply(proxy_client_p client, struct proxy_pending_t *pending)
+{
+    ab_request_p req = pending->req;
+    eip_encap *encap = (eip_encap *)(req->data);
+    uint8_t *cip = NULL;
+    int cip_len = 0;
+
+    if(req->status != PLCTAG_STATUS_OK || req->request_size < (int)sizeof(eip_encap) || le2h32(encap->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "Request from client %u failed, %s!", client->session_handle, plc_tag_decode_error(req->status));
+        return client_send_cip_error(client, pending->sender_context, pending->service, AB_CIP_ERR_CONNECTION_FAILURE);
+    }
+
+    if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
+        cip = &((eip_cip_co_resp *)(req->data))->reply_service;
+    } else {
+        cip = &((eip_cip_uc_resp *)(req->data))->reply_service;
+    }
+
+    cip_len = req->request_size - (int)(cip - req->data);
+    if(cip_len <= 0) {
+        pdebug(DEBUG_WARN, "Reply for client %u is too short!", client->session_handle);
+        return client_send_cip_error(client, pending->sender_context, pending->service, AB_CIP_ERR_CONNECTION_FAILURE);
+    }
+
+    return client_send_uc_reply(client, pending->sender_context, cip, cip_len);
+}
+
+
+
+int client_send_cip_error(proxy_client_p client, uint64_le sender_context, uint8_t service, uint8_t status)
+{
+    uint8_t cip[4];
+
+    cip[0] = (uint8_t)(service | AB_EIP_CMD_CIP_OK);
+    cip[1] = 0;
+    cip[2] = status;
+    cip[3] = 0;
+
+    return client_send_uc_reply(client, sender_context, cip, (int)sizeof(cip));
+}
+
+
+
+int client_send_uc_reply(proxy_client_p client, uint64_le sender_context, uint8_t *cip, int cip_len)
+{
+    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)client->out;
+    int total = (int)offsetof(eip_cip_uc_resp, reply_service) + cip_len;
+
+    if(total > PROXY_BUF_SIZE) {
+        pdebug(DEBUG_WARN, "Reply of %d bytes is too large!", total);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_set(resp, 0, (int)sizeof(*resp));
+
+    resp->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    resp->encap_length = h2le16((uint16_t)(total - (int)sizeof(eip_encap)));
+    resp->encap_session_handle = h2le32(client->session_handle);
+    resp->encap_status = h2le32(AB_EIP_OK);
+    resp->encap_sender_context = sender_context;
+    resp->cpf_item_count = h2le16(2);
+    resp->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    resp->cpf_nai_item_length = h2le16(0);
+    resp->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    resp->cpf_udi_item_length = h2le16((uint16_t)cip_len);
+
+    mem_copy(&resp->reply_service, cip, cip_len);
+
+    return client_send(client, client->out, total);
+}
+
+
+
+int client_send_encap_error(proxy_client_p client, eip_encap *encap, uint32_t status)
+{
+    eip_encap resp;
+
+    resp = *encap;
+    resp.encap_length = h2le16(0);
+    resp.encap_status = h2le32(status);
+
+    return client_send(client, (uint8_t *)&resp, (int)sizeof(resp));
+}
+
+
+
+int client_send(proxy_client_p client, uint8_t *data, int size)
+{
+    int sent = 0;
+
+    while(sent < size) {
+        int rc = (int)send(client->fd, data + sent, (size_t)(size - sent), MSG_NOSIGNAL);
+
+        if(rc < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            pdebug(DEBUG_WARN, "Error sending to client %u, errno: %d", client->session_handle, errno);
+            return PLCTAG_ERR_WRITE;
+        }
+
+        sent += rc;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void client_abort_pending(proxy_client_p client)
+{
+    for(int i = 0; i < client->num_pending; i++) {
+        client->pending[i].req->abort_request = 1;
+        rc_dec(client->pending[i].req);
+    }
+
+    client->num_pending = 0;
+}
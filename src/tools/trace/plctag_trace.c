@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plctag_trace
+ *
+ * Print the events in a trace file written by plc_tag_trace_start().
+ *
+ *   plctag_trace trace.bin
+ *
+ * Each thread's events are written in batches, so the events are sorted
+ * by time before printing.  The file must come from a host with the
+ * same byte order.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_trace <trace file>\n");
+}
+
+
+
+static int compare_records(const void *a, const void *b)
+{
+    const trace_record_t *ra = a;
+    const trace_record_t *rb = b;
+
+    if(ra->time_us < rb->time_us) {
+        return -1;
+    }
+
+    return (ra->time_us > rb->time_us ? 1 : 0);
+}
+
+
+
+int main(int argc, char **argv)
+{
+    FILE *in = NULL;
+    trace_file_header_t header;
+    trace_record_t *records = NULL;
+    size_t capacity = 0;
+    size_t count = 0;
+    char line[256];
+
+    if(argc != 2) {
+        usage();
+        return 1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if(!in) {
+        fprintf(stderr, "Unable to open %s!\n", argv[1]);
+        return 1;
+    }
+
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a trace file!\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    if(header.version != TRACE_FILE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Unsupported trace file version %u with record size %u!\n", header.version, header.record_size);
+        fclose(in);
+        return 1;
+    }
+
+    for(;;) {
+        if(count == capacity) {
+            trace_record_t *new_records = NULL;
+
+            capacity = (capacity ? capacity * 2 : 4096);
+            new_records = realloc(records, capacity * sizeof(trace_record_t));
+
+            if(!new_records) {
+                fprintf(stderr, "Out of memory!\n");
+                free(records);
+                fclose(in);
+                return 1;
+            }
+
+            records = new_records;
+        }
+
+        if(fread(&records[count], sizeof(trace_record_t), 1, in) != 1) {
+            break;
+        }
+
+        count++;
+    }
+
+    fclose(in);
+
+    qsort(records, count, sizeof(trace_record_t), compare_records);
+
+    for(size_t i=0; i < count; i++) {
+        trace_format_record(&records[i], header.start_wall_us - header.start_mono_us, line, (int)sizeof(line));
+        printf("%s\n", line);
+    }
+
+    free(records);
+
+    fprintf(stderr, "%lu events.\n", (unsigned long)count);
+
+    return 0;
+}
@@ -52,6 +52,50 @@ static THREAD_LOCAL int tag_id = 0;
 static lock_t printed_version = LOCK_INIT;
 
 
+/*
+ * Log callback support.
+ *
+ * When the application registers a callback, messages are formatted
+ * on the calling thread and put in a bounded queue instead of being
+ * written to stderr.  A separate thread calls the callback, so a slow
+ * callback never holds up the session threads.  If the queue is full
+ * the message is dropped and counted.
+ */
+
+#define LOG_QUEUE_SIZE (1024)
+#define LOG_MESSAGE_SIZE (256)
+#define LOG_DRAIN_PERIOD_MS (5)
+
+typedef struct {
+    int level;
+    const char *func;
+    int line_num;
+    int tag_id;
+    char message[LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+/* log_callback routes the messages, log_sink is what the thread calls. */
+static volatile plc_tag_log_callback_func log_callback = NULL;
+static volatile plc_tag_log_callback_func log_sink = NULL;
+
+/* the queue is never freed, late messages can still land in it. */
+static lock_t log_queue_lock = LOCK_INIT;
+static log_entry_t log_queue[LOG_QUEUE_SIZE];
+static uint32_t log_head = 0;
+static uint32_t log_tail = 0;
+static uint32_t log_dropped = 0;
+static uint32_t log_dropped_reported = 0;
+
+/* register and unregister are serialized by this. */
+static lock_t log_control_lock = LOCK_INIT;
+static thread_p log_thread = NULL;
+static volatile int log_terminating = 0;
+
+static void log_enqueue(int level, const char *func, int line_num, const char *message);
+static void log_drain(plc_tag_log_callback_func callback);
+static THREAD_FUNC(log_thread_func);
+
+
 
 extern int set_debug_level(int level)
 {
@@ -77,7 +121,7 @@ void debug_set_tag_id(int t_id)
 
 
 
-static uint32_t get_thread_id()
+uint32_t debug_get_thread_id(void)
 {
     if(!this_thread_num) {
         spin_block(&thread_num_lock) {
@@ -114,7 +158,7 @@ static int make_prefix(char *prefix_buf, int prefix_buf_size)
 
     /* create the prefix and format for the file entry. */
     rc = snprintf(prefix_buf, (size_t)prefix_buf_size,"%04d-%02d-%02d %02d:%02d:%02d.%03d thread(%u) tag(%d)",
-                  t.tm_year+1900,t.tm_mon,t.tm_mday,t.tm_hour,t.tm_min,t.tm_sec,remainder_ms, get_thread_id(), tag_id);
+                  t.tm_year+1900,t.tm_mon,t.tm_mday,t.tm_hour,t.tm_min,t.tm_sec,remainder_ms, debug_get_thread_id(), tag_id);
 
     /* enforce zero string termination */
     if(rc > 1 && rc < prefix_buf_size) {
@@ -136,6 +180,24 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
     char prefix[48]; /* MAGIC */
     int prefix_size;
 
+    /* the application gets the parts, not the formatted line. */
+    if(log_callback) {
+        if(!printed_version && debug_level >= DEBUG_INFO) {
+            if(lock_acquire_try((lock_t*)&printed_version)) {
+                snprintf(output, sizeof(output), "libplctag version %s", VERSION);
+                log_enqueue(DEBUG_INFO, __func__, __LINE__, output);
+            }
+        }
+
+        va_start(va,templ);
+        vsnprintf(output, LOG_MESSAGE_SIZE, templ, va);
+        va_end(va);
+
+        log_enqueue(debug_level, func, line_num, output);
+
+        return;
+    }
+
     /* build the prefix */
     prefix_size = make_prefix(prefix,(int)sizeof(prefix));  /* don't exceed a size that int can express! */
     if(prefix_size <= 0) {
@@ -175,11 +237,16 @@ extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_lev
     int prefix_size;
     char row_buf[300]; /* MAGIC */
 
-    /* build the prefix */
-    prefix_size = make_prefix(prefix,(int)sizeof(prefix));
+    /* the application gets each row as a message. */
+    if(log_callback) {
+        prefix[0] = 0;
+    } else {
+        /* build the prefix */
+        prefix_size = make_prefix(prefix,(int)sizeof(prefix));
 
-    if(prefix_size <= 0) {
-        return;
+        if(prefix_size <= 0) {
+            return;
+        }
     }
 
     /* determine the number of rows we will need to print. */
@@ -190,7 +257,11 @@ extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_lev
         int row_offset;
 
         /* print the prefix and address */
-        row_offset = snprintf(&row_buf[0], sizeof(row_buf),"%s %s %s:%d %05d", prefix, debug_level_name[debug_level], func, line_num, offset);
+        if(log_callback) {
+            row_offset = snprintf(&row_buf[0], sizeof(row_buf),"%05d", offset);
+        } else {
+            row_offset = snprintf(&row_buf[0], sizeof(row_buf),"%s %s %s:%d %05d", prefix, debug_level_name[debug_level], func, line_num, offset);
+        }
 
         for(column = 0; column < COLUMNS && ((row * COLUMNS) + column) < count && row_offset < (int)sizeof(row_buf); column++) {
             offset = (row * COLUMNS) + column;
@@ -201,9 +272,177 @@ extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_lev
         row_buf[sizeof(row_buf)-1] = 0; /* just in case */
 
         /* output it, finally */
-        fprintf(stderr,"%s\n",row_buf);
+        if(log_callback) {
+            log_enqueue(debug_level, func, line_num, row_buf);
+        } else {
+            fprintf(stderr,"%s\n",row_buf);
+        }
     }
 
 
     /*fflush(stderr);*/
 }
+
+
+
+
+/*
+ * debug_register_logger
+ *
+ * Send the debug output to the callback instead of stderr.  Registering
+ * again replaces the callback.
+ */
+
+int debug_register_logger(plc_tag_log_callback_func callback)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!callback) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    spin_block(&log_control_lock) {
+        if(log_thread) {
+            log_sink = callback;
+            log_callback = callback;
+            break;
+        }
+
+        /* forget anything left from an earlier callback. */
+        spin_block(&log_queue_lock) {
+            log_tail = log_head;
+            log_dropped_reported = log_dropped;
+        }
+
+        log_terminating = 0;
+        log_sink = callback;
+
+        rc = thread_create(&log_thread, log_thread_func, 32*1024, NULL);
+        if(rc != PLCTAG_STATUS_OK) {
+            log_thread = NULL;
+            log_sink = NULL;
+            break;
+        }
+
+        log_callback = callback;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * debug_unregister_logger
+ *
+ * Deliver what is queued and go back to stderr.
+ */
+
+int debug_unregister_logger(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    spin_block(&log_control_lock) {
+        if(!log_thread) {
+            rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        log_callback = NULL;
+
+        log_terminating = 1;
+        thread_join(log_thread);
+        thread_destroy(&log_thread);
+        log_thread = NULL;
+
+        log_drain(log_sink);
+        log_sink = NULL;
+    }
+
+    return rc;
+}
+
+
+
+void log_enqueue(int level, const char *func, int line_num, const char *message)
+{
+    spin_block(&log_queue_lock) {
+        log_entry_t *entry = NULL;
+
+        if(log_head - log_tail >= LOG_QUEUE_SIZE) {
+            log_dropped++;
+            break;
+        }
+
+        entry = &log_queue[log_head % LOG_QUEUE_SIZE];
+
+        entry->level = level;
+        entry->func = func;
+        entry->line_num = line_num;
+        entry->tag_id = tag_id;
+
+        strncpy(entry->message, message, LOG_MESSAGE_SIZE - 1);
+        entry->message[LOG_MESSAGE_SIZE - 1] = 0;
+
+        log_head++;
+    }
+}
+
+
+
+/*
+ * log_drain
+ *
+ * Call the callback for each queued message, outside the queue lock.
+ */
+
+void log_drain(plc_tag_log_callback_func callback)
+{
+    log_entry_t entry;
+    uint32_t dropped = 0;
+    int have_entry = 0;
+
+    do {
+        have_entry = 0;
+
+        spin_block(&log_queue_lock) {
+            if(log_tail != log_head) {
+                entry = log_queue[log_tail % LOG_QUEUE_SIZE];
+                log_tail++;
+                have_entry = 1;
+            }
+        }
+
+        if(have_entry && callback) {
+            callback(entry.level, entry.func, entry.line_num, entry.tag_id, entry.message);
+        }
+    } while(have_entry);
+
+    spin_block(&log_queue_lock) {
+        dropped = log_dropped - log_dropped_reported;
+        log_dropped_reported = log_dropped;
+    }
+
+    if(dropped && callback) {
+        char message[64];
+
+        snprintf(message, sizeof(message), "Dropped %u log messages, the queue was full.", dropped);
+
+        callback(DEBUG_WARN, __func__, __LINE__, 0, message);
+    }
+}
+
+
+
+THREAD_FUNC(log_thread_func)
+{
+    (void)arg;
+
+    while(!log_terminating) {
+        log_drain(log_sink);
+
+        sleep_ms(LOG_DRAIN_PERIOD_MS);
+    }
+
+    THREAD_RETURN(0);
+}
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <lib/libplctag.h>
+
 #define DEBUG_NONE      (0)
 #define DEBUG_ERROR     (1)
 #define DEBUG_WARN      (2)
@@ -38,6 +40,10 @@
 extern int set_debug_level(int debug_level);
 extern int get_debug_level(void);
 extern void debug_set_tag_id(int tag_id);
+extern uint32_t debug_get_thread_id(void);
+
+extern int debug_register_logger(plc_tag_log_callback_func callback);
+extern int debug_unregister_logger(void);
 
 extern void pdebug_impl(const char *func, int line_num, int debug_level, const char *templ, ...);
 /*#if defined(USE_STD_VARARG_MACROS) || defined(_WIN32)
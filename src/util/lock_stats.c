@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * lock_stats.c
+ *
+ * Lock contention counters for builds with PLCTAG_LOCK_STATS defined.
+ *
+ * critical_block() and spin_block() call these instead of locking
+ * directly.  Each lock is named by the expression used in the block,
+ * for example "session->mutex" or "&tag->req->lock", so all the locks
+ * of one kind are counted together.  For each name we count how often
+ * it was taken, how often it was already held, how long we waited for
+ * it and how long it was held.  lib_teardown() prints the report.
+ *
+ * The counters are kept per thread so counting does not add contention
+ * of its own.  The report adds up the threads' counters without locking
+ * them, so it can be a little off if threads are still running.
+ */
+
+#include <platform.h>
+
+#ifdef PLCTAG_LOCK_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lib/libplctag.h>
+
+
+#define LOCK_STATS_MAX_NAMES (64)
+#define LOCK_STATS_NAME_WIDTH (36)
+
+struct lock_stat_t {
+    const char *name;
+    uint64_t count;
+    uint64_t contended;
+    int64_t wait_ns;
+    int64_t max_wait_ns;
+    int64_t hold_ns;
+    int64_t max_hold_ns;
+};
+
+typedef struct lock_stats_table_t *lock_stats_table_p;
+
+struct lock_stats_table_t {
+    lock_stats_table_p next;
+    int num_stats;
+    struct lock_stat_t stats[LOCK_STATS_MAX_NAMES];
+};
+
+
+static THREAD_LOCAL lock_stats_table_p this_table = NULL;
+
+/* tables are never freed, threads that exit still count. */
+static lock_t table_list_lock = LOCK_INIT;
+static lock_stats_table_p table_list = NULL;
+
+static struct lock_stat_t overflow_stat = { "(other)", 0, 0, 0, 0, 0, 0 };
+
+
+static struct lock_stat_t *find_stat(const char *name);
+static void count_wait(struct lock_stat_t *stat, int64_t wait_ns);
+static void count_hold(struct lock_stat_t *stat, int64_t held_start);
+static void merge_stat(struct lock_stat_t *totals, int *num_totals, int max_totals, struct lock_stat_t *stat);
+static int compare_stats(const void *a, const void *b);
+
+
+
+
+int lock_stats_mutex_lock(mutex_p m, const char *name, int64_t *held_start)
+{
+    struct lock_stat_t *stat = find_stat(name);
+    int rc = mutex_try_lock(m);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        int64_t wait_start = time_mono_ns();
+
+        rc = mutex_lock(m);
+
+        count_wait(stat, time_mono_ns() - wait_start);
+    }
+
+    stat->count++;
+
+    *held_start = time_mono_ns();
+
+    return rc;
+}
+
+
+
+int lock_stats_mutex_unlock(mutex_p m, const char *name, int64_t held_start)
+{
+    count_hold(find_stat(name), held_start);
+
+    return mutex_unlock(m);
+}
+
+
+
+int lock_stats_acquire(lock_t *lock, const char *name, int64_t *held_start)
+{
+    struct lock_stat_t *stat = find_stat(name);
+    int rc = lock_acquire_try(lock);
+
+    if(!rc) {
+        int64_t wait_start = time_mono_ns();
+
+        rc = lock_acquire(lock);
+
+        count_wait(stat, time_mono_ns() - wait_start);
+    }
+
+    stat->count++;
+
+    *held_start = time_mono_ns();
+
+    return rc;
+}
+
+
+
+void lock_stats_release(lock_t *lock, const char *name, int64_t held_start)
+{
+    count_hold(find_stat(name), held_start);
+
+    lock_release(lock);
+}
+
+
+
+/*
+ * lock_stats_report
+ *
+ * Print the counters of all threads added up by lock name, the locks
+ * waited on longest first.
+ */
+
+void lock_stats_report(void)
+{
+    struct lock_stat_t totals[LOCK_STATS_MAX_NAMES + 1];
+    int num_totals = 0;
+    lock_stats_table_p table = NULL;
+
+    lock_acquire(&table_list_lock);
+    table = table_list;
+    lock_release(&table_list_lock);
+
+    /* tables are only added at the front, so this is safe without the lock. */
+    for(; table; table = table->next) {
+        for(int i=0; i < table->num_stats; i++) {
+            merge_stat(totals, &num_totals, LOCK_STATS_MAX_NAMES, &table->stats[i]);
+        }
+    }
+
+    if(overflow_stat.count) {
+        totals[num_totals++] = overflow_stat;
+    }
+
+    qsort(totals, (size_t)num_totals, sizeof(totals[0]), compare_stats);
+
+    fprintf(stderr, "\nlibplctag lock contention report\n");
+    fprintf(stderr, "%-*s %12s %12s %12s %12s %12s %12s\n", LOCK_STATS_NAME_WIDTH, "lock",
+            "acquired", "contended", "wait ms", "max wait us", "hold ms", "max hold us");
+
+    for(int i=0; i < num_totals; i++) {
+        struct lock_stat_t *stat = &totals[i];
+
+        fprintf(stderr, "%-*.*s %12llu %12llu %12.3f %12.1f %12.3f %12.1f\n", LOCK_STATS_NAME_WIDTH, LOCK_STATS_NAME_WIDTH, stat->name,
+                (unsigned long long)stat->count, (unsigned long long)stat->contended,
+                (double)stat->wait_ns / 1000000.0, (double)stat->max_wait_ns / 1000.0,
+                (double)stat->hold_ns / 1000000.0, (double)stat->max_hold_ns / 1000.0);
+    }
+
+    fflush(stderr);
+}
+
+
+
+/***** helpers *****/
+
+
+/*
+ * find_stat
+ *
+ * Find the counters for a lock name in this thread's table.  Names are
+ * string constants, so the pointer is compared first.
+ */
+
+struct lock_stat_t *find_stat(const char *name)
+{
+    lock_stats_table_p table = this_table;
+    struct lock_stat_t *stat = NULL;
+
+    if(!table) {
+        table = mem_alloc((int)sizeof(*table));
+
+        if(!table) {
+            return &overflow_stat;
+        }
+
+        /* not spin_block(), that would count this lock. */
+        lock_acquire(&table_list_lock);
+        table->next = table_list;
+        table_list = table;
+        lock_release(&table_list_lock);
+
+        this_table = table;
+    }
+
+    for(int i=0; i < table->num_stats; i++) {
+        if(table->stats[i].name == name) {
+            return &table->stats[i];
+        }
+    }
+
+    if(table->num_stats >= LOCK_STATS_MAX_NAMES) {
+        return &overflow_stat;
+    }
+
+    stat = &table->stats[table->num_stats];
+    stat->name = name;
+    table->num_stats++;
+
+    return stat;
+}
+
+
+
+void count_wait(struct lock_stat_t *stat, int64_t wait_ns)
+{
+    stat->contended++;
+    stat->wait_ns += wait_ns;
+
+    if(wait_ns > stat->max_wait_ns) {
+        stat->max_wait_ns = wait_ns;
+    }
+}
+
+
+
+void count_hold(struct lock_stat_t *stat, int64_t held_start)
+{
+    int64_t hold_ns = time_mono_ns() - held_start;
+
+    stat->hold_ns += hold_ns;
+
+    if(hold_ns > stat->max_hold_ns) {
+        stat->max_hold_ns = hold_ns;
+    }
+}
+
+
+
+void merge_stat(struct lock_stat_t *totals, int *num_totals, int max_totals, struct lock_stat_t *stat)
+{
+    struct lock_stat_t *total = NULL;
+
+    for(int i=0; i < *num_totals; i++) {
+        if(strcmp(totals[i].name, stat->name) == 0) {
+            total = &totals[i];
+            break;
+        }
+    }
+
+    if(!total) {
+        if(*num_totals >= max_totals) {
+            return;
+        }
+
+        total = &totals[*num_totals];
+        memset(total, 0, sizeof(*total));
+        total->name = stat->name;
+        (*num_totals)++;
+    }
+
+    total->count += stat->count;
+    total->contended += stat->contended;
+    total->wait_ns += stat->wait_ns;
+    total->hold_ns += stat->hold_ns;
+
+    if(stat->max_wait_ns > total->max_wait_ns) {
+        total->max_wait_ns = stat->max_wait_ns;
+    }
+
+    if(stat->max_hold_ns > total->max_hold_ns) {
+        total->max_hold_ns = stat->max_hold_ns;
+    }
+}
+
+
+
+int compare_stats(const void *a, const void *b)
+{
+    const struct lock_stat_t *sa = a;
+    const struct lock_stat_t *sb = b;
+
+    if(sa->wait_ns != sb->wait_ns) {
+        return (sa->wait_ns < sb->wait_ns ? 1 : -1);
+    }
+
+    return (sa->count < sb->count ? 1 : (sa->count > sb->count ? -1 : 0));
+}
+
+#endif /* PLCTAG_LOCK_STATS */
@@ -55,8 +55,7 @@
  */
 
 struct refcount_t {
-    lock_t lock;
-    int count;
+    volatile int count;     /* only changed with atomic_cas_int(). */
     const char *function_name;
     int line_num;
     //cleanup_p cleaners;
@@ -107,7 +106,6 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
     }
 
     rc->count = 1;  /* start with a reference count. */
-    rc->lock = LOCK_INIT;
 
     rc->cleanup_func = cleaner_func;
 
@@ -158,16 +156,21 @@ void *rc_inc_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* spin until we have ownership */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count++;
-            count = rc->count;
-            result = data;
-        } else {
-            count = rc->count;
-            result = NULL;
+    /*
+     * bump the count unless it already hit zero.  Once at zero the
+     * clean up is running and the count must stay there.
+     */
+    do {
+        count = rc->count;
+
+        if(count <= 0) {
+            break;
         }
+    } while(!atomic_cas_int(&rc->count, count, count + 1));
+
+    if(count > 0) {
+        count++;
+        result = data;
     }
 
     if(!result) {
@@ -209,15 +212,18 @@ void *rc_dec_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* do this sorta atomically */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count--;
-            count = rc->count;
-        } else {
-            count = rc->count;
+    /* only the caller that takes the count to zero cleans up. */
+    do {
+        count = rc->count;
+
+        if(count <= 0) {
             invalid = 1;
+            break;
         }
+    } while(!atomic_cas_int(&rc->count, count, count - 1));
+
+    if(!invalid) {
+        count--;
     }
 
     if(invalid) {
@@ -0,0 +1,616 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/debug.h>
+#include <util/trace.h>
+
+
+/*
+ * Each thread that traces gets its own ring.  The owning thread is the
+ * only writer of head and dropped, the drain thread is the only writer
+ * of tail.  Rings are never freed while the library runs.  When a
+ * thread exits, it gives up its ring and another thread can take it
+ * over once it is drained.  Rings still held by a thread are not freed
+ * at teardown either.
+ */
+
+#define TRACE_RING_SIZE (1024)    /* must be a power of two */
+#define TRACE_DRAIN_PERIOD_MS (10)
+
+typedef struct trace_ring_t *trace_ring_p;
+
+struct trace_ring_t {
+    trace_ring_p next;
+
+    volatile int in_use;
+
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    /* records lost because the ring was full, and how many we reported. */
+    volatile uint32_t dropped;
+    uint32_t dropped_reported;
+
+    /* stage records waiting for their done record, for JSON output. */
+    trace_record_t stages;
+    trace_record_t wire;
+
+    trace_record_t records[TRACE_RING_SIZE];
+};
+
+typedef enum {
+    TRACE_FORMAT_TEXT,
+    TRACE_FORMAT_BINARY,
+    TRACE_FORMAT_JSON
+} trace_format_t;
+
+
+#define TRACE_EVENT_NAME(id, name, a0, a1, a2) name,
+#define TRACE_EVENT_ARGS(id, name, a0, a1, a2) {a0, a1, a2},
+
+static const char *event_names[] = { TRACE_EVENT_LIST(TRACE_EVENT_NAME) };
+static const char *event_arg_names[][3] = { TRACE_EVENT_LIST(TRACE_EVENT_ARGS) };
+
+
+volatile int trace_enabled = 0;
+
+static THREAD_LOCAL trace_ring_p this_ring = NULL;
+static THREAD_LOCAL int exit_hook_set = 0;
+
+static lock_t ring_list_lock = LOCK_INIT;
+static trace_ring_p ring_list = NULL;
+
+/* start and stop are serialized by this. */
+static lock_t trace_control_lock = LOCK_INIT;
+static thread_p drain_thread = NULL;
+static volatile int drain_terminating = 0;
+static FILE *trace_file = NULL;
+static trace_format_t trace_format = TRACE_FORMAT_TEXT;
+static int64_t wall_offset_us = 0;
+static int64_t start_mono_us = 0;
+
+
+static trace_ring_p claim_ring(void);
+static void drain_rings(void);
+static void output_record(trace_ring_p ring, const trace_record_t *record);
+static void output_json(trace_ring_p ring, const trace_record_t *record);
+static void output_json_span(const char *name, int32_t tag_id, int64_t start_us, int64_t end_us, int rc);
+static int is_json_file(const char *file_name);
+static THREAD_FUNC(trace_drain_func);
+
+
+
+
+void trace_event_impl(trace_event_t event, int32_t tag_id, int64_t arg0, int64_t arg1, int64_t arg2)
+{
+    trace_ring_p ring = this_ring;
+    trace_record_t *record = NULL;
+    uint32_t head = 0;
+
+    if(!ring) {
+        ring = this_ring = claim_ring();
+
+        if(!ring) {
+            return;
+        }
+
+        /* application threads never call trace_thread_done() themselves. */
+        if(!exit_hook_set && thread_at_exit(trace_thread_done) == PLCTAG_STATUS_OK) {
+            exit_hook_set = 1;
+        }
+    }
+
+    head = ring->head;
+
+    if(head - ring->tail >= TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+
+    record->time_us = time_mono_us();
+    record->thread_id = debug_get_thread_id();
+    record->tag_id = tag_id;
+    record->event = (uint32_t)event;
+    record->reserved = 0;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+
+    /* the record must be visible before the drain thread sees the new head. */
+    mem_barrier();
+
+    ring->head = head + 1;
+}
+
+
+
+/*
+ * trace_start
+ *
+ * Start collecting records.  With a file name the records are written
+ * raw to the file, or as Chrome trace JSON if the name ends in .json.
+ * Otherwise they are printed to stderr.
+ */
+
+int trace_start(const char *file_name)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    spin_block(&trace_control_lock) {
+        if(drain_thread) {
+            pdebug(DEBUG_WARN, "Tracing is already running!");
+            rc = PLCTAG_ERR_BUSY;
+            break;
+        }
+
+        start_mono_us = time_mono_us();
+        wall_offset_us = time_us() - start_mono_us;
+        trace_format = TRACE_FORMAT_TEXT;
+
+        if(file_name && str_length(file_name) > 0 && is_json_file(file_name)) {
+            trace_file = fopen(file_name, "w");
+            if(!trace_file) {
+                pdebug(DEBUG_WARN, "Unable to open trace file %s!", file_name);
+                rc = PLCTAG_ERR_OPEN;
+                break;
+            }
+
+            trace_format = TRACE_FORMAT_JSON;
+
+            /* the array form still loads if the closing bracket is missing. */
+            fprintf(trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"tags\"}},\n");
+            fprintf(trace_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"threads\"}}");
+        } else if(file_name && str_length(file_name) > 0) {
+            trace_file_header_t header;
+
+            trace_file = fopen(file_name, "wb");
+            if(!trace_file) {
+                pdebug(DEBUG_WARN, "Unable to open trace file %s!", file_name);
+                rc = PLCTAG_ERR_OPEN;
+                break;
+            }
+
+            trace_format = TRACE_FORMAT_BINARY;
+
+            mem_set(&header, 0, (int)sizeof(header));
+            mem_copy(header.magic, (uint8_t *)TRACE_FILE_MAGIC, (int)sizeof(header.magic));
+            header.version = TRACE_FILE_VERSION;
+            header.record_size = (uint32_t)sizeof(trace_record_t);
+            header.start_mono_us = time_mono_us();
+            header.start_wall_us = header.start_mono_us + wall_offset_us;
+
+            if(fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+                pdebug(DEBUG_WARN, "Unable to write trace file header!");
+                fclose(trace_file);
+                trace_file = NULL;
+                rc = PLCTAG_ERR_WRITE;
+                break;
+            }
+        }
+
+        /* throw away anything left over from an earlier run. */
+        spin_block(&ring_list_lock) {
+            for(trace_ring_p ring = ring_list; ring; ring = ring->next) {
+                ring->tail = ring->head;
+                ring->dropped_reported = ring->dropped;
+                ring->stages.tag_id = 0;
+                ring->wire.tag_id = 0;
+            }
+        }
+
+        drain_terminating = 0;
+
+        rc = thread_create(&drain_thread, trace_drain_func, 32*1024, NULL);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create trace drain thread!");
+            drain_thread = NULL;
+
+            if(trace_file) {
+                fclose(trace_file);
+                trace_file = NULL;
+            }
+
+            break;
+        }
+
+        trace_enabled = 1;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * trace_stop
+ *
+ * Stop collecting records and write out the ones we have.
+ */
+
+int trace_stop(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    spin_block(&trace_control_lock) {
+        if(!drain_thread) {
+            pdebug(DEBUG_DETAIL, "Tracing is not running.");
+            break;
+        }
+
+        trace_enabled = 0;
+
+        drain_terminating = 1;
+        thread_join(drain_thread);
+        thread_destroy(&drain_thread);
+        drain_thread = NULL;
+
+        /* get the last ones. */
+        drain_rings();
+
+        if(trace_format == TRACE_FORMAT_JSON) {
+            fprintf(trace_file, "\n]\n");
+        }
+
+        if(trace_file) {
+            if(fclose(trace_file) != 0) {
+                rc = PLCTAG_ERR_WRITE;
+            }
+
+            trace_file = NULL;
+        } else {
+            fflush(stderr);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * trace_thread_done
+ *
+ * Give the ring of the calling thread back.  This is also called when
+ * any thread that traced exits.
+ */
+
+void trace_thread_done(void)
+{
+    if(this_ring) {
+        this_ring->in_use = 0;
+        this_ring = NULL;
+    }
+}
+
+
+
+void trace_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    trace_stop();
+
+    trace_thread_done();
+
+    /* other threads may still point at their rings, keep those. */
+    spin_block(&ring_list_lock) {
+        trace_ring_p *prev = &ring_list;
+
+        while(*prev) {
+            trace_ring_p ring = *prev;
+
+            if(ring->in_use) {
+                prev = &ring->next;
+            } else {
+                *prev = ring->next;
+                mem_free(ring);
+            }
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+const char *trace_event_name(uint32_t event)
+{
+    if(event >= (uint32_t)TRACE_EVENT_END) {
+        return "unknown";
+    }
+
+    return event_names[event];
+}
+
+
+
+const char *trace_event_arg_name(uint32_t event, int arg)
+{
+    if(event >= (uint32_t)TRACE_EVENT_END || arg < 0 || arg > 2) {
+        return "";
+    }
+
+    return event_arg_names[event][arg];
+}
+
+
+
+/*
+ * trace_format_record
+ *
+ * Make a text line like the pdebug output from a record.  The offset
+ * converts the monotonic time stamp to wall clock time.
+ */
+
+int trace_format_record(const trace_record_t *record, int64_t wall_offset, char *buf, int buf_size)
+{
+    struct tm t;
+    time_t epoch;
+    int64_t wall_us = record->time_us + wall_offset;
+    int offset = 0;
+
+    epoch = (time_t)(wall_us / 1000000);
+    localtime_r(&epoch, &t);
+
+    offset = snprintf(buf, (size_t)buf_size, "%04d-%02d-%02d %02d:%02d:%02d.%06d thread(%u) tag(%d) TRACE %s",
+                      t.tm_year+1900, t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (int)(wall_us % 1000000),
+                      record->thread_id, record->tag_id, trace_event_name(record->event));
+
+    for(int i=0; i < 3 && offset > 0 && offset < buf_size; i++) {
+        const char *arg_name = trace_event_arg_name(record->event, i);
+
+        if(arg_name[0]) {
+            offset += snprintf(buf + offset, (size_t)(buf_size - offset), " %s=%lld", arg_name, (long long)record->args[i]);
+        }
+    }
+
+    buf[buf_size - 1] = 0;
+
+    return offset;
+}
+
+
+
+/***** helpers *****/
+
+
+trace_ring_p claim_ring(void)
+{
+    trace_ring_p ring = NULL;
+
+    spin_block(&ring_list_lock) {
+        /* reuse a drained ring that a finished thread gave back. */
+        for(ring = ring_list; ring; ring = ring->next) {
+            if(!ring->in_use && ring->head == ring->tail) {
+                ring->in_use = 1;
+                break;
+            }
+        }
+
+        if(!ring) {
+            ring = mem_alloc((int)sizeof(struct trace_ring_t));
+
+            if(ring) {
+                ring->in_use = 1;
+                ring->next = ring_list;
+                ring_list = ring;
+            }
+        }
+    }
+
+    return ring;
+}
+
+
+
+/*
+ * drain_rings
+ *
+ * Only called by the drain thread, or by trace_stop() after the drain
+ * thread is gone.  Rings are only added to the front of the list, so
+ * the list can be walked without the lock once we have the head.
+ */
+
+void drain_rings(void)
+{
+    trace_ring_p ring = NULL;
+
+    spin_block(&ring_list_lock) {
+        ring = ring_list;
+    }
+
+    for(; ring; ring = ring->next) {
+        uint32_t head = ring->head;
+        uint32_t tail = ring->tail;
+        uint32_t dropped = ring->dropped;
+
+        /* the records up to head must be read after head. */
+        mem_barrier();
+
+        while(tail != head) {
+            output_record(ring, &ring->records[tail & (TRACE_RING_SIZE - 1)]);
+            tail++;
+        }
+
+        /* done reading the records before giving the space back. */
+        mem_barrier();
+
+        ring->tail = tail;
+
+        if(dropped != ring->dropped_reported) {
+            trace_record_t record;
+
+            mem_set(&record, 0, (int)sizeof(record));
+            record.time_us = time_mono_us();
+            record.event = (uint32_t)TRACE_DROPPED;
+            record.args[0] = (int64_t)(uint32_t)(dropped - ring->dropped_reported);
+
+            output_record(ring, &record);
+
+            ring->dropped_reported = dropped;
+        }
+    }
+}
+
+
+
+void output_record(trace_ring_p ring, const trace_record_t *record)
+{
+    char buf[256];
+
+    switch(trace_format) {
+    case TRACE_FORMAT_BINARY:
+        fwrite(record, sizeof(*record), 1, trace_file);
+        break;
+
+    case TRACE_FORMAT_JSON:
+        output_json(ring, record);
+        break;
+
+    default:
+        trace_format_record(record, wall_offset_us, buf, (int)sizeof(buf));
+        fprintf(stderr, "%s\n", buf);
+        break;
+    }
+}
+
+
+
+/*
+ * output_json
+ *
+ * A finished tag operation becomes one span for the whole operation and
+ * one for each stage, on the tag's track.  Everything else is an instant
+ * event on the track of the thread that recorded it.  Time stamps are
+ * microseconds from the start of tracing.
+ */
+
+void output_json(trace_ring_p ring, const trace_record_t *record)
+{
+    switch(record->event) {
+    case TRACE_TAG_OP_STAGES:
+        ring->stages = *record;
+        return;
+
+    case TRACE_TAG_OP_WIRE:
+        ring->wire = *record;
+        return;
+
+    case TRACE_TAG_OP_DONE: {
+            int64_t completed_us = record->args[2];
+            int64_t started_us = completed_us - record->args[1];
+
+            output_json_span("operation", record->tag_id, started_us, completed_us, (int)record->args[0]);
+
+            /* the stage records are only right if they are for this tag. */
+            if(ring->stages.tag_id == record->tag_id && ring->wire.tag_id == record->tag_id) {
+                int64_t stage_times[7];
+                static const char *stage_names[6] = {"api call", "queued", "packed", "on the wire", "unpacked", "picked up"};
+
+                stage_times[0] = ring->stages.args[0];
+                stage_times[1] = ring->stages.args[1];
+                stage_times[2] = ring->stages.args[2];
+                stage_times[3] = ring->wire.args[0];
+                stage_times[4] = ring->wire.args[1];
+                stage_times[5] = ring->wire.args[2];
+                stage_times[6] = completed_us;
+
+                for(int i=0; i < 6; i++) {
+                    if(stage_times[i] && stage_times[i+1] >= stage_times[i]) {
+                        output_json_span(stage_names[i], record->tag_id, stage_times[i], stage_times[i+1], (int)record->args[0]);
+                    }
+                }
+            }
+
+            ring->stages.tag_id = 0;
+            ring->wire.tag_id = 0;
+
+            return;
+        }
+
+    default:
+        break;
+    }
+
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":2,\"tid\":%u,\"ts\":%lld,\"args\":{\"tag\":%d",
+            trace_event_name(record->event), record->thread_id, (long long)(record->time_us - start_mono_us), record->tag_id);
+
+    for(int i=0; i < 3; i++) {
+        const char *arg_name = trace_event_arg_name(record->event, i);
+
+        if(arg_name[0]) {
+            fprintf(trace_file, ",\"%s\":%lld", arg_name, (long long)record->args[i]);
+        }
+    }
+
+    fprintf(trace_file, "}}");
+}
+
+
+
+void output_json_span(const char *name, int32_t tag_id, int64_t start_us, int64_t end_us, int rc)
+{
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{\"rc\":%d}}",
+            name, tag_id, (long long)(start_us - start_mono_us), (long long)(end_us - start_us), rc);
+}
+
+
+
+int is_json_file(const char *file_name)
+{
+    int len = str_length(file_name);
+
+    return (len > 5 && str_cmp_i(file_name + len - 5, ".json") == 0);
+}
+
+
+
+THREAD_FUNC(trace_drain_func)
+{
+    (void)arg;
+
+    while(!drain_terminating) {
+        drain_rings();
+
+        if(trace_file) {
+            fflush(trace_file);
+        }
+
+        sleep_ms(TRACE_DRAIN_PERIOD_MS);
+    }
+
+    THREAD_RETURN(0);
+}
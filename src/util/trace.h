@@ -0,0 +1,110 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * trace.h
+ *
+ * Binary event tracing.
+ *
+ * pdebug() formats and prints on the calling thread, which is too slow
+ * for the packet paths.  trace_event() instead copies a fixed size
+ * record into a ring owned by the calling thread.  No locks are taken
+ * and nothing is formatted.  A background thread drains the rings and
+ * either prints the records or writes them raw to a file for
+ * plctag_trace to decode later.  When the ring is full the record is
+ * dropped and counted.
+ *
+ * A file name ending in .json gets Chrome trace event JSON instead, for
+ * chrome://tracing or Perfetto.  Each finished tag read or write shows
+ * up as a span per stage on a track for the tag.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The events.  The names are used by the text output and the decoder.
+ * Only add to the end, trace files store the numbers.
+ */
+#define TRACE_EVENT_LIST(X) \
+    X(TRACE_DROPPED,            "dropped",          "count", "", "") \
+    X(TRACE_TAG_READ_START,     "tag_read_start",   "rc", "", "") \
+    X(TRACE_TAG_WRITE_START,    "tag_write_start",  "rc", "", "") \
+    X(TRACE_TAG_OP_DONE,        "tag_op_done",      "rc", "duration_us", "completed_us") \
+    X(TRACE_REQUEST_QUEUED,     "request_queued",   "request_size", "queue_depth", "") \
+    X(TRACE_PACKET_PREPARED,    "packet_prepared",  "size", "sequence", "connected") \
+    X(TRACE_PACKET_SENT,        "packet_sent",      "size", "requests", "") \
+    X(TRACE_PACKET_RECEIVED,    "packet_received",  "size", "rtt_us", "encap_status") \
+    X(TRACE_REQUEST_DONE,       "request_done",     "status", "response_size", "") \
+    X(TRACE_TAG_OP_STAGES,      "tag_op_stages",    "started_us", "queued_us", "packed_us") \
+    X(TRACE_TAG_OP_WIRE,        "tag_op_wire",      "sent_us", "received_us", "unpacked_us")
+
+#define TRACE_EVENT_ENUM(id, name, a0, a1, a2) id,
+
+typedef enum {
+    TRACE_EVENT_LIST(TRACE_EVENT_ENUM)
+    TRACE_EVENT_END
+} trace_event_t;
+
+
+/* one event.  This is also the layout of the records in a trace file. */
+typedef struct {
+    int64_t time_us;        /* time_mono_us() */
+    uint32_t thread_id;
+    int32_t tag_id;
+    uint32_t event;
+    uint32_t reserved;
+    int64_t args[3];
+} trace_record_t;
+
+
+/*
+ * A trace file is this header followed by records in host byte order.
+ * The wall and monotonic times from the same instant let the decoder
+ * print wall clock times.
+ */
+#define TRACE_FILE_MAGIC "PLCTRACE"
+#define TRACE_FILE_VERSION (1)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int64_t start_wall_us;
+    int64_t start_mono_us;
+} trace_file_header_t;
+
+
+extern volatile int trace_enabled;
+
+#define trace_event(ev, tag_id, a0, a1, a2) \
+    do { if(trace_enabled) trace_event_impl((ev), (int32_t)(tag_id), (int64_t)(a0), (int64_t)(a1), (int64_t)(a2)); } while(0)
+
+extern void trace_event_impl(trace_event_t event, int32_t tag_id, int64_t arg0, int64_t arg1, int64_t arg2);
+
+extern int trace_start(const char *file_name);
+extern int trace_stop(void);
+extern void trace_thread_done(void);
+extern void trace_teardown(void);
+
+extern const char *trace_event_name(uint32_t event);
+extern const char *trace_event_arg_name(uint32_t event, int arg);
+extern int trace_format_record(const trace_record_t *record, int64_t wall_offset_us, char *buf, int buf_size);
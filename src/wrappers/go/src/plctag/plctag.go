@@ -29,6 +29,7 @@ import "C"
 import "unsafe"
 
 const (
+	STATUS_STALE = C.PLCTAG_STATUS_STALE
 	STATUS_PENDING = C.PLCTAG_STATUS_PENDING
 	STATUS_OK = C.PLCTAG_STATUS_OK
 
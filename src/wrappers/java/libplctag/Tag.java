@@ -34,6 +34,7 @@ public class Tag implements Library {
     }
 
     // error codes
+    public static final int PLCTAG_STATUS_STALE = (int)(2);
     public static final int PLCTAG_STATUS_PENDING = (int)(1);
     public static final int PLCTAG_STATUS_OK = (int)(0);
 
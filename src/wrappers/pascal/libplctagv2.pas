@@ -17,6 +17,7 @@ const
 
 
   // library internal status.
+  const PLCTAG_STATUS_STALE         = (2);
   const PLCTAG_STATUS_PENDING       = (1);
   const PLCTAG_STATUS_OK            = (0);
   const PLCTAG_ERR_ABORT            = (-1);